@@ -0,0 +1,43 @@
+//
+//  PSCAnnotationViewCache.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Annotation view cache with sized pools, prewarming and reuse statistics.
+
+    Pages with many link, video or note annotations stutter when all views are created on first scroll.
+    This subclass keeps one pool per annotation view class, bounded by maximumPoolSize. When a view is dequeued, the
+    annotation views of the next pages are created ahead of time (in small chunks on the main thread), so scrolling
+    can reuse them. On memory warnings, pools are trimmed down to minimumPoolSize instead of being dropped.
+
+    Use PSPDFViewController's overrideClassNames to use this subclass:
+    pdfController.overrideClassNames = @{(id)[PSPDFAnnotationCache class] : [PSCAnnotationViewCache class]};
+*/
+@interface PSCAnnotationViewCache : PSPDFAnnotationCache
+
+/// Creates the views needed for the annotations of pages (absolute page indexes) and adds them to the pools.
+/// Annotations are loaded in the background; views are created on the main thread.
+/// The last 32 requested pages of the current document are remembered and not prewarmed again.
+- (void)prewarmViewsForDocument:(PSPDFDocument *)document pages:(NSIndexSet *)pages;
+
+/// Maximum pooled views per class. Defaults to 10.
+@property(nonatomic, assign) NSUInteger maximumPoolSize;
+
+/// Overrides maximumPoolSize for a specific annotation view class.
+- (void)setMaximumPoolSize:(NSUInteger)maximumPoolSize forAnnotationViewClass:(Class)annotationViewClass;
+- (NSUInteger)maximumPoolSizeForAnnotationViewClass:(Class)annotationViewClass;
+
+/// Pool size per class that survives a memory warning. Defaults to 2.
+@property(nonatomic, assign) NSUInteger minimumPoolSize;
+
+/// Number of pages after the page of a dequeued annotation that are prewarmed. Defaults to 2. Set to 0 to disable.
+/// Note: only evaluates the first file if multiple files are set.
+@property(nonatomic, assign) NSUInteger prewarmPageCount;
+
+/// Class name -> dictionary with @"hits", @"misses", @"recycled", @"dropped", @"prewarmed" and @"pooled".
+- (NSDictionary *)reuseStatistics;
+
+@end
@@ -0,0 +1,261 @@
+//
+//  PSCAnnotationViewCache.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCAnnotationViewCache.h"
+
+#define kPSCAnnotationViewCacheDefaultMaximumPoolSize 10
+#define kPSCAnnotationViewCacheDefaultMinimumPoolSize 2
+#define kPSCAnnotationViewCachePrewarmChunkSize 3 // views created per runloop pass
+#define kPSCAnnotationViewCacheMaxPrewarmedPages 32 // remembered pages, least recently requested are forgotten first
+
+#define kPSCReuseStatisticsHits @"hits"
+#define kPSCReuseStatisticsMisses @"misses"
+#define kPSCReuseStatisticsRecycled @"recycled"
+#define kPSCReuseStatisticsDropped @"dropped"
+#define kPSCReuseStatisticsPrewarmed @"prewarmed"
+#define kPSCReuseStatisticsPooled @"pooled"
+
+@interface PSCAnnotationViewCache () {
+    NSMutableDictionary *_pools;            // class name -> NSMutableArray of views
+    NSMutableDictionary *_maximumPoolSizes; // class name -> NSNumber
+    NSMutableDictionary *_statistics;       // class name -> NSMutableDictionary
+    NSMutableArray *_prewarmQueue;          // view classes waiting to be created
+    NSMutableOrderedSet *_prewarmedPages;   // NSNumber page of _prewarmedDocumentUID, least recently requested first
+    NSString *_prewarmedDocumentUID;
+    dispatch_queue_t _annotationQueue;
+}
+@end
+
+@implementation PSCAnnotationViewCache
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _pools = [NSMutableDictionary new];
+        _maximumPoolSizes = [NSMutableDictionary new];
+        _statistics = [NSMutableDictionary new];
+        _prewarmQueue = [NSMutableArray new];
+        _prewarmedPages = [NSMutableOrderedSet new];
+        _annotationQueue = dispatch_queue_create("com.pspdfkit.catalog.annotationViewCacheQueue", NULL);
+        _maximumPoolSize = kPSCAnnotationViewCacheDefaultMaximumPoolSize;
+        _minimumPoolSize = kPSCAnnotationViewCacheDefaultMinimumPoolSize;
+        _prewarmPageCount = 2;
+
+        // register for memory notifications
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(didReceiveMemoryWarning) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+    PSPDFDispatchRelease(_annotationQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ pools:%@>", NSStringFromClass([self class]), [self reuseStatistics]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFAnnotationCache
+
+- (void)recycleAnnotationView:(id<PSPDFAnnotationView>)annotationView {
+    if (!annotationView) return;
+
+    NSString *className = NSStringFromClass([annotationView class]);
+    NSMutableArray *pool = [self poolForClassName:className];
+    if ([pool count] >= [self maximumPoolSizeForClassName:className] || [pool indexOfObjectIdenticalTo:annotationView] != NSNotFound) {
+        [self incrementStatistic:kPSCReuseStatisticsDropped forClassName:className];
+        return;
+    }
+
+    if ([annotationView isKindOfClass:[UIView class]]) {
+        [(UIView *)annotationView removeFromSuperview];
+    }
+    [pool addObject:annotationView];
+    [self incrementStatistic:kPSCReuseStatisticsRecycled forClassName:className];
+}
+
+- (UIView <PSPDFAnnotationView>*)dequeueViewFromCacheForAnnotation:(PSPDFAnnotation *)annotation class:(Class)annotationViewClass {
+    NSString *className = NSStringFromClass(annotationViewClass);
+    NSMutableArray *pool = _pools[className];
+
+    // prefer the view that showed the same annotation before.
+    NSUInteger index = [pool indexOfObjectPassingTest:^BOOL(id<PSPDFAnnotationView> view, NSUInteger idx, BOOL *stop) {
+        return [view respondsToSelector:@selector(annotation)] && view.annotation == annotation;
+    }];
+    if (index == NSNotFound && [pool count] > 0) index = [pool count] - 1;
+
+    UIView <PSPDFAnnotationView> *annotationView = nil;
+    if (index != NSNotFound) {
+        annotationView = pool[index];
+        [pool removeObjectAtIndex:index];
+        [self incrementStatistic:kPSCReuseStatisticsHits forClassName:className];
+    }else {
+        [self incrementStatistic:kPSCReuseStatisticsMisses forClassName:className];
+    }
+
+    [self prewarmPagesFollowingAnnotation:annotation];
+    return annotationView;
+}
+
+- (void)clearAllObjects {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(createPrewarmChunk) object:nil];
+    [_prewarmQueue removeAllObjects];
+    [_prewarmedPages removeAllObjects];
+    [_pools removeAllObjects];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)prewarmViewsForDocument:(PSPDFDocument *)document pages:(NSIndexSet *)pages {
+    if (!document || [pages count] == 0) return;
+
+    // only the pages of the current document are remembered.
+    if (![_prewarmedDocumentUID isEqualToString:document.UID]) {
+        [_prewarmedPages removeAllObjects];
+        _prewarmedDocumentUID = [document.UID copy];
+    }
+
+    // skip pages we already prewarmed.
+    NSMutableIndexSet *newPages = [NSMutableIndexSet indexSet];
+    [pages enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        NSNumber *pageNumber = @(page);
+        if ([_prewarmedPages containsObject:pageNumber]) {
+            [_prewarmedPages removeObject:pageNumber]; // moves it to the end below
+        }else {
+            [newPages addIndex:page];
+        }
+        [_prewarmedPages addObject:pageNumber];
+    }];
+    if ([_prewarmedPages count] > kPSCAnnotationViewCacheMaxPrewarmedPages) {
+        [_prewarmedPages removeObjectsInRange:NSMakeRange(0, [_prewarmedPages count] - kPSCAnnotationViewCacheMaxPrewarmedPages)];
+    }
+    if ([newPages count] == 0) return;
+
+    // parsing annotations might need file access; don't block the main thread.
+    dispatch_async(_annotationQueue, ^{
+        NSMutableArray *viewClasses = [NSMutableArray array];
+        NSUInteger pageCount = [document pageCount];
+        [newPages enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+            if (page >= pageCount) { *stop = YES; return; }
+            PSPDFAnnotationParser *annotationParser = [document annotationParserForPage:page];
+            for (PSPDFAnnotation *annotation in [document annotationsForPage:page type:PSPDFAnnotationTypeAll]) {
+                Class viewClass = [annotationParser annotationClassForAnnotation:annotation];
+                if (viewClass) [viewClasses addObject:viewClass];
+            }
+        }];
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [_prewarmQueue addObjectsFromArray:viewClasses];
+            [self schedulePrewarmChunk];
+        });
+    });
+}
+
+- (void)setMaximumPoolSize:(NSUInteger)maximumPoolSize forAnnotationViewClass:(Class)annotationViewClass {
+    NSString *className = NSStringFromClass(annotationViewClass);
+    _maximumPoolSizes[className] = @(maximumPoolSize);
+    [self trimPoolForClassName:className toSize:maximumPoolSize];
+}
+
+- (NSUInteger)maximumPoolSizeForAnnotationViewClass:(Class)annotationViewClass {
+    return [self maximumPoolSizeForClassName:NSStringFromClass(annotationViewClass)];
+}
+
+- (NSDictionary *)reuseStatistics {
+    NSMutableDictionary *reuseStatistics = [NSMutableDictionary dictionary];
+    NSMutableSet *classNames = [NSMutableSet setWithArray:[_statistics allKeys]];
+    [classNames addObjectsFromArray:[_pools allKeys]];
+    for (NSString *className in classNames) {
+        NSMutableDictionary *classStatistics = [NSMutableDictionary dictionaryWithDictionary:_statistics[className] ?: @{}];
+        classStatistics[kPSCReuseStatisticsPooled] = @([_pools[className] count]);
+        reuseStatistics[className] = classStatistics;
+    }
+    return reuseStatistics;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSMutableArray *)poolForClassName:(NSString *)className {
+    NSMutableArray *pool = _pools[className];
+    if (!pool) {
+        pool = [NSMutableArray array];
+        _pools[className] = pool;
+    }
+    return pool;
+}
+
+- (NSUInteger)maximumPoolSizeForClassName:(NSString *)className {
+    NSNumber *maximumPoolSize = _maximumPoolSizes[className];
+    return maximumPoolSize ? [maximumPoolSize unsignedIntegerValue] : self.maximumPoolSize;
+}
+
+- (void)incrementStatistic:(NSString *)statistic forClassName:(NSString *)className {
+    NSMutableDictionary *classStatistics = _statistics[className];
+    if (!classStatistics) {
+        classStatistics = [NSMutableDictionary dictionary];
+        _statistics[className] = classStatistics;
+    }
+    classStatistics[statistic] = @([classStatistics[statistic] unsignedIntegerValue] + 1);
+}
+
+- (void)trimPoolForClassName:(NSString *)className toSize:(NSUInteger)size {
+    NSMutableArray *pool = _pools[className];
+    if ([pool count] > size) {
+        // keep the most recently recycled views, they're most likely to match again.
+        [pool removeObjectsInRange:NSMakeRange(0, [pool count] - size)];
+    }
+}
+
+- (void)prewarmPagesFollowingAnnotation:(PSPDFAnnotation *)annotation {
+    PSPDFDocument *document = annotation.document;
+    if (self.prewarmPageCount == 0 || !document) return;
+    [self prewarmViewsForDocument:document pages:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(annotation.page + 1, self.prewarmPageCount)]];
+}
+
+- (void)schedulePrewarmChunk {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(createPrewarmChunk) object:nil];
+    if ([_prewarmQueue count] > 0) {
+        [self performSelector:@selector(createPrewarmChunk) withObject:nil afterDelay:0];
+    }
+}
+
+// Creates a few views per runloop pass so touch handling isn't blocked.
+- (void)createPrewarmChunk {
+    NSUInteger created = 0;
+    while ([_prewarmQueue count] > 0 && created < kPSCAnnotationViewCachePrewarmChunkSize) {
+        Class viewClass = _prewarmQueue[0];
+        [_prewarmQueue removeObjectAtIndex:0];
+
+        NSString *className = NSStringFromClass(viewClass);
+        if ([_pools[className] count] >= [self maximumPoolSizeForClassName:className]) continue;
+
+        UIView <PSPDFAnnotationView> *annotationView = [[viewClass alloc] initWithFrame:CGRectZero];
+        [[self poolForClassName:className] addObject:annotationView];
+        [self incrementStatistic:kPSCReuseStatisticsPrewarmed forClassName:className];
+        created++;
+    }
+    [self schedulePrewarmChunk];
+}
+
+- (void)didReceiveMemoryWarning {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(createPrewarmChunk) object:nil];
+    [_prewarmQueue removeAllObjects];
+    [_prewarmedPages removeAllObjects];
+    for (NSString *className in [_pools allKeys]) {
+        [self trimPoolForClassName:className toSize:self.minimumPoolSize];
+    }
+}
+
+@end
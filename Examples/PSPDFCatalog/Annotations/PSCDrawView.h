@@ -0,0 +1,27 @@
+//
+//  PSCDrawView.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Draw view with constant stroke latency.
+
+    PSPDFDrawView strokes the whole path on a CAShapeLayer for every touch, which gets slower the longer the drawing is.
+    This subclass smoothes points incrementally (Catmull-Rom, via PSPDFSplinePathFromPoints) and only rasterizes the
+    newly added segment into a backing bitmap. Undo/redo is stored as compact point deltas (with the stroke color and
+    width they were drawn with), lines is kept in sync so done works as before.
+
+    Use PSPDFViewController's overrideClassNames to use this subclass:
+    pdfController.overrideClassNames = @{(id)[PSPDFDrawView class] : [PSCDrawView class]};
+*/
+@interface PSCDrawView : PSPDFDrawView
+
+/// Number of strokes that can be undone.
+@property(nonatomic, assign, readonly) NSUInteger undoCount;
+
+/// Number of strokes that can be redone.
+@property(nonatomic, assign, readonly) NSUInteger redoCount;
+
+@end
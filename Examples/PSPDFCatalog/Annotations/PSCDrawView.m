@@ -0,0 +1,320 @@
+//
+//  PSCDrawView.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCDrawView.h"
+
+#define kPSCDrawActionTypeAdd @"add"
+#define kPSCDrawActionTypeRemove @"remove"
+
+// Compact undo/redo entry: the packed points of a single stroke and how it was stroked.
+@interface PSCDrawDelta : NSObject
+@property(nonatomic, strong) NSData *points; // CGPoint
+@property(nonatomic, strong) UIColor *strokeColor;
+@property(nonatomic, assign) CGFloat lineWidth;
+@end
+
+@implementation PSCDrawDelta
+@end
+
+@interface PSCDrawView () {
+    CGContextRef _backingContext;
+    CGImageRef _backingImage;   // snapshot of the backing store, created when drawn after a change
+    CGSize _backingSize;
+    NSMutableData *_currentPoints;
+    NSMutableArray *_undoStack;
+    NSMutableArray *_redoStack;
+}
+@end
+
+@implementation PSCDrawView
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithFrame:(CGRect)frame {
+    if ((self = [super initWithFrame:frame])) {
+        _undoStack = [NSMutableArray new];
+        _redoStack = [NSMutableArray new];
+        self.opaque = NO;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self destroyBackingStore];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - UIView
+
+- (void)layoutSubviews {
+    [super layoutSubviews];
+
+    CGSize size = self.bounds.size;
+    if (!CGSizeEqualToSize(size, _backingSize)) {
+        [self createBackingStore];
+        [self replayLines];
+    }
+}
+
+- (void)drawRect:(CGRect)rect {
+    if (!_backingContext) return;
+
+    // CGImages must not change after creation; CGBitmapContextCreateImage copies on write, so this is cheap
+    // as long as the backing store isn't modified while the image is in use.
+    if (!_backingImage) _backingImage = CGBitmapContextCreateImage(_backingContext);
+    CGContextRef context = UIGraphicsGetCurrentContext();
+    CGContextClipToRect(context, rect);
+    [[UIImage imageWithCGImage:_backingImage scale:self.contentScaleFactor orientation:UIImageOrientationUp] drawInRect:self.bounds];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Touches
+
+- (void)touchesBegan:(NSSet *)touches withEvent:(UIEvent *)event {
+    _currentPoints = [NSMutableData data];
+    [self addPoint:[[touches anyObject] locationInView:self]];
+
+    if ([self.delegate respondsToSelector:@selector(drawViewDidBeginDrawing:)]) {
+        [self.delegate drawViewDidBeginDrawing:self];
+    }
+}
+
+- (void)touchesMoved:(NSSet *)touches withEvent:(UIEvent *)event {
+    if (!_currentPoints) return;
+    [self addPoint:[[touches anyObject] locationInView:self]];
+
+    // the segment before the last one now has all 4 control points; stroke it.
+    NSUInteger count = [_currentPoints length] / sizeof(CGPoint);
+    if (count >= 3) {
+        [self strokeSegment:count-3 ofPoints:[_currentPoints bytes] count:count];
+    }
+}
+
+- (void)touchesEnded:(NSSet *)touches withEvent:(UIEvent *)event {
+    if (!_currentPoints) return;
+
+    NSUInteger count = [_currentPoints length] / sizeof(CGPoint);
+    if (count == 1) {
+        [self strokeSegment:0 ofPoints:[_currentPoints bytes] count:count];
+    }else {
+        [self strokeSegment:count-2 ofPoints:[_currentPoints bytes] count:count];
+    }
+
+    PSCDrawDelta *delta = [PSCDrawDelta new];
+    delta.points = _currentPoints;
+    delta.strokeColor = self.strokeColor;
+    delta.lineWidth = self.lineWidth;
+    _currentPoints = nil;
+    [_redoStack removeAllObjects];
+    [self applyDelta:delta];
+}
+
+- (void)touchesCancelled:(NSSet *)touches withEvent:(UIEvent *)event {
+    [self touchesEnded:touches withEvent:event];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDrawView
+
+- (UIImage *)currentImage {
+    if (!_backingContext) return [super currentImage];
+    CGImageRef imageRef = CGBitmapContextCreateImage(_backingContext);
+    UIImage *image = [UIImage imageWithCGImage:imageRef scale:self.contentScaleFactor orientation:UIImageOrientationUp];
+    CGImageRelease(imageRef);
+    return image;
+}
+
+- (void)loadImage:(UIImage *)image {
+    [super loadImage:image];
+    if (_backingContext && image) {
+        [self invalidateBackingImage];
+        UIGraphicsPushContext(_backingContext);
+        [image drawInRect:self.bounds];
+        UIGraphicsPopContext();
+        [self setNeedsDisplay];
+    }
+}
+
+- (BOOL)canUndo {
+    return [_undoStack count] > 0;
+}
+
+- (void)undo {
+    PSCDrawDelta *delta = [_undoStack lastObject];
+    if (!delta) return;
+    [_undoStack removeLastObject];
+    [_redoStack addObject:delta];
+    NSArray *removedLine = [self.lines lastObject];
+    [self.lines removeLastObject];
+    self.hasChanges = YES;
+
+    // removing pixels isn't incremental; replay the remaining strokes once.
+    [self replayLines];
+    [self notifyDelegateWithType:kPSCDrawActionTypeRemove line:removedLine delta:delta];
+}
+
+- (BOOL)canRedo {
+    return [_redoStack count] > 0;
+}
+
+- (void)redo {
+    PSCDrawDelta *delta = [_redoStack lastObject];
+    if (!delta) return;
+    [_redoStack removeLastObject];
+    [self strokeDelta:delta];
+    [self applyDelta:delta];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSUInteger)undoCount {
+    return [_undoStack count];
+}
+
+- (NSUInteger)redoCount {
+    return [_redoStack count];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)addPoint:(CGPoint)point {
+    [_currentPoints appendBytes:&point length:sizeof(CGPoint)];
+}
+
+// Adds the stroke to lines (consumed by done) and to the undo stack.
+- (void)applyDelta:(PSCDrawDelta *)delta {
+    if (!self.lines) self.lines = [NSMutableArray array];
+
+    NSUInteger count = [delta.points length] / sizeof(CGPoint);
+    const CGPoint *points = [delta.points bytes];
+    NSMutableArray *line = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [line addObject:[NSValue valueWithCGPoint:points[i]]];
+    }
+    [self.lines addObject:line];
+    [_undoStack addObject:delta];
+    self.hasChanges = YES;
+    [self notifyDelegateWithType:kPSCDrawActionTypeAdd line:line delta:delta];
+}
+
+// line is the stroke that was added or removed.
+- (void)notifyDelegateWithType:(NSString *)actionType line:(NSArray *)line delta:(PSCDrawDelta *)delta {
+    if ([self.delegate respondsToSelector:@selector(drawView:didChange:)]) {
+        PSPDFDrawAction *drawAction = [[PSPDFDrawAction alloc] initWithPoints:line path:nil type:actionType strokeColor:delta.strokeColor lineWidth:delta.lineWidth];
+        [self.delegate drawView:self didChange:drawAction];
+    }
+}
+
+// Strokes the smoothed segment between points[index] and points[index+1] into the backing store, in the current style.
+- (void)strokeSegment:(NSUInteger)index ofPoints:(const CGPoint *)points count:(NSUInteger)count {
+    [self strokeSegment:index ofPoints:points count:count color:self.strokeColor lineWidth:self.lineWidth];
+}
+
+- (void)strokeDelta:(PSCDrawDelta *)delta {
+    NSUInteger count = [delta.points length] / sizeof(CGPoint);
+    for (NSUInteger i = 0; i < MAX(count, 2)-1 && count > 0; i++) {
+        [self strokeSegment:i ofPoints:[delta.points bytes] count:count color:delta.strokeColor lineWidth:delta.lineWidth];
+    }
+}
+
+- (void)strokeSegment:(NSUInteger)index ofPoints:(const CGPoint *)points count:(NSUInteger)count color:(UIColor *)color lineWidth:(CGFloat)lineWidth {
+    if (!_backingContext || count == 0) return;
+    [self invalidateBackingImage];
+
+    CGPoint p1 = points[index];
+    CGPoint p0 = points[index > 0 ? index-1 : 0];
+    CGPoint p2 = points[MIN(index+1, count-1)];
+    CGPoint p3 = points[MIN(index+2, count-1)];
+
+    CGFloat distance = hypotf(p2.x - p1.x, p2.y - p1.y);
+    int divisions = MAX(2, (int)(distance / 2.f));
+    UIBezierPath *segment = PSPDFSplinePathFromPoints(p0, p1, p2, p3, divisions);
+    if (CGPointEqualToPoint(p1, p2)) {
+        // single point; draw a dot.
+        segment = [UIBezierPath bezierPath];
+        [segment moveToPoint:p1];
+        [segment addLineToPoint:p1];
+    }
+
+    CGContextSetStrokeColorWithColor(_backingContext, color.CGColor);
+    CGContextSetLineWidth(_backingContext, lineWidth);
+    CGContextSetLineCap(_backingContext, kCGLineCapRound);
+    CGContextSetLineJoin(_backingContext, kCGLineJoinRound);
+    CGContextAddPath(_backingContext, segment.CGPath);
+    CGContextStrokePath(_backingContext);
+
+    CGFloat inset = -(lineWidth + 2.f);
+    CGRect dirtyRect = CGRectInset(CGRectUnion((CGRect){.origin=p1}, (CGRect){.origin=p2}), inset, inset);
+    [self setNeedsDisplayInRect:CGRectUnion(dirtyRect, CGRectInset(segment.bounds, inset, inset))];
+}
+
+// Re-rasterizes all lines. Only needed on resize and undo.
+// The last lines are the strokes on the undo stack and keep their own style; lines that existed before use the current one.
+- (void)replayLines {
+    if (!_backingContext) return;
+    [self invalidateBackingImage];
+    CGContextClearRect(_backingContext, self.bounds);
+
+    NSArray *lines = self.lines;
+    NSUInteger firstDeltaLine = [lines count] - MIN([_undoStack count], [lines count]);
+    NSMutableData *points = [NSMutableData data];
+    for (NSUInteger lineIndex = 0; lineIndex < [lines count]; lineIndex++) {
+        if (lineIndex >= firstDeltaLine) {
+            [self strokeDelta:_undoStack[lineIndex - firstDeltaLine]];
+            continue;
+        }
+
+        NSArray *line = lines[lineIndex];
+        [points setLength:0];
+        for (NSValue *pointValue in line) {
+            CGPoint point = [pointValue CGPointValue];
+            [points appendBytes:&point length:sizeof(CGPoint)];
+        }
+        NSUInteger count = [line count];
+        for (NSUInteger i = 0; i < MAX(count, 2)-1 && count > 0; i++) {
+            [self strokeSegment:i ofPoints:[points bytes] count:count];
+        }
+    }
+    [self setNeedsDisplay];
+}
+
+// Called before the backing store changes; the next drawRect: takes a new snapshot.
+- (void)invalidateBackingImage {
+    CGImageRelease(_backingImage);
+    _backingImage = NULL;
+}
+
+- (void)createBackingStore {
+    [self destroyBackingStore];
+
+    CGSize size = self.bounds.size;
+    CGFloat scale = self.contentScaleFactor;
+    size_t width = (size_t)ceilf(size.width * scale), height = (size_t)ceilf(size.height * scale);
+    if (width == 0 || height == 0) return;
+
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    _backingContext = CGBitmapContextCreate(NULL, width, height, 8, width * 4, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    if (!_backingContext) return;
+
+    // use UIKit coordinates.
+    CGContextTranslateCTM(_backingContext, 0, height);
+    CGContextScaleCTM(_backingContext, scale, -scale);
+    _backingSize = size;
+}
+
+- (void)destroyBackingStore {
+    [self invalidateBackingImage];
+    CGContextRelease(_backingContext);
+    _backingContext = NULL;
+    _backingSize = CGSizeZero;
+}
+
+@end
@@ -0,0 +1,47 @@
+//
+//  PSCInkAnnotation.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/// A single point inside the packed point buffer.
+typedef struct {
+    float x, y;
+} PSCInkPoint;
+
+/**
+    Ink annotation subclass optimized for documents with very large amounts of ink points.
+
+    Instead of stroking the UIBezierPath's in paths (one object per point), lines are packed into a single float buffer.
+    Drawing uses a zoom-dependent, simplified version of the lines (Douglas-Peucker; LODs are cached per power-of-two zoom level)
+    and caches a rasterized image of the annotation per power-of-two scale, so redrawing at a similar scale is basically free.
+
+    Use PSPDFDocument's overrideClassNames to use this subclass:
+    document.overrideClassNames = @{(id)[PSPDFInkAnnotation class] : [PSCInkAnnotation class]};
+*/
+@interface PSCInkAnnotation : PSPDFInkAnnotation
+
+/// Packed points of all lines (PSCInkPoint, PDF coordinate space). Built from lines.
+@property(nonatomic, strong, readonly) NSData *pointBuffer;
+
+/// Total number of points in pointBuffer.
+@property(nonatomic, assign, readonly) NSUInteger pointCount;
+
+/// Number of lines in pointBuffer.
+@property(nonatomic, assign, readonly) NSUInteger lineCount;
+
+/// Maximum deviation (in device pixels) the simplified path may have from the original line. Defaults to 0.5.
+/// Set to 0 to disable simplification.
+@property(nonatomic, assign) CGFloat simplificationTolerance;
+
+/// If enabled, the annotation is rasterized once per power-of-two scale (rounded up) and then blitted. Defaults to YES.
+@property(nonatomic, assign, getter=isRasterCacheEnabled) BOOL rasterCacheEnabled;
+
+/// Returns the (cached) simplified path for the zoom level that matches scale. (scale = device pixels per PDF point)
+- (UIBezierPath *)simplifiedPathForScale:(CGFloat)scale;
+
+/// Clears the simplified paths and the rasterized images (all ink annotations share one raster cache, limited to 32MB). Called automatically when lines, color, alpha or lineWidth change.
+- (void)clearRenderCache;
+
+@end
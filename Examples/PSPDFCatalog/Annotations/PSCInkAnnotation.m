@@ -0,0 +1,418 @@
+//
+//  PSCInkAnnotation.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCInkAnnotation.h"
+
+#define kPSCInkDefaultSimplificationTolerance 0.5f
+#define kPSCInkMinLODLevel -4
+#define kPSCInkMaxLODLevel 6
+#define kPSCInkMaxRasterPixels (2048 * 2048)
+#define kPSCInkRasterCacheCostLimit (32 * 1024 * 1024)
+
+@interface PSCInkAnnotation () {
+    // The packed geometry is replaced as a whole on PSCInkAnnotationCacheQueue and read the same way,
+    // so render threads always see a buffer and line lengths that belong together.
+    NSData *_pointBuffer;
+    NSData *_lineLengths;      // NSUInteger per line
+    NSUInteger _pointCount;
+    NSUInteger _lineCount;
+    CGRect _strokeBounds;
+    BOOL _hasCustomTolerance;
+    BOOL _rasterCacheDisabled;
+    NSMutableDictionary *_simplifiedPaths; // NSNumber (LOD level) -> UIBezierPath
+    int64_t _rasterCacheID;                // unique per instance (assigned lazily), prefix of the shared raster cache keys
+    int32_t _rasterGeneration;             // bumped to invalidate this annotation's rasters
+}
+@end
+
+@implementation PSCInkAnnotation
+
+@synthesize simplificationTolerance = _simplificationTolerance;
+
+// Protects the packed geometry and the lazily built caches. Work is done outside the queue, only the lookup/store is serialized.
+static dispatch_queue_t PSCInkAnnotationCacheQueue(void) {
+    static dispatch_queue_t cacheQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cacheQueue = dispatch_queue_create("com.pspdfkit.catalog.inkAnnotationCacheQueue", NULL);
+    });
+    return cacheQueue;
+}
+
+// Rasters of all ink annotations share one cache, limited by their size in bytes.
+static NSCache *PSCInkAnnotationRasterCache(void) {
+    static NSCache *rasterCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        rasterCache = [NSCache new];
+        rasterCache.name = @"com.pspdfkit.catalog.inkAnnotationRasterCache";
+        rasterCache.totalCostLimit = kPSCInkRasterCacheCostLimit;
+    });
+    return rasterCache;
+}
+
+// Only bitmap contexts are worth rasterizing into; PDF and print contexts have no backing store.
+static BOOL PSCInkContextIsBitmap(CGContextRef context) {
+    return CGBitmapContextGetData(context) != NULL;
+}
+
+// Device pixels per PDF point for the current context transform (ignores rotation).
+static CGFloat PSCInkContextScale(CGContextRef context) {
+    CGAffineTransform ctm = CGContextGetCTM(context);
+    CGFloat scale = sqrtf(fabsf(ctm.a * ctm.d - ctm.b * ctm.c));
+    return scale > 0.f ? scale : 1.f;
+}
+
+// Scales are rounded up to the next power of two, so the simplification error never exceeds the tolerance in pixels.
+static NSInteger PSCInkLODLevelForScale(CGFloat scale) {
+    NSInteger level = (NSInteger)ceilf(log2f(scale));
+    return MAX(kPSCInkMinLODLevel, MIN(kPSCInkMaxLODLevel, level));
+}
+
+// Squared distance from p to the segment a-b.
+static inline float PSCInkSegmentDistanceSquared(PSCInkPoint p, PSCInkPoint a, PSCInkPoint b) {
+    float dx = b.x - a.x, dy = b.y - a.y;
+    float lengthSquared = dx*dx + dy*dy;
+    float t = lengthSquared > 0.f ? ((p.x - a.x)*dx + (p.y - a.y)*dy) / lengthSquared : 0.f;
+    t = fmaxf(0.f, fminf(1.f, t));
+    float px = a.x + t*dx - p.x, py = a.y + t*dy - p.y;
+    return px*px + py*py;
+}
+
+// Iterative Douglas-Peucker. Marks points to keep in `keep`; first and last are always kept.
+static void PSCInkSimplifyLine(const PSCInkPoint *points, NSUInteger count, float tolerance, BOOL *keep) {
+    memset(keep, 0, count * sizeof(BOOL));
+    if (count == 0) return;
+    keep[0] = keep[count-1] = YES;
+    if (count < 3) return;
+
+    float toleranceSquared = tolerance * tolerance;
+    NSUInteger *stack = malloc(count * 2 * sizeof(NSUInteger));
+    NSUInteger stackSize = 0;
+    stack[stackSize++] = 0; stack[stackSize++] = count-1;
+
+    while (stackSize > 0) {
+        NSUInteger last = stack[--stackSize], first = stack[--stackSize];
+        float maxDistance = 0.f;
+        NSUInteger maxIndex = first;
+        for (NSUInteger i = first+1; i < last; i++) {
+            float distance = PSCInkSegmentDistanceSquared(points[i], points[first], points[last]);
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                maxIndex = i;
+            }
+        }
+        if (maxDistance > toleranceSquared) {
+            keep[maxIndex] = YES;
+            stack[stackSize++] = first; stack[stackSize++] = maxIndex;
+            stack[stackSize++] = maxIndex; stack[stackSize++] = last;
+        }
+    }
+    free(stack);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ page:%d lines:%d points:%d>", NSStringFromClass([self class]), self.page, self.lineCount, self.pointCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFInkAnnotation
+
+- (void)setLines:(NSArray *)lines {
+    [super setLines:lines];
+    [self packLines];
+}
+
+- (void)rebuildPaths {
+    // UIBezierPath's are only built on demand (see paths); drawing uses the packed buffer.
+    [super setPaths:nil];
+    [self packLines];
+}
+
+- (NSArray *)paths {
+    NSArray *paths = [super paths];
+    if (!paths && [self.lines count]) {
+        [self packLinesIfNeeded];
+        paths = [self pathsWithTolerance:0.f];
+        [super setPaths:paths];
+    }
+    return paths;
+}
+
+- (void)clearAllData {
+    [super clearAllData];
+    [self packLines];
+}
+
+- (void)clearCachedPaths {
+    [super clearCachedPaths];
+    [self clearRenderCache];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFAnnotation
+
+- (void)setColor:(UIColor *)color {
+    [super setColor:color];
+    [self clearRasterCache];
+}
+
+- (void)setAlpha:(float)alpha {
+    [super setAlpha:alpha];
+    [self clearRasterCache];
+}
+
+- (void)setLineWidth:(float)lineWidth {
+    [super setLineWidth:lineWidth];
+    [self packLines]; // stroke bounds depend on the line width
+}
+
+- (void)drawInContext:(CGContextRef)context {
+    [self packLinesIfNeeded];
+    if (self.pointCount == 0) return;
+
+    CGFloat scale = PSCInkContextScale(context);
+
+    // only rasterize into bitmaps; PDF/print contexts keep the vector representation.
+    if (self.isRasterCacheEnabled && PSCInkContextIsBitmap(context)) {
+        CGRect strokeBounds;
+        UIImage *rasterImage = [self rasterImageForScale:scale strokeBounds:&strokeBounds];
+        if (rasterImage) {
+            CGContextDrawImage(context, strokeBounds, rasterImage.CGImage);
+            return;
+        }
+    }
+
+    [self strokePath:[self simplifiedPathForScale:scale] inContext:context];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSData *)pointBuffer {
+    __block NSData *pointBuffer;
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        pointBuffer = _pointBuffer;
+    });
+    return pointBuffer;
+}
+
+- (NSUInteger)pointCount {
+    __block NSUInteger pointCount;
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        pointCount = _pointCount;
+    });
+    return pointCount;
+}
+
+- (NSUInteger)lineCount {
+    __block NSUInteger lineCount;
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        lineCount = _lineCount;
+    });
+    return lineCount;
+}
+
+- (CGFloat)simplificationTolerance {
+    return _hasCustomTolerance ? _simplificationTolerance : kPSCInkDefaultSimplificationTolerance;
+}
+
+- (void)setSimplificationTolerance:(CGFloat)simplificationTolerance {
+    _simplificationTolerance = simplificationTolerance;
+    _hasCustomTolerance = YES;
+    [self clearRenderCache];
+}
+
+- (BOOL)isRasterCacheEnabled {
+    return !_rasterCacheDisabled;
+}
+
+- (void)setRasterCacheEnabled:(BOOL)rasterCacheEnabled {
+    _rasterCacheDisabled = !rasterCacheEnabled;
+    if (!rasterCacheEnabled) [self clearRasterCache];
+}
+
+- (UIBezierPath *)simplifiedPathForScale:(CGFloat)scale {
+    NSInteger level = PSCInkLODLevelForScale(scale);
+
+    __block UIBezierPath *path;
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        path = _simplifiedPaths[@(level)];
+    });
+
+    if (!path) {
+        CGFloat tolerance = self.simplificationTolerance / powf(2.f, level);
+        path = [UIBezierPath bezierPath];
+        for (UIBezierPath *linePath in [self pathsWithTolerance:tolerance]) {
+            [path appendPath:linePath];
+        }
+        dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+            if (!_simplifiedPaths) _simplifiedPaths = [NSMutableDictionary new];
+            _simplifiedPaths[@(level)] = path;
+        });
+    }
+    return path;
+}
+
+- (void)clearRenderCache {
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        [_simplifiedPaths removeAllObjects];
+    });
+    [self clearRasterCache];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)packLinesIfNeeded {
+    if (!self.pointBuffer && [self.lines count]) {
+        [self packLines];
+    }
+}
+
+// Converts the boxed points in lines into the packed float buffer.
+- (void)packLines {
+    NSArray *lines = self.lines;
+    NSUInteger pointCount = 0;
+    for (NSArray *line in lines) pointCount += [line count];
+
+    NSMutableData *pointBuffer = [NSMutableData dataWithLength:pointCount * sizeof(PSCInkPoint)];
+    NSMutableData *lineLengths = [NSMutableData dataWithLength:[lines count] * sizeof(NSUInteger)];
+    PSCInkPoint *points = [pointBuffer mutableBytes];
+    NSUInteger *lengths = [lineLengths mutableBytes];
+
+    CGFloat minX = CGFLOAT_MAX, minY = CGFLOAT_MAX, maxX = -CGFLOAT_MAX, maxY = -CGFLOAT_MAX;
+    NSUInteger pointIndex = 0, lineIndex = 0;
+    for (NSArray *line in lines) {
+        for (NSValue *pointValue in line) {
+            CGPoint point = [pointValue CGPointValue];
+            points[pointIndex++] = (PSCInkPoint){(float)point.x, (float)point.y};
+            minX = MIN(minX, point.x); minY = MIN(minY, point.y);
+            maxX = MAX(maxX, point.x); maxY = MAX(maxY, point.y);
+        }
+        lengths[lineIndex++] = [line count];
+    }
+
+    CGFloat inset = -(MAX(self.lineWidth, 1.f)/2.f + 1.f);
+    CGRect strokeBounds = pointCount ? CGRectInset(CGRectMake(minX, minY, maxX-minX, maxY-minY), inset, inset) : CGRectZero;
+
+    // swap in the new geometry at once; readers keep using the buffers they already took.
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        _strokeBounds = strokeBounds;
+        _lineLengths = lineLengths;
+        _lineCount = [lines count];
+        _pointCount = pointCount;
+        _pointBuffer = pointCount ? pointBuffer : nil;
+    });
+    [self clearRenderCache];
+}
+
+// One path per line. tolerance is in PDF points; 0 keeps every point.
+- (NSArray *)pathsWithTolerance:(CGFloat)tolerance {
+    __block NSData *pointBuffer, *lineLengthData;
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        pointBuffer = _pointBuffer;
+        lineLengthData = _lineLengths;
+    });
+    const PSCInkPoint *points = [pointBuffer bytes];
+    const NSUInteger *lengths = [lineLengthData bytes];
+    NSUInteger pointCount = [pointBuffer length] / sizeof(PSCInkPoint);
+    NSUInteger lineCount = [lineLengthData length] / sizeof(NSUInteger);
+
+    NSMutableArray *paths = [NSMutableArray arrayWithCapacity:lineCount];
+    BOOL *keep = malloc(MAX(pointCount, 1) * sizeof(BOOL));
+    NSUInteger offset = 0;
+    for (NSUInteger lineIndex = 0; lineIndex < lineCount; lineIndex++) {
+        NSUInteger length = lengths[lineIndex];
+        if (length == 0) continue;
+        if (offset + length > pointCount) break;
+        const PSCInkPoint *line = points + offset;
+        if (tolerance > 0.f) {
+            PSCInkSimplifyLine(line, length, tolerance, keep);
+        }else {
+            memset(keep, YES, length * sizeof(BOOL));
+        }
+
+        UIBezierPath *path = [UIBezierPath bezierPath];
+        [path moveToPoint:CGPointMake(line[0].x, line[0].y)];
+        for (NSUInteger i = 1; i < length; i++) {
+            if (keep[i]) [path addLineToPoint:CGPointMake(line[i].x, line[i].y)];
+        }
+        // single point: draw a dot (round cap)
+        if (length == 1) [path addLineToPoint:CGPointMake(line[0].x, line[0].y)];
+        [paths addObject:path];
+        offset += length;
+    }
+    free(keep);
+    return paths;
+}
+
+- (void)strokePath:(UIBezierPath *)path inContext:(CGContextRef)context {
+    CGContextSaveGState(context);
+    CGContextSetStrokeColorWithColor(context, self.colorWithAlpha.CGColor);
+    CGContextSetLineWidth(context, self.lineWidth);
+    CGContextSetLineCap(context, kCGLineCapRound);
+    CGContextSetLineJoin(context, kCGLineJoinRound);
+    CGContextAddPath(context, path.CGPath);
+    CGContextStrokePath(context);
+    CGContextRestoreGState(context);
+}
+
+// strokeBounds returns the rect the image covers, taken together with the geometry it was rendered from.
+- (UIImage *)rasterImageForScale:(CGFloat)scale strokeBounds:(CGRect *)strokeBounds {
+    __block CGRect bounds;
+    __block int64_t rasterCacheID;
+    __block int32_t generation;
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        static int64_t lastRasterCacheID;
+        if (_rasterCacheID == 0) _rasterCacheID = ++lastRasterCacheID;
+        rasterCacheID = _rasterCacheID;
+        bounds = _strokeBounds;
+        generation = _rasterGeneration;
+    });
+    *strokeBounds = bounds;
+
+    // one raster per LOD level; zooming between two powers of two reuses it instead of rendering a new one.
+    NSInteger level = PSCInkLODLevelForScale(scale);
+    scale = powf(2.f, level);
+
+    NSCache *rasterCache = PSCInkAnnotationRasterCache();
+    NSString *cacheKey = [NSString stringWithFormat:@"%lld_%d_%d", rasterCacheID, generation, level];
+    UIImage *rasterImage = [rasterCache objectForKey:cacheKey];
+    if (rasterImage) return rasterImage;
+
+    size_t width = (size_t)ceilf(bounds.size.width * scale), height = (size_t)ceilf(bounds.size.height * scale);
+    if (width == 0 || height == 0 || width * height > kPSCInkMaxRasterPixels) return nil;
+
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef bitmapContext = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    if (!bitmapContext) return nil;
+
+    CGContextScaleCTM(bitmapContext, width / bounds.size.width, height / bounds.size.height);
+    CGContextTranslateCTM(bitmapContext, -bounds.origin.x, -bounds.origin.y);
+    [self strokePath:[self simplifiedPathForScale:scale] inContext:bitmapContext];
+    CGImageRef imageRef = CGBitmapContextCreateImage(bitmapContext);
+    CGContextRelease(bitmapContext);
+
+    rasterImage = [UIImage imageWithCGImage:imageRef];
+    CGImageRelease(imageRef);
+    [rasterCache setObject:rasterImage forKey:cacheKey cost:width * height * 4];
+    return rasterImage;
+}
+
+// NSCache can't be enumerated; old rasters are no longer looked up and age out of the shared cache.
+- (void)clearRasterCache {
+    dispatch_sync(PSCInkAnnotationCacheQueue(), ^{
+        _rasterGeneration++;
+    });
+}
+
+@end
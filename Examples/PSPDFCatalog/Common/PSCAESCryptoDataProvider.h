@@ -0,0 +1,52 @@
+//
+//  PSCAESCryptoDataProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+@class PSCByteRangeSource;
+
+/**
+    Random-access replacement for PSPDFAESCryptoDataProvider.
+
+    Reads the same format (AES256-CBC, PKCS7 padding, IV in the first 16 bytes of the file), but doesn't decrypt the
+    whole file up front. In CBC, every 16 byte block can be decrypted on its own with the previous ciphertext block as IV,
+    so only the ranges CoreGraphics asks for are read and decrypted. Decrypted chunks are kept in a small LRU,
+    memory stays constant regardless of file size and opening only touches the last two blocks.
+
+    The key is derived with PBKDF2 (SHA1, 10000 rounds) from passphrase and salt. Derived keys are cached in memory
+    (keyed by a hash, never the passphrase itself) until the app enters the background or receives a memory warning.
+    Decryption runs through CommonCrypto, which uses the AES hardware of the device where available.
+
+    This class needs iOS5 or later.
+ */
+@interface PSCAESCryptoDataProvider : NSObject
+
+/// Designated initializer with the passphrase and salt.
+- (id)initWithURL:(NSURL *)URL passphrase:(NSString *)passphrase salt:(NSString *)salt;
+
+/// Created on first access. The returned provider is valid as long as you retain this object. Returns NULL if the file can't be opened.
+- (CGDataProviderRef)dataProviderRef;
+
+/// Decrypted bytes as range source, e.g. to export the plain PDF without decrypting it into memory first.
+- (PSCByteRangeSource *)byteRangeSource;
+
+/// Number of decrypted bytes (file size minus IV and padding).
+@property(nonatomic, assign, readonly) size_t length;
+
+/// Number of decrypted chunks kept in memory. Defaults to 16 (of 64KB each).
+@property(nonatomic, assign) NSUInteger cachedChunkCount;
+
+/// Removes all cached derived keys.
++ (void)clearDerivedKeyCache;
+
+#ifdef DEBUG
+/// Decrypts length bytes in chunks like the data provider does and returns the throughput in MB/s. Blocks, don't call on the main thread.
++ (double)decryptionThroughputWithLength:(size_t)length;
+#endif
+
+/// Encrypts a file into the format read by this class. Used to create test data.
++ (BOOL)encryptFileAtURL:(NSURL *)sourceURL toURL:(NSURL *)targetURL passphrase:(NSString *)passphrase salt:(NSString *)salt error:(NSError **)error;
+
+@end
@@ -0,0 +1,375 @@
+//
+//  PSCAESCryptoDataProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCAESCryptoDataProvider.h"
+#import "PSCByteRangeSource.h"
+#import <CommonCrypto/CommonCrypto.h>
+#import <QuartzCore/QuartzCore.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define kPSCAESCryptoChunkSize (64 * 1024) // multiple of kCCBlockSizeAES128
+#define kPSCAESCryptoDefaultCachedChunkCount 16
+#define kPSCAESCryptoKeyDerivationRounds 10000
+
+// Owns the file and cipher state. Retained by the CGDataProvider, so the provider stays valid on its own.
+@interface PSCAESCryptoStream : NSObject {
+    int _fileDescriptor;
+    off_t _fileSize;
+    CCCryptorRef _cryptor;
+    NSMutableDictionary *_chunks; // chunk index -> NSData
+    NSMutableArray *_chunkOrder;  // least recently used first
+    dispatch_queue_t _streamQueue;
+}
+- (id)initWithURL:(NSURL *)URL key:(const uint8_t *)key;
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count;
+@property(nonatomic, assign, readonly) size_t length;
+@property(nonatomic, assign) NSUInteger cachedChunkCount;
+@end
+
+// Derived keys, keyed by a SHA256 of passphrase and salt (so the passphrase itself isn't kept around).
+static NSMutableDictionary *_derivedKeys;
+static dispatch_queue_t _derivedKeysQueue;
+
+static void PSCAESCryptoClearDerivedKeys(void) {
+    dispatch_sync(_derivedKeysQueue, ^{
+        for (NSMutableData *keyData in [_derivedKeys allValues]) {
+            memset([keyData mutableBytes], 0, [keyData length]);
+        }
+        [_derivedKeys removeAllObjects];
+    });
+}
+
+static void PSCAESCryptoSetupDerivedKeys(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _derivedKeys = [NSMutableDictionary new];
+        _derivedKeysQueue = dispatch_queue_create("com.pspdfkit.catalog.aesDerivedKeysQueue", NULL);
+
+        // keys don't stay in memory while we're in the background.
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        for (NSString *notificationName in @[UIApplicationDidReceiveMemoryWarningNotification, UIApplicationDidEnterBackgroundNotification]) {
+            [dnc addObserverForName:notificationName object:nil queue:nil usingBlock:^(NSNotification *notification) {
+                PSCAESCryptoClearDerivedKeys();
+            }];
+        }
+    });
+}
+
+// PBKDF2 is deliberately slow; cache the result, as the same documents are opened repeatedly.
+static BOOL PSCAESCryptoDeriveKey(NSString *passphrase, NSString *salt, uint8_t key[kCCKeySizeAES256]) {
+    PSCAESCryptoSetupDerivedKeys();
+
+    NSData *passphraseData = [passphrase dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *saltData = [salt dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *cacheKeyInput = [NSMutableData dataWithCapacity:[passphraseData length] + [saltData length] + sizeof(NSUInteger)];
+    NSUInteger passphraseLength = [passphraseData length];
+    [cacheKeyInput appendBytes:&passphraseLength length:sizeof(passphraseLength)];
+    [cacheKeyInput appendData:passphraseData];
+    [cacheKeyInput appendData:saltData];
+    NSMutableData *cacheKey = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256([cacheKeyInput bytes], (CC_LONG)[cacheKeyInput length], [cacheKey mutableBytes]);
+    memset([cacheKeyInput mutableBytes], 0, [cacheKeyInput length]);
+
+    __block BOOL found = NO;
+    dispatch_sync(_derivedKeysQueue, ^{
+        NSData *keyData = _derivedKeys[cacheKey];
+        if (keyData) {
+            memcpy(key, [keyData bytes], kCCKeySizeAES256);
+            found = YES;
+        }
+    });
+    if (found) return YES;
+
+    int status = CCKeyDerivationPBKDF(kCCPBKDF2, [passphraseData bytes], [passphraseData length], [saltData bytes], [saltData length], kCCPRFHmacAlgSHA1, kPSCAESCryptoKeyDerivationRounds, key, kCCKeySizeAES256);
+    if (status != kCCSuccess) return NO;
+
+    dispatch_sync(_derivedKeysQueue, ^{
+        _derivedKeys[cacheKey] = [NSMutableData dataWithBytes:key length:kCCKeySizeAES256];
+    });
+    return YES;
+}
+
+static size_t PSCAESCryptoGetBytesAtPosition(void *info, void *buffer, off_t position, size_t count) {
+    return [(__bridge PSCAESCryptoStream *)info getBytes:buffer atPosition:position count:count];
+}
+
+static void PSCAESCryptoReleaseInfo(void *info) {
+    CFBridgingRelease(info);
+}
+
+@implementation PSCAESCryptoStream
+
+- (id)initWithURL:(NSURL *)URL key:(const uint8_t *)key {
+    if ((self = [super init])) {
+        _fileDescriptor = open([[URL path] fileSystemRepresentation], O_RDONLY);
+        if (_fileDescriptor < 0) {
+            PSCLog(@"Failed to open %@: %s", URL, strerror(errno));
+            return nil;
+        }
+
+        // IV + at least one block, whole blocks only.
+        _fileSize = lseek(_fileDescriptor, 0, SEEK_END);
+        if (_fileSize < 2 * kCCBlockSizeAES128 || _fileSize % kCCBlockSizeAES128 != 0) {
+            PSCLog(@"%@ is not a valid encrypted file.", URL);
+            return nil;
+        }
+
+        if (CCCryptorCreate(kCCDecrypt, kCCAlgorithmAES128, 0, key, kCCKeySizeAES256, NULL, &_cryptor) != kCCSuccess) {
+            return nil;
+        }
+
+        // the padding is in the last block; decrypt it (with the block before as IV) to get the plain length.
+        uint8_t lastBlocks[2 * kCCBlockSizeAES128], plainBlock[kCCBlockSizeAES128];
+        size_t decryptedLength = 0;
+        if (pread(_fileDescriptor, lastBlocks, sizeof(lastBlocks), _fileSize - sizeof(lastBlocks)) != sizeof(lastBlocks) ||
+            CCCryptorReset(_cryptor, lastBlocks) != kCCSuccess ||
+            CCCryptorUpdate(_cryptor, lastBlocks + kCCBlockSizeAES128, kCCBlockSizeAES128, plainBlock, sizeof(plainBlock), &decryptedLength) != kCCSuccess) {
+            return nil;
+        }
+        uint8_t padding = plainBlock[kCCBlockSizeAES128 - 1];
+        BOOL validPadding = padding > 0 && padding <= kCCBlockSizeAES128;
+        for (NSUInteger i = kCCBlockSizeAES128 - padding; validPadding && i < kCCBlockSizeAES128; i++) {
+            validPadding = plainBlock[i] == padding;
+        }
+        if (!validPadding) {
+            PSCLog(@"Invalid padding in %@. Wrong passphrase or salt?", URL);
+            return nil;
+        }
+        _length = (size_t)(_fileSize - kCCBlockSizeAES128 - padding);
+
+        _chunks = [NSMutableDictionary new];
+        _chunkOrder = [NSMutableArray new];
+        _cachedChunkCount = kPSCAESCryptoDefaultCachedChunkCount;
+        _streamQueue = dispatch_queue_create("com.pspdfkit.catalog.aesCryptoStreamQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_cryptor) CCCryptorRelease(_cryptor);
+    if (_fileDescriptor >= 0) close(_fileDescriptor);
+    if (_streamQueue) PSPDFDispatchRelease(_streamQueue);
+}
+
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count {
+    if (position < 0 || (size_t)position >= _length) return 0;
+    count = MIN(count, _length - (size_t)position);
+
+    __block size_t copied = 0;
+    dispatch_sync(_streamQueue, ^{
+        while (copied < count) {
+            off_t offset = position + copied;
+            NSData *chunk = [self chunkAtIndex:(NSUInteger)(offset / kPSCAESCryptoChunkSize)];
+            if (!chunk) break;
+
+            size_t chunkOffset = (size_t)(offset % kPSCAESCryptoChunkSize);
+            size_t chunkCopy = MIN(count - copied, [chunk length] - chunkOffset);
+            memcpy((uint8_t *)buffer + copied, (const uint8_t *)[chunk bytes] + chunkOffset, chunkCopy);
+            copied += chunkCopy;
+        }
+    });
+    return copied;
+}
+
+// Needs to be called on _streamQueue.
+- (NSData *)chunkAtIndex:(NSUInteger)chunkIndex {
+    NSNumber *chunkKey = @(chunkIndex);
+    NSData *chunk = _chunks[chunkKey];
+    if (chunk) {
+        [_chunkOrder removeObject:chunkKey];
+        [_chunkOrder addObject:chunkKey];
+        return chunk;
+    }
+
+    // the ciphertext of chunk n starts after the IV; the 16 bytes before it are the IV for its first block.
+    off_t fileOffset = (off_t)chunkIndex * kPSCAESCryptoChunkSize;
+    size_t cipherLength = (size_t)MIN((off_t)kPSCAESCryptoChunkSize, _fileSize - kCCBlockSizeAES128 - fileOffset);
+    NSMutableData *cipherData = [NSMutableData dataWithLength:kCCBlockSizeAES128 + cipherLength];
+    if (pread(_fileDescriptor, [cipherData mutableBytes], [cipherData length], fileOffset) != (ssize_t)[cipherData length]) {
+        PSCLog(@"Failed to read chunk %d: %s", chunkIndex, strerror(errno));
+        return nil;
+    }
+
+    NSMutableData *plainData = [NSMutableData dataWithLength:cipherLength];
+    size_t decryptedLength = 0;
+    const uint8_t *cipherBytes = [cipherData bytes];
+    if (CCCryptorReset(_cryptor, cipherBytes) != kCCSuccess ||
+        CCCryptorUpdate(_cryptor, cipherBytes + kCCBlockSizeAES128, cipherLength, [plainData mutableBytes], cipherLength, &decryptedLength) != kCCSuccess) {
+        return nil;
+    }
+
+    // the last chunk contains the padding.
+    size_t plainOffset = chunkIndex * kPSCAESCryptoChunkSize;
+    [plainData setLength:MIN(decryptedLength, _length - plainOffset)];
+
+    _chunks[chunkKey] = plainData;
+    [_chunkOrder addObject:chunkKey];
+    while ([_chunkOrder count] > MAX(_cachedChunkCount, 1)) {
+        [_chunks removeObjectForKey:_chunkOrder[0]];
+        [_chunkOrder removeObjectAtIndex:0];
+    }
+    return plainData;
+}
+
+@end
+
+@interface PSCAESCryptoDataProvider () {
+    CGDataProviderRef _dataProvider;
+    PSCAESCryptoStream *_stream;
+    NSURL *_URL;
+    NSString *_passphrase;
+    NSString *_salt;
+}
+@end
+
+@implementation PSCAESCryptoDataProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithURL:(NSURL *)URL passphrase:(NSString *)passphrase salt:(NSString *)salt {
+    if ((self = [super init])) {
+        _URL = URL;
+        _passphrase = [passphrase copy];
+        _salt = [salt copy];
+        _cachedChunkCount = kPSCAESCryptoDefaultCachedChunkCount;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    CGDataProviderRelease(_dataProvider);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ URL:%@ length:%lu>", NSStringFromClass([self class]), _URL, (unsigned long)self.length];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (CGDataProviderRef)dataProviderRef {
+    if (!_dataProvider && [self loadStream]) {
+        CGDataProviderDirectCallbacks callbacks = {
+            .version = 0,
+            .getBytePointer = NULL,
+            .releaseBytePointer = NULL,
+            .getBytesAtPosition = PSCAESCryptoGetBytesAtPosition,
+            .releaseInfo = PSCAESCryptoReleaseInfo,
+        };
+        _dataProvider = CGDataProviderCreateDirect((__bridge_retained void *)_stream, _stream.length, &callbacks);
+    }
+    return _dataProvider;
+}
+
+- (PSCByteRangeSource *)byteRangeSource {
+    if (![self loadStream]) return nil;
+    PSCAESCryptoStream *stream = _stream;
+    return [PSCByteRangeSource sourceWithLength:stream.length readBlock:^size_t(void *buffer, off_t position, size_t count) {
+        return [stream getBytes:buffer atPosition:position count:count];
+    }];
+}
+
+- (size_t)length {
+    [self loadStream];
+    return _stream.length;
+}
+
+- (void)setCachedChunkCount:(NSUInteger)cachedChunkCount {
+    _cachedChunkCount = cachedChunkCount;
+    _stream.cachedChunkCount = cachedChunkCount;
+}
+
++ (BOOL)encryptFileAtURL:(NSURL *)sourceURL toURL:(NSURL *)targetURL passphrase:(NSString *)passphrase salt:(NSString *)salt error:(NSError **)error {
+    uint8_t key[kCCKeySizeAES256], iv[kCCBlockSizeAES128];
+    if (!PSCAESCryptoDeriveKey(passphrase, salt, key)) {
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey : @"Key derivation failed."}];
+        return NO;
+    }
+    for (NSUInteger i = 0; i < sizeof(iv); i += sizeof(u_int32_t)) {
+        u_int32_t random = arc4random();
+        memcpy(iv + i, &random, sizeof(random));
+    }
+
+    FILE *source = fopen([[sourceURL path] fileSystemRepresentation], "rb");
+    FILE *target = fopen([[targetURL path] fileSystemRepresentation], "wb");
+    CCCryptorRef cryptor = NULL;
+    BOOL success = source && target && CCCryptorCreate(kCCEncrypt, kCCAlgorithmAES128, kCCOptionPKCS7Padding, key, kCCKeySizeAES256, iv, &cryptor) == kCCSuccess;
+    success = success && fwrite(iv, 1, sizeof(iv), target) == sizeof(iv);
+
+    // stream in chunks; the output of update is at most one block larger than the input.
+    uint8_t *plainBuffer = malloc(kPSCAESCryptoChunkSize), *cipherBuffer = malloc(kPSCAESCryptoChunkSize + kCCBlockSizeAES128);
+    size_t readLength, cipherLength;
+    while (success && (readLength = fread(plainBuffer, 1, kPSCAESCryptoChunkSize, source)) > 0) {
+        success = CCCryptorUpdate(cryptor, plainBuffer, readLength, cipherBuffer, kPSCAESCryptoChunkSize + kCCBlockSizeAES128, &cipherLength) == kCCSuccess;
+        success = success && fwrite(cipherBuffer, 1, cipherLength, target) == cipherLength;
+    }
+    success = success && !ferror(source);
+    success = success && CCCryptorFinal(cryptor, cipherBuffer, kCCBlockSizeAES128, &cipherLength) == kCCSuccess;
+    success = success && fwrite(cipherBuffer, 1, cipherLength, target) == cipherLength;
+
+    int errorNumber = errno;
+    free(plainBuffer);
+    free(cipherBuffer);
+    if (cryptor) CCCryptorRelease(cryptor);
+    if (source) fclose(source);
+    if (target && fclose(target) != 0) success = NO;
+    memset(key, 0, sizeof(key));
+
+    if (!success && error) {
+        *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errorNumber userInfo:nil];
+    }
+    return success;
+}
+
++ (void)clearDerivedKeyCache {
+    PSCAESCryptoSetupDerivedKeys();
+    PSCAESCryptoClearDerivedKeys();
+}
+
+#ifdef DEBUG
++ (double)decryptionThroughputWithLength:(size_t)length {
+    length = MAX(length / kCCBlockSizeAES128, 1) * kCCBlockSizeAES128;
+    uint8_t key[kCCKeySizeAES256] = {0}, iv[kCCBlockSizeAES128] = {0};
+    NSMutableData *cipherData = [NSMutableData dataWithLength:length];
+    NSMutableData *plainData = [NSMutableData dataWithLength:length];
+
+    CCCryptorRef cryptor = NULL;
+    if (CCCryptorCreate(kCCDecrypt, kCCAlgorithmAES128, 0, key, kCCKeySizeAES256, iv, &cryptor) != kCCSuccess) return 0;
+
+    // same access pattern as the data provider: one reset and one update per chunk.
+    size_t decryptedLength = 0;
+    CFTimeInterval startTime = CACurrentMediaTime();
+    for (size_t offset = 0; offset < length; offset += kPSCAESCryptoChunkSize) {
+        size_t chunkLength = MIN((size_t)kPSCAESCryptoChunkSize, length - offset);
+        CCCryptorReset(cryptor, offset > 0 ? (const uint8_t *)[cipherData bytes] + offset - kCCBlockSizeAES128 : iv);
+        CCCryptorUpdate(cryptor, (const uint8_t *)[cipherData bytes] + offset, chunkLength, (uint8_t *)[plainData mutableBytes] + offset, chunkLength, &decryptedLength);
+    }
+    CFTimeInterval duration = CACurrentMediaTime() - startTime;
+    CCCryptorRelease(cryptor);
+
+    return duration > 0 ? (length / (1024. * 1024.)) / duration : 0;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (BOOL)loadStream {
+    if (!_stream) {
+        uint8_t key[kCCKeySizeAES256];
+        if (PSCAESCryptoDeriveKey(_passphrase, _salt, key)) {
+            _stream = [[PSCAESCryptoStream alloc] initWithURL:_URL key:key];
+            _stream.cachedChunkCount = _cachedChunkCount;
+        }
+        memset(key, 0, sizeof(key));
+    }
+    return _stream != nil;
+}
+
+@end
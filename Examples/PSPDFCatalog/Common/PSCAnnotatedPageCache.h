@@ -0,0 +1,40 @@
+//
+//  PSCAnnotatedPageCache.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Memory cache for pages that were rendered together with their annotations.
+
+    Entries are keyed by document UID, page, size, clip rect and render options, and carry a revision hash of the annotations.
+    As long as no annotation on the page changes (moves, gets recolored, becomes dirty, is deleted...), the composited
+    bitmap is reused and the page isn't rendered again. Use it from PSPDFDocument's renderImageForPage:withSize:clippedToRect:withAnnotations:options:.
+*/
+@interface PSCAnnotatedPageCache : NSObject
+
+/// Shared instance.
++ (PSCAnnotatedPageCache *)sharedAnnotatedPageCache;
+
+/// Returns the cached composited image, or calls renderBlock and caches the result.
+/// Pages without annotations are not cached here (PSPDFCache already handles them).
+- (UIImage *)imageForDocument:(PSPDFDocument *)document page:(NSUInteger)page size:(CGSize)size clippedToRect:(CGRect)clipRect annotations:(NSArray *)annotations options:(NSDictionary *)options renderBlock:(UIImage *(^)(void))renderBlock;
+
+/// Hash over the render-relevant state of the annotations. Changes whenever an annotation changes.
++ (NSUInteger)revisionHashForAnnotations:(NSArray *)annotations;
+
+/// Removes all cached images of a page. PSCMagazine calls this for the changed pages when annotations are saved.
+- (void)invalidateDocument:(PSPDFDocument *)document page:(NSUInteger)page;
+
+/// Removes all cached images.
+- (void)clearCache;
+
+/// Maximum bytes held in memory. Defaults to 20MB.
+@property(nonatomic, assign) NSUInteger totalCostLimit;
+
+/// Statistics.
+@property(nonatomic, assign, readonly) NSUInteger hitCount;
+@property(nonatomic, assign, readonly) NSUInteger missCount;
+
+@end
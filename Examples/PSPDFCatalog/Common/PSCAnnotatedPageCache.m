@@ -0,0 +1,177 @@
+//
+//  PSCAnnotatedPageCache.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCAnnotatedPageCache.h"
+
+#define kPSCAnnotatedPageCacheDefaultCostLimit (20 * 1024 * 1024)
+
+// Cache entry; the image is only valid for the annotation revision it was rendered with.
+@interface PSCAnnotatedPageCacheEntry : NSObject
+@property(nonatomic, strong) UIImage *image;
+@property(nonatomic, assign) NSUInteger revision;
+@end
+
+@implementation PSCAnnotatedPageCacheEntry
+@end
+
+@interface PSCAnnotatedPageCache () {
+    NSCache *_cache;
+    NSMutableDictionary *_pageGenerations; // page key -> NSNumber, bumped on invalidation
+    dispatch_queue_t _stateQueue;
+}
+@property(nonatomic, assign) NSUInteger hitCount;
+@property(nonatomic, assign) NSUInteger missCount;
+@end
+
+@implementation PSCAnnotatedPageCache
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCAnnotatedPageCache *)sharedAnnotatedPageCache {
+    static dispatch_once_t pred = 0;
+    __strong static PSCAnnotatedPageCache *_sharedAnnotatedPageCache = nil;
+    dispatch_once(&pred, ^{
+        _sharedAnnotatedPageCache = [self new];
+    });
+    return _sharedAnnotatedPageCache;
+}
+
+static inline NSUInteger PSCHashCombine(NSUInteger hash, NSUInteger value) {
+    return hash * 31 + value;
+}
+
+static inline NSUInteger PSCHashFloat(CGFloat value) {
+    return (NSUInteger)(value * 1000.f);
+}
+
+// Ink lines are arrays of boxed CGPoints; NSArray's hash is just the count, so hash the points themselves.
+static NSUInteger PSCHashInkLines(NSArray *lines) {
+    NSUInteger hash = [lines count];
+    for (NSArray *line in lines) {
+        hash = PSCHashCombine(hash, [line count]);
+        for (NSValue *pointValue in line) {
+            CGPoint point = [pointValue CGPointValue];
+            hash = PSCHashCombine(hash, PSCHashFloat(point.x) ^ PSCHashFloat(point.y) << 8);
+        }
+    }
+    return hash;
+}
+
++ (NSUInteger)revisionHashForAnnotations:(NSArray *)annotations {
+    NSUInteger hash = [annotations count];
+    for (PSPDFAnnotation *annotation in annotations) {
+        CGRect boundingBox = annotation.boundingBox;
+        // content only, no object addresses: a reparsed or reallocated but otherwise equal annotation keeps its hash.
+        hash = PSCHashCombine(hash, annotation.type ^ annotation.indexOnPage << 8);
+        hash = PSCHashCombine(hash, annotation.isDirty | annotation.isDeleted << 1);
+        hash = PSCHashCombine(hash, PSCHashFloat(boundingBox.origin.x) ^ PSCHashFloat(boundingBox.origin.y) << 8);
+        hash = PSCHashCombine(hash, PSCHashFloat(boundingBox.size.width) ^ PSCHashFloat(boundingBox.size.height) << 8);
+        hash = PSCHashCombine(hash, [annotation.color hash] ^ PSCHashFloat(annotation.alpha));
+        hash = PSCHashCombine(hash, PSCHashFloat(annotation.lineWidth));
+        hash = PSCHashCombine(hash, [annotation.contents hash]);
+        if ([annotation isKindOfClass:[PSPDFInkAnnotation class]]) {
+            hash = PSCHashCombine(hash, PSCHashInkLines([(PSPDFInkAnnotation *)annotation lines]));
+        }
+    }
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _cache = [NSCache new];
+        _cache.name = @"com.pspdfkit.catalog.annotatedPageCache";
+        _cache.totalCostLimit = kPSCAnnotatedPageCacheDefaultCostLimit;
+        _pageGenerations = [NSMutableDictionary new];
+        _stateQueue = dispatch_queue_create("com.pspdfkit.catalog.annotatedPageCacheStateQueue", NULL);
+
+        // register for memory notifications
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(didReceiveMemoryWarning) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    PSPDFDispatchRelease(_stateQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ hits:%d misses:%d>", NSStringFromClass([self class]), self.hitCount, self.missCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (UIImage *)imageForDocument:(PSPDFDocument *)document page:(NSUInteger)page size:(CGSize)size clippedToRect:(CGRect)clipRect annotations:(NSArray *)annotations options:(NSDictionary *)options renderBlock:(UIImage *(^)(void))renderBlock {
+    if ([annotations count] == 0 || !document.UID) {
+        return renderBlock();
+    }
+
+    NSString *pageKey = [self pageKeyForDocument:document page:page];
+    __block NSUInteger generation;
+    dispatch_sync(_stateQueue, ^{
+        generation = [_pageGenerations[pageKey] unsignedIntegerValue];
+    });
+    NSString *cacheKey = [NSString stringWithFormat:@"%@_%d_%@_%@_%u", pageKey, generation, NSStringFromCGSize(size), NSStringFromCGRect(clipRect), [[options description] hash]];
+    NSUInteger revision = [[self class] revisionHashForAnnotations:annotations];
+
+    PSCAnnotatedPageCacheEntry *entry = [_cache objectForKey:cacheKey];
+    if (entry && entry.revision == revision) {
+        dispatch_sync(_stateQueue, ^{ _hitCount++; });
+        return entry.image;
+    }
+
+    dispatch_sync(_stateQueue, ^{ _missCount++; });
+    UIImage *image = renderBlock();
+    if (image) {
+        entry = [PSCAnnotatedPageCacheEntry new];
+        entry.image = image;
+        entry.revision = revision;
+        CGSize pixelSize = CGSizeMake(image.size.width * image.scale, image.size.height * image.scale);
+        [_cache setObject:entry forKey:cacheKey cost:(NSUInteger)(pixelSize.width * pixelSize.height * 4)];
+    }else {
+        [_cache removeObjectForKey:cacheKey];
+    }
+    return image;
+}
+
+- (void)invalidateDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    NSString *pageKey = [self pageKeyForDocument:document page:page];
+    dispatch_sync(_stateQueue, ^{
+        _pageGenerations[pageKey] = @([_pageGenerations[pageKey] unsignedIntegerValue] + 1);
+    });
+}
+
+- (void)clearCache {
+    [_cache removeAllObjects];
+}
+
+- (NSUInteger)totalCostLimit {
+    return _cache.totalCostLimit;
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    _cache.totalCostLimit = totalCostLimit;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSString *)pageKeyForDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    return [NSString stringWithFormat:@"%@_%d", document.UID, page];
+}
+
+- (void)didReceiveMemoryWarning {
+    [self clearCache];
+}
+
+@end
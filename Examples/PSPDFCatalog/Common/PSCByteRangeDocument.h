@@ -0,0 +1,25 @@
+//
+//  PSCByteRangeDocument.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+@class PSCByteRangeSource;
+
+/**
+    Document for a direct-access CGDataProvider with a PSCByteRangeSource over the same bytes.
+
+    PSPDFKit renders from the data provider. Email, print and open in ask the document provider for its data, which
+    by default copies the whole data provider into memory. PSCByteRangeDocumentProvider (set automatically) answers
+    with the source instead: the backing NSData if there is one, else an error. Nothing is copied, and decrypted
+    bytes are never written to disk.
+*/
+@interface PSCByteRangeDocument : PSPDFDocument
+
+/// byteRangeSource has to serve the same bytes as dataProvider.
+- (id)initWithDataProvider:(CGDataProviderRef)dataProvider byteRangeSource:(PSCByteRangeSource *)byteRangeSource;
+
+@property(nonatomic, strong, readonly) PSCByteRangeSource *byteRangeSource;
+
+@end
@@ -0,0 +1,28 @@
+//
+//  PSCByteRangeDocument.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCByteRangeDocument.h"
+#import "PSCByteRangeDocumentProvider.h"
+
+@interface PSCByteRangeDocument ()
+@property(nonatomic, strong) PSCByteRangeSource *byteRangeSource;
+@end
+
+@implementation PSCByteRangeDocument
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDataProvider:(CGDataProviderRef)dataProvider byteRangeSource:(PSCByteRangeSource *)byteRangeSource {
+    if ((self = [super initWithDataProvider:dataProvider])) {
+        _byteRangeSource = byteRangeSource;
+        self.overrideClassNames = @{(id)[PSPDFDocumentProvider class] : [PSCByteRangeDocumentProvider class]};
+    }
+    return self;
+}
+
+@end
@@ -0,0 +1,20 @@
+//
+//  PSCByteRangeDocumentProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Document provider that builds dataRepresentationWithError: from a PSCByteRangeSource.
+
+    PSPDFDocument's fileNamesWithDataDictionary (used for email, print and open in) asks every provider for its
+    data. For data providers, the default implementation copies the whole PDF into memory. This subclass returns
+    the backing data of the PSCByteRangeDocument's source, or an error if the source has none (e.g. decrypted
+    bytes). Files and NSData are returned as before, they are already mapped or referenced.
+
+    PSCByteRangeDocument sets this subclass up with overrideClassNames.
+*/
+@interface PSCByteRangeDocumentProvider : PSPDFDocumentProvider
+
+@end
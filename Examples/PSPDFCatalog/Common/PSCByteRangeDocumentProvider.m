@@ -0,0 +1,26 @@
+//
+//  PSCByteRangeDocumentProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCByteRangeDocumentProvider.h"
+#import "PSCByteRangeSource.h"
+#import "PSCByteRangeDocument.h"
+
+@implementation PSCByteRangeDocumentProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDocumentProvider
+
+- (NSData *)dataRepresentationWithError:(NSError **)error {
+    if (self.fileURL || self.data || !self.dataProvider) return [super dataRepresentationWithError:error];
+
+    PSCByteRangeDocument *document = (PSCByteRangeDocument *)self.document;
+    PSCByteRangeSource *source = [document isKindOfClass:[PSCByteRangeDocument class]] ? document.byteRangeSource : nil;
+    if (!source) return [super dataRepresentationWithError:error];
+    return [source mappedDataRepresentationWithError:error];
+}
+
+@end
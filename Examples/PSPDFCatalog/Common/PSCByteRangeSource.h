@@ -0,0 +1,59 @@
+//
+//  PSCByteRangeSource.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+typedef size_t (^PSCByteRangeReadBlock)(void *buffer, off_t position, size_t count);
+
+/**
+    Read-only, random-access view on the bytes of a PDF source.
+
+    dataRepresentationWithError: of PSPDFDocumentProvider returns the whole PDF as NSData, which is a full copy for
+    data providers and for files that can't be mapped. This class hides the source (file, memory-mapped file, NSData,
+    CGDataProvider or a read block) behind ranges, so exporting a document streams from the source in small chunks.
+    Sub-ranges share the source and never copy. PSCByteRangeDocument uses this for email, print and export.
+*/
+@interface PSCByteRangeSource : NSObject
+
+/// Source for a document provider (fileURL, data or dataProvider, whichever is set).
++ (PSCByteRangeSource *)sourceWithDocumentProvider:(PSPDFDocumentProvider *)documentProvider;
+
+/// Memory-maps the file. Falls back to pread if the file can't be mapped.
++ (PSCByteRangeSource *)sourceWithFileURL:(NSURL *)fileURL;
+
+/// Uses the bytes of data directly. (can be memory or mapped data)
++ (PSCByteRangeSource *)sourceWithData:(NSData *)data;
+
+/// CGDataProvider has no public random access API; the data is copied once on first access.
+/// Prefer sourceWithLength:readBlock: (or PSCByteRangeDocument) if you have direct access to the underlying bytes.
++ (PSCByteRangeSource *)sourceWithDataProvider:(CGDataProviderRef)dataProvider;
+
+/// Reads through a block. The block may be called from any thread, but never concurrently.
++ (PSCByteRangeSource *)sourceWithLength:(size_t)length readBlock:(PSCByteRangeReadBlock)readBlock;
+
+/// Number of bytes in the source.
+@property(nonatomic, assign, readonly) size_t length;
+
+/// Returns a source for a part of this source. Shares the backing store.
+- (PSCByteRangeSource *)sourceWithRange:(NSRange)range;
+
+/// Copies range into buffer. Returns the number of copied bytes.
+- (size_t)getBytes:(void *)buffer range:(NSRange)range;
+
+/// Calls block with consecutive pieces of range. bytes point into the backing store if possible (mapped files, NSData),
+/// otherwise into a reused buffer of chunkSize. bytes is only valid within the block.
+- (void)enumerateBytesInRange:(NSRange)range chunkSize:(size_t)chunkSize usingBlock:(void (^)(const void *bytes, NSRange byteRange, BOOL *stop))block;
+
+/// Streams all bytes into a file. Writes atomically.
+- (BOOL)writeToURL:(NSURL *)fileURL error:(NSError **)error;
+
+/// Copies the source into NSData. Only use this if you really need a single contiguous buffer.
+- (NSData *)dataRepresentation;
+
+/// The backing NSData (in memory or memory-mapped) if this source covers all of it. Otherwise returns nil and an error;
+/// the bytes are never copied, and never written to disk (a read block might return decrypted data).
+- (NSData *)mappedDataRepresentationWithError:(NSError **)error;
+
+@end
@@ -0,0 +1,238 @@
+//
+//  PSCByteRangeSource.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCByteRangeSource.h"
+#include <unistd.h>
+
+#define kPSCByteRangeDefaultChunkSize (256 * 1024)
+
+// Shared by a source and all of its sub-ranges.
+@interface PSCByteRangeBacking : NSObject {
+    dispatch_queue_t _readQueue;
+    dispatch_once_t _copyOnceToken;
+}
+@property(nonatomic, strong) NSData *data;
+@property(nonatomic, strong) __attribute__((NSObject)) CGDataProviderRef dataProvider;
+@property(nonatomic, copy) PSCByteRangeReadBlock readBlock;
+- (const void *)bytes; // NULL if there's no contiguous buffer
+- (size_t)getBytes:(void *)buffer position:(off_t)position count:(size_t)count;
+@end
+
+@implementation PSCByteRangeBacking
+
+- (id)init {
+    if ((self = [super init])) {
+        _readQueue = dispatch_queue_create("com.pspdfkit.catalog.byteRangeReadQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    PSPDFDispatchRelease(_readQueue);
+}
+
+- (const void *)bytes {
+    // data is either set before the backing is shared, or exactly once here.
+    if (_dataProvider) {
+        dispatch_once(&_copyOnceToken, ^{
+            if (!_data) _data = CFBridgingRelease(CGDataProviderCopyData(_dataProvider));
+        });
+    }
+    return [_data bytes];
+}
+
+- (size_t)getBytes:(void *)buffer position:(off_t)position count:(size_t)count {
+    const void *bytes = [self bytes];
+    if (bytes) {
+        memcpy(buffer, (const uint8_t *)bytes + position, count);
+        return count;
+    }
+
+    __block size_t readLength = 0;
+    dispatch_sync(_readQueue, ^{
+        readLength = self.readBlock ? self.readBlock(buffer, position, count) : 0;
+    });
+    return readLength;
+}
+
+@end
+
+@interface PSCByteRangeSource () {
+    PSCByteRangeBacking *_backing;
+    off_t _offset;
+}
+@property(nonatomic, assign) size_t length;
+@end
+
+@implementation PSCByteRangeSource
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCByteRangeSource *)sourceWithDocumentProvider:(PSPDFDocumentProvider *)documentProvider {
+    if (documentProvider.fileURL) return [self sourceWithFileURL:documentProvider.fileURL];
+    if (documentProvider.data) return [self sourceWithData:documentProvider.data];
+    if (documentProvider.dataProvider) return [self sourceWithDataProvider:documentProvider.dataProvider];
+    return nil;
+}
+
++ (PSCByteRangeSource *)sourceWithFileURL:(NSURL *)fileURL {
+    NSError *error = nil;
+    NSData *mappedData = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedAlways error:&error];
+    if (mappedData) return [self sourceWithData:mappedData];
+
+    // mapping can fail (e.g. on some network volumes); read ranges instead.
+    PSCLog(@"Failed to map %@ (%@); using pread.", fileURL, error);
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingFromURL:fileURL error:&error];
+    if (!fileHandle) {
+        PSCLog(@"Failed to open %@: %@", fileURL, error);
+        return nil;
+    }
+    size_t length = (size_t)[fileHandle seekToEndOfFile];
+    return [self sourceWithLength:length readBlock:^size_t(void *buffer, off_t position, size_t count) {
+        ssize_t readLength = pread([fileHandle fileDescriptor], buffer, count, position);
+        return readLength > 0 ? (size_t)readLength : 0;
+    }];
+}
+
++ (PSCByteRangeSource *)sourceWithData:(NSData *)data {
+    PSCByteRangeBacking *backing = [PSCByteRangeBacking new];
+    backing.data = data;
+    return [[self alloc] initWithBacking:backing offset:0 length:[data length]];
+}
+
++ (PSCByteRangeSource *)sourceWithDataProvider:(CGDataProviderRef)dataProvider {
+    if (!dataProvider) return nil;
+    PSCByteRangeBacking *backing = [PSCByteRangeBacking new];
+    backing.dataProvider = dataProvider;
+    // the length isn't known without copying.
+    return [[self alloc] initWithBacking:backing offset:0 length:(size_t)-1];
+}
+
++ (PSCByteRangeSource *)sourceWithLength:(size_t)length readBlock:(PSCByteRangeReadBlock)readBlock {
+    PSCByteRangeBacking *backing = [PSCByteRangeBacking new];
+    backing.readBlock = readBlock;
+    return [[self alloc] initWithBacking:backing offset:0 length:length];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithBacking:(PSCByteRangeBacking *)backing offset:(off_t)offset length:(size_t)length {
+    if ((self = [super init])) {
+        _backing = backing;
+        _offset = offset;
+        _length = length;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ offset:%lld length:%lu>", NSStringFromClass([self class]), _offset, (unsigned long)self.length];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (size_t)length {
+    if (_length == (size_t)-1) {
+        [_backing bytes];
+        _length = [_backing.data length];
+    }
+    return _length;
+}
+
+- (PSCByteRangeSource *)sourceWithRange:(NSRange)range {
+    range = [self clampedRange:range];
+    return [[[self class] alloc] initWithBacking:_backing offset:_offset + range.location length:range.length];
+}
+
+- (size_t)getBytes:(void *)buffer range:(NSRange)range {
+    range = [self clampedRange:range];
+    if (range.length == 0) return 0;
+    return [_backing getBytes:buffer position:_offset + range.location count:range.length];
+}
+
+- (void)enumerateBytesInRange:(NSRange)range chunkSize:(size_t)chunkSize usingBlock:(void (^)(const void *bytes, NSRange byteRange, BOOL *stop))block {
+    range = [self clampedRange:range];
+    if (range.length == 0 || !block) return;
+    chunkSize = chunkSize ?: kPSCByteRangeDefaultChunkSize;
+
+    // contiguous backing store: no copy at all.
+    const uint8_t *bytes = [_backing bytes];
+    void *buffer = bytes ? NULL : malloc(chunkSize);
+
+    BOOL stop = NO;
+    for (NSUInteger location = range.location; location < NSMaxRange(range) && !stop; location += chunkSize) {
+        NSRange chunkRange = NSMakeRange(location, MIN(chunkSize, NSMaxRange(range) - location));
+        if (bytes) {
+            block(bytes + _offset + chunkRange.location, chunkRange, &stop);
+        }else {
+            chunkRange.length = [_backing getBytes:buffer position:_offset + chunkRange.location count:chunkRange.length];
+            if (chunkRange.length == 0) break;
+            block(buffer, chunkRange, &stop);
+        }
+    }
+    free(buffer);
+}
+
+- (BOOL)writeToURL:(NSURL *)fileURL error:(NSError **)error {
+    NSString *temporaryPath = [[fileURL path] stringByAppendingFormat:@".%@.tmp", [[NSProcessInfo processInfo] globallyUniqueString]];
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:temporaryPath append:NO];
+    [outputStream open];
+
+    __block BOOL success = [outputStream streamStatus] == NSStreamStatusOpen;
+    if (success) {
+        [self enumerateBytesInRange:NSMakeRange(0, self.length) chunkSize:kPSCByteRangeDefaultChunkSize usingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+            NSUInteger written = 0;
+            while (written < byteRange.length) {
+                NSInteger result = [outputStream write:(const uint8_t *)bytes + written maxLength:byteRange.length - written];
+                if (result <= 0) { success = NO; *stop = YES; return; }
+                written += result;
+            }
+        }];
+    }
+    NSError *streamError = [outputStream streamError];
+    [outputStream close];
+
+    NSFileManager *fileManager = [NSFileManager new];
+    if (success) {
+        [fileManager removeItemAtURL:fileURL error:NULL];
+        success = [fileManager moveItemAtPath:temporaryPath toPath:[fileURL path] error:error];
+    }else if (error) {
+        *error = streamError ?: [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorUnableToConvertToDataRepresentation userInfo:nil];
+    }
+    if (!success) [fileManager removeItemAtPath:temporaryPath error:NULL];
+    return success;
+}
+
+- (NSData *)dataRepresentation {
+    const uint8_t *bytes = [_backing bytes];
+    if (bytes && _offset == 0 && self.length == [_backing.data length]) return _backing.data;
+
+    NSMutableData *data = [NSMutableData dataWithLength:self.length];
+    [data setLength:[self getBytes:[data mutableBytes] range:NSMakeRange(0, self.length)]];
+    return data;
+}
+
+- (NSData *)mappedDataRepresentationWithError:(NSError **)error {
+    // only the backing data itself; read block sources (e.g. decrypted bytes) are never copied or written to disk.
+    if ([_backing bytes] && _offset == 0 && self.length == [_backing.data length]) return _backing.data;
+    if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorUnableToConvertToDataRepresentation userInfo:@{NSLocalizedDescriptionKey : @"The source has no contiguous buffer."}];
+    return nil;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSRange)clampedRange:(NSRange)range {
+    size_t length = self.length;
+    if (range.location >= length) return NSMakeRange(length, 0);
+    return NSMakeRange(range.location, MIN(range.length, length - range.location));
+}
+
+@end
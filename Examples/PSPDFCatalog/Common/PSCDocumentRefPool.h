@@ -0,0 +1,43 @@
+//
+//  PSCDocumentRefPool.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Process-wide pool of open CGPDFDocumentRefs.
+
+    Every PSPDFDocumentProvider keeps its own document reference open, so with many tabs (or many documents in memory)
+    file descriptors and parsed xref tables add up. The pool caps the number of open references. References that are in
+    use are never closed; idle ones are closed least recently used first and transparently reopened on the next request.
+    Use it through PSCPooledDocumentProvider.
+*/
+@interface PSCDocumentRefPool : NSObject
+
+/// Shared instance.
++ (PSCDocumentRefPool *)sharedDocumentRefPool;
+
+/// Returns the open reference for key, or opens it with openBlock (must return a +1 reference).
+/// The reference stays open until it's released with releaseDocumentRefForKey:. Calls need to be balanced.
+- (CGPDFDocumentRef)requestDocumentRefForKey:(id<NSCopying>)key openBlock:(CGPDFDocumentRef (^)(void))openBlock;
+
+/// Balances requestDocumentRefForKey:openBlock:.
+- (void)releaseDocumentRefForKey:(id<NSCopying>)key;
+
+/// Closes the reference for key (once it's idle) and forgets the key.
+- (void)removeDocumentRefForKey:(id<NSCopying>)key;
+
+/// Closes all idle references. Called on memory warnings.
+- (void)closeIdleDocumentRefs;
+
+/// Maximum number of open references. Defaults to 6. Exceeded only if all references are in use.
+@property(nonatomic, assign) NSUInteger maximumOpenDocumentRefs;
+
+/// Number of currently open references.
+@property(nonatomic, assign, readonly) NSUInteger openDocumentRefCount;
+
+/// Tuning metrics: @"hits", @"opens", @"reopens", @"evictions" and @"reopenTime" (total seconds spent reopening closed references).
+- (NSDictionary *)metrics;
+
+@end
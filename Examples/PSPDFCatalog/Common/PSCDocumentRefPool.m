@@ -0,0 +1,221 @@
+//
+//  PSCDocumentRefPool.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCDocumentRefPool.h"
+#import <QuartzCore/QuartzCore.h>
+
+#define kPSCDocumentRefPoolDefaultMaximum 6
+
+@interface PSCDocumentRefPoolEntry : NSObject
+@property(nonatomic, assign) CGPDFDocumentRef documentRef;
+@property(nonatomic, assign) NSUInteger useCount;
+@property(nonatomic, assign) NSUInteger lastUse;   // pool clock, for LRU
+@property(nonatomic, assign) BOOL wasOpened;       // YES after the first open, to detect reopens
+@property(nonatomic, assign) BOOL removeWhenIdle;
+@end
+
+@implementation PSCDocumentRefPoolEntry
+
+- (void)dealloc {
+    CGPDFDocumentRelease(_documentRef);
+}
+
+- (void)close {
+    CGPDFDocumentRelease(_documentRef);
+    _documentRef = NULL;
+}
+
+@end
+
+@interface PSCDocumentRefPool () {
+    NSMutableDictionary *_entries; // key -> PSCDocumentRefPoolEntry
+    NSUInteger _clock;
+    NSUInteger _hits, _opens, _reopens, _evictions;
+    CFTimeInterval _reopenTime;
+    dispatch_queue_t _poolQueue;
+}
+@end
+
+@implementation PSCDocumentRefPool
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCDocumentRefPool *)sharedDocumentRefPool {
+    static dispatch_once_t pred = 0;
+    __strong static PSCDocumentRefPool *_sharedDocumentRefPool = nil;
+    dispatch_once(&pred, ^{
+        _sharedDocumentRefPool = [self new];
+    });
+    return _sharedDocumentRefPool;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _entries = [NSMutableDictionary new];
+        _maximumOpenDocumentRefs = kPSCDocumentRefPoolDefaultMaximum;
+        _poolQueue = dispatch_queue_create("com.pspdfkit.catalog.documentRefPoolQueue", NULL);
+
+        // register for memory notifications
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(closeIdleDocumentRefs) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    PSPDFDispatchRelease(_poolQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ open:%d/%d metrics:%@>", NSStringFromClass([self class]), self.openDocumentRefCount, self.maximumOpenDocumentRefs, [self metrics]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (CGPDFDocumentRef)requestDocumentRefForKey:(id<NSCopying>)key openBlock:(CGPDFDocumentRef (^)(void))openBlock {
+    if (!key) return NULL;
+
+    __block CGPDFDocumentRef documentRef = NULL;
+    __block BOOL reopen = NO;
+    dispatch_sync(_poolQueue, ^{
+        PSCDocumentRefPoolEntry *entry = [self entryForKey:key];
+        entry.useCount++;
+        entry.lastUse = ++_clock;
+        documentRef = entry.documentRef;
+        if (documentRef) _hits++;
+        reopen = entry.wasOpened;
+    });
+    if (documentRef || !openBlock) return documentRef;
+
+    // open outside of the queue; parsing the xref table can take a while.
+    CFTimeInterval startTime = CACurrentMediaTime();
+    CGPDFDocumentRef openedRef = openBlock();
+    CFTimeInterval openTime = CACurrentMediaTime() - startTime;
+
+    dispatch_sync(_poolQueue, ^{
+        PSCDocumentRefPoolEntry *entry = [self entryForKey:key];
+        if (entry.documentRef) {
+            // another thread was faster.
+            CGPDFDocumentRelease(openedRef);
+        }else if (openedRef) {
+            entry.documentRef = openedRef;
+            entry.wasOpened = YES;
+            _opens++;
+            if (reopen) {
+                _reopens++;
+                _reopenTime += openTime;
+            }
+            [self evictIdleDocumentRefsIfNeeded];
+        }
+        documentRef = entry.documentRef;
+        if (!documentRef) entry.useCount--; // nothing to release later
+    });
+    return documentRef;
+}
+
+- (void)releaseDocumentRefForKey:(id<NSCopying>)key {
+    if (!key) return;
+    dispatch_sync(_poolQueue, ^{
+        PSCDocumentRefPoolEntry *entry = _entries[key];
+        if (!entry || entry.useCount == 0) {
+            PSPDFLogError(@"Unbalanced release of document ref for %@", key);
+            return;
+        }
+        entry.useCount--;
+        if (entry.useCount == 0 && entry.removeWhenIdle) {
+            [_entries removeObjectForKey:key];
+        }else {
+            [self evictIdleDocumentRefsIfNeeded];
+        }
+    });
+}
+
+- (void)removeDocumentRefForKey:(id<NSCopying>)key {
+    if (!key) return;
+    dispatch_sync(_poolQueue, ^{
+        PSCDocumentRefPoolEntry *entry = _entries[key];
+        if (entry.useCount > 0) {
+            entry.removeWhenIdle = YES;
+        }else {
+            [_entries removeObjectForKey:key];
+        }
+    });
+}
+
+- (void)closeIdleDocumentRefs {
+    dispatch_sync(_poolQueue, ^{
+        for (PSCDocumentRefPoolEntry *entry in [_entries allValues]) {
+            if (entry.useCount == 0 && entry.documentRef) {
+                [entry close];
+                _evictions++;
+            }
+        }
+    });
+}
+
+- (NSUInteger)openDocumentRefCount {
+    __block NSUInteger openDocumentRefCount;
+    dispatch_sync(_poolQueue, ^{
+        openDocumentRefCount = [self openCount];
+    });
+    return openDocumentRefCount;
+}
+
+- (NSDictionary *)metrics {
+    __block NSDictionary *metrics;
+    dispatch_sync(_poolQueue, ^{
+        metrics = @{@"hits" : @(_hits), @"opens" : @(_opens), @"reopens" : @(_reopens), @"evictions" : @(_evictions), @"reopenTime" : @(_reopenTime)};
+    });
+    return metrics;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Needs to be called on _poolQueue.
+- (PSCDocumentRefPoolEntry *)entryForKey:(id<NSCopying>)key {
+    PSCDocumentRefPoolEntry *entry = _entries[key];
+    if (!entry) {
+        entry = [PSCDocumentRefPoolEntry new];
+        _entries[key] = entry;
+    }
+    return entry;
+}
+
+// Needs to be called on _poolQueue.
+- (NSUInteger)openCount {
+    NSUInteger openCount = 0;
+    for (PSCDocumentRefPoolEntry *entry in [_entries allValues]) {
+        if (entry.documentRef) openCount++;
+    }
+    return openCount;
+}
+
+// Needs to be called on _poolQueue. Closes least recently used idle references until we're within the limit.
+- (void)evictIdleDocumentRefsIfNeeded {
+    NSUInteger openCount = [self openCount];
+    while (openCount > self.maximumOpenDocumentRefs) {
+        PSCDocumentRefPoolEntry *leastRecentlyUsed = nil;
+        for (PSCDocumentRefPoolEntry *entry in [_entries allValues]) {
+            if (entry.documentRef && entry.useCount == 0 && (!leastRecentlyUsed || entry.lastUse < leastRecentlyUsed.lastUse)) {
+                leastRecentlyUsed = entry;
+            }
+        }
+        if (!leastRecentlyUsed) break; // everything is in use
+        [leastRecentlyUsed close];
+        _evictions++;
+        openCount--;
+    }
+}
+
+@end
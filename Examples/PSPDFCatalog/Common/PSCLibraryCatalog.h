@@ -0,0 +1,36 @@
+//
+//  PSCLibraryCatalog.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Persisted metadata of all PDF files in the library.
+
+    Entries are keyed by path and validated by file size and modification date, so after the first run a folder scan
+    only needs a stat() per file. Unknown or changed files are read with PSCMetadataProbe. The catalog is stored as a
+    binary plist in the caches directory. All methods are thread safe; probing happens outside of the lock, so files can
+    be probed concurrently.
+*/
+@interface PSCLibraryCatalog : NSObject
+
+/// Shared instance.
++ (PSCLibraryCatalog *)sharedLibraryCatalog;
+
+/// Metadata of the PDF at path (kPSPDFMetadataKey* keys), probed if needed. Empty if the file couldn't be probed.
+- (NSDictionary *)metadataForFileAtPath:(NSString *)path;
+
+/// Title from the metadata, or the file name without extension (like PSPDFDocument).
+- (NSString *)titleForFileAtPath:(NSString *)path;
+
+/// Removes entries of files that are not in paths (e.g. after a full scan).
+- (void)removeEntriesExceptForPaths:(NSSet *)paths;
+
+/// Writes the catalog if it changed. Also called when the app enters the background.
+- (void)save;
+
+/// Number of cached entries.
+@property(nonatomic, assign, readonly) NSUInteger count;
+
+@end
@@ -0,0 +1,163 @@
+//
+//  PSCLibraryCatalog.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCLibraryCatalog.h"
+#import "PSCMetadataProbe.h"
+#include <sys/stat.h>
+
+#define kPSCLibraryCatalogFileName @"PSCLibraryCatalog.plist"
+#define kPSCLibraryCatalogVersion 1
+
+#define kPSCLibraryCatalogKeySize @"size"
+#define kPSCLibraryCatalogKeyModificationDate @"mtime"
+#define kPSCLibraryCatalogKeyMetadata @"metadata"
+
+@interface PSCLibraryCatalog () {
+    NSMutableDictionary *_entries; // abbreviated path -> entry
+    BOOL _loaded, _dirty;
+    dispatch_queue_t _catalogQueue;
+}
+@end
+
+@implementation PSCLibraryCatalog
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCLibraryCatalog *)sharedLibraryCatalog {
+    static dispatch_once_t pred = 0;
+    __strong static PSCLibraryCatalog *_sharedLibraryCatalog = nil;
+    dispatch_once(&pred, ^{
+        _sharedLibraryCatalog = [self new];
+    });
+    return _sharedLibraryCatalog;
+}
+
++ (NSString *)catalogPath {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [cachesPath stringByAppendingPathComponent:kPSCLibraryCatalogFileName];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _entries = [NSMutableDictionary new];
+        _catalogQueue = dispatch_queue_create("com.pspdfkit.catalog.libraryCatalogQueue", NULL);
+
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(save) name:UIApplicationDidEnterBackgroundNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    PSPDFDispatchRelease(_catalogQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ entries:%d>", NSStringFromClass([self class]), self.count];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSDictionary *)metadataForFileAtPath:(NSString *)path {
+    struct stat fileStat;
+    if (!path || stat([path fileSystemRepresentation], &fileStat) != 0) return nil;
+    NSNumber *size = @((unsigned long long)fileStat.st_size);
+    NSNumber *modificationDate = @(fileStat.st_mtimespec.tv_sec + fileStat.st_mtimespec.tv_nsec / 1e9);
+    NSString *key = [path stringByAbbreviatingWithTildeInPath];
+
+    __block NSDictionary *metadata = nil;
+    dispatch_sync(_catalogQueue, ^{
+        [self loadIfNeeded];
+        NSDictionary *entry = _entries[key];
+        if ([entry[kPSCLibraryCatalogKeySize] isEqual:size] && [entry[kPSCLibraryCatalogKeyModificationDate] isEqual:modificationDate]) {
+            metadata = entry[kPSCLibraryCatalogKeyMetadata];
+        }
+    });
+    if (metadata) return metadata;
+
+    // probe outside of the queue; multiple scanners can probe in parallel.
+    metadata = [PSCMetadataProbe metadataForFileAtPath:path] ?: @{};
+    dispatch_sync(_catalogQueue, ^{
+        _entries[key] = @{kPSCLibraryCatalogKeySize : size, kPSCLibraryCatalogKeyModificationDate : modificationDate, kPSCLibraryCatalogKeyMetadata : metadata};
+        _dirty = YES;
+    });
+    return metadata;
+}
+
+- (NSString *)titleForFileAtPath:(NSString *)path {
+    NSString *title = [self metadataForFileAtPath:path][kPSPDFMetadataKeyTitle];
+    title = [title stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+    if ([title length] == 0) {
+        title = [path lastPathComponent];
+        if ([[[title pathExtension] lowercaseString] isEqualToString:@"pdf"]) title = [title stringByDeletingPathExtension];
+    }
+    return title;
+}
+
+- (void)removeEntriesExceptForPaths:(NSSet *)paths {
+    NSMutableSet *keys = [NSMutableSet setWithCapacity:[paths count]];
+    for (NSString *path in paths) [keys addObject:[path stringByAbbreviatingWithTildeInPath]];
+
+    dispatch_sync(_catalogQueue, ^{
+        [self loadIfNeeded];
+        for (NSString *key in [_entries allKeys]) {
+            if (![keys containsObject:key]) {
+                [_entries removeObjectForKey:key];
+                _dirty = YES;
+            }
+        }
+    });
+}
+
+- (void)save {
+    dispatch_sync(_catalogQueue, ^{
+        if (!_dirty) return;
+        _dirty = NO;
+
+        NSError *error = nil;
+        NSData *catalogData = [NSPropertyListSerialization dataWithPropertyList:@{@"version" : @(kPSCLibraryCatalogVersion), @"entries" : _entries} format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+        if (!catalogData || ![catalogData writeToFile:[[self class] catalogPath] options:NSDataWritingAtomic error:&error]) {
+            PSCLog(@"Failed to write library catalog: %@", error);
+        }
+    });
+}
+
+- (NSUInteger)count {
+    __block NSUInteger count;
+    dispatch_sync(_catalogQueue, ^{
+        [self loadIfNeeded];
+        count = [_entries count];
+    });
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Needs to be called on _catalogQueue.
+- (void)loadIfNeeded {
+    if (_loaded) return;
+    _loaded = YES;
+
+    NSData *catalogData = [NSData dataWithContentsOfFile:[[self class] catalogPath] options:NSDataReadingMappedIfSafe error:NULL];
+    if (!catalogData) return;
+
+    NSDictionary *catalog = [NSPropertyListSerialization propertyListWithData:catalogData options:NSPropertyListMutableContainers format:NULL error:NULL];
+    if (![catalog isKindOfClass:[NSDictionary class]] || [catalog[@"version"] integerValue] != kPSCLibraryCatalogVersion || ![catalog[@"entries"] isKindOfClass:[NSMutableDictionary class]]) {
+        PSCLog(@"Discarding invalid library catalog.");
+        return;
+    }
+    _entries = catalog[@"entries"];
+}
+
+@end
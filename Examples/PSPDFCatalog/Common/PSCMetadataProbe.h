@@ -0,0 +1,23 @@
+//
+//  PSCMetadataProbe.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Reads the document information of a PDF file without opening it with CoreGraphics.
+
+    PSPDFDocument's metadata and title open the whole document (xref table, page tree) to get a few strings. The probe
+    only reads the tail of the file: startxref, the cross-reference section (tables and streams, following /Prev),
+    the trailer and the Info dictionary. If the Info dictionary has no title or author, dc:title and dc:creator of the
+    catalog's XMP metadata stream are used. Typically a handful of small reads.
+
+    Returns nil for encrypted or damaged files; use PSPDFDocument's metadata then.
+*/
+@interface PSCMetadataProbe : NSObject
+
+/// Metadata using the kPSPDFMetadataKey* keys, values are NSStrings. Empty if the file has no metadata.
++ (NSDictionary *)metadataForFileAtPath:(NSString *)path;
+
+@end
@@ -0,0 +1,736 @@
+//
+//  PSCMetadataProbe.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCMetadataProbe.h"
+#import "PSCByteRangeSource.h"
+#include <zlib.h>
+
+#define kPSCMetadataProbeTailLength 1024            // startxref has to be within the last 1024 bytes
+#define kPSCMetadataProbeChunkLength 4096
+#define kPSCMetadataProbeMaxChunkLength (64 * 1024)
+#define kPSCMetadataProbeMaxSections 32
+#define kPSCMetadataProbeMaxSubsections 4096
+#define kPSCMetadataProbeMaxStreamLength (16 * 1024 * 1024)
+#define kPSCMetadataProbeMaxDepth 32
+#define kPSCMetadataProbeXRefEntryLength 20
+
+typedef struct {
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger position;
+} PSCPDFScanner;
+
+typedef struct {
+    uint8_t type;       // 0 free, 1 uncompressed (offset), 2 compressed (object stream, index)
+    uint64_t field2;
+    uint64_t field3;
+} PSCPDFXRefEntry;
+
+// Indirect object reference ("12 0 R"). Strings are parsed as NSData, names as NSString.
+@interface PSCPDFReference : NSObject
+@property(nonatomic, assign) uint64_t objectNumber;
+@end
+
+@implementation PSCPDFReference
+@end
+
+// One cross-reference section; either a table (subsections point into the file) or a decoded stream.
+@interface PSCPDFXRefSection : NSObject
+@property(nonatomic, strong) NSMutableData *subsections; // PSCPDFXRefSubsection
+@property(nonatomic, strong) NSData *streamEntries;      // nil for tables
+@property(nonatomic, assign, readonly) NSUInteger *widths; // type, field 2, field 3 (streams only)
+@end
+
+typedef struct {
+    uint64_t first;
+    uint64_t count;
+    uint64_t start; // file offset of the first entry (tables) or first row (streams)
+} PSCPDFXRefSubsection;
+
+@implementation PSCPDFXRefSection {
+    NSUInteger _fieldWidths[3];
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _subsections = [NSMutableData new];
+    }
+    return self;
+}
+
+- (NSUInteger *)widths {
+    return _fieldWidths;
+}
+
+- (void)addSubsectionWithFirst:(uint64_t)first count:(uint64_t)count start:(uint64_t)start {
+    PSCPDFXRefSubsection subsection = {first, count, start};
+    [_subsections appendBytes:&subsection length:sizeof(subsection)];
+}
+
+- (const PSCPDFXRefSubsection *)subsectionForObjectNumber:(uint64_t)objectNumber {
+    const PSCPDFXRefSubsection *subsections = [_subsections bytes];
+    for (NSUInteger idx = 0; idx < [_subsections length] / sizeof(PSCPDFXRefSubsection); idx++) {
+        if (objectNumber >= subsections[idx].first && objectNumber < subsections[idx].first + subsections[idx].count) return &subsections[idx];
+    }
+    return NULL;
+}
+
+@end
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Parsing
+
+static BOOL PSCIsWhitespace(uint8_t c) {
+    return c == 0 || c == '\t' || c == '\n' || c == '\f' || c == '\r' || c == ' ';
+}
+
+static BOOL PSCIsDelimiter(uint8_t c) {
+    return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' || c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+static void PSCSkipWhitespace(PSCPDFScanner *scanner) {
+    while (scanner->position < scanner->length) {
+        uint8_t c = scanner->bytes[scanner->position];
+        if (c == '%') {
+            while (scanner->position < scanner->length && scanner->bytes[scanner->position] != '\n' && scanner->bytes[scanner->position] != '\r') scanner->position++;
+        }else if (PSCIsWhitespace(c)) {
+            scanner->position++;
+        }else {
+            break;
+        }
+    }
+}
+
+static BOOL PSCScanKeyword(PSCPDFScanner *scanner, const char *keyword) {
+    PSCSkipWhitespace(scanner);
+    size_t length = strlen(keyword);
+    if (scanner->position + length > scanner->length || memcmp(scanner->bytes + scanner->position, keyword, length) != 0) return NO;
+    NSUInteger end = scanner->position + length;
+    if (end < scanner->length && !PSCIsWhitespace(scanner->bytes[end]) && !PSCIsDelimiter(scanner->bytes[end])) return NO;
+    scanner->position = end;
+    return YES;
+}
+
+// Integers only; fails for reals.
+static BOOL PSCScanInteger(PSCPDFScanner *scanner, long long *value) {
+    PSCSkipWhitespace(scanner);
+    NSUInteger position = scanner->position;
+    BOOL negative = NO;
+    if (position < scanner->length && (scanner->bytes[position] == '-' || scanner->bytes[position] == '+')) {
+        negative = scanner->bytes[position] == '-';
+        position++;
+    }
+    NSUInteger digitsStart = position;
+    long long result = 0;
+    while (position < scanner->length && isdigit(scanner->bytes[position]) && position - digitsStart < 18) {
+        result = result * 10 + (scanner->bytes[position] - '0');
+        position++;
+    }
+    if (position == digitsStart || (position < scanner->length && scanner->bytes[position] == '.')) return NO;
+    scanner->position = position;
+    *value = negative ? -result : result;
+    return YES;
+}
+
+static NSString *PSCParseName(PSCPDFScanner *scanner) {
+    NSUInteger start = ++scanner->position;
+    while (scanner->position < scanner->length && !PSCIsWhitespace(scanner->bytes[scanner->position]) && !PSCIsDelimiter(scanner->bytes[scanner->position])) scanner->position++;
+    return [[NSString alloc] initWithBytes:scanner->bytes + start length:scanner->position - start encoding:NSISOLatin1StringEncoding];
+}
+
+static NSData *PSCParseLiteralString(PSCPDFScanner *scanner) {
+    const uint8_t *bytes = scanner->bytes;
+    NSMutableData *string = [NSMutableData data];
+    NSUInteger nesting = 1;
+    scanner->position++;
+    while (scanner->position < scanner->length) {
+        uint8_t c = bytes[scanner->position++];
+        if (c == '\\') {
+            if (scanner->position >= scanner->length) return nil;
+            c = bytes[scanner->position++];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case '\r': // line continuation
+                    if (scanner->position < scanner->length && bytes[scanner->position] == '\n') scanner->position++;
+                    continue;
+                case '\n':
+                    continue;
+                default:
+                    if (c >= '0' && c <= '7') {
+                        NSUInteger octal = c - '0';
+                        for (NSUInteger idx = 0; idx < 2 && scanner->position < scanner->length && bytes[scanner->position] >= '0' && bytes[scanner->position] <= '7'; idx++) {
+                            octal = octal * 8 + (bytes[scanner->position++] - '0');
+                        }
+                        c = (uint8_t)octal;
+                    }
+                    break; // \( \) \\ and unknown escapes are the character itself
+            }
+        }else if (c == '(') {
+            nesting++;
+        }else if (c == ')') {
+            if (--nesting == 0) return string;
+        }
+        [string appendBytes:&c length:1];
+    }
+    return nil;
+}
+
+static NSData *PSCParseHexString(PSCPDFScanner *scanner) {
+    NSMutableData *string = [NSMutableData data];
+    int high = -1;
+    scanner->position++;
+    while (scanner->position < scanner->length) {
+        uint8_t c = scanner->bytes[scanner->position++];
+        int nibble;
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else if (PSCIsWhitespace(c)) continue;
+        else if (c == '>') {
+            if (high >= 0) {
+                uint8_t byte = (uint8_t)(high << 4); // odd number of digits: last one is followed by 0
+                [string appendBytes:&byte length:1];
+            }
+            return string;
+        }else return nil;
+
+        if (high < 0) {
+            high = nibble;
+        }else {
+            uint8_t byte = (uint8_t)((high << 4) | nibble);
+            [string appendBytes:&byte length:1];
+            high = -1;
+        }
+    }
+    return nil;
+}
+
+static id PSCParseNumberOrReference(PSCPDFScanner *scanner) {
+    NSUInteger start = scanner->position;
+    long long number, generation;
+    if (PSCScanInteger(scanner, &number)) {
+        NSUInteger afterNumber = scanner->position;
+        if (number >= 0 && PSCScanInteger(scanner, &generation) && generation >= 0 && PSCScanKeyword(scanner, "R")) {
+            PSCPDFReference *reference = [PSCPDFReference new];
+            reference.objectNumber = (uint64_t)number;
+            return reference;
+        }
+        scanner->position = afterNumber;
+        return @(number);
+    }
+
+    scanner->position = start;
+    char buffer[32];
+    NSUInteger length = 0;
+    while (scanner->position < scanner->length && length < sizeof(buffer) - 1) {
+        uint8_t c = scanner->bytes[scanner->position];
+        if (!isdigit(c) && c != '.' && c != '-' && c != '+') break;
+        buffer[length++] = (char)c;
+        scanner->position++;
+    }
+    if (length == 0) return nil;
+    buffer[length] = '\0';
+    return @(strtod(buffer, NULL));
+}
+
+static id PSCParseObject(PSCPDFScanner *scanner, NSUInteger depth);
+
+static NSDictionary *PSCParseDictionary(PSCPDFScanner *scanner, NSUInteger depth) {
+    scanner->position += 2;
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+    while (YES) {
+        PSCSkipWhitespace(scanner);
+        if (scanner->position + 1 >= scanner->length) return nil;
+        if (scanner->bytes[scanner->position] == '>' && scanner->bytes[scanner->position + 1] == '>') {
+            scanner->position += 2;
+            return dictionary;
+        }
+        if (scanner->bytes[scanner->position] != '/') return nil;
+        NSString *key = PSCParseName(scanner);
+        id value = PSCParseObject(scanner, depth + 1);
+        if (!key || !value) return nil;
+        dictionary[key] = value;
+    }
+}
+
+static id PSCParseObject(PSCPDFScanner *scanner, NSUInteger depth) {
+    if (depth > kPSCMetadataProbeMaxDepth) return nil;
+    PSCSkipWhitespace(scanner);
+    if (scanner->position >= scanner->length) return nil;
+
+    uint8_t c = scanner->bytes[scanner->position];
+    if (c == '/') return PSCParseName(scanner);
+    if (c == '(') return PSCParseLiteralString(scanner);
+    if (c == '<') {
+        if (scanner->position + 1 < scanner->length && scanner->bytes[scanner->position + 1] == '<') return PSCParseDictionary(scanner, depth);
+        return PSCParseHexString(scanner);
+    }
+    if (c == '[') {
+        scanner->position++;
+        NSMutableArray *array = [NSMutableArray array];
+        while (YES) {
+            PSCSkipWhitespace(scanner);
+            if (scanner->position >= scanner->length) return nil;
+            if (scanner->bytes[scanner->position] == ']') {
+                scanner->position++;
+                return array;
+            }
+            id object = PSCParseObject(scanner, depth + 1);
+            if (!object) return nil;
+            [array addObject:object];
+        }
+    }
+    if (isdigit(c) || c == '-' || c == '+' || c == '.') return PSCParseNumberOrReference(scanner);
+    if (PSCScanKeyword(scanner, "true")) return @YES;
+    if (PSCScanKeyword(scanner, "false")) return @NO;
+    if (PSCScanKeyword(scanner, "null")) return [NSNull null];
+    return nil;
+}
+
+static NSUInteger PSCFindLast(NSData *data, const char *needle) {
+    size_t needleLength = strlen(needle);
+    const uint8_t *bytes = [data bytes];
+    if ([data length] < needleLength) return NSNotFound;
+    for (NSUInteger idx = [data length] - needleLength + 1; idx > 0; idx--) {
+        if (memcmp(bytes + idx - 1, needle, needleLength) == 0) return idx - 1;
+    }
+    return NSNotFound;
+}
+
+// Text strings are UTF-16BE with BOM or PDFDocEncoding, which matches Latin-1 for all printable characters.
+static NSString *PSCTextStringFromData(NSData *data) {
+    const uint8_t *bytes = [data bytes];
+    if ([data length] >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+        return [[NSString alloc] initWithData:[data subdataWithRange:NSMakeRange(2, [data length] - 2)] encoding:NSUTF16BigEndianStringEncoding];
+    }
+    if ([data length] >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) {
+        return [[NSString alloc] initWithData:[data subdataWithRange:NSMakeRange(3, [data length] - 3)] encoding:NSUTF8StringEncoding];
+    }
+    return [[NSString alloc] initWithData:data encoding:NSISOLatin1StringEncoding];
+}
+
+static NSData *PSCInflate(NSData *data) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) return nil;
+
+    NSMutableData *output = [NSMutableData dataWithLength:MAX([data length] * 4, 1024)];
+    stream.next_in = (Bytef *)[data bytes];
+    stream.avail_in = (uInt)[data length];
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (stream.total_out >= [output length]) {
+            if ([output length] >= kPSCMetadataProbeMaxStreamLength) break;
+            [output increaseLengthBy:[output length]];
+        }
+        stream.next_out = (Bytef *)[output mutableBytes] + stream.total_out;
+        stream.avail_out = (uInt)([output length] - stream.total_out);
+        status = inflate(&stream, Z_SYNC_FLUSH);
+    }
+    inflateEnd(&stream);
+
+    // some writers omit the end of the zlib stream; accept it if all input was used.
+    if (status != Z_STREAM_END && !(status == Z_BUF_ERROR && stream.avail_in == 0)) return nil;
+    [output setLength:stream.total_out];
+    return output;
+}
+
+static NSData *PSCUndoPNGPredictor(NSData *data, NSUInteger rowLength, NSUInteger bytesPerPixel) {
+    NSUInteger stride = rowLength + 1, rowCount = [data length] / stride;
+    NSMutableData *output = [NSMutableData dataWithLength:rowCount * rowLength];
+    const uint8_t *input = [data bytes];
+    uint8_t *rows = [output mutableBytes];
+
+    for (NSUInteger row = 0; row < rowCount; row++) {
+        uint8_t filterType = input[row * stride];
+        const uint8_t *source = input + row * stride + 1;
+        uint8_t *destination = rows + row * rowLength;
+        const uint8_t *previous = row > 0 ? destination - rowLength : NULL;
+        for (NSUInteger idx = 0; idx < rowLength; idx++) {
+            int left = idx >= bytesPerPixel ? destination[idx - bytesPerPixel] : 0;
+            int up = previous ? previous[idx] : 0;
+            int upLeft = previous && idx >= bytesPerPixel ? previous[idx - bytesPerPixel] : 0;
+            switch (filterType) {
+                case 0: destination[idx] = source[idx]; break;
+                case 1: destination[idx] = (uint8_t)(source[idx] + left); break;
+                case 2: destination[idx] = (uint8_t)(source[idx] + up); break;
+                case 3: destination[idx] = (uint8_t)(source[idx] + (left + up) / 2); break;
+                case 4: {
+                    int estimate = left + up - upLeft;
+                    int distanceLeft = abs(estimate - left), distanceUp = abs(estimate - up), distanceUpLeft = abs(estimate - upLeft);
+                    int predictor = distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft ? left : (distanceUp <= distanceUpLeft ? up : upLeft);
+                    destination[idx] = (uint8_t)(source[idx] + predictor);
+                }break;
+                default: return nil;
+            }
+        }
+    }
+    return output;
+}
+
+// Reads the first text of element (<dc:title><rdf:Alt><rdf:li xml:lang="x-default">Title</rdf:li>...).
+static NSString *PSCXMPValue(NSString *xmp, NSString *element) {
+    NSRange elementRange = [xmp rangeOfString:[NSString stringWithFormat:@"<%@>", element]];
+    if (elementRange.location == NSNotFound) elementRange = [xmp rangeOfString:[NSString stringWithFormat:@"<%@ ", element]];
+    if (elementRange.location == NSNotFound) return nil;
+
+    NSUInteger contentStart = NSMaxRange(elementRange);
+    NSRange endRange = [xmp rangeOfString:[NSString stringWithFormat:@"</%@>", element] options:0 range:NSMakeRange(contentStart, [xmp length] - contentStart)];
+    if (endRange.location == NSNotFound) return nil;
+    NSString *content = [xmp substringWithRange:NSMakeRange(contentStart, endRange.location - contentStart)];
+    if ([[xmp substringWithRange:elementRange] hasSuffix:@" "]) {
+        NSRange tagEnd = [content rangeOfString:@">"];
+        if (tagEnd.location == NSNotFound) return nil;
+        content = [content substringFromIndex:NSMaxRange(tagEnd)];
+    }
+
+    NSRange itemRange = [content rangeOfString:@"<rdf:li"];
+    if (itemRange.location != NSNotFound) {
+        NSRange tagEnd = [content rangeOfString:@">" options:0 range:NSMakeRange(NSMaxRange(itemRange), [content length] - NSMaxRange(itemRange))];
+        NSRange itemEnd = [content rangeOfString:@"</rdf:li>"];
+        if (tagEnd.location == NSNotFound || itemEnd.location == NSNotFound || itemEnd.location < NSMaxRange(tagEnd)) return nil;
+        content = [content substringWithRange:NSMakeRange(NSMaxRange(tagEnd), itemEnd.location - NSMaxRange(tagEnd))];
+    }
+
+    NSMutableString *value = [[content stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]] mutableCopy];
+    NSDictionary *entities = @{@"&lt;" : @"<", @"&gt;" : @">", @"&quot;" : @"\"", @"&apos;" : @"'", @"&amp;" : @"&"}; // &amp; last
+    for (NSString *entity in @[@"&lt;", @"&gt;", @"&quot;", @"&apos;", @"&amp;"]) {
+        [value replaceOccurrencesOfString:entity withString:entities[entity] options:0 range:NSMakeRange(0, [value length])];
+    }
+    return [value length] && [value rangeOfString:@"<"].location == NSNotFound ? value : nil;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSCPDFTailReader
+
+// Resolves objects through the cross-reference sections, reading only the bytes it needs.
+@interface PSCPDFTailReader : NSObject {
+    PSCByteRangeSource *_source;
+    NSMutableArray *_sections;              // newest first
+    NSMutableDictionary *_objectStreams;    // object number -> @[data, first]
+    NSUInteger _resolveDepth;
+}
+- (id)initWithSource:(PSCByteRangeSource *)source;
+- (BOOL)readCrossReferences;
+- (id)resolve:(id)object;
+- (id)objectForNumber:(uint64_t)objectNumber streamData:(NSData **)streamData;
+@property(nonatomic, strong, readonly) NSDictionary *trailer;
+@end
+
+@implementation PSCPDFTailReader
+
+- (id)initWithSource:(PSCByteRangeSource *)source {
+    if ((self = [super init])) {
+        _source = source;
+        _sections = [NSMutableArray new];
+        _objectStreams = [NSMutableDictionary new];
+    }
+    return self;
+}
+
+- (NSData *)dataAtOffset:(uint64_t)offset length:(NSUInteger)length {
+    if (offset >= _source.length) return [NSData data];
+    length = (NSUInteger)MIN((uint64_t)length, _source.length - offset);
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    [data setLength:[_source getBytes:[data mutableBytes] range:NSMakeRange((NSUInteger)offset, length)]];
+    return data;
+}
+
+- (BOOL)readCrossReferences {
+    size_t fileLength = _source.length;
+    NSUInteger tailLength = MIN(fileLength, kPSCMetadataProbeTailLength);
+    NSData *tail = [self dataAtOffset:fileLength - tailLength length:tailLength];
+    NSUInteger startxrefPosition = PSCFindLast(tail, "startxref");
+    if (startxrefPosition == NSNotFound) return NO;
+
+    PSCPDFScanner scanner = {[tail bytes], [tail length], startxrefPosition + strlen("startxref")};
+    long long offset;
+    if (!PSCScanInteger(&scanner, &offset)) return NO;
+
+    // newest section first, then /XRefStm of hybrid files, then /Prev.
+    NSMutableSet *visitedOffsets = [NSMutableSet set];
+    while (offset >= 0 && (uint64_t)offset < fileLength && [_sections count] < kPSCMetadataProbeMaxSections && ![visitedOffsets containsObject:@(offset)]) {
+        [visitedOffsets addObject:@(offset)];
+        NSDictionary *trailer = nil;
+        PSCPDFXRefSection *section = [self sectionAtOffset:(uint64_t)offset trailer:&trailer];
+        if (!section) break;
+        [_sections addObject:section];
+        if (!_trailer) _trailer = trailer;
+
+        id xrefStreamOffset = trailer[@"XRefStm"];
+        if ([xrefStreamOffset isKindOfClass:[NSNumber class]]) {
+            PSCPDFXRefSection *streamSection = [self sectionAtOffset:[xrefStreamOffset unsignedLongLongValue] trailer:NULL];
+            if (streamSection) [_sections addObject:streamSection];
+        }
+
+        id previousOffset = trailer[@"Prev"];
+        if (![previousOffset isKindOfClass:[NSNumber class]]) break;
+        offset = [previousOffset longLongValue];
+    }
+    return _trailer != nil;
+}
+
+- (PSCPDFXRefSection *)sectionAtOffset:(uint64_t)offset trailer:(NSDictionary **)trailer {
+    NSData *header = [self dataAtOffset:offset length:64];
+    PSCPDFScanner scanner = {[header bytes], [header length], 0};
+    if (PSCScanKeyword(&scanner, "xref")) {
+        return [self tableSectionAtOffset:offset + scanner.position trailer:trailer];
+    }
+    return [self streamSectionAtOffset:offset trailer:trailer];
+}
+
+// Classic table: "first count" lines, each followed by count entries of 20 bytes, then "trailer".
+- (PSCPDFXRefSection *)tableSectionAtOffset:(uint64_t)position trailer:(NSDictionary **)trailer {
+    PSCPDFXRefSection *section = [PSCPDFXRefSection new];
+    for (NSUInteger subsection = 0; subsection < kPSCMetadataProbeMaxSubsections; subsection++) {
+        NSData *header = [self dataAtOffset:position length:64];
+        PSCPDFScanner scanner = {[header bytes], [header length], 0};
+        if (PSCScanKeyword(&scanner, "trailer")) {
+            id trailerDictionary = [self objectAtOffset:position + scanner.position objectHeader:NO streamData:NULL];
+            if (![trailerDictionary isKindOfClass:[NSDictionary class]]) return nil;
+            if (trailer) *trailer = trailerDictionary;
+            return section;
+        }
+
+        long long first, count;
+        if (!PSCScanInteger(&scanner, &first) || !PSCScanInteger(&scanner, &count) || first < 0 || count < 0) return nil;
+        PSCSkipWhitespace(&scanner);
+        [section addSubsectionWithFirst:(uint64_t)first count:(uint64_t)count start:position + scanner.position];
+        position += scanner.position + (uint64_t)count * kPSCMetadataProbeXRefEntryLength;
+    }
+    return nil;
+}
+
+// Cross-reference stream (PDF 1.5): rows of /W field widths for the ranges in /Index.
+- (PSCPDFXRefSection *)streamSectionAtOffset:(uint64_t)offset trailer:(NSDictionary **)trailer {
+    NSData *streamData = nil;
+    NSDictionary *dictionary = [self objectAtOffset:offset objectHeader:YES streamData:&streamData];
+    if (![dictionary isKindOfClass:[NSDictionary class]] || ![dictionary[@"Type"] isEqual:@"XRef"] || !streamData) return nil;
+
+    NSArray *widths = dictionary[@"W"];
+    if (![widths isKindOfClass:[NSArray class]] || [widths count] != 3) return nil;
+    PSCPDFXRefSection *section = [PSCPDFXRefSection new];
+    for (NSUInteger idx = 0; idx < 3; idx++) {
+        if (![widths[idx] isKindOfClass:[NSNumber class]] || [widths[idx] integerValue] < 0 || [widths[idx] integerValue] > 8) return nil;
+        section.widths[idx] = [widths[idx] unsignedIntegerValue];
+    }
+    section.streamEntries = streamData;
+
+    NSArray *index = dictionary[@"Index"] ?: @[@0, dictionary[@"Size"] ?: @0];
+    if (![index isKindOfClass:[NSArray class]]) return nil;
+    uint64_t row = 0;
+    for (NSUInteger idx = 0; idx + 1 < [index count]; idx += 2) {
+        if (![index[idx] isKindOfClass:[NSNumber class]] || ![index[idx + 1] isKindOfClass:[NSNumber class]]) return nil;
+        uint64_t count = [index[idx + 1] unsignedLongLongValue];
+        [section addSubsectionWithFirst:[index[idx] unsignedLongLongValue] count:count start:row];
+        row += count;
+    }
+    if (trailer) *trailer = dictionary;
+    return section;
+}
+
+- (BOOL)getEntry:(PSCPDFXRefEntry *)entry forObjectNumber:(uint64_t)objectNumber inSection:(PSCPDFXRefSection *)section {
+    const PSCPDFXRefSubsection *subsection = [section subsectionForObjectNumber:objectNumber];
+    if (!subsection) return NO;
+
+    if (!section.streamEntries) {
+        NSData *entryData = [self dataAtOffset:subsection->start + (objectNumber - subsection->first) * kPSCMetadataProbeXRefEntryLength length:kPSCMetadataProbeXRefEntryLength];
+        PSCPDFScanner scanner = {[entryData bytes], [entryData length], 0};
+        long long entryOffset, generation;
+        if (!PSCScanInteger(&scanner, &entryOffset) || !PSCScanInteger(&scanner, &generation)) return NO;
+        PSCSkipWhitespace(&scanner);
+        if (scanner.position >= scanner.length) return NO;
+        *entry = (PSCPDFXRefEntry){scanner.bytes[scanner.position] == 'n' ? 1 : 0, (uint64_t)entryOffset, (uint64_t)generation};
+        return YES;
+    }
+
+    NSUInteger *widths = section.widths;
+    NSUInteger rowLength = widths[0] + widths[1] + widths[2];
+    uint64_t rowOffset = (subsection->start + objectNumber - subsection->first) * rowLength;
+    if (rowLength == 0 || rowOffset + rowLength > [section.streamEntries length]) return NO;
+
+    const uint8_t *row = (const uint8_t *)[section.streamEntries bytes] + rowOffset;
+    uint64_t fields[3] = {1, 0, 0}; // type defaults to 1 if its width is 0
+    for (NSUInteger field = 0; field < 3; field++) {
+        if (widths[field] == 0) continue;
+        fields[field] = 0;
+        for (NSUInteger idx = 0; idx < widths[field]; idx++) fields[field] = (fields[field] << 8) | *row++;
+    }
+    *entry = (PSCPDFXRefEntry){(uint8_t)MIN(fields[0], 3), fields[1], fields[2]};
+    return YES;
+}
+
+// Parses one object at offset; reads a bigger chunk if the object is cut off.
+- (id)objectAtOffset:(uint64_t)offset objectHeader:(BOOL)objectHeader streamData:(NSData **)streamData {
+    for (NSUInteger chunkLength = kPSCMetadataProbeChunkLength; ; chunkLength *= 4) {
+        NSData *chunk = [self dataAtOffset:offset length:chunkLength];
+        BOOL truncated = [chunk length] == chunkLength && chunkLength < kPSCMetadataProbeMaxChunkLength;
+        PSCPDFScanner scanner = {[chunk bytes], [chunk length], 0};
+        long long objectNumber, generation;
+        id object = nil;
+        if (!objectHeader || (PSCScanInteger(&scanner, &objectNumber) && PSCScanInteger(&scanner, &generation) && PSCScanKeyword(&scanner, "obj"))) {
+            object = PSCParseObject(&scanner, 0);
+        }
+        if (!object) {
+            if (truncated) continue;
+            return nil;
+        }
+
+        if (streamData) {
+            *streamData = nil;
+            if ([object isKindOfClass:[NSDictionary class]]) {
+                if (!PSCScanKeyword(&scanner, "stream")) {
+                    if (truncated) continue;
+                    return object;
+                }
+                // the keyword is followed by CRLF or LF.
+                if (scanner.position < scanner.length && scanner.bytes[scanner.position] == '\r') scanner.position++;
+                if (scanner.position < scanner.length && scanner.bytes[scanner.position] == '\n') scanner.position++;
+                *streamData = [self streamDataForDictionary:object atOffset:offset + scanner.position];
+            }
+        }
+        return object;
+    }
+}
+
+- (NSData *)streamDataForDictionary:(NSDictionary *)dictionary atOffset:(uint64_t)offset {
+    id length = [self resolve:dictionary[@"Length"]];
+    if (![length isKindOfClass:[NSNumber class]] || [length longLongValue] < 0 || [length longLongValue] > kPSCMetadataProbeMaxStreamLength) return nil;
+    NSData *data = [self dataAtOffset:offset length:[length unsignedIntegerValue]];
+
+    id filter = [self resolve:dictionary[@"Filter"]];
+    NSArray *filters = filter ? ([filter isKindOfClass:[NSArray class]] ? filter : @[filter]) : @[];
+    if ([filters count] == 0) return data;
+    if ([filters count] > 1 || ![filters[0] isEqual:@"FlateDecode"]) return nil; // not needed for xref, object and metadata streams
+
+    data = PSCInflate(data);
+    id parameters = [self resolve:dictionary[@"DecodeParms"]];
+    if ([parameters isKindOfClass:[NSArray class]]) parameters = [parameters count] ? parameters[0] : nil;
+    NSInteger predictor = [parameters isKindOfClass:[NSDictionary class]] ? [parameters[@"Predictor"] integerValue] : 1;
+    if (!data || predictor <= 1) return data;
+    if (predictor < 10) return nil; // TIFF predictor
+
+    NSUInteger columns = [parameters[@"Columns"] unsignedIntegerValue] ?: 1;
+    NSUInteger colors = [parameters[@"Colors"] unsignedIntegerValue] ?: 1;
+    NSUInteger bitsPerComponent = [parameters[@"BitsPerComponent"] unsignedIntegerValue] ?: 8;
+    return PSCUndoPNGPredictor(data, (columns * colors * bitsPerComponent + 7) / 8, MAX(colors * bitsPerComponent / 8, 1U));
+}
+
+- (id)objectForNumber:(uint64_t)objectNumber streamData:(NSData **)streamData {
+    if (streamData) *streamData = nil;
+    if (_resolveDepth > kPSCMetadataProbeMaxDepth) return nil;
+
+    PSCPDFXRefEntry entry = {0, 0, 0};
+    for (PSCPDFXRefSection *section in _sections) {
+        if ([self getEntry:&entry forObjectNumber:objectNumber inSection:section]) break;
+    }
+
+    id object = nil;
+    _resolveDepth++;
+    if (entry.type == 1) {
+        object = [self objectAtOffset:entry.field2 objectHeader:YES streamData:streamData];
+    }else if (entry.type == 2) {
+        object = [self objectWithIndex:(NSUInteger)entry.field3 inObjectStream:entry.field2];
+    }
+    _resolveDepth--;
+    return object;
+}
+
+// Object streams start with pairs of object number and offset (relative to /First).
+- (id)objectWithIndex:(NSUInteger)index inObjectStream:(uint64_t)streamNumber {
+    NSArray *objectStream = _objectStreams[@(streamNumber)];
+    if (!objectStream) {
+        NSData *streamData = nil;
+        NSDictionary *dictionary = [self objectForNumber:streamNumber streamData:&streamData];
+        if (![dictionary isKindOfClass:[NSDictionary class]] || ![dictionary[@"Type"] isEqual:@"ObjStm"] || !streamData || ![dictionary[@"First"] isKindOfClass:[NSNumber class]]) return nil;
+        objectStream = @[streamData, dictionary[@"First"]];
+        _objectStreams[@(streamNumber)] = objectStream;
+    }
+
+    NSData *data = objectStream[0];
+    PSCPDFScanner scanner = {[data bytes], [data length], 0};
+    long long objectNumber, objectOffset = -1;
+    for (NSUInteger idx = 0; idx <= index; idx++) {
+        if (!PSCScanInteger(&scanner, &objectNumber) || !PSCScanInteger(&scanner, &objectOffset)) return nil;
+    }
+    uint64_t position = [objectStream[1] unsignedLongLongValue] + (uint64_t)objectOffset;
+    if (objectOffset < 0 || position >= [data length]) return nil;
+    scanner.position = (NSUInteger)position;
+    return PSCParseObject(&scanner, 0);
+}
+
+- (id)resolve:(id)object {
+    for (NSUInteger depth = 0; [object isKindOfClass:[PSCPDFReference class]] && depth < 8; depth++) {
+        object = [self objectForNumber:[object objectNumber] streamData:NULL];
+    }
+    return [object isKindOfClass:[PSCPDFReference class]] ? nil : object;
+}
+
+@end
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSCMetadataProbe
+
+@implementation PSCMetadataProbe
+
++ (NSDictionary *)metadataKeys {
+    static dispatch_once_t pred = 0;
+    __strong static NSDictionary *_metadataKeys = nil;
+    dispatch_once(&pred, ^{
+        _metadataKeys = @{@"Title" : kPSPDFMetadataKeyTitle, @"Author" : kPSPDFMetadataKeyAuthor, @"Subject" : kPSPDFMetadataKeySubject,
+                          @"Keywords" : kPSPDFMetadataKeyKeywords, @"Creator" : kPSPDFMetadataKeyCreator, @"Producer" : kPSPDFMetadataKeyProducer,
+                          @"CreationDate" : kPSPDFMetadataKeyCreationDate, @"ModDate" : kPSPDFMetadataKeyModDate, @"Trapped" : kPSPDFMetadataKeyTrapped};
+    });
+    return _metadataKeys;
+}
+
++ (NSDictionary *)metadataForFileAtPath:(NSString *)path {
+    if (!path) return nil;
+    PSCByteRangeSource *source = [PSCByteRangeSource sourceWithFileURL:[NSURL fileURLWithPath:path]];
+    if (source.length < 32) return nil;
+
+    PSCPDFTailReader *reader = [[PSCPDFTailReader alloc] initWithSource:source];
+    if (![reader readCrossReferences]) return nil;
+    if (reader.trailer[@"Encrypt"]) return nil; // strings are encrypted
+
+    NSMutableDictionary *metadata = [NSMutableDictionary dictionary];
+    NSDictionary *metadataKeys = [self metadataKeys];
+    NSDictionary *info = [reader resolve:reader.trailer[@"Info"]];
+    if ([info isKindOfClass:[NSDictionary class]]) {
+        [info enumerateKeysAndObjectsUsingBlock:^(NSString *key, id value, BOOL *stop) {
+            NSString *metadataKey = metadataKeys[key];
+            if (!metadataKey) return;
+            value = [reader resolve:value];
+            NSString *string = nil;
+            if ([value isKindOfClass:[NSData class]]) string = PSCTextStringFromData(value);
+            else if ([value isKindOfClass:[NSString class]]) string = value; // Trapped is a name
+            if ([string length]) metadata[metadataKey] = string;
+        }];
+    }
+
+    // fall back to XMP (the metadata stream is usually uncompressed)
+    if (!metadata[kPSPDFMetadataKeyTitle] || !metadata[kPSPDFMetadataKeyAuthor]) {
+        NSDictionary *catalog = [reader resolve:reader.trailer[@"Root"]];
+        id metadataReference = [catalog isKindOfClass:[NSDictionary class]] ? catalog[@"Metadata"] : nil;
+        if ([metadataReference isKindOfClass:[PSCPDFReference class]]) {
+            NSData *xmpData = nil;
+            [reader objectForNumber:[metadataReference objectNumber] streamData:&xmpData];
+            NSString *xmp = xmpData ? [[NSString alloc] initWithData:xmpData encoding:NSUTF8StringEncoding] : nil;
+            if (xmp) {
+                if (!metadata[kPSPDFMetadataKeyTitle]) [metadata setValue:PSCXMPValue(xmp, @"dc:title") forKey:kPSPDFMetadataKeyTitle];
+                if (!metadata[kPSPDFMetadataKeyAuthor]) [metadata setValue:PSCXMPValue(xmp, @"dc:creator") forKey:kPSPDFMetadataKeyAuthor];
+            }
+        }
+    }
+    return metadata;
+}
+
+@end
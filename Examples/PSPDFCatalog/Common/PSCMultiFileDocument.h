@@ -0,0 +1,44 @@
+//
+//  PSCMultiFileDocument.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Document for many files that loads the page counts concurrently.
+
+    For a document with files, pageCount, fileIndexForPage: and compensatedPageForPage: need the page count of every file,
+    which opens the files one after another. This subclass opens them in parallel (at most maxConcurrentLoads at a time,
+    in file order) and builds a prefix-sum page table. Page lookups are a binary search, so the first page can be
+    displayed while later files are still loading.
+
+    Nothing waits on the main thread: pageCount and lookups there use the average page count of the loaded files for
+    files that are still loading, and kPSCMultiFileDocumentPageCountChangedNotification is posted (on the main thread)
+    whenever a file finishes. Reload the view when you receive it. Lookups on other threads wait for the real counts.
+
+    Until isPageTableLoaded, the mapping of pages to files is provisional on the main thread: pages after the loaded
+    files are placed by estimate, so a page index (and pageCount) can move to a different file or page when the real
+    counts arrive. Don't persist page indexes (e.g. as bookmarks or last viewed page) before that.
+
+    The file list (filesWithBasePath) is resolved once when loading starts and kept with the page table; clearCache
+    resolves it again.
+*/
+
+// Posted on the main thread with the document as object when the page count of a file is known.
+#define kPSCMultiFileDocumentPageCountChangedNotification @"kPSCMultiFileDocumentPageCountChangedNotification"
+
+// userInfo key of kPSCMultiFileDocumentPageCountChangedNotification, NSNumber with the file index.
+#define kPSCMultiFileDocumentFileIndexKey @"fileIndex"
+@interface PSCMultiFileDocument : PSPDFDocument
+
+/// Starts loading the page counts. Called automatically on first access.
+- (void)loadPageTable;
+
+/// Maximum number of files that are opened at the same time. Defaults to 4.
+@property(nonatomic, assign) NSUInteger maxConcurrentLoads;
+
+/// YES once the page count of all files is known.
+@property(nonatomic, assign, readonly, getter=isPageTableLoaded) BOOL pageTableLoaded;
+
+@end
@@ -0,0 +1,242 @@
+//
+//  PSCMultiFileDocument.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCMultiFileDocument.h"
+
+#define kPSCMultiFileDocumentDefaultMaxConcurrentLoads 4
+
+@interface PSCMultiFileDocument () {
+    NSCondition *_pageTableCondition;
+    NSArray *_fileURLs;        // filesWithBasePath, resolved once per page table
+    NSUInteger _fileCount;
+    NSUInteger *_pageCounts;   // NSNotFound while loading
+    NSUInteger *_pageOffsets;  // prefix sums, _fileCount + 1 entries; valid up to _loadedPrefixCount
+    NSUInteger _loadedPrefixCount;
+    NSUInteger _loadedFileCount, _loadedPageSum; // all loaded files, used for estimates
+    NSUInteger _nextFileIndex; // next file to start loading
+    NSUInteger _generation;    // bumped when the files change, stale loads are ignored
+    BOOL _loadingStarted;
+}
+@end
+
+@implementation PSCMultiFileDocument
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithBaseURL:(NSURL *)basePath files:(NSArray *)files {
+    if ((self = [super initWithBaseURL:basePath files:files])) {
+        _pageTableCondition = [NSCondition new];
+        _maxConcurrentLoads = kPSCMultiFileDocumentDefaultMaxConcurrentLoads;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_pageCounts);
+    free(_pageOffsets);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDocument
+
+- (NSUInteger)pageCount {
+    if (![self waitForPageTable]) return [super pageCount];
+
+    // never waits; files that are still loading are estimated.
+    [_pageTableCondition lock];
+    NSUInteger pageCount = _pageOffsets[_loadedPrefixCount];
+    for (NSUInteger fileIndex = _loadedPrefixCount; fileIndex < _fileCount; fileIndex++) {
+        pageCount += [self estimatedPageCountForFileIndex:fileIndex];
+    }
+    [_pageTableCondition unlock];
+    return pageCount;
+}
+
+- (NSInteger)fileIndexForPage:(NSUInteger)page {
+    if (![self waitForPageTable]) return [super fileIndexForPage:page];
+    return [self fileIndexAndOffset:NULL forPage:page];
+}
+
+- (NSUInteger)compensatedPageForPage:(NSUInteger)page {
+    if (![self waitForPageTable]) return [super compensatedPageForPage:page];
+    NSUInteger pageOffset = 0;
+    [self fileIndexAndOffset:&pageOffset forPage:page];
+    return page - pageOffset;
+}
+
+- (NSUInteger)pageNumberForPage:(NSUInteger)page {
+    if (![self waitForPageTable]) return [super pageNumberForPage:page];
+    return [self compensatedPageForPage:page] + 1;
+}
+
+- (PSPDFDocumentProvider *)documentProviderForPage:(NSUInteger)page {
+    if (![self waitForPageTable]) return [super documentProviderForPage:page];
+    NSArray *documentProviders = self.documentProviders;
+    NSInteger fileIndex = [self fileIndexForPage:page];
+    return fileIndex < (NSInteger)[documentProviders count] ? documentProviders[fileIndex] : [super documentProviderForPage:page];
+}
+
+- (void)clearCache {
+    [super clearCache];
+
+    // files might have changed; restart loading if it already ran, so waiting lookups get the new table.
+    [_pageTableCondition lock];
+    BOOL wasLoading = _loadingStarted;
+    _generation++;
+    _loadingStarted = NO;
+    [_pageTableCondition unlock];
+    if (wasLoading) [self loadPageTable];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)loadPageTable {
+    // pageCount and every lookup end up here; once loading started this must stay cheap.
+    [_pageTableCondition lock];
+    BOOL loadingStarted = _loadingStarted;
+    [_pageTableCondition unlock];
+    if (loadingStarted) return;
+
+    NSArray *fileURLs = [self filesWithBasePath];
+    NSString *password = self.password;
+
+    [_pageTableCondition lock];
+    if (_loadingStarted) {
+        [_pageTableCondition unlock];
+        return;
+    }
+    _loadingStarted = YES;
+    NSUInteger generation = ++_generation;
+    _fileURLs = fileURLs;
+    _fileCount = [fileURLs count];
+    _loadedPrefixCount = 0;
+    _loadedFileCount = 0;
+    _loadedPageSum = 0;
+    _nextFileIndex = 0;
+    _pageCounts = realloc(_pageCounts, MAX(_fileCount, 1) * sizeof(NSUInteger));
+    _pageOffsets = realloc(_pageOffsets, (_fileCount + 1) * sizeof(NSUInteger));
+    for (NSUInteger i = 0; i < _fileCount; i++) _pageCounts[i] = NSNotFound;
+    _pageOffsets[0] = 0;
+    [_pageTableCondition unlock];
+
+    // start maxConcurrentLoads files; every finished load starts the next file in order.
+    NSUInteger concurrentLoads = MIN(MAX(self.maxConcurrentLoads, 1), [fileURLs count]);
+    for (NSUInteger i = 0; i < concurrentLoads; i++) {
+        [self loadNextFileWithPassword:password generation:generation];
+    }
+}
+
+- (BOOL)isPageTableLoaded {
+    [_pageTableCondition lock];
+    BOOL loaded = _loadingStarted && _loadedPrefixCount == _fileCount;
+    [_pageTableCondition unlock];
+    return loaded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Files are started in order, so the first pages are known first. No thread waits for a free slot.
+- (void)loadNextFileWithPassword:(NSString *)password generation:(NSUInteger)generation {
+    [_pageTableCondition lock];
+    NSUInteger fileIndex = (generation == _generation && _nextFileIndex < _fileCount) ? _nextFileIndex++ : NSNotFound;
+    NSURL *fileURL = fileIndex != NSNotFound ? _fileURLs[fileIndex] : nil;
+    [_pageTableCondition unlock];
+    if (!fileURL) return;
+
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSUInteger pageCount = [[self class] pageCountForFileURL:fileURL password:password];
+        [self setPageCount:pageCount forFileIndex:fileIndex generation:generation];
+        [self loadNextFileWithPassword:password generation:generation];
+    });
+}
+
++ (NSUInteger)pageCountForFileURL:(NSURL *)fileURL password:(NSString *)password {
+    CGPDFDocumentRef documentRef = CGPDFDocumentCreateWithURL((__bridge CFURLRef)fileURL);
+    if (documentRef && CGPDFDocumentIsEncrypted(documentRef) && !CGPDFDocumentIsUnlocked(documentRef) && password) {
+        CGPDFDocumentUnlockWithPassword(documentRef, [password UTF8String]);
+    }
+    NSUInteger pageCount = documentRef ? CGPDFDocumentGetNumberOfPages(documentRef) : 0;
+    CGPDFDocumentRelease(documentRef);
+    if (!documentRef) PSCLog(@"Failed to open %@", fileURL);
+    return pageCount;
+}
+
+- (void)setPageCount:(NSUInteger)pageCount forFileIndex:(NSUInteger)fileIndex generation:(NSUInteger)generation {
+    [_pageTableCondition lock];
+    BOOL current = generation == _generation;
+    if (current) {
+        _pageCounts[fileIndex] = pageCount;
+        _loadedFileCount++;
+        _loadedPageSum += pageCount;
+
+        // extend the contiguous prefix.
+        while (_loadedPrefixCount < _fileCount && _pageCounts[_loadedPrefixCount] != NSNotFound) {
+            _pageOffsets[_loadedPrefixCount + 1] = _pageOffsets[_loadedPrefixCount] + _pageCounts[_loadedPrefixCount];
+            _loadedPrefixCount++;
+        }
+        [_pageTableCondition broadcast];
+    }
+    [_pageTableCondition unlock];
+
+    if (current) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [[NSNotificationCenter defaultCenter] postNotificationName:kPSCMultiFileDocumentPageCountChangedNotification object:self userInfo:@{kPSCMultiFileDocumentFileIndexKey : @(fileIndex)}];
+        });
+    }
+}
+
+// Page count of a file, or the average of the loaded files while it's loading. Call with the lock held.
+- (NSUInteger)estimatedPageCountForFileIndex:(NSUInteger)fileIndex {
+    if (_pageCounts[fileIndex] != NSNotFound) return _pageCounts[fileIndex];
+    return _loadedFileCount > 0 ? MAX(_loadedPageSum / _loadedFileCount, 1) : 1;
+}
+
+// Returns NO for documents without files (data, dataProvider); those use the default implementation.
+- (BOOL)waitForPageTable {
+    if (!_pageTableCondition || [self.files count] == 0) return NO;
+    [self loadPageTable];
+    return YES;
+}
+
+// Binary searches the prefix sums. Off the main thread, waits until the file containing page is known;
+// the main thread never waits and uses the estimated counts (kPSCMultiFileDocumentPageCountChangedNotification follows).
+- (NSInteger)fileIndexAndOffset:(NSUInteger *)pageOffset forPage:(NSUInteger)page {
+    BOOL mayWait = ![NSThread isMainThread];
+    [_pageTableCondition lock];
+    while (mayWait && _loadedPrefixCount < _fileCount && page >= _pageOffsets[_loadedPrefixCount]) {
+        [_pageTableCondition wait];
+    }
+
+    NSUInteger fileIndex, fileOffset;
+    if (_loadedPrefixCount > 0 && (_loadedPrefixCount == _fileCount || page < _pageOffsets[_loadedPrefixCount])) {
+        // first file that ends after page (skips files without pages). Out-of-range pages map to the last file.
+        NSUInteger low = 0, high = _loadedPrefixCount - 1;
+        while (low < high) {
+            NSUInteger mid = (low + high) / 2;
+            if (_pageOffsets[mid + 1] > page) high = mid;
+            else low = mid + 1;
+        }
+        fileIndex = low;
+        fileOffset = _pageOffsets[fileIndex];
+    }else {
+        // page is after the loaded prefix: walk the estimates.
+        fileIndex = _loadedPrefixCount;
+        fileOffset = _pageOffsets[_loadedPrefixCount];
+        while (fileIndex + 1 < _fileCount && page >= fileOffset + [self estimatedPageCountForFileIndex:fileIndex]) {
+            fileOffset += [self estimatedPageCountForFileIndex:fileIndex];
+            fileIndex++;
+        }
+    }
+    if (pageOffset) *pageOffset = fileOffset;
+    [_pageTableCondition unlock];
+    return fileIndex;
+}
+
+@end
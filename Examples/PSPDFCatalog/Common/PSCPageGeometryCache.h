@@ -0,0 +1,45 @@
+//
+//  PSCPageGeometryCache.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Persisted page geometry (page rect and rotation) of a document.
+
+    pageInfoForPage:, rectBoxForPage: and aspectRatioVariance need to parse the page dictionaries, which adds up
+    for documents with hundreds of pages. This cache stores the geometry of all pages in a small binary table in the
+    caches directory, keyed by document UID and the modification date and size of its files. Reopening a document
+    then costs a single read. Use it from a PSPDFDocument subclass (see PSCMagazine).
+*/
+@interface PSCPageGeometryCache : NSObject
+
+/// Loads the table for document lazily on first access.
+- (id)initWithDocument:(PSPDFDocument *)document;
+
+/// Returns a page info built from the table, or nil if the page isn't cached.
+- (PSPDFPageInfo *)pageInfoForPage:(NSUInteger)page;
+
+/// Adds the geometry of pageInfo. The table is written shortly after the last change.
+- (void)setPageInfo:(PSPDFPageInfo *)pageInfo forPage:(NSUInteger)page;
+
+/// Cached aspect ratio variance, or NAN if not yet known.
+@property(nonatomic, assign) CGFloat aspectRatioVariance;
+
+/// Forgets the in-memory table (e.g. if the files changed). The table on disk is validated again on next access.
+- (void)reload;
+
+/// Writes pending changes immediately.
+- (void)save;
+
+/// Removes all tables on disk.
++ (void)removeAllTables;
+
+/// Path of a table for document in the cache directory; other per-document caches (see PSCLabelParser) use their own extension.
++ (NSString *)tablePathForDocument:(PSPDFDocument *)document pathExtension:(NSString *)pathExtension;
+
+/// Latest modification date and total size of all files of document. Returns NO for documents without files.
++ (BOOL)getModificationDate:(double *)modificationDate fileSize:(uint64_t *)fileSize forDocument:(PSPDFDocument *)document;
+
+@end
@@ -0,0 +1,233 @@
+//
+//  PSCPageGeometryCache.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCPageGeometryCache.h"
+
+#define kPSCPageGeometryMagic 0x50534347 // 'PSCG'
+#define kPSCPageGeometryVersion 1
+#define kPSCPageGeometrySaveDelay 1.0
+#define kPSCPageGeometryDirectoryName @"PSCPageGeometry"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    double modificationDate; // latest modification date of all files
+    uint64_t fileSize;       // sum of all file sizes
+    uint32_t pageCount;      // number of entries
+    float aspectRatioVariance;
+} PSCPageGeometryHeader;
+
+typedef struct {
+    float x, y, width, height;
+    uint16_t rotation;
+    uint16_t valid;
+} PSCPageGeometryEntry;
+
+@interface PSCPageGeometryCache () {
+    PSCPageGeometryHeader _header;
+    NSMutableData *_entries;            // PSCPageGeometryEntry
+    NSMutableDictionary *_pageInfos;    // page -> PSPDFPageInfo
+    NSString *_tablePath;               // resolved on load; the document might be gone when saving
+    BOOL _loaded, _dirty, _saveScheduled;
+    dispatch_queue_t _tableQueue;
+}
+@property(nonatomic, ps_weak) PSPDFDocument *document;
+@end
+
+@implementation PSCPageGeometryCache
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (NSString *)tableDirectory {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [cachesPath stringByAppendingPathComponent:kPSCPageGeometryDirectoryName];
+}
+
++ (void)removeAllTables {
+    [[NSFileManager new] removeItemAtPath:[self tableDirectory] error:NULL];
+}
+
++ (NSString *)tablePathForDocument:(PSPDFDocument *)document pathExtension:(NSString *)pathExtension {
+    NSString *UID = document.UID;
+    if ([UID length] == 0) return nil;
+    NSCharacterSet *illegalCharacters = [NSCharacterSet characterSetWithCharactersInString:@"/\\:"];
+    NSString *fileName = [[UID componentsSeparatedByCharactersInSet:illegalCharacters] componentsJoinedByString:@"_"];
+    return [[self tableDirectory] stringByAppendingPathComponent:[fileName stringByAppendingPathExtension:pathExtension]];
+}
+
++ (BOOL)getModificationDate:(double *)modificationDate fileSize:(uint64_t *)fileSize forDocument:(PSPDFDocument *)document {
+    NSArray *fileURLs = [document filesWithBasePath];
+    if ([fileURLs count] == 0) return NO;
+
+    NSFileManager *fileManager = [NSFileManager new];
+    *modificationDate = 0;
+    *fileSize = 0;
+    for (NSURL *fileURL in fileURLs) {
+        NSDictionary *attributes = [fileManager attributesOfItemAtPath:[fileURL path] error:NULL];
+        if (!attributes) return NO;
+        *modificationDate = MAX(*modificationDate, [[attributes fileModificationDate] timeIntervalSinceReferenceDate]);
+        *fileSize += [attributes fileSize];
+    }
+    return YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super init])) {
+        _document = document;
+        _entries = [NSMutableData new];
+        _pageInfos = [NSMutableDictionary new];
+        _tableQueue = dispatch_queue_create("com.pspdfkit.catalog.pageGeometryQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    PSPDFDispatchRelease(_tableQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ pages:%d variance:%f>", NSStringFromClass([self class]), _header.pageCount, _header.aspectRatioVariance];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (PSPDFPageInfo *)pageInfoForPage:(NSUInteger)page {
+    __block PSPDFPageInfo *pageInfo = nil;
+    dispatch_sync(_tableQueue, ^{
+        [self loadTableIfNeeded];
+        pageInfo = _pageInfos[@(page)];
+        if (pageInfo || page >= _header.pageCount) return;
+
+        const PSCPageGeometryEntry *entry = (const PSCPageGeometryEntry *)[_entries bytes] + page;
+        if (entry->valid) {
+            CGRect pageRect = CGRectMake(entry->x, entry->y, entry->width, entry->height);
+            pageInfo = [[PSPDFPageInfo alloc] initWithPage:page rect:pageRect rotation:entry->rotation document:self.document];
+            _pageInfos[@(page)] = pageInfo;
+        }
+    });
+    return pageInfo;
+}
+
+- (void)setPageInfo:(PSPDFPageInfo *)pageInfo forPage:(NSUInteger)page {
+    if (!pageInfo) return;
+    dispatch_sync(_tableQueue, ^{
+        [self loadTableIfNeeded];
+        if (page >= _header.pageCount) {
+            [_entries setLength:(page + 1) * sizeof(PSCPageGeometryEntry)];
+            _header.pageCount = (uint32_t)(page + 1);
+        }
+        PSCPageGeometryEntry *entry = (PSCPageGeometryEntry *)[_entries mutableBytes] + page;
+        CGRect pageRect = pageInfo.pageRect;
+        *entry = (PSCPageGeometryEntry){pageRect.origin.x, pageRect.origin.y, pageRect.size.width, pageRect.size.height, (uint16_t)pageInfo.pageRotation, 1};
+        _pageInfos[@(page)] = pageInfo;
+        [self scheduleSave];
+    });
+}
+
+- (CGFloat)aspectRatioVariance {
+    __block CGFloat aspectRatioVariance;
+    dispatch_sync(_tableQueue, ^{
+        [self loadTableIfNeeded];
+        aspectRatioVariance = _header.aspectRatioVariance;
+    });
+    return aspectRatioVariance;
+}
+
+- (void)setAspectRatioVariance:(CGFloat)aspectRatioVariance {
+    dispatch_sync(_tableQueue, ^{
+        [self loadTableIfNeeded];
+        _header.aspectRatioVariance = aspectRatioVariance;
+        [self scheduleSave];
+    });
+}
+
+- (void)reload {
+    dispatch_sync(_tableQueue, ^{
+        _loaded = NO;
+        _dirty = NO;
+        [_pageInfos removeAllObjects];
+    });
+}
+
+- (void)save {
+    dispatch_sync(_tableQueue, ^{
+        [self writeTable];
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Needs to be called on _tableQueue.
+- (void)loadTableIfNeeded {
+    if (_loaded) return;
+    _loaded = YES;
+
+    [_entries setLength:0];
+    _header = (PSCPageGeometryHeader){kPSCPageGeometryMagic, kPSCPageGeometryVersion, 0, 0, 0, NAN};
+    PSPDFDocument *document = self.document;
+    _tablePath = [[self class] tablePathForDocument:document pathExtension:@"geometry"];
+    if (!_tablePath || ![[self class] getModificationDate:&_header.modificationDate fileSize:&_header.fileSize forDocument:document]) {
+        _tablePath = nil;
+        return;
+    }
+
+    NSData *tableData = [NSData dataWithContentsOfFile:_tablePath options:NSDataReadingUncached error:NULL];
+    if ([tableData length] < sizeof(PSCPageGeometryHeader)) return;
+
+    PSCPageGeometryHeader header;
+    [tableData getBytes:&header length:sizeof(header)];
+    NSUInteger entriesLength = header.pageCount * sizeof(PSCPageGeometryEntry);
+    BOOL valid = header.magic == kPSCPageGeometryMagic && header.version == kPSCPageGeometryVersion &&
+                 header.modificationDate == _header.modificationDate && header.fileSize == _header.fileSize &&
+                 [tableData length] == sizeof(header) + entriesLength;
+    if (!valid) {
+        PSCLog(@"Discarding outdated page geometry table for %@.", self.document.UID);
+        return;
+    }
+
+    _header = header;
+    [_entries appendBytes:(const uint8_t *)[tableData bytes] + sizeof(header) length:entriesLength];
+}
+
+// Coalesces the writes while pages are parsed in a row.
+- (void)scheduleSave {
+    _dirty = YES;
+    if (_saveScheduled) return;
+    _saveScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kPSCPageGeometrySaveDelay * NSEC_PER_SEC)), _tableQueue, ^{
+        _saveScheduled = NO;
+        [self writeTable];
+    });
+}
+
+// Needs to be called on _tableQueue.
+- (void)writeTable {
+    if (!_dirty) return;
+    _dirty = NO;
+
+    NSString *tablePath = _tablePath;
+    if (!tablePath) return;
+
+    NSMutableData *tableData = [NSMutableData dataWithCapacity:sizeof(_header) + [_entries length]];
+    [tableData appendBytes:&_header length:sizeof(_header)];
+    [tableData appendData:_entries];
+
+    NSError *error = nil;
+    [[NSFileManager new] createDirectoryAtPath:[tablePath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (![tableData writeToFile:tablePath options:NSDataWritingAtomic error:&error]) {
+        PSCLog(@"Failed to write page geometry table: %@", error);
+    }
+}
+
+@end
@@ -0,0 +1,16 @@
+//
+//  PSCPooledDocumentProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Document provider that gets its CGPDFDocumentRef from PSCDocumentRefPool instead of keeping it open.
+
+    Use PSPDFDocument's overrideClassNames to use this subclass:
+    document.overrideClassNames = @{(id)[PSPDFDocumentProvider class] : [PSCPooledDocumentProvider class]};
+*/
+@interface PSCPooledDocumentProvider : PSPDFDocumentProvider
+
+@end
@@ -0,0 +1,103 @@
+//
+//  PSCPooledDocumentProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCPooledDocumentProvider.h"
+#import "PSCDocumentRefPool.h"
+#include <libkern/OSAtomic.h>
+
+@interface PSCPooledDocumentProvider () {
+    NSNumber *_poolKey;
+}
+@end
+
+@implementation PSCPooledDocumentProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (void)dealloc {
+    [[PSCDocumentRefPool sharedDocumentRefPool] removeDocumentRefForKey:_poolKey];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDocumentProvider
+
+- (CGPDFDocumentRef)requestDocumentRef {
+    return [[PSCDocumentRefPool sharedDocumentRefPool] requestDocumentRefForKey:[self poolKey] openBlock:^CGPDFDocumentRef{
+        return [self openDocumentRef];
+    }];
+}
+
+- (void)releaseDocumentRef:(CGPDFDocumentRef)documentRef {
+    if (documentRef) [[PSCDocumentRefPool sharedDocumentRefPool] releaseDocumentRefForKey:[self poolKey]];
+}
+
+- (void)performBlock:(void(^)(PSPDFDocumentProvider *docProvider, CGPDFDocumentRef documentRef))documentRefBlock {
+    CGPDFDocumentRef documentRef = [self requestDocumentRef];
+    if (documentRefBlock) documentRefBlock(self, documentRef);
+    [self releaseDocumentRef:documentRef];
+}
+
+- (void)iterateOverPageRef:(void(^)(PSPDFDocumentProvider *docProvider, CGPDFDocumentRef documentRef, CGPDFPageRef pageRef, NSUInteger pageNumber))pageRefBlock {
+    [self performBlock:^(PSPDFDocumentProvider *docProvider, CGPDFDocumentRef documentRef) {
+        size_t pageCount = documentRef ? CGPDFDocumentGetNumberOfPages(documentRef) : 0;
+        for (size_t pageNumber = 1; pageNumber <= pageCount; pageNumber++) {
+            @autoreleasepool {
+                pageRefBlock(docProvider, documentRef, CGPDFDocumentGetPage(documentRef, pageNumber), pageNumber);
+            }
+        }
+    }];
+}
+
+// the page is owned by its document; keep the document pinned until the page is released.
+- (CGPDFPageRef)requestPageRefForPageNumber:(NSUInteger)page {
+    CGPDFDocumentRef documentRef = [self requestDocumentRef];
+    CGPDFPageRef pageRef = documentRef ? CGPDFDocumentGetPage(documentRef, page) : NULL;
+    if (!pageRef) [self releaseDocumentRef:documentRef];
+    return pageRef;
+}
+
+- (void)releasePageRef:(CGPDFPageRef)pageRef {
+    if (pageRef) [self releaseDocumentRef:CGPDFPageGetDocument(pageRef)];
+}
+
+- (void)flushDocumentReference {
+    [[PSCDocumentRefPool sharedDocumentRefPool] removeDocumentRefForKey:[self poolKey]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Unique per provider for the lifetime of the process. (an address could be reused by a new provider
+// while the pool still holds an idle reference of a deallocated one)
+- (NSNumber *)poolKey {
+    static int64_t lastPoolKey = 0;
+    @synchronized(self) {
+        if (!_poolKey) _poolKey = @(OSAtomicIncrement64Barrier(&lastPoolKey));
+        return _poolKey;
+    }
+}
+
+- (CGPDFDocumentRef)openDocumentRef {
+    CGPDFDocumentRef documentRef = NULL;
+    if (self.fileURL) {
+        documentRef = CGPDFDocumentCreateWithURL((__bridge CFURLRef)self.fileURL);
+    }else if (self.data) {
+        CGDataProviderRef dataProvider = CGDataProviderCreateWithCFData((__bridge CFDataRef)self.data);
+        documentRef = CGPDFDocumentCreateWithProvider(dataProvider);
+        CGDataProviderRelease(dataProvider);
+    }else if (self.dataProvider) {
+        documentRef = CGPDFDocumentCreateWithProvider(self.dataProvider);
+    }
+
+    if (documentRef && CGPDFDocumentIsEncrypted(documentRef) && !CGPDFDocumentIsUnlocked(documentRef) && self.password) {
+        CGPDFDocumentUnlockWithPassword(documentRef, [self.password UTF8String]);
+    }
+    return documentRef;
+}
+
+@end
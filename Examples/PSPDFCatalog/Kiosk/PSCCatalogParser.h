@@ -0,0 +1,75 @@
+//
+//  PSCCatalogParser.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "AFHTTPRequestOperation.h"
+
+extern NSString *const PSCCatalogParserErrorDomain;
+
+/// Magazine dictionaries (name, url, image) in catalog order.
+typedef void (^PSCCatalogEntriesHandler)(NSArray *entries);
+
+/**
+    Parses a store catalog while it's downloading and reports magazine entries in batches as soon as they are complete.
+
+    A catalog is either a plain array of magazine dictionaries (a full catalog), or an object:
+
+        {"version": "42", "delta": true, "magazines": [...], "removed": ["http://.../old.pdf", ...]}
+
+    The magazines array is streamed; the other values are small and parsed once complete. A delta catalog only lists
+    magazines that changed since the version it was requested for (see PSCCatalogRequestOperation) and the URLs of
+    removed ones. Only the bytes of the value being read are buffered, never the whole catalog.
+
+    Not thread safe, feed it from one queue.
+*/
+@interface PSCCatalogParser : NSObject
+
+/// entriesHandler is called synchronously from appendData: and finish.
+- (id)initWithEntriesHandler:(PSCCatalogEntriesHandler)entriesHandler;
+
+/// Parses the complete values in data. Returns NO (and sets error) on malformed JSON; later data is ignored.
+- (BOOL)appendData:(NSData *)data;
+
+/// Reports remaining entries. Returns NO if the catalog is malformed or incomplete.
+- (BOOL)finish;
+
+/// Entries collected before entriesHandler is called. Defaults to 50.
+@property(nonatomic, assign) NSUInteger batchSize;
+
+/// Number of entries reported so far.
+@property(nonatomic, assign, readonly) NSUInteger entryCount;
+
+/// "version" of an object catalog, nil for array catalogs.
+@property(nonatomic, copy, readonly) NSString *version;
+
+/// YES if the catalog says "delta": true.
+@property(nonatomic, assign, readonly, getter=isDelta) BOOL delta;
+
+/// "removed" URL strings of a delta catalog.
+@property(nonatomic, copy, readonly) NSArray *removedURLs;
+
+@property(nonatomic, strong, readonly) NSError *error;
+
+@end
+
+typedef void (^PSCCatalogCompletionBlock)(PSCCatalogParser *parser, NSHTTPURLResponse *response, NSError *error);
+
+/**
+    Downloads a catalog through PSCCatalogParser without keeping the response in memory.
+
+    If version is set, "since=<version>" is added to the query so the server can answer with a delta catalog; servers
+    that don't support this just send the full catalog. If ETag is set, it's sent as If-None-Match; a 304 response
+    completes without error and with a nil parser.
+
+    entriesHandler and completion are called on the main queue; completion after all entries.
+*/
+@interface PSCCatalogRequestOperation : AFHTTPRequestOperation
+
++ (PSCCatalogRequestOperation *)catalogRequestOperationWithURL:(NSURL *)URL version:(NSString *)version ETag:(NSString *)ETag entriesHandler:(PSCCatalogEntriesHandler)entriesHandler completion:(PSCCatalogCompletionBlock)completion;
+
+@property(nonatomic, strong, readonly) PSCCatalogParser *parser;
+
+@end
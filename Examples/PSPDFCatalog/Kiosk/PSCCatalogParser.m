@@ -0,0 +1,341 @@
+//
+//  PSCCatalogParser.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCCatalogParser.h"
+#import "PSCDownloadScheduler.h"
+
+NSString *const PSCCatalogParserErrorDomain = @"PSCCatalogParserErrorDomain";
+
+#define kPSCCatalogParserDefaultBatchSize 50
+
+typedef NS_ENUM(NSUInteger, PSCCatalogParserState) {
+    PSCCatalogParserStateStart,     // before the top level value
+    PSCCatalogParserStateKey,       // top level object, before a key
+    PSCCatalogParserStateKeyString, // inside a key
+    PSCCatalogParserStateColon,
+    PSCCatalogParserStateKeyValue,  // before a value of the top level object
+    PSCCatalogParserStateEntry,     // magazines array, before an entry
+    PSCCatalogParserStateValue,     // inside an entry or a value of the top level object
+    PSCCatalogParserStateEnd,
+    PSCCatalogParserStateError
+};
+
+static BOOL PSCIsJSONWhitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+@interface PSCCatalogParser () {
+    PSCCatalogEntriesHandler _entriesHandler;
+    PSCCatalogParserState _state;
+    NSMutableData *_buffer;
+    NSUInteger _position;   // next byte to scan in _buffer
+    NSUInteger _valueStart; // start of the key or value being read
+    NSUInteger _valueDepth; // nesting inside the value
+    BOOL _inString, _escaped;
+    BOOL _valueIsEntry, _entriesInObject;
+    NSString *_key;
+    NSMutableArray *_pendingEntries;
+}
+@property(nonatomic, assign) NSUInteger entryCount;
+@property(nonatomic, copy) NSString *version;
+@property(nonatomic, assign, getter=isDelta) BOOL delta;
+@property(nonatomic, copy) NSArray *removedURLs;
+@property(nonatomic, strong) NSError *error;
+@end
+
+@implementation PSCCatalogParser
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithEntriesHandler:(PSCCatalogEntriesHandler)entriesHandler {
+    if ((self = [super init])) {
+        _entriesHandler = [entriesHandler copy];
+        _buffer = [NSMutableData new];
+        _pendingEntries = [NSMutableArray new];
+        _batchSize = kPSCCatalogParserDefaultBatchSize;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ entries:%d version:%@ delta:%@ removed:%d>", NSStringFromClass([self class]), self.entryCount, self.version, self.isDelta ? @"YES" : @"NO", [self.removedURLs count]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (BOOL)appendData:(NSData *)data {
+    if (_state == PSCCatalogParserStateError) return NO;
+
+    [_buffer appendData:data];
+    const char *bytes = [_buffer bytes];
+    NSUInteger length = [_buffer length];
+
+    while (_position < length && _state != PSCCatalogParserStateError) {
+        char c = bytes[_position];
+        switch (_state) {
+            case PSCCatalogParserStateStart:
+                if (c == '[') {
+                    _entriesInObject = NO;
+                    _state = PSCCatalogParserStateEntry;
+                }else if (c == '{') {
+                    _state = PSCCatalogParserStateKey;
+                }else if (!PSCIsJSONWhitespace(c) && (unsigned char)c < 0x80) { // skips a BOM
+                    [self failWithDescription:@"A catalog needs to be an array or an object."];
+                }
+                _position++;
+                break;
+
+            case PSCCatalogParserStateKey:
+                if (c == '"') {
+                    _valueStart = _position + 1;
+                    _state = PSCCatalogParserStateKeyString;
+                }else if (c == '}') {
+                    _state = PSCCatalogParserStateEnd;
+                }else if (!PSCIsJSONWhitespace(c) && c != ',') {
+                    [self failWithDescription:@"Expected a key."];
+                }
+                _position++;
+                break;
+
+            case PSCCatalogParserStateKeyString:
+                if (_escaped) {
+                    _escaped = NO;
+                }else if (c == '\\') {
+                    _escaped = YES;
+                }else if (c == '"') {
+                    _key = [[NSString alloc] initWithBytes:bytes + _valueStart length:_position - _valueStart encoding:NSUTF8StringEncoding];
+                    _state = PSCCatalogParserStateColon;
+                }
+                _position++;
+                break;
+
+            case PSCCatalogParserStateColon:
+                if (c == ':') {
+                    _state = PSCCatalogParserStateKeyValue;
+                }else if (!PSCIsJSONWhitespace(c)) {
+                    [self failWithDescription:@"Expected a colon."];
+                }
+                _position++;
+                break;
+
+            case PSCCatalogParserStateKeyValue:
+                if (PSCIsJSONWhitespace(c)) {
+                    _position++;
+                }else if (c == '[' && [_key isEqualToString:@"magazines"]) {
+                    _entriesInObject = YES;
+                    _state = PSCCatalogParserStateEntry;
+                    _position++;
+                }else {
+                    [self beginValueAsEntry:NO];
+                }
+                break;
+
+            case PSCCatalogParserStateEntry:
+                if (c == ']') {
+                    _state = _entriesInObject ? PSCCatalogParserStateKey : PSCCatalogParserStateEnd;
+                    _position++;
+                }else if (PSCIsJSONWhitespace(c) || c == ',') {
+                    _position++;
+                }else {
+                    [self beginValueAsEntry:YES];
+                }
+                break;
+
+            case PSCCatalogParserStateValue:
+                if (_inString) {
+                    if (_escaped) _escaped = NO;
+                    else if (c == '\\') _escaped = YES;
+                    else if (c == '"') _inString = NO;
+                    _position++;
+                }else if (c == '"') {
+                    _inString = YES;
+                    _position++;
+                }else if (c == '{' || c == '[') {
+                    _valueDepth++;
+                    _position++;
+                }else if (c == '}' || c == ']') {
+                    if (_valueDepth == 0) {
+                        [self finishValue]; // ends a scalar, the bracket belongs to the enclosing container
+                    }else {
+                        _position++;
+                        if (--_valueDepth == 0) [self finishValue];
+                    }
+                }else if (_valueDepth == 0 && (c == ',' || PSCIsJSONWhitespace(c))) {
+                    [self finishValue];
+                }else {
+                    _position++;
+                }
+                break;
+
+            case PSCCatalogParserStateEnd:
+                if (!PSCIsJSONWhitespace(c)) [self failWithDescription:@"Unexpected data after the catalog."];
+                _position++;
+                break;
+
+            case PSCCatalogParserStateError:
+                break;
+        }
+    }
+
+    // drop everything that has been parsed, keep the value that is being read.
+    BOOL readingValue = _state == PSCCatalogParserStateValue || _state == PSCCatalogParserStateKeyString;
+    NSUInteger consumedLength = readingValue ? _valueStart : _position;
+    if (consumedLength > 0) {
+        [_buffer replaceBytesInRange:NSMakeRange(0, consumedLength) withBytes:NULL length:0];
+        _position -= consumedLength;
+        if (readingValue) _valueStart = 0;
+    }
+
+    if ([_pendingEntries count] >= self.batchSize) [self reportPendingEntries];
+    return _state != PSCCatalogParserStateError;
+}
+
+- (BOOL)finish {
+    [self reportPendingEntries];
+    if (_state != PSCCatalogParserStateEnd && _state != PSCCatalogParserStateError) {
+        [self failWithDescription:@"The catalog is incomplete."];
+    }
+    _buffer = nil;
+    return _state == PSCCatalogParserStateEnd;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)beginValueAsEntry:(BOOL)isEntry {
+    _valueStart = _position;
+    _valueDepth = 0;
+    _inString = _escaped = NO;
+    _valueIsEntry = isEntry;
+    _state = PSCCatalogParserStateValue;
+}
+
+// The value ends before _position.
+- (void)finishValue {
+    NSData *valueData = [NSData dataWithBytesNoCopy:(char *)[_buffer mutableBytes] + _valueStart length:_position - _valueStart freeWhenDone:NO];
+    NSError *error = nil;
+    id value = [NSJSONSerialization JSONObjectWithData:valueData options:NSJSONReadingAllowFragments error:&error];
+    if (!value) {
+        [self failWithDescription:[NSString stringWithFormat:@"Invalid value: %@", [error localizedDescription]]];
+        return;
+    }
+
+    if (_valueIsEntry) {
+        if ([value isKindOfClass:[NSDictionary class]]) {
+            [_pendingEntries addObject:value];
+        }else {
+            PSCLog(@"Error while parsing magazine JSON - Dictionary expected. Got this instead: %@", value);
+        }
+        _state = PSCCatalogParserStateEntry;
+    }else {
+        if ([_key isEqualToString:@"version"]) {
+            self.version = [value isKindOfClass:[NSNumber class]] ? [value stringValue] : ([value isKindOfClass:[NSString class]] ? value : nil);
+        }else if ([_key isEqualToString:@"delta"]) {
+            self.delta = [value respondsToSelector:@selector(boolValue)] && [value boolValue];
+        }else if ([_key isEqualToString:@"removed"] && [value isKindOfClass:[NSArray class]]) {
+            self.removedURLs = [value filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"self isKindOfClass: %@", [NSString class]]];
+        }
+        _state = PSCCatalogParserStateKey;
+    }
+}
+
+- (void)reportPendingEntries {
+    if ([_pendingEntries count] == 0) return;
+
+    NSArray *entries = [_pendingEntries copy];
+    [_pendingEntries removeAllObjects];
+    self.entryCount += [entries count];
+    if (_entriesHandler) _entriesHandler(entries);
+}
+
+- (void)failWithDescription:(NSString *)description {
+    self.error = [NSError errorWithDomain:PSCCatalogParserErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : description}];
+    _state = PSCCatalogParserStateError;
+}
+
+@end
+
+@interface PSCCatalogRequestOperation () {
+    dispatch_queue_t _parseQueue;
+}
+@property(nonatomic, strong) PSCCatalogParser *parser;
+@end
+
+@implementation PSCCatalogRequestOperation
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCCatalogRequestOperation *)catalogRequestOperationWithURL:(NSURL *)URL version:(NSString *)version ETag:(NSString *)ETag entriesHandler:(PSCCatalogEntriesHandler)entriesHandler completion:(PSCCatalogCompletionBlock)completion {
+    NSURL *requestURL = URL;
+    if ([version length]) {
+        NSString *escapedVersion = [version stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+        requestURL = [NSURL URLWithString:[[URL absoluteString] stringByAppendingFormat:@"%@since=%@", [URL query] ? @"&" : @"?", escapedVersion]];
+    }
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:requestURL cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:30.f];
+    if ([ETag length]) [request setValue:ETag forHTTPHeaderField:@"If-None-Match"];
+
+    PSCCatalogRequestOperation *operation = [[self alloc] initWithRequest:request];
+    operation.parser = [[PSCCatalogParser alloc] initWithEntriesHandler:^(NSArray *entries) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (entriesHandler) entriesHandler(entries);
+        });
+    }];
+
+    [operation setCompletionBlockWithSuccess:^(AFHTTPRequestOperation *requestOperation, id responseObject) {
+        // wait for the chunks that are still being parsed.
+        PSCCatalogParser *parser = [(PSCCatalogRequestOperation *)requestOperation parser];
+        NSHTTPURLResponse *response = requestOperation.response;
+        dispatch_async(((PSCCatalogRequestOperation *)requestOperation)->_parseQueue, ^{
+            BOOL parsed = [parser finish];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (completion) completion(parser, response, parsed ? nil : parser.error);
+            });
+        });
+    } failure:^(AFHTTPRequestOperation *requestOperation, NSError *error) {
+        BOOL notModified = requestOperation.response.statusCode == 304;
+        if (completion) completion(nil, requestOperation.response, notModified ? nil : error);
+    }];
+    return operation;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithRequest:(NSURLRequest *)urlRequest {
+    if ((self = [super initWithRequest:urlRequest])) {
+        _parseQueue = dispatch_queue_create("com.pspdfkit.catalog.catalogParseQueue", NULL);
+        self.outputStream = nil; // the parser gets the data, don't keep the whole catalog in memory
+    }
+    return self;
+}
+
+- (void)dealloc {
+    PSPDFDispatchRelease(_parseQueue);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSURLConnectionDelegate
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+    [super connection:connection didReceiveData:data];
+    [[PSCDownloadScheduler sharedDownloadScheduler] recordReceivedBytes:[data length]];
+
+    // error pages aren't catalogs.
+    NSInteger statusCode = self.response.statusCode;
+    if (statusCode < 200 || statusCode >= 300) return;
+
+    NSData *chunk = [data copy];
+    PSCCatalogParser *parser = self.parser;
+    dispatch_async(_parseQueue, ^{
+        [parser appendData:chunk];
+    });
+}
+
+@end
@@ -0,0 +1,56 @@
+//
+//  PSCCoverPipeline.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+@class PSCMagazine;
+
+/// Called on the main thread. cover is nil if the magazine has no cover (yet).
+typedef void (^PSCCoverCompletionBlock)(UIImage *cover);
+
+/**
+    Loads the covers of the Kiosk grid.
+
+    Covers are scaled to fit the requested size (in pixels of the main screen) and drawn into a bitmap once, in the
+    background. The resulting decoded images are kept in an LRU cache limited by their bitmap size, so showing a cover
+    again never decodes its JPG again while it's in the cache. Requests for the same cover (magazine and size) share one
+    load; a load is cancelled once all its requests are cancelled, e.g. when cells are reused while scrolling.
+
+    The source is the PSPDFCache thumbnail of the first page, else magazine.imageURL, which is fetched through
+    PSCDownloadScheduler with visible priority. Locked magazines share one lock cover per size.
+
+    Use from the main thread.
+*/
+@interface PSCCoverPipeline : NSObject
+
+/// Shared instance.
++ (PSCCoverPipeline *)sharedCoverPipeline;
+
+/// Decoded cover from the cache, or nil. Cheap.
+- (UIImage *)cachedCoverForMagazine:(PSCMagazine *)magazine size:(CGSize)size;
+
+/// Loads the cover in the background. Returns a request for cancelRequest:, or nil if the cover was cached
+/// (completion is then called right away).
+- (id)requestCoverForMagazine:(PSCMagazine *)magazine size:(CGSize)size completion:(PSCCoverCompletionBlock)completion;
+
+/// Loads the cover synchronously (local sources only) and caches it.
+- (UIImage *)coverForMagazine:(PSCMagazine *)magazine size:(CGSize)size;
+
+/// Completion of request won't be called. Nil is ignored.
+- (void)cancelRequest:(id)request;
+
+/// Drops cached covers of magazine, e.g. when its thumbnail was rendered.
+- (void)removeCoversForMagazine:(PSCMagazine *)magazine;
+
+/// Drops all cached covers. Also done on memory warnings.
+- (void)removeAllCovers;
+
+/// Maximum bytes of decoded bitmaps kept. Defaults to a 16th of the physical memory.
+@property(nonatomic, assign) NSUInteger totalCostLimit;
+
+/// Number of covers drawn so far (statistics).
+@property(nonatomic, assign, readonly) NSUInteger decodeCount;
+
+@end
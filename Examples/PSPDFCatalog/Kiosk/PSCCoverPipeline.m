@@ -0,0 +1,324 @@
+//
+//  PSCCoverPipeline.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCCoverPipeline.h"
+#import "PSCMagazine.h"
+#import "PSCDownloadScheduler.h"
+#import "AFImageRequestOperation.h"
+
+// Entry of the LRU list. Owned by the _entries dictionary; head is the most recently used.
+@interface PSCCoverCacheEntry : NSObject
+@property(nonatomic, copy) NSString *key;
+@property(nonatomic, strong) UIImage *image;
+@property(nonatomic, assign) NSUInteger cost;
+@property(nonatomic, unsafe_unretained) PSCCoverCacheEntry *previous;
+@property(nonatomic, unsafe_unretained) PSCCoverCacheEntry *next;
+@end
+
+@implementation PSCCoverCacheEntry
+@end
+
+@interface PSCCoverRequest : NSObject
+@property(nonatomic, copy) NSString *key;
+@property(nonatomic, copy) PSCCoverCompletionBlock completion;
+@end
+
+@implementation PSCCoverRequest
+@end
+
+// One load per key; all requests for the key wait for it.
+@interface PSCCoverLoad : NSObject
+@property(nonatomic, strong) NSOperation *operation;
+@property(nonatomic, strong) NSMutableArray *requests;
+@end
+
+@implementation PSCCoverLoad
+@end
+
+// Draws source scaled to fit into size (points of the main screen) into an opaque bitmap, so it's decoded right here.
+static UIImage *PSCCreatePresizedCover(UIImage *source, CGSize size) {
+    if (!source.CGImage || source.size.width <= 0 || source.size.height <= 0) return nil;
+
+    CGFloat scale = [UIScreen mainScreen].scale;
+    CGFloat ratio = MIN(size.width / source.size.width, size.height / source.size.height);
+    if (ratio <= 0) ratio = 1.f;
+    size_t width = (size_t)MAX(floorf(source.size.width * ratio * scale), 1.f);
+    size_t height = (size_t)MAX(floorf(source.size.height * ratio * scale), 1.f);
+
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) return nil;
+
+    CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), source.CGImage);
+    CGImageRef imageRef = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+
+    UIImage *cover = [UIImage imageWithCGImage:imageRef scale:scale orientation:UIImageOrientationUp];
+    CGImageRelease(imageRef);
+    return cover;
+}
+
+@interface PSCCoverPipeline () {
+    NSMutableDictionary *_entries; // key -> PSCCoverCacheEntry
+    PSCCoverCacheEntry *_head, *_tail;
+    NSUInteger _totalCost;
+    NSMutableDictionary *_loads;   // key -> PSCCoverLoad
+    NSOperationQueue *_coverQueue;
+}
+@property(nonatomic, assign) NSUInteger decodeCount;
+@end
+
+@implementation PSCCoverPipeline
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCCoverPipeline *)sharedCoverPipeline {
+    static dispatch_once_t pred = 0;
+    __strong static PSCCoverPipeline *_sharedCoverPipeline = nil;
+    dispatch_once(&pred, ^{
+        _sharedCoverPipeline = [self new];
+    });
+    return _sharedCoverPipeline;
+}
+
+// Catalog magazines without a file all share the UID of an empty document; they are identified by their download URL.
++ (NSString *)identifierForMagazine:(PSCMagazine *)magazine {
+    if ([magazine.files count] == 0) {
+        NSURL *URL = magazine.URL ?: magazine.imageURL;
+        if (URL) return [URL absoluteString];
+    }
+    return magazine.UID;
+}
+
++ (NSString *)keyForMagazine:(PSCMagazine *)magazine size:(CGSize)size {
+    CGFloat scale = [UIScreen mainScreen].scale;
+    return [NSString stringWithFormat:@"%@_%.0fx%.0f", [self identifierForMagazine:magazine], size.width * scale, size.height * scale];
+}
+
+// Called on _coverQueue or the main thread. Local sources only.
++ (UIImage *)drawCoverForMagazine:(PSCMagazine *)magazine size:(CGSize)size {
+    if (magazine.isLocked) return [magazine coverImageForSize:size]; // lock covers are drawn at size already
+
+    // basic check if file is available - don't check for pageCount here, it's lazy evaluated.
+    UIImage *thumbnail = magazine.basePath ? [[PSPDFCache sharedCache] cachedImageForDocument:magazine page:0 size:PSPDFSizeThumbnail] : nil;
+    return PSCCreatePresizedCover(thumbnail, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _entries = [NSMutableDictionary new];
+        _loads = [NSMutableDictionary new];
+        _coverQueue = [NSOperationQueue new];
+        _coverQueue.maxConcurrentOperationCount = 2;
+        _totalCostLimit = (NSUInteger)MIN([NSProcessInfo processInfo].physicalMemory / 16, 64ULL * 1024 * 1024);
+
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(removeAllCovers) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [_coverQueue cancelAllOperations];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ covers:%d cost:%dKB/%dKB loads:%d decoded:%d>", NSStringFromClass([self class]), [_entries count], _totalCost / 1024, _totalCostLimit / 1024, [_loads count], _decodeCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (UIImage *)cachedCoverForMagazine:(PSCMagazine *)magazine size:(CGSize)size {
+    return [self coverForKey:[[self class] keyForMagazine:magazine size:size]];
+}
+
+- (id)requestCoverForMagazine:(PSCMagazine *)magazine size:(CGSize)size completion:(PSCCoverCompletionBlock)completion {
+    NSString *key = [[self class] keyForMagazine:magazine size:size];
+    UIImage *cover = [self coverForKey:key];
+    if (cover) {
+        if (completion) completion(cover);
+        return nil;
+    }
+
+    PSCCoverRequest *request = [PSCCoverRequest new];
+    request.key = key;
+    request.completion = completion;
+
+    PSCCoverLoad *load = _loads[key];
+    if (!load) {
+        load = [PSCCoverLoad new];
+        load.requests = [NSMutableArray array];
+        _loads[key] = load;
+        [self startLoad:load forMagazine:magazine size:size key:key];
+    }
+    [load.requests addObject:request];
+    return request;
+}
+
+- (UIImage *)coverForMagazine:(PSCMagazine *)magazine size:(CGSize)size {
+    NSString *key = [[self class] keyForMagazine:magazine size:size];
+    UIImage *cover = [self coverForKey:key];
+    if (!cover) {
+        cover = [[self class] drawCoverForMagazine:magazine size:size];
+        if (cover) {
+            self.decodeCount++;
+            [self setCover:cover forKey:key];
+        }
+    }
+    return cover;
+}
+
+- (void)cancelRequest:(id)request {
+    if (![request isKindOfClass:[PSCCoverRequest class]]) return;
+
+    NSString *key = [(PSCCoverRequest *)request key];
+    PSCCoverLoad *load = _loads[key];
+    [load.requests removeObjectIdenticalTo:request];
+    if (load && [load.requests count] == 0) {
+        [load.operation cancel];
+        load.operation = nil; // the operation's blocks retain the load
+        [_loads removeObjectForKey:key];
+    }
+}
+
+// Also removes the covers stored under the URL, from before the magazine was downloaded.
+- (void)removeCoversForMagazine:(PSCMagazine *)magazine {
+    NSMutableSet *prefixes = [NSMutableSet setWithObject:[NSString stringWithFormat:@"%@_", [[self class] identifierForMagazine:magazine]]];
+    if (magazine.URL) [prefixes addObject:[NSString stringWithFormat:@"%@_", [magazine.URL absoluteString]]];
+    if (magazine.imageURL) [prefixes addObject:[NSString stringWithFormat:@"%@_", [magazine.imageURL absoluteString]]];
+    for (NSString *key in [_entries allKeys]) {
+        for (NSString *prefix in prefixes) {
+            if ([key hasPrefix:prefix]) {
+                [self removeEntry:_entries[key]];
+                break;
+            }
+        }
+    }
+}
+
+- (void)removeAllCovers {
+    [_entries removeAllObjects];
+    _head = _tail = nil;
+    _totalCost = 0;
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    _totalCostLimit = totalCostLimit;
+    [self trimToCostLimit];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Loading
+
+- (void)startLoad:(PSCCoverLoad *)load forMagazine:(PSCMagazine *)magazine size:(CGSize)size key:(NSString *)key {
+    NSBlockOperation *operation = [NSBlockOperation new];
+    __ps_weak NSBlockOperation *weakOperation = operation;
+    [operation addExecutionBlock:^{
+        if (weakOperation.isCancelled) return;
+        UIImage *cover = [[self class] drawCoverForMagazine:magazine size:size];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (!cover && magazine.imageURL) {
+                [self fetchCoverForLoad:load URL:magazine.imageURL size:size key:key];
+            }else {
+                [self finishLoad:load cover:cover key:key];
+            }
+        });
+    }];
+    load.operation = operation;
+    [_coverQueue addOperation:operation];
+}
+
+// The response goes through the URL cache; the cover is drawn on AFNetworking's processing queue.
+- (void)fetchCoverForLoad:(PSCCoverLoad *)load URL:(NSURL *)URL size:(CGSize)size key:(NSString *)key {
+    if (_loads[key] != load) return; // cancelled meanwhile
+
+    AFImageRequestOperation *operation = [AFImageRequestOperation imageRequestOperationWithRequest:[NSURLRequest requestWithURL:URL] imageProcessingBlock:^UIImage *(UIImage *image) {
+        return PSCCreatePresizedCover(image, size);
+    } success:^(NSURLRequest *request, NSHTTPURLResponse *response, UIImage *image) {
+        [self finishLoad:load cover:image key:key];
+    } failure:^(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error) {
+        PSCLog(@"Failed to load cover from %@: %@", URL, [error localizedDescription]);
+        [self finishLoad:load cover:nil key:key];
+    }];
+    load.operation = operation;
+    [[PSCDownloadScheduler sharedDownloadScheduler] addOperation:operation priority:PSCDownloadPriorityVisible];
+}
+
+- (void)finishLoad:(PSCCoverLoad *)load cover:(UIImage *)cover key:(NSString *)key {
+    if (_loads[key] != load) return; // cancelled
+    [_loads removeObjectForKey:key];
+    load.operation = nil;
+
+    if (cover) {
+        self.decodeCount++;
+        [self setCover:cover forKey:key];
+    }
+    for (PSCCoverRequest *request in load.requests) {
+        if (request.completion) request.completion(cover);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - LRU
+
+- (UIImage *)coverForKey:(NSString *)key {
+    PSCCoverCacheEntry *entry = _entries[key];
+    if (entry && entry != _head) {
+        [self unlinkEntry:entry];
+        [self linkEntryAtHead:entry];
+    }
+    return entry.image;
+}
+
+- (void)setCover:(UIImage *)cover forKey:(NSString *)key {
+    [self removeEntry:_entries[key]];
+
+    PSCCoverCacheEntry *entry = [PSCCoverCacheEntry new];
+    entry.key = key;
+    entry.image = cover;
+    entry.cost = (NSUInteger)(CGImageGetBytesPerRow(cover.CGImage) * CGImageGetHeight(cover.CGImage));
+    _entries[key] = entry;
+    [self linkEntryAtHead:entry];
+    _totalCost += entry.cost;
+    [self trimToCostLimit];
+}
+
+- (void)trimToCostLimit {
+    while (_totalCost > _totalCostLimit && _tail && _tail != _head) {
+        [self removeEntry:_tail];
+    }
+}
+
+- (void)removeEntry:(PSCCoverCacheEntry *)entry {
+    if (!entry) return;
+    [self unlinkEntry:entry];
+    _totalCost -= entry.cost;
+    [_entries removeObjectForKey:entry.key]; // releases entry
+}
+
+- (void)unlinkEntry:(PSCCoverCacheEntry *)entry {
+    if (entry.previous) entry.previous.next = entry.next; else _head = entry.next;
+    if (entry.next) entry.next.previous = entry.previous; else _tail = entry.previous;
+    entry.previous = entry.next = nil;
+}
+
+- (void)linkEntryAtHead:(PSCCoverCacheEntry *)entry {
+    entry.next = _head;
+    if (_head) _head.previous = entry;
+    _head = entry;
+    if (!_tail) _tail = entry;
+}
+
+@end
@@ -44,4 +44,14 @@ typedef NS_ENUM(NSUInteger, PSPDFStoreDownloadStatus) {
 
 @property(nonatomic, assign, readonly, getter=isCancelled) BOOL cancelled;
 
+/// Magazine that reads from the partially downloaded file. nil until the size of the file is known.
+/// Pages that aren't downloaded yet are fetched first and block rendering until they arrived.
+/// Has its own UID; once the download finished, its bookmarks move to magazine and its page cache is removed.
+- (PSCMagazine *)progressiveMagazine;
+
+/// Calls completionBlock (on the main thread) with progressiveMagazine once its trailer and cross-reference table are
+/// downloaded, so opening it doesn't wait on the main thread. Calls it with nil if there's no progressive magazine
+/// or it can't be opened.
+- (void)loadProgressiveMagazineWithCompletionBlock:(void (^)(PSCMagazine *progressiveMagazine))completionBlock;
+
 @end
@@ -7,8 +7,8 @@
 
 #import "PSCDownload.h"
 #import "PSCStoreManager.h"
-#import "AFHTTPRequestOperation.h"
-#import "AFDownloadRequestOperation.h"
+#import "PSCSegmentedDownload.h"
+#import "PSCProgressiveDataProvider.h"
 
 @interface PSCDownload () {
     UIProgressView *progressView_;
@@ -17,8 +17,10 @@
 @property(nonatomic, assign) PSPDFStoreDownloadStatus status;
 @property(nonatomic, assign) float downloadProgress;
 @property(nonatomic, strong) NSError *error;
-@property(nonatomic, strong) AFHTTPRequestOperation *request;
+@property(nonatomic, strong) PSCSegmentedDownload *request;
 @property(nonatomic, assign, getter=isCancelled) BOOL cancelled;
+@property(nonatomic, strong) PSCMagazine *progressiveMagazine;
+@property(nonatomic, strong) PSCProgressiveDataProvider *progressiveDataProvider;
 @end
 
 @implementation PSCDownload
@@ -92,29 +94,28 @@
 
     PSCLog(@"downloading pdf from %@ to %@", self.URL, destPath);
 
-    // create request
-    NSURLRequest *request = [NSURLRequest requestWithURL:self.URL];
-    AFDownloadRequestOperation *pdfRequest = [[AFDownloadRequestOperation alloc] initWithRequest:request targetPath:[self downloadDirectory] shouldResume:YES];
-    __ps_weak AFDownloadRequestOperation *pdfRequestWeak = pdfRequest;
-    [pdfRequest setShouldExecuteAsBackgroundTaskWithExpirationHandler:^{
+    // create request; large issues are fetched in parallel byte ranges and resume per segment.
+    PSCSegmentedDownload *pdfRequest = [[PSCSegmentedDownload alloc] initWithURL:self.URL targetPath:destPath];
+    __ps_weak PSCSegmentedDownload *pdfRequestWeak = pdfRequest;
+    pdfRequest.backgroundTaskExpirationHandler = ^{
         PSCLog(@"Download background time expired for %@", pdfRequestWeak);
-    }];
-    [pdfRequest setCompletionBlockWithSuccess:^(AFHTTPRequestOperation *operation, id responseObject) {
-        PSCLog(@"Download finished: %@", self.URL);
-
-        if (self.isCancelled) {
+    };
+    pdfRequest.completionBlock = ^(NSError *error) {
+        if (error || self.isCancelled) {
+            PSCLog(@"Download failed: %@. Reason: %@.", self.URL, [error localizedDescription]);
             self.status = PSPDFStoreDownloadFailed;
+            self.error = error;
             self.magazine.downloading = NO;
             return;
         }
 
-        NSString *fileName = [self.request.request.URL lastPathComponent];
-        NSString *destinationPath = [[self downloadDirectory] stringByAppendingPathComponent:fileName];
-        NSURL *destinationURL = [NSURL fileURLWithPath:destinationPath];
+        PSCLog(@"Download finished: %@", self.URL);
+        NSURL *destinationURL = [NSURL fileURLWithPath:destPath];
         self.magazine.available = YES;
         self.magazine.downloading = NO;
         self.magazine.fileURL = destinationURL;
         self.status = PSPDFStoreDownloadFinished;
+        [self finishProgressiveMagazine];
 
         // start crunching!
         [[PSPDFCache sharedCache] cacheDocument:self.magazine startAtPage:0 size:PSPDFSizeNative];
@@ -122,22 +123,57 @@
 
         // don't back up the downloaded pdf - iCloud is for self-created files only.
         [self addSkipBackupAttributeToItemAtURL:destinationURL];
-    } failure:^(AFHTTPRequestOperation *operation, NSError *error) {
-        PSCLog(@"Download failed: %@. Reason: %@.", self.URL, [error localizedDescription]);
-        self.status = PSPDFStoreDownloadFailed;
-        self.error = pdfRequestWeak.error;
-        self.magazine.downloading = NO;
-    }];
-    [pdfRequest setProgressiveDownloadProgressBlock:^(NSInteger bytesRead, long long totalBytesRead, long long totalBytesExpected, long long totalBytesReadForFile, long long totalBytesExpectedToReadForFile) {
-        self.downloadProgress = totalBytesReadForFile/(float)totalBytesExpectedToReadForFile;
-
-    }];    
+    };
+    pdfRequest.progressBlock = ^(long long bytesWritten, long long totalBytes) {
+        if (totalBytes > 0) self.downloadProgress = bytesWritten/(float)totalBytes;
+    };
     [pdfRequest start];
 
     self.request = pdfRequest; // save request
     [[PSCStoreManager sharedStoreManager] addMagazinesToStore:@[self.magazine]];
 }
 
+- (PSCMagazine *)progressiveMagazine {
+    if (!_progressiveMagazine && self.request && !self.request.isFinished) {
+        PSCProgressiveDataProvider *dataProvider = [[PSCProgressiveDataProvider alloc] initWithDownload:self.request];
+        CGDataProviderRef dataProviderRef = [dataProvider dataProviderRef];
+        if (dataProviderRef) {
+            PSCMagazine *progressiveMagazine = [[PSCMagazine alloc] initWithDataProvider:dataProviderRef];
+            progressiveMagazine.title = self.magazine.title;
+            // own UID, so partially loaded pages never end up in the cache of the final magazine. (else the provider is copied to calculate the UID)
+            progressiveMagazine.UID = [NSString stringWithFormat:@"progressive_%@", self.magazine.UID];
+            progressiveMagazine.available = YES;
+            _progressiveMagazine = progressiveMagazine;
+            _progressiveDataProvider = dataProvider;
+        }
+    }
+    return _progressiveMagazine;
+}
+
+// Moves bookmarks set while reading the partial download to the final magazine and purges the partial page cache.
+- (void)finishProgressiveMagazine {
+    PSCMagazine *progressiveMagazine = _progressiveMagazine;
+    if (!progressiveMagazine) return;
+
+    PSPDFBookmarkParser *bookmarkParser = self.magazine.bookmarkParser;
+    for (PSPDFBookmark *bookmark in progressiveMagazine.bookmarkParser.bookmarks) {
+        if (![bookmarkParser bookmarkForPage:bookmark.page]) [bookmarkParser addBookmarkForPage:bookmark.page];
+    }
+    [[PSPDFCache sharedCache] removeCacheForDocument:progressiveMagazine deleteDocument:NO waitUntilDone:NO];
+}
+
+- (void)loadProgressiveMagazineWithCompletionBlock:(void (^)(PSCMagazine *progressiveMagazine))completionBlock {
+    PSCMagazine *progressiveMagazine = [self progressiveMagazine];
+    if (!progressiveMagazine || self.progressiveDataProvider.isDocumentLoaded) {
+        if (completionBlock) completionBlock(progressiveMagazine);
+        return;
+    }
+
+    [self.progressiveDataProvider loadDocumentWithCompletionBlock:^(BOOL success) {
+        if (completionBlock) completionBlock(success ? progressiveMagazine : nil);
+    }];
+}
+
 - (void)cancelDownload {
     self.cancelled = YES;
     [_request cancel];
@@ -0,0 +1,47 @@
+//
+//  PSCDownloadProgressHub.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+@class PSCDownloadProgressHub;
+
+@protocol PSCDownloadProgressObserver <NSObject>
+
+/// Average progress of the observed downloads changed visibly. Finished downloads count as 1.
+- (void)downloadProgressHub:(PSCDownloadProgressHub *)progressHub didUpdateProgress:(float)progress animated:(BOOL)animated;
+
+@end
+
+/**
+    Delivers download progress to the grid at a fixed rate.
+
+    Instead of every cell observing every download, the hub samples downloadProgress of all observed downloads once
+    per updateInterval on the main thread and pushes only the values that changed by at least minimumProgressChange,
+    all within one CATransaction. Views that aren't in a window are skipped; they get the current value on the first
+    tick after they are visible again. The timer only runs while something is observed.
+
+    Observers aren't retained; remove them in prepareForReuse and dealloc. Entries of deallocated observers are dropped on
+    the next tick. Main thread only.
+*/
+@interface PSCDownloadProgressHub : NSObject
+
+/// Shared instance.
++ (PSCDownloadProgressHub *)sharedProgressHub;
+
+/// Observes the average progress of downloads (PSCDownload) for observer and reports the current value right away.
+/// Replaces downloads set before; nil or an empty array removes the observer.
+/// Once all downloads finished or failed, the last value is delivered (if the observer is in a window) and the observer is removed.
+- (void)setDownloads:(NSArray *)downloads forObserver:(UIView<PSCDownloadProgressObserver> *)observer;
+
+/// Stops delivering progress to observer.
+- (void)removeObserver:(UIView<PSCDownloadProgressObserver> *)observer;
+
+/// Sampling interval. Defaults to 1/10 second.
+@property(nonatomic, assign) NSTimeInterval updateInterval;
+
+/// Smaller changes aren't delivered (except reaching 1). Defaults to 0.005, less than a point of the cell progress bar.
+@property(nonatomic, assign) float minimumProgressChange;
+
+@end
@@ -0,0 +1,167 @@
+//
+//  PSCDownloadProgressHub.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCDownloadProgressHub.h"
+#import "PSCDownload.h"
+#import <QuartzCore/QuartzCore.h>
+
+@interface PSCDownloadProgressEntry : NSObject
+@property(nonatomic, __ps_weak) UIView<PSCDownloadProgressObserver> *observer;
+@property(nonatomic, copy) NSArray *downloads;
+@property(nonatomic, assign) float deliveredProgress; // -1 if nothing was delivered yet
+@end
+
+@implementation PSCDownloadProgressEntry
+@end
+
+@interface PSCDownloadProgressHub () {
+    NSMutableArray *_entries;
+    NSTimer *_updateTimer;
+}
+@end
+
+@implementation PSCDownloadProgressHub
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCDownloadProgressHub *)sharedProgressHub {
+    static dispatch_once_t pred = 0;
+    __strong static PSCDownloadProgressHub *_sharedProgressHub = nil;
+    dispatch_once(&pred, ^{
+        _sharedProgressHub = [self new];
+    });
+    return _sharedProgressHub;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _entries = [NSMutableArray new];
+        _updateInterval = 1/10.0;
+        _minimumProgressChange = 0.005f;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_updateTimer invalidate];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ observers:%d%@>", NSStringFromClass([self class]), [_entries count], _updateTimer ? @" sampling" : @""];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)setDownloads:(NSArray *)downloads forObserver:(UIView<PSCDownloadProgressObserver> *)observer {
+    NSParameterAssert([NSThread isMainThread]);
+    [self removeObserver:observer];
+    if (!observer || [downloads count] == 0) return;
+
+    PSCDownloadProgressEntry *entry = [PSCDownloadProgressEntry new];
+    entry.observer = observer;
+    entry.downloads = downloads;
+    entry.deliveredProgress = [self progressOfDownloads:downloads];
+    [observer downloadProgressHub:self didUpdateProgress:entry.deliveredProgress animated:NO];
+
+    if (![self downloadsAreDone:downloads]) {
+        [_entries addObject:entry];
+        [self startTimerIfNeeded];
+    }
+}
+
+// Called from the observer's dealloc, the weak reference of its entry is already nil then; drop those as well.
+- (void)removeObserver:(UIView<PSCDownloadProgressObserver> *)observer {
+    NSParameterAssert([NSThread isMainThread]);
+    NSIndexSet *indexes = [_entries indexesOfObjectsPassingTest:^BOOL(PSCDownloadProgressEntry *entry, NSUInteger idx, BOOL *stop) {
+        return !entry.observer || entry.observer == observer;
+    }];
+    [_entries removeObjectsAtIndexes:indexes];
+    if ([_entries count] == 0) [self stopTimer];
+}
+
+- (void)setUpdateInterval:(NSTimeInterval)updateInterval {
+    if (_updateInterval != updateInterval) {
+        _updateInterval = updateInterval;
+        [self stopTimer];
+        if ([_entries count]) [self startTimerIfNeeded];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (float)progressOfDownloads:(NSArray *)downloads {
+    float progress = 0.f;
+    for (PSCDownload *download in downloads) {
+        progress += download.status == PSPDFStoreDownloadFinished ? 1.f : download.downloadProgress;
+    }
+    return progress / [downloads count];
+}
+
+- (BOOL)downloadsAreDone:(NSArray *)downloads {
+    for (PSCDownload *download in downloads) {
+        if (download.status != PSPDFStoreDownloadFinished && download.status != PSPDFStoreDownloadFailed) return NO;
+    }
+    return YES;
+}
+
+- (void)startTimerIfNeeded {
+    if (_updateTimer) return;
+
+    // common modes: progress keeps moving while the grid scrolls.
+    _updateTimer = [NSTimer timerWithTimeInterval:self.updateInterval target:self selector:@selector(updateTimerFired:) userInfo:nil repeats:YES];
+    [[NSRunLoop mainRunLoop] addTimer:_updateTimer forMode:NSRunLoopCommonModes];
+}
+
+- (void)stopTimer {
+    [_updateTimer invalidate];
+    _updateTimer = nil;
+}
+
+- (void)updateTimerFired:(NSTimer *)timer {
+    // sample first, then deliver; an observer may change its downloads while we call it.
+    NSMutableArray *changedEntries = [NSMutableArray array];
+    NSMutableArray *changedProgress = [NSMutableArray array];
+    NSMutableIndexSet *doneIndexes = [NSMutableIndexSet indexSet];
+
+    [_entries enumerateObjectsUsingBlock:^(PSCDownloadProgressEntry *entry, NSUInteger idx, BOOL *stop) {
+        UIView<PSCDownloadProgressObserver> *observer = entry.observer;
+        if (!observer) {
+            [doneIndexes addIndex:idx]; // deallocated without removing itself
+            return;
+        }
+        BOOL done = [self downloadsAreDone:entry.downloads];
+        if (done) [doneIndexes addIndex:idx];
+        if (!observer.window) return; // not visible, delivered once it is (done ones get it with setDownloads:forObserver:)
+
+        float progress = [self progressOfDownloads:entry.downloads];
+        BOOL changed = fabsf(progress - entry.deliveredProgress) >= self.minimumProgressChange || (progress >= 1.f && entry.deliveredProgress < 1.f);
+        if (changed || (done && progress != entry.deliveredProgress)) {
+            entry.deliveredProgress = progress;
+            [changedEntries addObject:entry];
+            [changedProgress addObject:@(progress)];
+        }
+    }];
+    [_entries removeObjectsAtIndexes:doneIndexes];
+
+    if ([changedEntries count]) {
+        [CATransaction begin];
+        [changedEntries enumerateObjectsUsingBlock:^(PSCDownloadProgressEntry *entry, NSUInteger idx, BOOL *stop) {
+            [entry.observer downloadProgressHub:self didUpdateProgress:[changedProgress[idx] floatValue] animated:YES];
+        }];
+        [CATransaction commit];
+    }
+
+    if ([_entries count] == 0) [self stopTimer];
+}
+
+@end
@@ -0,0 +1,67 @@
+//
+//  PSCDownloadScheduler.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+typedef NS_ENUM(NSUInteger, PSCDownloadPriority) {
+    PSCDownloadPriorityReaderBlocking, // ranges a reader is waiting for right now (see PSCProgressiveDataProvider)
+    PSCDownloadPriorityUserInitiated, // the issue the user tapped, pages of an issue that is being read
+    PSCDownloadPriorityVisible,       // covers of visible cells, the store catalog
+    PSCDownloadPriorityPrefetch,      // everything the user doesn't wait for
+};
+
+/**
+    Global scheduler for all network operations of the Kiosk.
+
+    Operations wait in one lane per priority and are started in priority order. User-initiated operations may use one
+    slot more than the current limit, prefetches one less, so a tap never waits behind covers or prefetches. Reads that
+    block a reader have a lane of their own with one more reserved slot, so they never wait behind a whole issue.
+
+    The limit adapts to the measured throughput: while all slots are busy, it's moved up or down every few seconds and
+    kept in the direction that increased throughput (fewer connections if it didn't change). Report received bytes with
+    recordReceivedBytes:; responseData of finished AFURLConnectionOperations is counted automatically.
+
+    pauseAll/resumeAll nest; while paused, nothing is started in any lane and running AFURLConnectionOperations are
+    paused (they resume with a range request).
+*/
+@interface PSCDownloadScheduler : NSObject
+
+/// Shared instance.
++ (PSCDownloadScheduler *)sharedDownloadScheduler;
+
+/// Queues operation. It's started when a slot for its priority is free.
+- (void)addOperation:(NSOperation *)operation priority:(PSCDownloadPriority)priority;
+
+/// Moves a queued operation into another lane, e.g. when a cover scrolls into view. No effect on running operations.
+- (void)setPriority:(PSCDownloadPriority)priority forOperation:(NSOperation *)operation;
+
+/// Adds bytes to the throughput measurement. Thread safe and cheap, call it for every received chunk.
+- (void)recordReceivedBytes:(long long)bytes;
+
+/// Stops starting operations and pauses running ones, e.g. during rendering-heavy phases.
+- (void)pauseAll;
+
+/// Balances pauseAll.
+- (void)resumeAll;
+
+@property(nonatomic, assign, readonly, getter=isPaused) BOOL paused;
+
+/// Current limit of concurrent operations.
+@property(nonatomic, assign, readonly) NSUInteger concurrentOperationCount;
+
+/// Bounds of the adaptive limit. Default to 2 and 8.
+@property(nonatomic, assign) NSUInteger minimumConcurrentOperationCount;
+@property(nonatomic, assign) NSUInteger maximumConcurrentOperationCount;
+
+/// Smoothed throughput in bytes per second while operations run.
+@property(nonatomic, assign, readonly) double throughput;
+
+/// Number of queued (not yet started) operations with priority.
+- (NSUInteger)queuedOperationCountForPriority:(PSCDownloadPriority)priority;
+
+/// Number of started, unfinished operations.
+@property(nonatomic, assign, readonly) NSUInteger runningOperationCount;
+
+@end
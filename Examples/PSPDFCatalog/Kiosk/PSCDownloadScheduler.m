@@ -0,0 +1,256 @@
+//
+//  PSCDownloadScheduler.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCDownloadScheduler.h"
+#import "AFURLConnectionOperation.h"
+#include <libkern/OSAtomic.h>
+
+#define kPSCDownloadPriorityCount 4
+#define kPSCDownloadSchedulerSampleInterval 1.0 // seconds
+#define kPSCDownloadSchedulerSamplesPerAdjustment 3
+#define kPSCDownloadSchedulerThroughputSmoothing 0.3
+#define kPSCDownloadSchedulerSignificantChange 0.05
+
+@interface PSCDownloadScheduler () {
+    NSMutableArray *_queuedOperations[kPSCDownloadPriorityCount];
+    NSMutableArray *_runningOperations;
+    NSOperationQueue *_operationQueue;
+    NSUInteger _pauseCount;
+    volatile int64_t _receivedBytes;
+    dispatch_source_t _sampleTimer;
+    NSUInteger _samplesSinceAdjustment;
+    double _throughputAtLastAdjustment;
+    NSInteger _adjustmentDirection;
+    dispatch_queue_t _schedulerQueue;
+}
+@property(nonatomic, assign) NSUInteger concurrentOperationCount;
+@property(nonatomic, assign) double throughput;
+@end
+
+@implementation PSCDownloadScheduler
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCDownloadScheduler *)sharedDownloadScheduler {
+    static dispatch_once_t pred = 0;
+    __strong static PSCDownloadScheduler *_sharedDownloadScheduler = nil;
+    dispatch_once(&pred, ^{
+        _sharedDownloadScheduler = [self new];
+    });
+    return _sharedDownloadScheduler;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        for (NSUInteger priority = 0; priority < kPSCDownloadPriorityCount; priority++) _queuedOperations[priority] = [NSMutableArray new];
+        _runningOperations = [NSMutableArray new];
+        _operationQueue = [NSOperationQueue new]; // admission is done here, not by the queue.
+        _minimumConcurrentOperationCount = 2;
+        _maximumConcurrentOperationCount = 8;
+        _concurrentOperationCount = 3;
+        _adjustmentDirection = 1;
+        _schedulerQueue = dispatch_queue_create("com.pspdfkit.catalog.downloadSchedulerQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_sampleTimer) {
+        dispatch_source_cancel(_sampleTimer);
+        PSPDFDispatchRelease(_sampleTimer);
+    }
+    PSPDFDispatchRelease(_schedulerQueue);
+}
+
+- (NSString *)description {
+    __block NSString *description;
+    dispatch_sync(_schedulerQueue, ^{
+        description = [NSString stringWithFormat:@"<%@ running:%d limit:%d queued:%d/%d/%d/%d throughput:%.0fKB/s%@>", NSStringFromClass([self class]), [_runningOperations count], _concurrentOperationCount, [_queuedOperations[0] count], [_queuedOperations[1] count], [_queuedOperations[2] count], [_queuedOperations[3] count], _throughput / 1024, _pauseCount ? @" paused" : @""];
+    });
+    return description;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)addOperation:(NSOperation *)operation priority:(PSCDownloadPriority)priority {
+    NSParameterAssert(operation && priority < kPSCDownloadPriorityCount);
+    dispatch_async(_schedulerQueue, ^{
+        [_queuedOperations[priority] addObject:operation];
+        [self startOperationsIfPossible];
+    });
+}
+
+- (void)setPriority:(PSCDownloadPriority)priority forOperation:(NSOperation *)operation {
+    NSParameterAssert(priority < kPSCDownloadPriorityCount);
+    dispatch_async(_schedulerQueue, ^{
+        for (NSUInteger lane = 0; lane < kPSCDownloadPriorityCount; lane++) {
+            if (lane != priority && [_queuedOperations[lane] containsObject:operation]) {
+                [_queuedOperations[lane] removeObject:operation];
+                [_queuedOperations[priority] addObject:operation];
+                [self startOperationsIfPossible];
+                break;
+            }
+        }
+    });
+}
+
+- (void)recordReceivedBytes:(long long)bytes {
+    OSAtomicAdd64Barrier(bytes, &_receivedBytes);
+}
+
+- (void)pauseAll {
+    dispatch_async(_schedulerQueue, ^{
+        if (_pauseCount++ > 0) return;
+        for (NSOperation *operation in _runningOperations) {
+            if ([operation isKindOfClass:[AFURLConnectionOperation class]] && [operation isExecuting]) [(AFURLConnectionOperation *)operation pause];
+        }
+    });
+}
+
+- (void)resumeAll {
+    dispatch_async(_schedulerQueue, ^{
+        if (_pauseCount == 0 || --_pauseCount > 0) return;
+        for (NSOperation *operation in _runningOperations) {
+            if ([operation isKindOfClass:[AFURLConnectionOperation class]] && [(AFURLConnectionOperation *)operation isPaused]) [(AFURLConnectionOperation *)operation resume];
+        }
+        [self startOperationsIfPossible];
+    });
+}
+
+- (BOOL)isPaused {
+    __block BOOL paused;
+    dispatch_sync(_schedulerQueue, ^{ paused = _pauseCount > 0; });
+    return paused;
+}
+
+- (NSUInteger)queuedOperationCountForPriority:(PSCDownloadPriority)priority {
+    __block NSUInteger count = 0;
+    dispatch_sync(_schedulerQueue, ^{ count = priority < kPSCDownloadPriorityCount ? [_queuedOperations[priority] count] : 0; });
+    return count;
+}
+
+- (NSUInteger)runningOperationCount {
+    __block NSUInteger count;
+    dispatch_sync(_schedulerQueue, ^{ count = [_runningOperations count]; });
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Needs to be called on _schedulerQueue.
+- (BOOL)canStartOperationWithPriority:(PSCDownloadPriority)priority {
+    NSUInteger runningCount = [_runningOperations count];
+    switch (priority) {
+        case PSCDownloadPriorityReaderBlocking: return runningCount < _concurrentOperationCount + 2;
+        case PSCDownloadPriorityUserInitiated: return runningCount < _concurrentOperationCount + 1;
+        case PSCDownloadPriorityVisible:       return runningCount < _concurrentOperationCount;
+        default:                               return runningCount < MAX(_concurrentOperationCount - 1, 1U);
+    }
+}
+
+// Needs to be called on _schedulerQueue.
+- (void)startOperationsIfPossible {
+    if (_pauseCount > 0) return; // no lane dequeues while paused
+
+    for (NSUInteger priority = 0; priority < kPSCDownloadPriorityCount; priority++) {
+        NSMutableArray *queuedOperations = _queuedOperations[priority];
+        while ([queuedOperations count] && [self canStartOperationWithPriority:priority]) {
+            NSOperation *operation = queuedOperations[0];
+            [queuedOperations removeObjectAtIndex:0];
+            [self startOperation:operation];
+        }
+        if ([queuedOperations count]) break; // lower lanes never overtake
+    }
+}
+
+// Needs to be called on _schedulerQueue.
+- (void)startOperation:(NSOperation *)operation {
+    [_runningOperations addObject:operation];
+
+    // the completion block belongs to the operation (AFNetworking uses it); a dependent operation tells us when it's done.
+    NSBlockOperation *finishOperation = [NSBlockOperation blockOperationWithBlock:^{
+        dispatch_async(_schedulerQueue, ^{
+            [self operationFinished:operation];
+        });
+    }];
+    [finishOperation addDependency:operation];
+    [_operationQueue addOperation:finishOperation];
+    [_operationQueue addOperation:operation];
+
+    [self startSampleTimerIfNeeded];
+}
+
+// Needs to be called on _schedulerQueue.
+- (void)operationFinished:(NSOperation *)operation {
+    if ([operation isKindOfClass:[AFURLConnectionOperation class]]) {
+        [self recordReceivedBytes:[[(AFURLConnectionOperation *)operation responseData] length]];
+    }
+    [_runningOperations removeObject:operation];
+    [self startOperationsIfPossible];
+}
+
+// Needs to be called on _schedulerQueue.
+- (void)startSampleTimerIfNeeded {
+    if (_sampleTimer) return;
+
+    _sampleTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _schedulerQueue);
+    uint64_t interval = (uint64_t)(kPSCDownloadSchedulerSampleInterval * NSEC_PER_SEC);
+    dispatch_source_set_timer(_sampleTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    __ps_weak PSCDownloadScheduler *weakSelf = self;
+    dispatch_source_set_event_handler(_sampleTimer, ^{
+        [weakSelf sampleThroughput];
+    });
+    dispatch_resume(_sampleTimer);
+}
+
+// Needs to be called on _schedulerQueue.
+- (void)sampleThroughput {
+    int64_t receivedBytes = _receivedBytes;
+    OSAtomicAdd64Barrier(-receivedBytes, &_receivedBytes);
+    double sample = receivedBytes / kPSCDownloadSchedulerSampleInterval;
+    _throughput = _throughput > 0 ? _throughput + kPSCDownloadSchedulerThroughputSmoothing * (sample - _throughput) : sample;
+
+    // nothing to measure; stop the timer until the next operation starts.
+    if ([_runningOperations count] == 0) {
+        dispatch_source_cancel(_sampleTimer);
+        PSPDFDispatchRelease(_sampleTimer);
+        _sampleTimer = NULL;
+        _samplesSinceAdjustment = 0;
+        return;
+    }
+
+    // only a saturated limit says something about the right number of connections.
+    BOOL saturated = [_runningOperations count] >= _concurrentOperationCount && _pauseCount == 0;
+    if (!saturated || ++_samplesSinceAdjustment < kPSCDownloadSchedulerSamplesPerAdjustment) return;
+    _samplesSinceAdjustment = 0;
+
+    if (_throughputAtLastAdjustment > 0) {
+        double change = (_throughput - _throughputAtLastAdjustment) / _throughputAtLastAdjustment;
+        if (change < -kPSCDownloadSchedulerSignificantChange) {
+            _adjustmentDirection = -_adjustmentDirection; // last step made it worse
+        }else if (change < kPSCDownloadSchedulerSignificantChange) {
+            _adjustmentDirection = -1; // no gain, prefer fewer connections
+        }
+    }
+    _throughputAtLastAdjustment = _throughput;
+
+    NSInteger concurrentOperationCount = (NSInteger)_concurrentOperationCount + _adjustmentDirection;
+    concurrentOperationCount = MAX(MIN(concurrentOperationCount, (NSInteger)self.maximumConcurrentOperationCount), (NSInteger)self.minimumConcurrentOperationCount);
+    if ((NSUInteger)concurrentOperationCount != _concurrentOperationCount) {
+        PSCLog(@"Download limit %d -> %d at %.0fKB/s", _concurrentOperationCount, concurrentOperationCount, _throughput / 1024);
+        _concurrentOperationCount = concurrentOperationCount;
+        [self startOperationsIfPossible];
+    }
+}
+
+@end
@@ -27,6 +27,9 @@
     NSUInteger _animationCellIndex;
     BOOL _animationDoubleWithPageCurl;
     BOOL _animateViewWillAppearWithFade;
+    NSUInteger _storeUpdateCount;
+    BOOL _needsReloadAfterStoreUpdate;
+    BOOL _loadingProgressiveMagazine;
 }
 @property(nonatomic, assign) BOOL immediatelyLoadCellImages; // UI tweak.
 @property(nonatomic, assign, getter=isEditMode) BOOL editMode;
@@ -602,7 +605,34 @@
     PSCLog(@"Magazine selected: %d %@", indexPath.item, magazine);
 
     if ([folder.magazines count] == 1 || self.magazineFolder) {
-        if (magazine.isDownloading) {
+        PSCDownload *download = magazine.isDownloading ? [[PSCStoreManager sharedStoreManager] downloadObjectForMagazine:magazine] : nil;
+        if ([download progressiveMagazine]) {
+            // read while downloading; pages wait for their data. Show a spinner until the trailer and
+            // cross-reference table are there, so opening doesn't wait on the main thread.
+            if (_loadingProgressiveMagazine) return;
+            _loadingProgressiveMagazine = YES;
+            PSCollectionViewCell *cell = [self.gridView cellForItemAtIndexPath:indexPath];
+            UIActivityIndicatorView *activityView = [[UIActivityIndicatorView alloc] initWithActivityIndicatorStyle:UIActivityIndicatorViewStyleWhiteLarge];
+            activityView.center = CGPointMake(roundf(cell.bounds.size.width/2.f), roundf(cell.bounds.size.height/2.f));
+            [cell.contentView addSubview:activityView];
+            [activityView startAnimating];
+
+            NSUInteger cellIndex = indexPath.item;
+            [download loadProgressiveMagazineWithCompletionBlock:^(PSCMagazine *progressiveMagazine) {
+                _loadingProgressiveMagazine = NO;
+                [activityView removeFromSuperview];
+                if (!self.view.window) return;
+                if (progressiveMagazine) {
+                    [self openMagazine:progressiveMagazine animated:NO cellIndex:cellIndex];
+                }else {
+                    [[[UIAlertView alloc] initWithTitle:NSLocalizedString(@"Item is currently downloading.", @"")
+                                                message:nil
+                                               delegate:nil
+                                      cancelButtonTitle:NSLocalizedString(@"OK", @"")
+                                      otherButtonTitles:nil] show];
+                }
+            }];
+        } else if (magazine.isDownloading) {
             [[[UIAlertView alloc] initWithTitle:NSLocalizedString(@"Item is currently downloading.", @"")
                                         message:nil
                                        delegate:nil
@@ -635,8 +665,18 @@
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - PSPDFStoreManagerDelegate
 
-- (void)magazineStoreBeginUpdate {}
-- (void)magazineStoreEndUpdate {}
+- (void)magazineStoreBeginUpdate {
+    _storeUpdateCount++;
+}
+
+// catalog batches add many magazines at once, reload only once per update.
+- (void)magazineStoreEndUpdate {
+    if (_storeUpdateCount > 0) _storeUpdateCount--;
+    if (_storeUpdateCount == 0 && _needsReloadAfterStoreUpdate) {
+        _needsReloadAfterStoreUpdate = NO;
+        [self.gridView reloadData];
+    }
+}
 
 - (void)magazineStoreFolderDeleted:(PSCMagazineFolder *)magazineFolder {
     if (!self.magazineFolder) {
@@ -692,7 +732,11 @@
 }
 
 - (void)magazineStoreMagazineAdded:(PSCMagazine *)magazine {
-    [self.gridView reloadData];
+    if (_storeUpdateCount > 0) {
+        _needsReloadAfterStoreUpdate = YES;
+    }else {
+        [self.gridView reloadData];
+    }
     // TODO: PSPDFGridView has some problems with inserting elements; will be fixed soon.
     /*
      if (self.magazineFolder) {
@@ -10,27 +10,24 @@
 #import "PSCImageGridViewCell.h"
 #import "PSCDownload.h"
 #import "PSCStoreManager.h"
-#import "UIImageView+AFNetworking.h"
+#import "PSCDownloadProgressHub.h"
+#import "PSCCoverPipeline.h"
 
 #define kPSPDFKitDownloadingKey @"downloading"
 #define kPSPDFCellAnimationDuration 0.25f
 
-@interface PSCImageGridViewCell() {
-    __block NSOperation *imageLoadOperation_;
-    UIImage *magazineOperationImage_;
-    NSString *magazineTitle_;
+@interface PSCImageGridViewCell() <PSCDownloadProgressObserver> {
+    id coverRequest_;
     CGRect defaultFrame_;
 
     UIView *progressViewBackground_;
     UILabel *magazineCounter_;
     UIImageView *_magazineCounterBadgeImage;
-    NSMutableSet *observedMagazineDownloads_;
 }
 @property(nonatomic, strong) UIImageView *magazineCounterBadgeImage;
 @property(nonatomic, strong) UIProgressView *progressView;
 - (void)setProgress:(float)theProgress animated:(BOOL)animated;
 - (void)darkenView:(BOOL)darken animated:(BOOL)animated;
-- (void)updateProgressAnimated:(BOOL)animated;
 @end
 
 @implementation PSCImageGridViewCell
@@ -51,25 +48,49 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - Private
 
-- (void)checkMagazineAndObserveProgressIfDownloading:(PSCMagazine *)magazine {
-    if (magazine.isDownloading) {
-        PSCDownload *download = [[PSCStoreManager sharedStoreManager] downloadObjectForMagazine:magazine];
-        if (!download) {
-            PSPDFLogError(@"failed to find associated download object for %@", magazine);
-            return;
+// progress is sampled by PSCDownloadProgressHub; observing every download here floods the main queue.
+- (void)observeProgressOfDownloadingMagazines:(NSArray *)magazines {
+    NSMutableArray *downloads = [NSMutableArray array];
+    for (PSCMagazine *magazine in magazines) {
+        if (magazine.isDownloading) {
+            PSCDownload *download = [[PSCStoreManager sharedStoreManager] downloadObjectForMagazine:magazine];
+            if (!download) {
+                PSPDFLogError(@"failed to find associated download object for %@", magazine);
+                continue;
+            }
+            [downloads addObject:download];
         }
-        [observedMagazineDownloads_ addObject:download];
-        [download addObserver:self forKeyPath:NSStringFromSelector(@selector(downloadProgress)) options:NSKeyValueObservingOptionInitial context:kPSPDFKVOToken];
-        [self updateProgressAnimated:NO];
     }
+    [[PSCDownloadProgressHub sharedProgressHub] setDownloads:downloads forObserver:self];
 }
 
 - (void)clearProgressObservers {
-    // clear all observed magazines
-    for (PSCDownload *download in observedMagazineDownloads_) {
-        [download removeObserver:self forKeyPath:NSStringFromSelector(@selector(downloadProgress)) context:kPSPDFKVOToken];
+    [[PSCDownloadProgressHub sharedProgressHub] removeObserver:self];
+}
+
+// covers are pre-sized for the cell and cached decoded; requests are cancelled on reuse.
+- (void)loadCoverForMagazine:(PSCMagazine *)magazine animated:(BOOL)animated {
+    PSCCoverPipeline *coverPipeline = [PSCCoverPipeline sharedCoverPipeline];
+    [coverPipeline cancelRequest:coverRequest_];
+    coverRequest_ = nil;
+
+    if (self.immediatelyLoadCellImages) {
+        UIImage *cover = [coverPipeline coverForMagazine:magazine size:self.frame.size];
+        if (cover || !magazine.imageURL) {
+            [self setImage:cover animated:NO];
+            return;
+        }
     }
-    [observedMagazineDownloads_ removeAllObjects];
+
+    __ps_weak PSCImageGridViewCell *weakSelf = self;
+    coverRequest_ = [coverPipeline requestCoverForMagazine:magazine size:self.frame.size completion:^(UIImage *cover) {
+        PSCImageGridViewCell *strongSelf = weakSelf;
+        strongSelf->coverRequest_ = nil;
+        if (cover) {
+            // animating this is too expensive while scrolling.
+            [strongSelf setImage:cover animated:animated];
+        }
+    }];
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -80,9 +101,6 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
         defaultFrame_ = frame;
         //self.deleteButtonIcon = [UIImage imageNamed:@"delete"];
 
-        // incomplete downloads stay here
-        observedMagazineDownloads_ = [[NSMutableSet alloc] init];
-
         self.showingSiteLabel = YES;
         self.edgeInsets = UIEdgeInsetsMake(0, 0, 10, 0);
     }
@@ -91,6 +109,7 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
 }
 
 - (void)dealloc {
+    [[PSCCoverPipeline sharedCoverPipeline] cancelRequest:coverRequest_];
     [_magazine removeObserver:self forKeyPath:kPSPDFKitDownloadingKey context:kPSPDFKVOToken];
     [self clearProgressObservers];
     [[PSPDFCache sharedCache] removeDelegate:self];
@@ -140,27 +159,13 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - KVO
 
-- (void)updateProgressAnimated:(BOOL)animated {
-    float progressTotal = 1.f;
-
-    if ([observedMagazineDownloads_ count]) {
-        progressTotal = [[observedMagazineDownloads_ valueForKeyPath:@"@avg.downloadProgress"] floatValue];
-    }
-
-    [self setProgress:progressTotal animated:animated];
-}
-
 - (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context {
     if (context == kPSPDFKVOToken) {
-        if ([keyPath isEqualToString:NSStringFromSelector(@selector(downloadProgress))]) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [self updateProgressAnimated:YES];
-            });
-        }else if([keyPath isEqualToString:kPSPDFKitDownloadingKey]) {
+        if([keyPath isEqualToString:kPSPDFKitDownloadingKey]) {
             // check if magazine needs to be observed (if download progress is active)
-            if (self.magazine.isDownloading && ![observedMagazineDownloads_ containsObject:self.magazine]) {
+            if (self.magazine.isDownloading) {
                 dispatch_async(dispatch_get_main_queue(), ^{
-                    [self checkMagazineAndObserveProgressIfDownloading:self.magazine];
+                    [self observeProgressOfDownloadingMagazines:@[self.magazine]];
                 });
             }
         }
@@ -187,55 +192,19 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
             // add KVO for download property
             [magazine addObserver:self forKeyPath:kPSPDFKitDownloadingKey options:0 context:kPSPDFKVOToken];
 
-            // add KVO
-            [self checkMagazineAndObserveProgressIfDownloading:magazine];
+            // observe download progress
+            [self observeProgressOfDownloadingMagazines:@[magazine]];
 
             self.magazineCount = 0;
 
-            NSBlockOperation *imageLoadOperation = [NSBlockOperation new];
-            __ps_weak NSBlockOperation *weakImageLoadOperation = imageLoadOperation;
-            [imageLoadOperation addExecutionBlock:^{
-                NSBlockOperation *strongImageLoadOperation = weakImageLoadOperation;
-                if (!strongImageLoadOperation.isCancelled) {
-                    magazineOperationImage_ = [magazine coverImageForSize:self.frame.size];
-                }
-                BOOL imageLoadedFromWeb = NO;
-                if (!magazineOperationImage_ && !strongImageLoadOperation.isCancelled) {
-                    // try to download image
-                    if (!self.image && magazine.imageURL) {
-                        imageLoadedFromWeb = YES;
-                        PSPDFDispatchIfNotOnMainThread(^{
-                            [self.imageView setImageWithURL:magazine.imageURL];
-                        });
-                    }
-                }
-
-                // also may be slow, parsing the title from PDF metadata.
-                magazineTitle_ = magazine.title;
-
-                if (!strongImageLoadOperation.isCancelled && !imageLoadedFromWeb) {
-                    PSPDFDispatchIfNotOnMainThread(^{
-                        if(!strongImageLoadOperation.isCancelled) {
-                            // animating this is too expensive.
-                            [self setImage:magazineOperationImage_ animated:NO];
-                            self.siteLabel.text = magazineTitle_;
-                        }
-                    });
-                }
-            }];
-
-            if (self.immediatelyLoadCellImages) {
-                [imageLoadOperation start]; // start directly.
-            }else {
-                [[[self class] thumbnailQueue] addOperation:imageLoadOperation];
-                imageLoadOperation_ = imageLoadOperation;
-            }
+            [self loadCoverForMagazine:magazine animated:NO];
 
             // dark out view if it needs to be downloaded
             [self darkenView:!magazine.isAvailable animated:NO];
         }
 
-        NSString *siteLabelText = PSPDFStripPDFFileType([magazine.files ps_firstObject]);
+        // the title of local magazines comes from the library catalog and is cheap.
+        NSString *siteLabelText = magazine.isAvailable ? magazine.title : PSPDFStripPDFFileType([magazine.files ps_firstObject]);
         [self updateSiteLabel]; // create lazily
         self.siteLabel.text = [siteLabelText length] ? siteLabelText : magazine.title;
         [self updateSiteLabel];
@@ -252,9 +221,7 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
         [self clearProgressObservers];
         _magazineFolder = magazineFolder;
 
-        for (PSCMagazine *aMagazine in _magazineFolder.magazines) {
-            [self checkMagazineAndObserveProgressIfDownloading:aMagazine];
-        }
+        [self observeProgressOfDownloadingMagazines:_magazineFolder.magazines];
 
         // setup for folder
         if (magazineFolder) {
@@ -268,7 +235,7 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
                     break;
                 }
             }
-            self.image = [coverMagazine coverImageForSize:self.frame.size];
+            [self loadCoverForMagazine:coverMagazine animated:NO];
         }
         self.accessibilityLabel = self.magazineFolder.title;
     }
@@ -407,14 +374,21 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
     [self setNeedsLayout];
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSCDownloadProgressObserver
+
+- (void)downloadProgressHub:(PSCDownloadProgressHub *)progressHub didUpdateProgress:(float)progress animated:(BOOL)animated {
+    [self setProgress:progress animated:animated];
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - PSPDFGridViewCell
 
 - (void)prepareForReuse {
     [super prepareForReuse];
     [self clearProgressObservers];
-    [imageLoadOperation_ cancel];
-    [self.imageView cancelImageRequestOperation];
+    [[PSCCoverPipeline sharedCoverPipeline] cancelRequest:coverRequest_];
+    coverRequest_ = nil;
     self.imageView.image = nil;
     [self setImageSize:defaultFrame_.size];
     [self darkenView:NO animated:NO];
@@ -438,7 +412,8 @@ void PSPDFDispatchIfNotOnMainThread(dispatch_block_t block) {
     }
 
     if (magazine == document && page == 0 && size == PSPDFSizeThumbnail) {
-        [self setImage:cachedImage animated:YES];
+        [[PSCCoverPipeline sharedCoverPipeline] removeCoversForMagazine:magazine];
+        [self loadCoverForMagazine:magazine animated:YES];
     }
 }
 
@@ -9,6 +9,7 @@
 #import "PSCMagazine.h"
 #import "PSCSettingsController.h"
 #import "PSCGridController.h"
+#import "PSCStorageQuotaManager.h"
 #import "PSCSettingsBarButtonItem.h"
 #import "PSCMetadataBarButtonItem.h"
 #import "PSCAnnotationTableBarButtonItem.h"
@@ -28,6 +29,7 @@ NSString *const kPSPDFAspectRatioVarianceCalculated = @"kPSPDFAspectRatioVarianc
 - (id)initWithDocument:(PSPDFDocument *)document {
     if ((self = [super initWithDocument:document])) {
         self.delegate = self;
+        [[PSCStorageQuotaManager sharedStorageQuotaManager] documentDidOpen:document];
         
         // initally update vars
         [self globalVarChanged];
@@ -88,6 +90,7 @@ NSString *const kPSPDFAspectRatioVarianceCalculated = @"kPSPDFAspectRatioVarianc
         NSData *viewStateData = [NSKeyedArchiver archivedDataWithRootObject:[self viewState]];
         [[NSUserDefaults standardUserDefaults] setObject:viewStateData forKey:self.document.UID];
     }
+    [[PSCStorageQuotaManager sharedStorageQuotaManager] documentDidClose:self.document];
     [[NSNotificationCenter defaultCenter] removeObserver:self];
 }
 
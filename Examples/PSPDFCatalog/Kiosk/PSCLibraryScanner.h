@@ -0,0 +1,54 @@
+//
+//  PSCLibraryScanner.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/// A PDF file found by PSCLibraryScanner.
+@interface PSCLibraryScanEntry : NSObject
+
+/// Full path of the file.
+@property(nonatomic, copy, readonly) NSString *path;
+
+/// Name of the root folder for files in a root, else the folder path relative to the root ("Magazines/2012").
+@property(nonatomic, copy, readonly) NSString *folderTitle;
+
+/// Title from PSCLibraryCatalog.
+@property(nonatomic, copy, readonly) NSString *title;
+
+@property(nonatomic, assign, readonly) unsigned long long fileSize;
+@property(nonatomic, assign, readonly) NSTimeInterval modificationDate;
+
+@end
+
+typedef void (^PSCLibraryScanChangeHandler)(NSArray *addedEntries, NSArray *removedEntries);
+
+/**
+    Finds PDF files in folder hierarchies and reports what changed since the last scan.
+
+    The result of each scan (directories with their modification date and entries, files with size, modification date
+    and title) is persisted. The next scan only reads directories whose modification date changed, only stats files, and
+    only probes new or changed files. Directories are processed concurrently. Changes are reported in batches on the main
+    queue while the scan is running; modified files are reported as removed and added.
+*/
+@interface PSCLibraryScanner : NSObject
+
+/// Scans rootPaths and all their subdirectories. The snapshot is stored under snapshotName in the caches directory.
+- (id)initWithRootPaths:(NSArray *)rootPaths snapshotName:(NSString *)snapshotName;
+
+@property(nonatomic, copy, readonly) NSArray *rootPaths;
+
+/// Files of the last completed scan, without touching the file system. Use this to show the library right away.
+- (NSArray *)snapshotEntries;
+
+/// Starts a scan. changeHandler and completion are called on the main queue. Scans started while scanning are queued.
+- (void)scanWithChangeHandler:(PSCLibraryScanChangeHandler)changeHandler completion:(dispatch_block_t)completion;
+
+/// Number of directories processed at the same time. Defaults to 4.
+@property(nonatomic, assign) NSUInteger maxConcurrentScans;
+
+/// Number of entries collected before they are reported. Defaults to 20.
+@property(nonatomic, assign) NSUInteger batchSize;
+
+@end
@@ -0,0 +1,335 @@
+//
+//  PSCLibraryScanner.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCLibraryScanner.h"
+#import "PSCLibraryCatalog.h"
+#include <sys/stat.h>
+#include <dirent.h>
+
+#define kPSCLibraryScanSnapshotVersion 1
+#define kPSCLibraryScanDefaultMaxConcurrentScans 4
+#define kPSCLibraryScanDefaultBatchSize 20
+#define kPSCLibraryScanMaxDepth 32
+
+// Snapshot records: files are [folderTitle, title, size, modificationDate], directories [modificationDate, subdirectory names, pdf names].
+#define kPSCLibraryScanFileFolderTitle 0
+#define kPSCLibraryScanFileTitle 1
+#define kPSCLibraryScanFileSize 2
+#define kPSCLibraryScanFileModificationDate 3
+
+static NSTimeInterval PSCModificationDateOfStat(struct stat *fileStat) {
+    return fileStat->st_mtimespec.tv_sec + fileStat->st_mtimespec.tv_nsec / 1e9;
+}
+
+@interface PSCLibraryScanEntry ()
+@property(nonatomic, copy) NSString *path;
+@property(nonatomic, copy) NSString *folderTitle;
+@property(nonatomic, copy) NSString *title;
+@property(nonatomic, assign) unsigned long long fileSize;
+@property(nonatomic, assign) NSTimeInterval modificationDate;
+@end
+
+@implementation PSCLibraryScanEntry
+
++ (PSCLibraryScanEntry *)entryWithPath:(NSString *)path record:(NSArray *)record {
+    PSCLibraryScanEntry *entry = [PSCLibraryScanEntry new];
+    entry.path = path;
+    entry.folderTitle = record[kPSCLibraryScanFileFolderTitle];
+    entry.title = record[kPSCLibraryScanFileTitle];
+    entry.fileSize = [record[kPSCLibraryScanFileSize] unsignedLongLongValue];
+    entry.modificationDate = [record[kPSCLibraryScanFileModificationDate] doubleValue];
+    return entry;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %@ folder:%@ title:%@>", NSStringFromClass([self class]), self.path, self.folderTitle, self.title];
+}
+
+@end
+
+// State of a single scan. Results are collected on _resultQueue.
+@interface PSCLibraryScan : NSObject {
+    NSDictionary *_oldFiles, *_oldDirectories;
+    NSMutableDictionary *_files, *_directories;
+    NSMutableArray *_pendingAddedEntries, *_pendingRemovedEntries;
+    NSUInteger _batchSize;
+    PSCLibraryScanChangeHandler _changeHandler;
+    dispatch_group_t _group;
+    dispatch_semaphore_t _semaphore;
+    dispatch_queue_t _resultQueue;
+}
+- (id)initWithFiles:(NSDictionary *)files directories:(NSDictionary *)directories maxConcurrentScans:(NSUInteger)maxConcurrentScans batchSize:(NSUInteger)batchSize changeHandler:(PSCLibraryScanChangeHandler)changeHandler;
+- (void)scanRootPaths:(NSArray *)rootPaths;
+@property(nonatomic, strong, readonly) NSDictionary *files;
+@property(nonatomic, strong, readonly) NSDictionary *directories;
+@end
+
+@implementation PSCLibraryScan
+
+- (id)initWithFiles:(NSDictionary *)files directories:(NSDictionary *)directories maxConcurrentScans:(NSUInteger)maxConcurrentScans batchSize:(NSUInteger)batchSize changeHandler:(PSCLibraryScanChangeHandler)changeHandler {
+    if ((self = [super init])) {
+        _oldFiles = files ?: @{};
+        _oldDirectories = directories ?: @{};
+        _files = [NSMutableDictionary new];
+        _directories = [NSMutableDictionary new];
+        _pendingAddedEntries = [NSMutableArray new];
+        _pendingRemovedEntries = [NSMutableArray new];
+        _batchSize = MAX(batchSize, 1U);
+        _changeHandler = [changeHandler copy];
+        _group = dispatch_group_create();
+        _semaphore = dispatch_semaphore_create((long)MAX(maxConcurrentScans, 1U));
+        _resultQueue = dispatch_queue_create("com.pspdfkit.catalog.libraryScanResultQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    PSPDFDispatchRelease(_group);
+    PSPDFDispatchRelease(_semaphore);
+    PSPDFDispatchRelease(_resultQueue);
+}
+
+// Blocks until all directories are processed.
+- (void)scanRootPaths:(NSArray *)rootPaths {
+    for (NSString *rootPath in rootPaths) {
+        [self scanDirectoryAtPath:rootPath relativePath:@"" rootTitle:[rootPath lastPathComponent] depth:0];
+    }
+    dispatch_group_wait(_group, DISPATCH_TIME_FOREVER);
+
+    dispatch_sync(_resultQueue, ^{
+        [_oldFiles enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSArray *record, BOOL *stop) {
+            if (!_files[key]) [_pendingRemovedEntries addObject:[PSCLibraryScanEntry entryWithPath:[key stringByExpandingTildeInPath] record:record]];
+        }];
+        [self reportPendingEntries];
+    });
+}
+
+- (void)scanDirectoryAtPath:(NSString *)path relativePath:(NSString *)relativePath rootTitle:(NSString *)rootTitle depth:(NSUInteger)depth {
+    dispatch_group_async(_group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
+        @autoreleasepool {
+            [self processDirectoryAtPath:path relativePath:relativePath rootTitle:rootTitle depth:depth];
+        }
+        dispatch_semaphore_signal(_semaphore);
+    });
+}
+
+- (void)processDirectoryAtPath:(NSString *)path relativePath:(NSString *)relativePath rootTitle:(NSString *)rootTitle depth:(NSUInteger)depth {
+    struct stat directoryStat;
+    if (lstat([path fileSystemRepresentation], &directoryStat) != 0 || !S_ISDIR(directoryStat.st_mode)) return;
+
+    // an unchanged modification date means no entries were added, removed or renamed.
+    NSString *directoryKey = [path stringByAbbreviatingWithTildeInPath];
+    NSNumber *modificationDate = @(PSCModificationDateOfStat(&directoryStat));
+    NSArray *cachedDirectory = _oldDirectories[directoryKey];
+    NSArray *subdirectoryNames, *fileNames;
+    if ([cachedDirectory count] == 3 && [cachedDirectory[0] isEqual:modificationDate]) {
+        subdirectoryNames = cachedDirectory[1];
+        fileNames = cachedDirectory[2];
+    }else {
+        [self readDirectoryAtPath:path subdirectoryNames:&subdirectoryNames fileNames:&fileNames];
+    }
+    dispatch_sync(_resultQueue, ^{
+        _directories[directoryKey] = @[modificationDate, subdirectoryNames, fileNames];
+    });
+
+    if (depth < kPSCLibraryScanMaxDepth) {
+        for (NSString *subdirectoryName in subdirectoryNames) {
+            [self scanDirectoryAtPath:[path stringByAppendingPathComponent:subdirectoryName] relativePath:[relativePath stringByAppendingPathComponent:subdirectoryName] rootTitle:rootTitle depth:depth + 1];
+        }
+    }
+
+    NSString *folderTitle = [relativePath length] ? relativePath : rootTitle;
+    for (NSString *fileName in fileNames) {
+        NSString *filePath = [path stringByAppendingPathComponent:fileName];
+        struct stat fileStat;
+        if (stat([filePath fileSystemRepresentation], &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) continue;
+
+        NSString *fileKey = [filePath stringByAbbreviatingWithTildeInPath];
+        NSNumber *fileSize = @((unsigned long long)fileStat.st_size);
+        NSNumber *fileModificationDate = @(PSCModificationDateOfStat(&fileStat));
+        NSArray *oldRecord = _oldFiles[fileKey];
+        if ([oldRecord[kPSCLibraryScanFileSize] isEqual:fileSize] && [oldRecord[kPSCLibraryScanFileModificationDate] isEqual:fileModificationDate] && [oldRecord[kPSCLibraryScanFileFolderTitle] isEqual:folderTitle]) {
+            dispatch_sync(_resultQueue, ^{
+                _files[fileKey] = oldRecord;
+            });
+            continue;
+        }
+
+        // new or changed; this is the only case where the file is read.
+        NSString *title = [[PSCLibraryCatalog sharedLibraryCatalog] titleForFileAtPath:filePath];
+        NSArray *record = @[folderTitle, title, fileSize, fileModificationDate];
+        dispatch_sync(_resultQueue, ^{
+            _files[fileKey] = record;
+            if (oldRecord) [_pendingRemovedEntries addObject:[PSCLibraryScanEntry entryWithPath:filePath record:oldRecord]];
+            [_pendingAddedEntries addObject:[PSCLibraryScanEntry entryWithPath:filePath record:record]];
+            if ([_pendingAddedEntries count] >= _batchSize) [self reportPendingEntries];
+        });
+    }
+
+    dispatch_async(_resultQueue, ^{
+        [self reportPendingEntries];
+    });
+}
+
+// readdir gives us the type of most entries; no extra stat as with fileExistsAtPath:isDirectory:.
+- (void)readDirectoryAtPath:(NSString *)path subdirectoryNames:(NSArray **)subdirectoryNames fileNames:(NSArray **)fileNames {
+    NSMutableArray *subdirectories = [NSMutableArray array], *files = [NSMutableArray array];
+    DIR *directory = opendir([path fileSystemRepresentation]);
+    if (directory) {
+        NSFileManager *fileManager = [NSFileManager new];
+        struct dirent *directoryEntry;
+        while ((directoryEntry = readdir(directory))) {
+            if (directoryEntry->d_name[0] == '.') continue; // ".", ".." and hidden files
+            NSString *name = [fileManager stringWithFileSystemRepresentation:directoryEntry->d_name length:strlen(directoryEntry->d_name)];
+            uint8_t type = directoryEntry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat entryStat;
+                if (lstat([[path stringByAppendingPathComponent:name] fileSystemRepresentation], &entryStat) != 0) continue;
+                type = S_ISDIR(entryStat.st_mode) ? DT_DIR : (S_ISREG(entryStat.st_mode) ? DT_REG : DT_LNK);
+            }
+            // symlinked directories are not followed; no cycles.
+            if (type == DT_DIR) {
+                [subdirectories addObject:name];
+            }else if ((type == DT_REG || type == DT_LNK) && [[[name pathExtension] lowercaseString] isEqualToString:@"pdf"]) {
+                [files addObject:name];
+            }
+        }
+        closedir(directory);
+    }
+    *subdirectoryNames = subdirectories;
+    *fileNames = files;
+}
+
+// Needs to be called on _resultQueue.
+- (void)reportPendingEntries {
+    if ([_pendingAddedEntries count] == 0 && [_pendingRemovedEntries count] == 0) return;
+    NSArray *addedEntries = [_pendingAddedEntries copy], *removedEntries = [_pendingRemovedEntries copy];
+    [_pendingAddedEntries removeAllObjects];
+    [_pendingRemovedEntries removeAllObjects];
+
+    PSCLibraryScanChangeHandler changeHandler = _changeHandler;
+    if (changeHandler) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            changeHandler(addedEntries, removedEntries);
+        });
+    }
+}
+
+- (NSDictionary *)files {
+    __block NSDictionary *files;
+    dispatch_sync(_resultQueue, ^{ files = [_files copy]; });
+    return files;
+}
+
+- (NSDictionary *)directories {
+    __block NSDictionary *directories;
+    dispatch_sync(_resultQueue, ^{ directories = [_directories copy]; });
+    return directories;
+}
+
+@end
+
+@interface PSCLibraryScanner () {
+    NSString *_snapshotPath;
+    NSDictionary *_snapshot; // version, roots, files, directories
+    dispatch_queue_t _scanQueue;
+}
+@property(nonatomic, copy) NSArray *rootPaths;
+@end
+
+@implementation PSCLibraryScanner
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithRootPaths:(NSArray *)rootPaths snapshotName:(NSString *)snapshotName {
+    if ((self = [super init])) {
+        _rootPaths = [rootPaths copy];
+        _maxConcurrentScans = kPSCLibraryScanDefaultMaxConcurrentScans;
+        _batchSize = kPSCLibraryScanDefaultBatchSize;
+        NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+        _snapshotPath = [cachesPath stringByAppendingPathComponent:[snapshotName stringByAppendingPathExtension:@"plist"]];
+        _scanQueue = dispatch_queue_create("com.pspdfkit.catalog.libraryScanQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    PSPDFDispatchRelease(_scanQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ roots:%@ files:%d>", NSStringFromClass([self class]), self.rootPaths, [[self snapshotEntries] count]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSArray *)snapshotEntries {
+    NSDictionary *files = [self snapshot][@"files"];
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:[files count]];
+    [files enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSArray *record, BOOL *stop) {
+        [entries addObject:[PSCLibraryScanEntry entryWithPath:[key stringByExpandingTildeInPath] record:record]];
+    }];
+    [entries sortUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"path" ascending:YES]]];
+    return entries;
+}
+
+- (void)scanWithChangeHandler:(PSCLibraryScanChangeHandler)changeHandler completion:(dispatch_block_t)completion {
+    dispatch_async(_scanQueue, ^{
+        CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+        NSDictionary *snapshot = [self snapshot];
+        PSCLibraryScan *scan = [[PSCLibraryScan alloc] initWithFiles:snapshot[@"files"] directories:snapshot[@"directories"] maxConcurrentScans:self.maxConcurrentScans batchSize:self.batchSize changeHandler:changeHandler];
+        [scan scanRootPaths:self.rootPaths];
+
+        NSDictionary *files = scan.files;
+        [self saveSnapshot:@{@"version" : @(kPSCLibraryScanSnapshotVersion), @"roots" : [self abbreviatedRootPaths], @"files" : files, @"directories" : scan.directories}];
+        PSCLog(@"Scanned %d files in %.3fs.", [files count], CFAbsoluteTimeGetCurrent() - startTime);
+
+        // after the last batch of changes.
+        if (completion) dispatch_async(dispatch_get_main_queue(), completion);
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSArray *)abbreviatedRootPaths {
+    NSMutableArray *abbreviatedRootPaths = [NSMutableArray arrayWithCapacity:[self.rootPaths count]];
+    for (NSString *rootPath in self.rootPaths) [abbreviatedRootPaths addObject:[rootPath stringByAbbreviatingWithTildeInPath]];
+    return abbreviatedRootPaths;
+}
+
+- (NSDictionary *)snapshot {
+    @synchronized(self) {
+        if (!_snapshot) {
+            NSData *snapshotData = [NSData dataWithContentsOfFile:_snapshotPath options:NSDataReadingMappedIfSafe error:NULL];
+            NSDictionary *snapshot = snapshotData ? [NSPropertyListSerialization propertyListWithData:snapshotData options:NSPropertyListImmutable format:NULL error:NULL] : nil;
+            BOOL valid = [snapshot isKindOfClass:[NSDictionary class]] && [snapshot[@"version"] integerValue] == kPSCLibraryScanSnapshotVersion &&
+                         [snapshot[@"roots"] isEqual:[self abbreviatedRootPaths]] &&
+                         [snapshot[@"files"] isKindOfClass:[NSDictionary class]] && [snapshot[@"directories"] isKindOfClass:[NSDictionary class]];
+            if (snapshot && !valid) PSCLog(@"Discarding library snapshot at %@", _snapshotPath);
+            _snapshot = valid ? snapshot : @{};
+        }
+        return _snapshot;
+    }
+}
+
+- (void)saveSnapshot:(NSDictionary *)snapshot {
+    @synchronized(self) {
+        _snapshot = snapshot;
+    }
+
+    NSError *error = nil;
+    NSData *snapshotData = [NSPropertyListSerialization dataWithPropertyList:snapshot format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    if (!snapshotData || ![snapshotData writeToFile:_snapshotPath options:NSDataWritingAtomic error:&error]) {
+        PSCLog(@"Failed to write library snapshot: %@", error);
+    }
+}
+
+@end
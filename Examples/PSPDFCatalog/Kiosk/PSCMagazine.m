@@ -7,8 +7,15 @@
 
 #import "PSCMagazine.h"
 #import "PSCMagazineFolder.h"
+#import "PSCAnnotatedPageCache.h"
+#import "PSCPageGeometryCache.h"
 #import <QuartzCore/CATiledLayer.h>
 
+@interface PSCMagazine () {
+    PSCPageGeometryCache *_geometryCache;
+}
+@end
+
 @implementation PSCMagazine
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -38,6 +45,11 @@
 #pragma mark - Meta Data
 
 - (UIImage *)coverImageForSize:(CGSize)size {
+    // use a custom, centered lock image if the magazine is password protected.
+    if (self.isLocked && !CGSizeEqualToSize(size, CGSizeZero)) {
+        return [[self class] lockImageForSize:size];
+    }
+
     UIImage *coverImage = nil;
     
     // basic check if file is available - don't check for pageCount here, it's lazy evaluated.
@@ -45,22 +57,32 @@
         coverImage = [[PSPDFCache sharedCache] cachedImageForDocument:self page:0 size:PSPDFSizeThumbnail];
     }
     
-    // draw a custom, centered lock image if the magazine is password protected.
-    @autoreleasepool {
-        if (self.isLocked) {
-            if (!CGSizeEqualToSize(size, CGSizeZero)) {
-                UIGraphicsBeginImageContextWithOptions(size, YES, 0.0);
-                [[UIColor colorWithWhite:0.9 alpha:1.f] setFill];
-                CGContextFillRect(UIGraphicsGetCurrentContext(), (CGRect){.size=size});
-                UIImage *lockImage = [UIImage imageNamed:@"lock"];
-                CGSize lockImageTargetSize = PSPDFSizeForScale(lockImage.size, PSIsIpad() ? 0.6f : 0.3f);
-                [lockImage drawInRect:(CGRect){.origin={floorf((size.width-lockImageTargetSize.width)/2), floorf((size.height-lockImageTargetSize.height)/2)}, .size=lockImageTargetSize}];
-                coverImage = UIGraphicsGetImageFromCurrentImageContext();
-                UIGraphicsEndImageContext();
-            }
+    return coverImage;
+}
+
+// all locked magazines share the lock image, it's only drawn once per size.
++ (UIImage *)lockImageForSize:(CGSize)size {
+    static NSCache *lockImageCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        lockImageCache = [NSCache new];
+    });
+
+    NSString *key = NSStringFromCGSize(size);
+    UIImage *coverImage = [lockImageCache objectForKey:key];
+    if (!coverImage) {
+        @autoreleasepool {
+            UIGraphicsBeginImageContextWithOptions(size, YES, 0.0);
+            [[UIColor colorWithWhite:0.9 alpha:1.f] setFill];
+            CGContextFillRect(UIGraphicsGetCurrentContext(), (CGRect){.size=size});
+            UIImage *lockImage = [UIImage imageNamed:@"lock"];
+            CGSize lockImageTargetSize = PSPDFSizeForScale(lockImage.size, PSIsIpad() ? 0.6f : 0.3f);
+            [lockImage drawInRect:(CGRect){.origin={floorf((size.width-lockImageTargetSize.width)/2), floorf((size.height-lockImageTargetSize.height)/2)}, .size=lockImageTargetSize}];
+            coverImage = UIGraphicsGetImageFromCurrentImageContext();
+            UIGraphicsEndImageContext();
         }
+        if (coverImage) [lockImageCache setObject:coverImage forKey:key];
     }
-    
     return coverImage;
 }
 
@@ -72,6 +94,92 @@
  return pi;
  }*/
 
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Page Geometry
+
+// page rects and rotations are persisted, so reopening a magazine doesn't parse every page again.
+- (PSCPageGeometryCache *)geometryCache {
+    @synchronized(self) {
+        if (!_geometryCache) _geometryCache = [[PSCPageGeometryCache alloc] initWithDocument:self];
+        return _geometryCache;
+    }
+}
+
+- (BOOL)hasPageInfoForPage:(NSUInteger)page {
+    return [self.geometryCache pageInfoForPage:page] != nil || [super hasPageInfoForPage:page];
+}
+
+- (PSPDFPageInfo *)pageInfoForPage:(NSUInteger)page {
+    PSPDFPageInfo *pageInfo = [self.geometryCache pageInfoForPage:page];
+    if (!pageInfo) {
+        pageInfo = [super pageInfoForPage:page];
+        [self.geometryCache setPageInfo:pageInfo forPage:page];
+    }
+    return pageInfo;
+}
+
+- (PSPDFPageInfo *)pageInfoForPage:(NSUInteger)page pageRef:(CGPDFPageRef)pageRef {
+    PSPDFPageInfo *pageInfo = [self.geometryCache pageInfoForPage:page];
+    if (!pageInfo) {
+        pageInfo = [super pageInfoForPage:page pageRef:pageRef];
+        [self.geometryCache setPageInfo:pageInfo forPage:page];
+    }
+    return pageInfo;
+}
+
+- (CGRect)rectBoxForPage:(NSUInteger)page {
+    PSPDFPageInfo *pageInfo = [self.geometryCache pageInfoForPage:page];
+    return pageInfo ? pageInfo.pageRect : [super rectBoxForPage:page];
+}
+
+- (int)rotationForPage:(NSUInteger)page {
+    PSPDFPageInfo *pageInfo = [self.geometryCache pageInfoForPage:page];
+    return pageInfo ? (int)pageInfo.pageRotation : [super rotationForPage:page];
+}
+
+- (CGFloat)aspectRatioVariance {
+    CGFloat aspectRatioVariance = self.geometryCache.aspectRatioVariance;
+    if (isnan(aspectRatioVariance)) {
+        aspectRatioVariance = [super aspectRatioVariance];
+        self.geometryCache.aspectRatioVariance = aspectRatioVariance;
+    }
+    return aspectRatioVariance;
+}
+
+- (void)clearCache {
+    [super clearCache];
+    [_geometryCache reload];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Rendering
+
+// pages with unchanged annotations are served from the composited page+annotation cache.
+- (UIImage *)renderImageForPage:(NSUInteger)page withSize:(CGSize)fullSize clippedToRect:(CGRect)clipRect withAnnotations:(NSArray *)annotations options:(NSDictionary *)options {
+    return [[PSCAnnotatedPageCache sharedAnnotatedPageCache] imageForDocument:self page:page size:fullSize clippedToRect:clipRect annotations:annotations options:options renderBlock:^UIImage *{
+        return [super renderImageForPage:page withSize:fullSize clippedToRect:clipRect withAnnotations:annotations options:options];
+    }];
+}
+
+// saving writes the annotations into the pdf, so composited pages with changed annotations need to be rendered again.
+- (BOOL)saveChangedAnnotationsWithError:(NSError **)error {
+    NSMutableIndexSet *changedPages = [NSMutableIndexSet indexSet];
+    NSUInteger pageOffset = 0;
+    for (PSPDFDocumentProvider *documentProvider in self.documentProviders) {
+        for (NSNumber *page in [documentProvider.annotationParser dirtyAnnotations]) {
+            [changedPages addIndex:pageOffset + [page unsignedIntegerValue]]; // parser pages are file relative
+        }
+        pageOffset += documentProvider.pageCount;
+    }
+
+    BOOL success = [super saveChangedAnnotationsWithError:error];
+    PSCAnnotatedPageCache *annotatedPageCache = [PSCAnnotatedPageCache sharedAnnotatedPageCache];
+    [changedPages enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        [annotatedPageCache invalidateDocument:self page:page];
+    }];
+    return success;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - Public
 
@@ -23,6 +23,7 @@
 
 - (PSCMagazine *)firstMagazine;
 - (void)addMagazine:(PSCMagazine *)magazine;
+- (void)addMagazines:(NSArray *)magazines; // sorts once
 - (void)removeMagazine:(PSCMagazine *)magazine;
 
 @end
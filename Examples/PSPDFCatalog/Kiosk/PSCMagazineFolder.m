@@ -85,6 +85,14 @@
     [self sortMagazines];
 }
 
+- (void)addMagazines:(NSArray *)magazines {
+    [_magazines addObjectsFromArray:magazines];
+    for (PSCMagazine *magazine in magazines) {
+        magazine.folder = self;
+    }
+    [self sortMagazines];
+}
+
 - (void)removeMagazine:(PSCMagazine *)magazine {
     magazine.folder = nil;
     [_magazines removeObject:magazine];
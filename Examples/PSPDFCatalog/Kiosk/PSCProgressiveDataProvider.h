@@ -0,0 +1,45 @@
+//
+//  PSCProgressiveDataProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+@class PSCSegmentedDownload;
+
+/**
+    Data provider that reads a PDF while PSCSegmentedDownload is still downloading it.
+
+    Reads of bytes that are already there return immediately. Reads of missing bytes prioritize that range in the
+    download (which starts a new range request if it is far ahead) and block until the bytes arrived or timeout passed.
+    As PSPDFKit renders pages on background threads, only the pages whose objects aren't downloaded yet wait; the rest
+    of the document is usable. Reads on the main thread never wait, so open the document with
+    loadDocumentWithCompletionBlock: before showing it.
+
+    CoreGraphics always starts at the trailer and cross-reference table at the end of the file (linearization hints are
+    not used), so the tail of the file is prioritized as soon as the provider is created.
+*/
+@interface PSCProgressiveDataProvider : NSObject
+
+/// The download must know its size (totalBytes > 0), else dataProviderRef returns NULL.
+- (id)initWithDownload:(PSCSegmentedDownload *)download;
+
+@property(nonatomic, strong, readonly) PSCSegmentedDownload *download;
+
+/// Created on first access. The returned provider is valid as long as you retain this object.
+- (CGDataProviderRef)dataProviderRef;
+
+/// Reads the trailer and cross-reference table on a background queue (waiting for them to download) and calls
+/// completionBlock on the main queue. success is NO if the document can't be opened.
+- (void)loadDocumentWithCompletionBlock:(void (^)(BOOL success))completionBlock;
+
+/// YES once loadDocumentWithCompletionBlock: succeeded.
+@property(atomic, assign, readonly, getter=isDocumentLoaded) BOOL documentLoaded;
+
+/// Maximum time a read waits for missing bytes. Defaults to 30 seconds. Reads on the main thread don't wait.
+@property(nonatomic, assign) NSTimeInterval timeout;
+
+/// Number of bytes prioritized at the end of the file. Defaults to 128KB.
+@property(nonatomic, assign) long long tailLength;
+
+@end
@@ -0,0 +1,167 @@
+//
+//  PSCProgressiveDataProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCProgressiveDataProvider.h"
+#import "PSCSegmentedDownload.h"
+
+// Info object of the CGDataProvider. Separate from PSCProgressiveDataProvider to not retain the provider from itself.
+@interface PSCProgressiveReader : NSObject {
+    PSCSegmentedDownload *_download;
+    NSCondition *_condition;
+    NSUInteger _generation; // incremented whenever new bytes arrive
+}
+- (id)initWithDownload:(PSCSegmentedDownload *)download timeout:(NSTimeInterval)timeout;
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count;
+- (void)dataAvailable;
+@property(atomic, assign) NSTimeInterval timeout;
+@end
+
+@implementation PSCProgressiveReader
+
+- (id)initWithDownload:(PSCSegmentedDownload *)download timeout:(NSTimeInterval)timeout {
+    if ((self = [super init])) {
+        _download = download;
+        _condition = [NSCondition new];
+        _timeout = timeout;
+    }
+    return self;
+}
+
+- (void)dataAvailable {
+    [_condition lock];
+    _generation++;
+    [_condition broadcast];
+    [_condition unlock];
+}
+
+// Called by CoreGraphics, possibly from several threads. Never holds the lock while reading.
+// Never waits on the main thread: missing bytes are prioritized and the read comes back short.
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count {
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:[NSThread isMainThread] ? 0 : self.timeout];
+    BOOL prioritized = NO;
+    size_t readBytes = 0;
+
+    while (readBytes < count) {
+        [_condition lock];
+        NSUInteger generation = _generation;
+        [_condition unlock];
+
+        size_t bytes = [_download readBytes:(uint8_t *)buffer + readBytes atOffset:position + readBytes length:count - readBytes];
+        if (bytes > 0) {
+            readBytes += bytes;
+            continue;
+        }
+        if ([_download isFinished]) break; // failed or past the end
+
+        if (!prioritized) {
+            [_download prioritizeBytesAtOffset:position + readBytes length:count - readBytes];
+            prioritized = YES;
+        }
+
+        BOOL signaled = YES;
+        [_condition lock];
+        while (signaled && _generation == generation) signaled = [_condition waitUntilDate:deadline];
+        [_condition unlock];
+        if (!signaled) {
+            PSCLog(@"Timed out waiting for %lu bytes at %lld of %@", (unsigned long)(count - readBytes), (long long)position + readBytes, _download.URL);
+            break;
+        }
+    }
+    return readBytes;
+}
+
+@end
+
+static size_t PSCProgressiveGetBytesAtPosition(void *info, void *buffer, off_t position, size_t count) {
+    return [(__bridge PSCProgressiveReader *)info getBytes:buffer atPosition:position count:count];
+}
+
+static void PSCProgressiveReleaseInfo(void *info) {
+    CFBridgingRelease(info);
+}
+
+@interface PSCProgressiveDataProvider () {
+    CGDataProviderRef _dataProvider;
+    PSCProgressiveReader *_reader;
+}
+@property(nonatomic, strong) PSCSegmentedDownload *download;
+@property(atomic, assign, getter=isDocumentLoaded) BOOL documentLoaded;
+@end
+
+@implementation PSCProgressiveDataProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDownload:(PSCSegmentedDownload *)download {
+    if ((self = [super init])) {
+        NSParameterAssert(download);
+        _download = download;
+        _timeout = 30.0;
+        _tailLength = 128 * 1024;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    CGDataProviderRelease(_dataProvider);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ download:%@>", NSStringFromClass([self class]), self.download];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (CGDataProviderRef)dataProviderRef {
+    long long totalBytes = self.download.totalBytes;
+    if (!_dataProvider && totalBytes > 0) {
+        _reader = [[PSCProgressiveReader alloc] initWithDownload:self.download timeout:self.timeout];
+        __ps_weak PSCProgressiveReader *weakReader = _reader;
+        self.download.dataAvailableBlock = ^{
+            [weakReader dataAvailable];
+        };
+
+        // opening the document reads the trailer first.
+        long long tailLength = MIN(self.tailLength, totalBytes);
+        [self.download prioritizeBytesAtOffset:totalBytes - tailLength length:tailLength];
+
+        CGDataProviderDirectCallbacks callbacks = {
+            .version = 0,
+            .getBytePointer = NULL,
+            .releaseBytePointer = NULL,
+            .getBytesAtPosition = PSCProgressiveGetBytesAtPosition,
+            .releaseInfo = PSCProgressiveReleaseInfo,
+        };
+        _dataProvider = CGDataProviderCreateDirect((__bridge_retained void *)_reader, (off_t)totalBytes, &callbacks);
+    }
+    return _dataProvider;
+}
+
+- (void)loadDocumentWithCompletionBlock:(void (^)(BOOL success))completionBlock {
+    CGDataProviderRef dataProvider = CGDataProviderRetain([self dataProviderRef]);
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+        // opening and counting pages reads the trailer and the cross-reference table, waiting for them if needed.
+        CGPDFDocumentRef documentRef = dataProvider ? CGPDFDocumentCreateWithProvider(dataProvider) : NULL;
+        BOOL success = documentRef && CGPDFDocumentGetNumberOfPages(documentRef) > 0;
+        CGPDFDocumentRelease(documentRef);
+        CGDataProviderRelease(dataProvider);
+        if (success) self.documentLoaded = YES;
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (completionBlock) completionBlock(success);
+        });
+    });
+}
+
+- (void)setTimeout:(NSTimeInterval)timeout {
+    _timeout = timeout;
+    _reader.timeout = timeout;
+}
+
+@end
@@ -0,0 +1,97 @@
+//
+//  PSCSegmentedDownload.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCDownloadScheduler.h"
+
+extern NSString *const PSCSegmentedDownloadErrorDomain;
+
+typedef NS_ENUM(NSInteger, PSCSegmentedDownloadError) {
+    PSCSegmentedDownloadErrorIncomplete = 1,  // a segment has less or more bytes than requested
+    PSCSegmentedDownloadErrorChecksum,        // MD5 of the assembled file doesn't match
+    PSCSegmentedDownloadErrorFile,            // part files couldn't be written or assembled
+};
+
+/**
+    Downloads a file with several parallel HTTP range requests.
+
+    The file is split into segments (after a HEAD request for size, Accept-Ranges and validator). Each segment is
+    written to its own part file; the length of a part file is the progress of its segment, so an interrupted download
+    (cancel, failure, app killed) resumes every segment where it stopped. A manifest with the segment ranges and the
+    ETag/Last-Modified validator is stored next to the parts; resumed requests use If-Range, so a changed file on the
+    server restarts the download instead of mixing versions.
+
+    After all segments are complete, the parts are concatenated into targetPath while the MD5 is calculated and
+    checked against expectedMD5 or the Content-MD5 header. Servers without range support get a single segment.
+
+    Downloaded bytes can be read before the download finished (see PSCProgressiveDataProvider). Prioritizing a range
+    that is far ahead of its segment splits the segment, so the range is fetched right away by a new request.
+*/
+@interface PSCSegmentedDownload : NSObject
+
+/// Downloads URL to targetPath. The parent directory of targetPath must exist.
+- (id)initWithURL:(NSURL *)URL targetPath:(NSString *)targetPath;
+
+@property(nonatomic, strong, readonly) NSURL *URL;
+@property(nonatomic, copy, readonly) NSString *targetPath;
+
+/// Starts or resumes the download.
+- (void)start;
+
+/// Cancels all segments. Part files are kept so the next download of the same URL/targetPath resumes.
+- (void)cancel;
+
+/// Removes part files and the manifest of an unfinished download.
+- (BOOL)deletePartsWithError:(NSError **)error;
+
+/// Called on the main queue, at most every progressInterval. totalBytes is 0 if the size is unknown.
+@property(nonatomic, copy) void (^progressBlock)(long long bytesWritten, long long totalBytes);
+
+/// Called once on the main queue. error is nil on success.
+@property(nonatomic, copy) void (^completionBlock)(NSError *error);
+
+/// Maximum number of parallel range requests. Defaults to 4.
+@property(nonatomic, assign) NSUInteger maxConcurrentSegments;
+
+/// Files are split into segments of at least this size. Defaults to 1MB.
+@property(nonatomic, assign) long long minimumSegmentSize;
+
+/// How often a failed segment is resumed before the download fails. Defaults to 3.
+@property(nonatomic, assign) NSUInteger maxRetriesPerSegment;
+
+/// Hex MD5 of the file. If nil, the Content-MD5 header is used if the server sends one.
+@property(nonatomic, copy) NSString *expectedMD5;
+
+/// Minimum time between progress callbacks. Defaults to 0.1s.
+@property(nonatomic, assign) NSTimeInterval progressInterval;
+
+/// Lane in PSCDownloadScheduler. Defaults to PSCDownloadPriorityUserInitiated. Prioritized ranges use PSCDownloadPriorityReaderBlocking.
+@property(nonatomic, assign) PSCDownloadPriority priority;
+
+/// Keeps segments running as a background task.
+@property(nonatomic, copy) dispatch_block_t backgroundTaskExpirationHandler;
+
+@property(nonatomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+
+/// @name Reading while downloading
+
+/// Size of the file, 0 while unknown (before the HEAD request finished, or if the server doesn't send it).
+@property(nonatomic, assign, readonly) long long totalBytes;
+
+/// YES after completionBlock was scheduled, also if the download failed.
+@property(nonatomic, assign, readonly, getter=isFinished) BOOL finished;
+
+/// Copies the downloaded bytes starting at offset into buffer. Returns less than length (or 0) if the following bytes
+/// are not downloaded yet. Thread safe.
+- (size_t)readBytes:(void *)buffer atOffset:(long long)offset length:(size_t)length;
+
+/// Fetches the given bytes next. Splits the segment if the range is more than 256KB ahead of what it downloaded.
+- (void)prioritizeBytesAtOffset:(long long)offset length:(long long)length;
+
+/// Called on a private queue whenever new bytes are available, and when the download finishes.
+@property(nonatomic, copy) dispatch_block_t dataAvailableBlock;
+
+@end
@@ -0,0 +1,659 @@
+//
+//  PSCSegmentedDownload.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCSegmentedDownload.h"
+#import "AFHTTPRequestOperation.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+NSString *const PSCSegmentedDownloadErrorDomain = @"PSCSegmentedDownloadErrorDomain";
+
+#define kPSCSegmentedDownloadManifestVersion 2
+#define kPSCSegmentedDownloadManifestFileName @"manifest.plist"
+#define kPSCSegmentedDownloadCopyBufferSize (512 * 1024)
+#define kPSCSegmentedDownloadSplitDistance (256 * 1024) // closer ranges arrive soon anyway
+#define kPSCSegmentedDownloadSplitAlignment (16 * 1024)
+
+static NSError *PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadError code, NSString *description) {
+    return [NSError errorWithDomain:PSCSegmentedDownloadErrorDomain code:code userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+static long long PSCFileSizeAtPath(NSString *path) {
+    struct stat fileStat;
+    return stat([path fileSystemRepresentation], &fileStat) == 0 ? fileStat.st_size : 0;
+}
+
+// Content-MD5 is base64, expectedMD5 is hex.
+static NSString *PSCBase64StringForDigest(const unsigned char *digest) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    NSMutableString *string = [NSMutableString stringWithCapacity:24];
+    for (NSUInteger i = 0; i < CC_MD5_DIGEST_LENGTH; i += 3) {
+        NSUInteger remaining = CC_MD5_DIGEST_LENGTH - i;
+        uint32_t value = digest[i] << 16 | (remaining > 1 ? digest[i+1] << 8 : 0) | (remaining > 2 ? digest[i+2] : 0);
+        [string appendFormat:@"%c%c%c%c", table[(value >> 18) & 63], table[(value >> 12) & 63], remaining > 1 ? table[(value >> 6) & 63] : '=', remaining > 2 ? table[value & 63] : '='];
+    }
+    return string;
+}
+
+static NSString *PSCHexStringForDigest(const unsigned char *digest) {
+    NSMutableString *string = [NSMutableString stringWithCapacity:CC_MD5_DIGEST_LENGTH * 2];
+    for (NSUInteger i = 0; i < CC_MD5_DIGEST_LENGTH; i++) [string appendFormat:@"%02x", digest[i]];
+    return string;
+}
+
+@interface AFURLConnectionOperation (AFInternal)
+@property (nonatomic, strong) NSURLRequest *request;
+@end
+
+// Range request that doesn't write a response starting somewhere else than requested (e.g. a 200 after If-Range).
+// Stops after byteLimit bytes; the limit can be lowered while running when the segment is split.
+@interface PSCSegmentRequestOperation : AFHTTPRequestOperation {
+    long long _receivedBytes;
+}
+@property(nonatomic, assign) long long expectedOffset;
+@property(nonatomic, assign) long long rangeEnd; // -1 if open
+@property(nonatomic, assign) BOOL acceptsFullResponse;
+@property(nonatomic, assign, readonly) BOOL rangeMismatch;
+@property(atomic, assign) long long byteLimit; // 0 = unlimited
+@end
+
+@implementation PSCSegmentRequestOperation
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+    [super connection:connection didReceiveResponse:response];
+
+    NSHTTPURLResponse *HTTPResponse = (NSHTTPURLResponse *)response;
+    if (![HTTPResponse isKindOfClass:[NSHTTPURLResponse class]] || HTTPResponse.statusCode >= 300) return; // regular failure
+
+    long long offset = -1;
+    if (HTTPResponse.statusCode == 206) {
+        // Content-Range: bytes 1000-1999/5000
+        NSString *contentRange = [HTTPResponse allHeaderFields][@"Content-Range"];
+        if ([contentRange hasPrefix:@"bytes "]) offset = [[contentRange substringFromIndex:6] longLongValue];
+    }else if (self.acceptsFullResponse) {
+        offset = 0;
+    }
+
+    if (offset != self.expectedOffset) {
+        _rangeMismatch = YES;
+        [connection cancel];
+        [self connection:connection didFailWithError:PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorIncomplete, [NSString stringWithFormat:@"Expected data at offset %lld, got %lld.", self.expectedOffset, offset])];
+    }
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+    if (_rangeMismatch) return;
+
+    long long byteLimit = self.byteLimit;
+    if (byteLimit > 0 && _receivedBytes + (long long)[data length] >= byteLimit) {
+        long long remainingBytes = MAX(byteLimit - _receivedBytes, 0);
+        _receivedBytes += remainingBytes;
+        if (remainingBytes > 0) [super connection:connection didReceiveData:[data subdataWithRange:NSMakeRange(0, (NSUInteger)remainingBytes)]];
+        [connection cancel];
+        [self connectionDidFinishLoading:connection];
+        return;
+    }
+
+    _receivedBytes += [data length];
+    [super connection:connection didReceiveData:data];
+}
+
+// AFHTTPRequestOperation resumes at the offset of the output stream, which is relative to the part file.
+- (void)resume {
+    if (![self isPaused]) return;
+
+    long long offset = self.expectedOffset + _receivedBytes;
+    NSMutableURLRequest *request = [self.request mutableCopy];
+    NSString *range = self.rangeEnd >= 0 ? [NSString stringWithFormat:@"bytes=%lld-%lld", offset, self.rangeEnd] : [NSString stringWithFormat:@"bytes=%lld-", offset];
+    [request setValue:range forHTTPHeaderField:@"Range"];
+    self.request = request;
+
+    if (self.byteLimit > 0) self.byteLimit = MAX(self.byteLimit - _receivedBytes, 1);
+    self.expectedOffset = offset;
+    self.acceptsFullResponse = offset == 0;
+    _receivedBytes = 0;
+    [super resume];
+}
+
+@end
+
+@interface PSCDownloadSegment : NSObject
+@property(nonatomic, assign) long long start;
+@property(nonatomic, assign) long long end; // inclusive, -1 if the length is unknown
+@property(nonatomic, copy) NSString *partPath;
+@property(nonatomic, assign) long long writtenBytes;
+@property(nonatomic, assign) NSUInteger retries;
+@property(nonatomic, strong) PSCSegmentRequestOperation *operation;
+@end
+
+@implementation PSCDownloadSegment
+
+- (long long)length {
+    return self.end >= 0 ? self.end - self.start + 1 : -1;
+}
+
+- (BOOL)isComplete {
+    return self.end >= 0 && self.writtenBytes == [self length];
+}
+
+@end
+
+@interface PSCSegmentedDownload () {
+    NSString *_partsPath;
+    NSMutableArray *_segments;
+    long long _totalBytes;
+    BOOL _acceptsRanges, _running, _finished, _restarted, _succeeded;
+    NSString *_validator, *_contentMD5;
+    CFAbsoluteTime _lastProgressTime;
+    NSMutableSet *_operations; // scheduled, possibly finished
+    dispatch_queue_t _downloadQueue;
+}
+@property(nonatomic, strong) NSURL *URL;
+@property(nonatomic, copy) NSString *targetPath;
+@property(nonatomic, assign, getter=isCancelled) BOOL cancelled;
+@end
+
+@implementation PSCSegmentedDownload
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (NSString *)partsFolder {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [cachesPath stringByAppendingPathComponent:@"PSCSegmentedDownloads"];
+}
+
++ (NSString *)partsNameForTargetPath:(NSString *)targetPath {
+    const char *string = [[targetPath stringByAbbreviatingWithTildeInPath] UTF8String];
+    unsigned char digest[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(string, (CC_LONG)strlen(string), digest);
+    return PSCHexStringForDigest(digest);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithURL:(NSURL *)URL targetPath:(NSString *)targetPath {
+    if ((self = [super init])) {
+        NSParameterAssert(URL && targetPath);
+        _URL = URL;
+        _targetPath = [targetPath copy];
+        _partsPath = [[[self class] partsFolder] stringByAppendingPathComponent:[[self class] partsNameForTargetPath:targetPath]];
+        _maxConcurrentSegments = 4;
+        _minimumSegmentSize = 1024 * 1024;
+        _maxRetriesPerSegment = 3;
+        _progressInterval = 0.1;
+        _priority = PSCDownloadPriorityUserInitiated;
+        _operations = [NSMutableSet new];
+        _downloadQueue = dispatch_queue_create("com.pspdfkit.catalog.segmentedDownloadQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self cancelOperations];
+    PSPDFDispatchRelease(_downloadQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %@ segments:%d>", NSStringFromClass([self class]), self.URL, [_segments count]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)start {
+    dispatch_async(_downloadQueue, ^{
+        if (_running || _finished || self.isCancelled) return;
+        _running = YES;
+
+        if ([self loadManifest]) {
+            PSCLog(@"Resuming %@ with %d segments.", self.URL, [_segments count]);
+            [self startSegments];
+        }else {
+            [self requestFileInfo];
+        }
+    });
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+    [self cancelOperations];
+    dispatch_async(_downloadQueue, ^{
+        [self finishWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+    });
+}
+
+- (BOOL)deletePartsWithError:(NSError **)error {
+    __block BOOL success = YES;
+    dispatch_sync(_downloadQueue, ^{
+        NSFileManager *fileManager = [NSFileManager new];
+        if ([fileManager fileExistsAtPath:_partsPath]) success = [fileManager removeItemAtPath:_partsPath error:error];
+        _segments = nil;
+    });
+    return success;
+}
+
+- (long long)totalBytes {
+    __block long long totalBytes;
+    dispatch_sync(_downloadQueue, ^{ totalBytes = _totalBytes; });
+    return totalBytes;
+}
+
+- (BOOL)isFinished {
+    __block BOOL finished;
+    dispatch_sync(_downloadQueue, ^{ finished = _finished; });
+    return finished;
+}
+
+- (size_t)readBytes:(void *)buffer atOffset:(long long)offset length:(size_t)length {
+    // the second attempt covers parts that were moved into place while reading.
+    for (NSUInteger attempt = 0; attempt < 2; attempt++) {
+        __block NSString *path = nil;
+        __block long long fileOffset = 0;
+        __block size_t availableBytes = 0;
+        dispatch_sync(_downloadQueue, ^{
+            if (_finished) {
+                if (_succeeded) {
+                    path = self.targetPath;
+                    fileOffset = offset;
+                    availableBytes = length;
+                }
+                return;
+            }
+            PSCDownloadSegment *segment = [self segmentContainingOffset:offset];
+            if (segment && offset - segment.start < segment.writtenBytes) {
+                path = segment.partPath;
+                fileOffset = offset - segment.start;
+                availableBytes = (size_t)MIN((long long)length, segment.writtenBytes - fileOffset);
+            }
+        });
+        if (!path) return 0;
+
+        int fileDescriptor = open([path fileSystemRepresentation], O_RDONLY);
+        if (fileDescriptor < 0) continue;
+        ssize_t readBytes = pread(fileDescriptor, buffer, availableBytes, fileOffset);
+        close(fileDescriptor);
+        return readBytes > 0 ? (size_t)readBytes : 0;
+    }
+    return 0;
+}
+
+- (void)prioritizeBytesAtOffset:(long long)offset length:(long long)length {
+    dispatch_async(_downloadQueue, ^{
+        if (_finished || self.isCancelled || !_acceptsRanges) return;
+        PSCDownloadSegment *segment = [self segmentContainingOffset:offset];
+        if (!segment || segment.end < 0 || [segment isComplete]) return;
+
+        // a reader waits for this segment; if it's still queued, move it ahead of everything else.
+        if (segment.operation) [[PSCDownloadScheduler sharedDownloadScheduler] setPriority:PSCDownloadPriorityReaderBlocking forOperation:segment.operation];
+
+        // close ranges will arrive soon anyway; a new request costs a round trip.
+        long long splitOffset = offset - offset % kPSCSegmentedDownloadSplitAlignment;
+        if (splitOffset < segment.start + segment.writtenBytes + kPSCSegmentedDownloadSplitDistance) return;
+
+        PSCDownloadSegment *tailSegment = [PSCDownloadSegment new];
+        tailSegment.start = splitOffset;
+        tailSegment.end = segment.end;
+        tailSegment.partPath = [self partPathForStart:splitOffset];
+        unlink([tailSegment.partPath fileSystemRepresentation]);
+
+        // the running request stops at the new end; overshooting bytes are truncated when it finishes.
+        segment.end = splitOffset - 1;
+        segment.operation.byteLimit = MAX(segment.end + 1 - segment.operation.expectedOffset, 1);
+
+        [_segments insertObject:tailSegment atIndex:[_segments indexOfObject:segment] + 1];
+        [self saveManifest];
+        PSCLog(@"Split segment of %@ at %lld.", self.URL, splitOffset);
+
+        [self startSegment:tailSegment priority:PSCDownloadPriorityReaderBlocking];
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+static NSString *PSCHeaderValue(NSHTTPURLResponse *response, NSString *name) {
+    __block NSString *value = nil;
+    [[response allHeaderFields] enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *headerValue, BOOL *stop) {
+        if ([key caseInsensitiveCompare:name] == NSOrderedSame) { value = headerValue; *stop = YES; }
+    }];
+    return value;
+}
+
+- (void)scheduleOperation:(NSOperation *)operation priority:(PSCDownloadPriority)priority {
+    @synchronized(_operations) {
+        [_operations addObject:operation];
+    }
+    [[PSCDownloadScheduler sharedDownloadScheduler] addOperation:operation priority:priority];
+}
+
+- (void)cancelOperations {
+    @synchronized(_operations) {
+        [_operations makeObjectsPerformSelector:@selector(cancel)];
+        [_operations removeAllObjects];
+    }
+}
+
+- (NSString *)partPathForStart:(long long)start {
+    return [_partsPath stringByAppendingPathComponent:[NSString stringWithFormat:@"%lld.part", start]];
+}
+
+// Needs to be called on _downloadQueue. Segments are sorted by start.
+- (PSCDownloadSegment *)segmentContainingOffset:(long long)offset {
+    for (PSCDownloadSegment *segment in _segments) {
+        if (offset >= segment.start && (segment.end < 0 || offset <= segment.end)) return segment;
+    }
+    return nil;
+}
+
+// Needs to be called on _downloadQueue.
+- (void)requestFileInfo {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:self.URL];
+    request.HTTPMethod = @"HEAD";
+    AFHTTPRequestOperation *operation = [[AFHTTPRequestOperation alloc] initWithRequest:request];
+    operation.successCallbackQueue = _downloadQueue;
+    operation.failureCallbackQueue = _downloadQueue;
+    [operation setCompletionBlockWithSuccess:^(AFHTTPRequestOperation *infoOperation, id responseObject) {
+        [self createSegmentsWithResponse:infoOperation.response];
+        [self startSegments];
+    } failure:^(AFHTTPRequestOperation *infoOperation, NSError *error) {
+        // some servers don't allow HEAD; download in one piece.
+        PSCLog(@"HEAD request failed for %@: %@", self.URL, [error localizedDescription]);
+        [self createSegmentsWithResponse:nil];
+        [self startSegments];
+    }];
+    [self scheduleOperation:operation priority:self.priority];
+}
+
+// Needs to be called on _downloadQueue.
+- (void)createSegmentsWithResponse:(NSHTTPURLResponse *)response {
+    NSFileManager *fileManager = [NSFileManager new];
+    [fileManager removeItemAtPath:_partsPath error:NULL];
+    [fileManager createDirectoryAtPath:_partsPath withIntermediateDirectories:YES attributes:nil error:NULL];
+
+    _totalBytes = MAX(response.expectedContentLength, 0);
+    _acceptsRanges = [[PSCHeaderValue(response, @"Accept-Ranges") lowercaseString] isEqualToString:@"bytes"];
+    _validator = PSCHeaderValue(response, @"ETag") ?: PSCHeaderValue(response, @"Last-Modified");
+    _contentMD5 = PSCHeaderValue(response, @"Content-MD5");
+
+    long long segmentCount = 1;
+    if (_acceptsRanges && _totalBytes > 0) {
+        segmentCount = MAX(MIN(_totalBytes / MAX(self.minimumSegmentSize, 1), (long long)self.maxConcurrentSegments), 1);
+    }
+    _segments = [NSMutableArray arrayWithCapacity:(NSUInteger)segmentCount];
+    for (long long index = 0; index < segmentCount; index++) {
+        PSCDownloadSegment *segment = [PSCDownloadSegment new];
+        segment.start = index * _totalBytes / segmentCount;
+        segment.end = _totalBytes > 0 ? (index + 1) * _totalBytes / segmentCount - 1 : -1;
+        segment.partPath = [self partPathForStart:segment.start];
+        [_segments addObject:segment];
+    }
+    [self saveManifest];
+}
+
+// Needs to be called on _downloadQueue.
+- (void)saveManifest {
+    NSMutableArray *ranges = [NSMutableArray arrayWithCapacity:[_segments count]];
+    for (PSCDownloadSegment *segment in _segments) [ranges addObject:@[@(segment.start), @(segment.end)]];
+
+    NSMutableDictionary *manifest = [@{@"version" : @(kPSCSegmentedDownloadManifestVersion), @"URL" : [self.URL absoluteString], @"totalBytes" : @(_totalBytes), @"acceptsRanges" : @(_acceptsRanges), @"segments" : ranges} mutableCopy];
+    if (_validator) manifest[@"validator"] = _validator;
+    if (_contentMD5) manifest[@"contentMD5"] = _contentMD5;
+
+    NSData *manifestData = [NSPropertyListSerialization dataWithPropertyList:manifest format:NSPropertyListBinaryFormat_v1_0 options:0 error:NULL];
+    if (![manifestData writeToFile:[_partsPath stringByAppendingPathComponent:kPSCSegmentedDownloadManifestFileName] atomically:YES]) {
+        PSCLog(@"Failed to write download manifest for %@", self.URL);
+    }
+}
+
+// Needs to be called on _downloadQueue. Returns NO if there's nothing to resume.
+- (BOOL)loadManifest {
+    NSData *manifestData = [NSData dataWithContentsOfFile:[_partsPath stringByAppendingPathComponent:kPSCSegmentedDownloadManifestFileName]];
+    NSDictionary *manifest = manifestData ? [NSPropertyListSerialization propertyListWithData:manifestData options:NSPropertyListImmutable format:NULL error:NULL] : nil;
+    if (![manifest isKindOfClass:[NSDictionary class]] || [manifest[@"version"] integerValue] != kPSCSegmentedDownloadManifestVersion || ![manifest[@"URL"] isEqual:[self.URL absoluteString]]) return NO;
+
+    _totalBytes = [manifest[@"totalBytes"] longLongValue];
+    _acceptsRanges = [manifest[@"acceptsRanges"] boolValue];
+    _validator = manifest[@"validator"];
+    _contentMD5 = manifest[@"contentMD5"];
+    if (!_acceptsRanges) return NO; // can't resume anything
+
+    NSMutableArray *segments = [NSMutableArray array];
+    [manifest[@"segments"] enumerateObjectsUsingBlock:^(NSArray *range, NSUInteger idx, BOOL *stop) {
+        PSCDownloadSegment *segment = [PSCDownloadSegment new];
+        segment.start = [range[0] longLongValue];
+        segment.end = [range[1] longLongValue];
+        segment.partPath = [self partPathForStart:segment.start];
+        segment.writtenBytes = PSCFileSizeAtPath(segment.partPath);
+        [segments addObject:segment];
+    }];
+    for (PSCDownloadSegment *segment in segments) {
+        if (segment.end < 0) return NO;
+        [self truncateSegmentIfNeeded:segment];
+    }
+    _segments = segments;
+    return [_segments count] > 0;
+}
+
+// Needs to be called on _downloadQueue.
+- (void)startSegments {
+    if (_finished || self.isCancelled) return;
+
+    BOOL allComplete = YES;
+    for (PSCDownloadSegment *segment in _segments) {
+        if (![segment isComplete]) {
+            allComplete = NO;
+            if (!segment.operation) [self startSegment:segment];
+        }
+    }
+    if (allComplete) [self assembleFile];
+}
+
+// Needs to be called on _downloadQueue.
+- (void)startSegment:(PSCDownloadSegment *)segment {
+    [self startSegment:segment priority:self.priority];
+}
+
+// Needs to be called on _downloadQueue.
+- (void)startSegment:(PSCDownloadSegment *)segment priority:(PSCDownloadPriority)priority {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:self.URL];
+    long long offset = segment.start + segment.writtenBytes;
+    BOOL ranged = _acceptsRanges && ([_segments count] > 1 || offset > 0);
+    if (ranged) {
+        NSString *range = segment.end >= 0 ? [NSString stringWithFormat:@"bytes=%lld-%lld", offset, segment.end] : [NSString stringWithFormat:@"bytes=%lld-", offset];
+        [request setValue:range forHTTPHeaderField:@"Range"];
+        if (_validator) [request setValue:_validator forHTTPHeaderField:@"If-Range"];
+    }else {
+        segment.writtenBytes = 0;
+    }
+
+    PSCSegmentRequestOperation *operation = [[PSCSegmentRequestOperation alloc] initWithRequest:request];
+    operation.expectedOffset = ranged ? offset : 0;
+    operation.rangeEnd = ranged ? segment.end : -1;
+    operation.acceptsFullResponse = !ranged;
+    if (segment.end >= 0) operation.byteLimit = [segment length] - segment.writtenBytes;
+    operation.outputStream = [NSOutputStream outputStreamToFileAtPath:segment.partPath append:ranged];
+    operation.successCallbackQueue = _downloadQueue;
+    operation.failureCallbackQueue = _downloadQueue;
+    if (self.backgroundTaskExpirationHandler) [operation setShouldExecuteAsBackgroundTaskWithExpirationHandler:self.backgroundTaskExpirationHandler];
+
+    __ps_weak PSCSegmentRequestOperation *weakOperation = operation;
+    [operation setDownloadProgressBlock:^(NSInteger bytesRead, long long totalBytesRead, long long totalBytesExpectedToRead) {
+        dispatch_async(_downloadQueue, ^{
+            if (segment.operation != weakOperation) return;
+            segment.writtenBytes += bytesRead;
+            [[PSCDownloadScheduler sharedDownloadScheduler] recordReceivedBytes:bytesRead];
+            [self reportProgress];
+            dispatch_block_t dataAvailableBlock = self.dataAvailableBlock;
+            if (dataAvailableBlock) dataAvailableBlock();
+        });
+    }];
+    [operation setCompletionBlockWithSuccess:^(AFHTTPRequestOperation *segmentOperation, id responseObject) {
+        [self segment:segment finishedWithError:nil];
+    } failure:^(AFHTTPRequestOperation *segmentOperation, NSError *error) {
+        [self segment:segment finishedWithError:error];
+    }];
+    segment.operation = operation;
+    [self scheduleOperation:operation priority:priority];
+}
+
+// Needs to be called on _downloadQueue.
+- (void)segment:(PSCDownloadSegment *)segment finishedWithError:(NSError *)error {
+    BOOL rangeMismatch = segment.operation.rangeMismatch;
+    segment.operation = nil;
+    if (_finished || self.isCancelled) return;
+
+    // the part file is the truth, no matter what the progress callbacks counted.
+    segment.writtenBytes = PSCFileSizeAtPath(segment.partPath);
+    [self truncateSegmentIfNeeded:segment];
+    if (!error && segment.end < 0) {
+        segment.end = segment.start + segment.writtenBytes - 1; // length was unknown
+        _totalBytes = segment.writtenBytes;
+    }
+
+    if (rangeMismatch) {
+        // the file changed on the server or ranges aren't supported after all. Start over, once.
+        if (_restarted) {
+            [self finishWithError:error];
+        }else {
+            PSCLog(@"Restarting download of %@: %@", self.URL, [error localizedDescription]);
+            _restarted = YES;
+            [self cancelOperations];
+            for (PSCDownloadSegment *otherSegment in _segments) otherSegment.operation = nil;
+            [self requestFileInfo];
+        }
+        return;
+    }
+
+    if (!error && ![segment isComplete]) {
+        error = PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorIncomplete, [NSString stringWithFormat:@"Segment at %lld has %lld of %lld bytes.", segment.start, segment.writtenBytes, [segment length]]);
+    }
+    if (error) {
+        if (segment.retries < self.maxRetriesPerSegment) {
+            segment.retries++;
+            PSCLog(@"Resuming segment at %lld of %@ (retry %d): %@", segment.start, self.URL, segment.retries, [error localizedDescription]);
+            [self startSegment:segment];
+        }else {
+            [self finishWithError:error];
+        }
+        return;
+    }
+
+    [self reportProgress];
+    [self startSegments];
+}
+
+// Needs to be called on _downloadQueue. After a split, a segment's request may have written past its new end.
+- (void)truncateSegmentIfNeeded:(PSCDownloadSegment *)segment {
+    if (segment.end >= 0 && segment.writtenBytes > [segment length]) {
+        truncate([segment.partPath fileSystemRepresentation], [segment length]);
+        segment.writtenBytes = [segment length];
+    }
+}
+
+// Needs to be called on _downloadQueue.
+- (void)reportProgress {
+    void (^progressBlock)(long long, long long) = self.progressBlock;
+    if (!progressBlock) return;
+
+    long long writtenBytes = 0;
+    for (PSCDownloadSegment *segment in _segments) writtenBytes += segment.writtenBytes;
+
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (now - _lastProgressTime < self.progressInterval && writtenBytes != _totalBytes) return;
+    _lastProgressTime = now;
+
+    long long totalBytes = _totalBytes;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        progressBlock(writtenBytes, totalBytes);
+    });
+}
+
+// Needs to be called on _downloadQueue. The first part becomes the file, the others are appended; everything is hashed once.
+- (void)assembleFile {
+    NSString *expectedMD5 = [self.expectedMD5 lowercaseString];
+    NSString *contentMD5 = expectedMD5 ? nil : _contentMD5;
+    BOOL verifyChecksum = expectedMD5 || contentMD5;
+
+    NSString *assemblyPath = [self.targetPath stringByAppendingPathExtension:@"assembling"];
+    PSCDownloadSegment *firstSegment = _segments[0];
+    unlink([assemblyPath fileSystemRepresentation]);
+    if (rename([firstSegment.partPath fileSystemRepresentation], [assemblyPath fileSystemRepresentation]) != 0) {
+        [self finishWithError:PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorFile, [NSString stringWithFormat:@"Failed to move %@ (%s).", firstSegment.partPath, strerror(errno)])];
+        return;
+    }
+
+    CC_MD5_CTX md5;
+    CC_MD5_Init(&md5);
+    void *buffer = malloc(kPSCSegmentedDownloadCopyBufferSize);
+    NSError *error = nil;
+
+    if (verifyChecksum) {
+        FILE *file = fopen([assemblyPath fileSystemRepresentation], "rb");
+        size_t bytesRead;
+        while (file && (bytesRead = fread(buffer, 1, kPSCSegmentedDownloadCopyBufferSize, file)) > 0) CC_MD5_Update(&md5, buffer, (CC_LONG)bytesRead);
+        if (file) fclose(file);
+    }
+
+    FILE *output = fopen([assemblyPath fileSystemRepresentation], "ab");
+    for (NSUInteger index = 1; output && !error && index < [_segments count]; index++) {
+        PSCDownloadSegment *segment = _segments[index];
+        FILE *input = fopen([segment.partPath fileSystemRepresentation], "rb");
+        long long copiedBytes = 0;
+        size_t bytesRead;
+        while (input && (bytesRead = fread(buffer, 1, kPSCSegmentedDownloadCopyBufferSize, input)) > 0) {
+            if (verifyChecksum) CC_MD5_Update(&md5, buffer, (CC_LONG)bytesRead);
+            if (fwrite(buffer, 1, bytesRead, output) != bytesRead) break;
+            copiedBytes += bytesRead;
+        }
+        if (input) fclose(input);
+        if (copiedBytes != [segment length]) error = PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorFile, [NSString stringWithFormat:@"Failed to append %@ (%s).", segment.partPath, strerror(errno)]);
+    }
+    if (!output || fclose(output) != 0) error = error ?: PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorFile, [NSString stringWithFormat:@"Failed to write %@ (%s).", assemblyPath, strerror(errno)]);
+    free(buffer);
+
+    if (!error && _totalBytes > 0 && PSCFileSizeAtPath(assemblyPath) != _totalBytes) {
+        error = PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorIncomplete, [NSString stringWithFormat:@"Expected %lld bytes, got %lld.", _totalBytes, PSCFileSizeAtPath(assemblyPath)]);
+    }
+    if (!error && verifyChecksum) {
+        unsigned char digest[CC_MD5_DIGEST_LENGTH];
+        CC_MD5_Final(digest, &md5);
+        BOOL matches = expectedMD5 ? [PSCHexStringForDigest(digest) isEqualToString:expectedMD5] : [PSCBase64StringForDigest(digest) isEqualToString:contentMD5];
+        if (!matches) error = PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorChecksum, [NSString stringWithFormat:@"Checksum mismatch for %@.", self.URL]);
+    }
+    if (!error && rename([assemblyPath fileSystemRepresentation], [self.targetPath fileSystemRepresentation]) != 0) {
+        error = PSCSegmentedDownloadErrorWithCode(PSCSegmentedDownloadErrorFile, [NSString stringWithFormat:@"Failed to move %@ (%s).", assemblyPath, strerror(errno)]);
+    }
+
+    // parts are useless now (a corrupt download needs to start over).
+    unlink([assemblyPath fileSystemRepresentation]);
+    [[NSFileManager new] removeItemAtPath:_partsPath error:NULL];
+    [self finishWithError:error];
+}
+
+// Needs to be called on _downloadQueue.
+- (void)finishWithError:(NSError *)error {
+    if (_finished) return;
+    _finished = YES;
+    _succeeded = !error;
+    // cancelled operations don't call back; break the segment <-> operation cycle here.
+    [self cancelOperations];
+    for (PSCDownloadSegment *segment in _segments) segment.operation = nil;
+
+    dispatch_block_t dataAvailableBlock = self.dataAvailableBlock;
+    if (dataAvailableBlock) dataAvailableBlock(); // wakes up waiting readers
+
+    void (^completionBlock)(NSError *) = self.completionBlock;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (completionBlock) completionBlock(error);
+    });
+}
+
+@end
@@ -0,0 +1,69 @@
+//
+//  PSCStorageQuotaManager.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+typedef NS_ENUM(NSUInteger, PSCStorageCategory) {
+    PSCStorageCategoryPageCache,   // pages rendered by PSPDFCache
+    PSCStorageCategoryDownloads,   // downloaded issues in <storagePath>/downloads
+    PSCStorageCategoryURLCache,    // responses of the shared NSURLCache (SDURLCache), covers and the store catalog
+    PSCStorageCategoryAnnotations, // annotation files of the documents
+};
+
+/**
+    Keeps the disk usage of the Kiosk within a budget.
+
+    Usage is tracked per document and category in a ledger that is persisted in the caches directory, so nothing is
+    walked on startup. The ledger is updated incrementally: page caches are re-measured (one directory) a few seconds
+    after PSPDFCache wrote pages of a document, downloads are recorded with the size the library scanner or the
+    download already know, annotation files are measured when a document is closed. The URL cache reports its own usage.
+
+    When usage exceeds budget, or free disk space drops below minimumFreeDiskSpace, space is reclaimed in this order:
+    1. page caches of issues that were never opened (largest first)
+    2. page caches of opened issues, least recently opened first
+    3. the URL cache
+    4. downloaded issues that can be downloaded again, least recently opened first (only if evictsDownloads is set)
+    Open documents and running downloads are never touched; annotations are never evicted.
+
+    All methods are thread safe.
+*/
+@interface PSCStorageQuotaManager : NSObject
+
+/// Shared instance. Registers as PSPDFCache delegate.
++ (PSCStorageQuotaManager *)sharedStorageQuotaManager;
+
+/// Call when a document is shown/closed. Open documents are not evicted; closing also measures the annotation file.
+- (void)documentDidOpen:(PSPDFDocument *)document;
+- (void)documentDidClose:(PSPDFDocument *)document;
+
+/// Records the size of a downloaded issue.
+- (void)setBytes:(long long)bytes forDownloadOfDocument:(PSPDFDocument *)document;
+
+/// Notes a document the library found on disk. Its page cache is measured once if it's not in the ledger yet.
+- (void)noteDocument:(PSPDFDocument *)document fileSize:(long long)fileSize;
+
+/// Removes all records of a deleted document.
+- (void)removeDocument:(PSPDFDocument *)document;
+
+/// Tracked bytes.
+- (long long)bytesForCategory:(PSCStorageCategory)category;
+@property(nonatomic, assign, readonly) long long totalBytes;
+
+/// Reclaims space if needed. Called automatically (coalesced) whenever usage grows.
+- (void)enforceBudget;
+
+/// Total bytes the Kiosk may use. Defaults to 500MB.
+@property(atomic, assign) long long budget;
+
+/// Space is reclaimed if less is free on the device. Defaults to 100MB.
+@property(atomic, assign) long long minimumFreeDiskSpace;
+
+/// Allows deleting downloaded issues (they stay in the store and can be downloaded again). Defaults to NO.
+@property(atomic, assign) BOOL evictsDownloads;
+
+/// Writes the ledger if it changed. Also called when the app enters the background.
+- (void)save;
+
+@end
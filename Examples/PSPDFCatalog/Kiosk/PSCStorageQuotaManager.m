@@ -0,0 +1,362 @@
+//
+//  PSCStorageQuotaManager.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCStorageQuotaManager.h"
+#import "PSCStoreManager.h"
+#import "PSCMagazine.h"
+
+#define kPSCStorageLedgerFileName @"PSCStorageLedger.plist"
+#define kPSCStorageLedgerVersion 1
+
+#define kPSCStorageKeyPageCache @"pageCache"
+#define kPSCStorageKeyDownload @"download"
+#define kPSCStorageKeyAnnotations @"annotations"
+#define kPSCStorageKeyLastOpened @"lastOpened"
+
+#define kPSCStorageMeasureDelay 5.0 // seconds, coalesces the page callbacks of PSPDFCache
+#define kPSCStorageEnforceDelay 2.0
+
+@interface PSCStorageQuotaManager () <PSPDFCacheDelegate> {
+    NSMutableDictionary *_records; // document UID -> mutable record
+    NSMutableSet *_dirtyPageCaches; // UIDs whose page cache needs measuring
+    NSCountedSet *_openDocuments;
+    BOOL _loaded, _dirty, _measureScheduled, _enforceScheduled;
+    dispatch_queue_t _quotaQueue;
+}
+@end
+
+@implementation PSCStorageQuotaManager
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (PSCStorageQuotaManager *)sharedStorageQuotaManager {
+    static dispatch_once_t pred = 0;
+    __strong static PSCStorageQuotaManager *_sharedStorageQuotaManager = nil;
+    dispatch_once(&pred, ^{
+        _sharedStorageQuotaManager = [self new];
+        [[PSPDFCache sharedCache] addDelegate:_sharedStorageQuotaManager];
+    });
+    return _sharedStorageQuotaManager;
+}
+
++ (NSString *)ledgerPath {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [cachesPath stringByAppendingPathComponent:kPSCStorageLedgerFileName];
+}
+
+// PSPDFCache keeps one directory per document UID below its cacheDirectory.
++ (NSString *)pageCachePathForUID:(NSString *)UID {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [[cachesPath stringByAppendingPathComponent:[PSPDFCache sharedCache].cacheDirectory] stringByAppendingPathComponent:UID];
+}
+
++ (long long)sizeOfItemAtPath:(NSString *)path {
+    NSFileManager *fileManager = [NSFileManager new];
+    NSDictionary *attributes = [fileManager attributesOfItemAtPath:path error:NULL];
+    if (![[attributes fileType] isEqualToString:NSFileTypeDirectory]) return (long long)[attributes fileSize];
+
+    long long size = 0;
+    NSDirectoryEnumerator *enumerator = [fileManager enumeratorAtPath:path];
+    while ([enumerator nextObject]) {
+        size += (long long)[[enumerator fileAttributes] fileSize];
+    }
+    return size;
+}
+
++ (long long)freeDiskSpace {
+    NSDictionary *attributes = [[NSFileManager new] attributesOfFileSystemForPath:NSHomeDirectory() error:NULL];
+    return [attributes[NSFileSystemFreeSize] longLongValue];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _records = [NSMutableDictionary new];
+        _dirtyPageCaches = [NSMutableSet new];
+        _openDocuments = [NSCountedSet new];
+        _budget = 500 * 1024 * 1024;
+        _minimumFreeDiskSpace = 100 * 1024 * 1024;
+        _quotaQueue = dispatch_queue_create("com.pspdfkit.catalog.storageQuotaQueue", NULL);
+
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(save) name:UIApplicationDidEnterBackgroundNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [[PSPDFCache sharedCache] removeDelegate:self];
+    PSPDFDispatchRelease(_quotaQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ pages:%lldKB downloads:%lldKB URLCache:%lldKB annotations:%lldKB budget:%lldKB>", NSStringFromClass([self class]), [self bytesForCategory:PSCStorageCategoryPageCache] / 1024, [self bytesForCategory:PSCStorageCategoryDownloads] / 1024, [self bytesForCategory:PSCStorageCategoryURLCache] / 1024, [self bytesForCategory:PSCStorageCategoryAnnotations] / 1024, self.budget / 1024];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)documentDidOpen:(PSPDFDocument *)document {
+    NSString *UID = document.UID;
+    if (!UID) return;
+    dispatch_async(_quotaQueue, ^{
+        [_openDocuments addObject:UID];
+        [self recordForUID:UID][kPSCStorageKeyLastOpened] = @([NSDate timeIntervalSinceReferenceDate]);
+        _dirty = YES;
+    });
+}
+
+- (void)documentDidClose:(PSPDFDocument *)document {
+    NSString *UID = document.UID;
+    NSString *annotationsPath = document.annotationParser.annotationsPath;
+    if (!UID) return;
+    dispatch_async(_quotaQueue, ^{
+        [_openDocuments removeObject:UID];
+        if (annotationsPath) {
+            [self recordForUID:UID][kPSCStorageKeyAnnotations] = @([[self class] sizeOfItemAtPath:annotationsPath]);
+            _dirty = YES;
+        }
+        [self schedulePageCacheMeasurementForUID:UID];
+    });
+}
+
+- (void)setBytes:(long long)bytes forDownloadOfDocument:(PSPDFDocument *)document {
+    NSString *UID = document.UID;
+    if (!UID) return;
+    dispatch_async(_quotaQueue, ^{
+        [self recordForUID:UID][kPSCStorageKeyDownload] = @(bytes);
+        _dirty = YES;
+        [self scheduleEnforceBudget];
+    });
+}
+
+- (void)noteDocument:(PSPDFDocument *)document fileSize:(long long)fileSize {
+    NSString *UID = document.UID;
+    BOOL isDownload = [[document.basePath stringByStandardizingPath] hasPrefix:[[[PSCStoreManager storagePath] stringByAppendingPathComponent:@"downloads"] stringByStandardizingPath]];
+    if (!UID) return;
+    dispatch_async(_quotaQueue, ^{
+        [self loadIfNeeded];
+        BOOL known = _records[UID] != nil;
+        NSMutableDictionary *record = [self recordForUID:UID];
+        if (isDownload && [record[kPSCStorageKeyDownload] longLongValue] != fileSize) {
+            record[kPSCStorageKeyDownload] = @(fileSize);
+            _dirty = YES;
+        }
+        if (!known) [self schedulePageCacheMeasurementForUID:UID];
+    });
+}
+
+- (void)removeDocument:(PSPDFDocument *)document {
+    NSString *UID = document.UID;
+    if (!UID) return;
+    dispatch_async(_quotaQueue, ^{
+        [self loadIfNeeded];
+        [_records removeObjectForKey:UID];
+        [_dirtyPageCaches removeObject:UID];
+        _dirty = YES;
+    });
+}
+
+- (long long)bytesForCategory:(PSCStorageCategory)category {
+    if (category == PSCStorageCategoryURLCache) return [[NSURLCache sharedURLCache] currentDiskUsage];
+
+    NSString *key = [self recordKeyForCategory:category];
+    __block long long bytes = 0;
+    dispatch_sync(_quotaQueue, ^{
+        [self loadIfNeeded];
+        for (NSDictionary *record in [_records allValues]) bytes += [record[key] longLongValue];
+    });
+    return bytes;
+}
+
+- (long long)totalBytes {
+    long long totalBytes = 0;
+    for (PSCStorageCategory category = PSCStorageCategoryPageCache; category <= PSCStorageCategoryAnnotations; category++) {
+        totalBytes += [self bytesForCategory:category];
+    }
+    return totalBytes;
+}
+
+- (void)enforceBudget {
+    long long URLCacheBytes = [[NSURLCache sharedURLCache] currentDiskUsage];
+    dispatch_async(_quotaQueue, ^{
+        [self loadIfNeeded];
+        _enforceScheduled = NO;
+
+        long long usedBytes = URLCacheBytes;
+        for (NSDictionary *record in [_records allValues]) {
+            usedBytes += [record[kPSCStorageKeyPageCache] longLongValue] + [record[kPSCStorageKeyDownload] longLongValue] + [record[kPSCStorageKeyAnnotations] longLongValue];
+        }
+        long long excessBytes = MAX(usedBytes - self.budget, self.minimumFreeDiskSpace - [[self class] freeDiskSpace]);
+        if (excessBytes <= 0) return;
+
+        PSCLog(@"Storage %lldKB over budget (using %lldKB), reclaiming space.", excessBytes / 1024, usedBytes / 1024);
+        NSArray *pageCacheUIDs = [self evictionOrderForKey:kPSCStorageKeyPageCache];
+        NSArray *downloadUIDs = self.evictsDownloads ? [self evictionOrderForKey:kPSCStorageKeyDownload] : nil;
+        NSDictionary *pageCacheBytes = [self bytesForKey:kPSCStorageKeyPageCache UIDs:pageCacheUIDs];
+        NSDictionary *downloadBytes = [self bytesForKey:kPSCStorageKeyDownload UIDs:downloadUIDs];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self reclaimBytes:excessBytes pageCacheUIDs:pageCacheUIDs pageCacheBytes:pageCacheBytes downloadUIDs:downloadUIDs downloadBytes:downloadBytes];
+        });
+    });
+}
+
+- (void)save {
+    dispatch_sync(_quotaQueue, ^{
+        if (!_dirty) return;
+        NSDictionary *ledger = @{@"version" : @(kPSCStorageLedgerVersion), @"records" : _records};
+        NSData *data = [NSPropertyListSerialization dataWithPropertyList:ledger format:NSPropertyListBinaryFormat_v1_0 options:0 error:NULL];
+        if ([data writeToFile:[[self class] ledgerPath] atomically:YES]) {
+            _dirty = NO;
+        }
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSString *)recordKeyForCategory:(PSCStorageCategory)category {
+    switch (category) {
+        case PSCStorageCategoryPageCache:   return kPSCStorageKeyPageCache;
+        case PSCStorageCategoryDownloads:   return kPSCStorageKeyDownload;
+        case PSCStorageCategoryAnnotations: return kPSCStorageKeyAnnotations;
+        default:                            return nil;
+    }
+}
+
+// Needs to be called on _quotaQueue.
+- (void)loadIfNeeded {
+    if (_loaded) return;
+    _loaded = YES;
+
+    NSData *data = [NSData dataWithContentsOfFile:[[self class] ledgerPath]];
+    NSDictionary *ledger = data ? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListMutableContainers format:NULL error:NULL] : nil;
+    if ([ledger isKindOfClass:[NSDictionary class]] && [ledger[@"version"] integerValue] == kPSCStorageLedgerVersion) {
+        [_records addEntriesFromDictionary:ledger[@"records"]];
+    }
+}
+
+// Needs to be called on _quotaQueue.
+- (NSMutableDictionary *)recordForUID:(NSString *)UID {
+    [self loadIfNeeded];
+    NSMutableDictionary *record = _records[UID];
+    if (!record) {
+        record = [NSMutableDictionary dictionary];
+        _records[UID] = record;
+    }
+    return record;
+}
+
+// Needs to be called on _quotaQueue.
+- (void)schedulePageCacheMeasurementForUID:(NSString *)UID {
+    [_dirtyPageCaches addObject:UID];
+    if (_measureScheduled) return;
+    _measureScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kPSCStorageMeasureDelay * NSEC_PER_SEC)), _quotaQueue, ^{
+        _measureScheduled = NO;
+        for (NSString *dirtyUID in _dirtyPageCaches) {
+            [self recordForUID:dirtyUID][kPSCStorageKeyPageCache] = @([[self class] sizeOfItemAtPath:[[self class] pageCachePathForUID:dirtyUID]]);
+        }
+        [_dirtyPageCaches removeAllObjects];
+        _dirty = YES;
+        [self scheduleEnforceBudget];
+    });
+}
+
+// Needs to be called on _quotaQueue.
+- (void)scheduleEnforceBudget {
+    if (_enforceScheduled) return;
+    _enforceScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kPSCStorageEnforceDelay * NSEC_PER_SEC)), _quotaQueue, ^{
+        [self enforceBudget];
+    });
+}
+
+// Needs to be called on _quotaQueue. Never opened documents first (largest first), then least recently opened.
+- (NSArray *)evictionOrderForKey:(NSString *)key {
+    NSMutableArray *UIDs = [NSMutableArray array];
+    [_records enumerateKeysAndObjectsUsingBlock:^(NSString *UID, NSDictionary *record, BOOL *stop) {
+        if ([record[key] longLongValue] > 0 && ![_openDocuments containsObject:UID]) [UIDs addObject:UID];
+    }];
+    [UIDs sortUsingComparator:^NSComparisonResult(NSString *UID1, NSString *UID2) {
+        NSDictionary *record1 = _records[UID1], *record2 = _records[UID2];
+        double lastOpened1 = [record1[kPSCStorageKeyLastOpened] doubleValue], lastOpened2 = [record2[kPSCStorageKeyLastOpened] doubleValue];
+        if (lastOpened1 != lastOpened2) return lastOpened1 < lastOpened2 ? NSOrderedAscending : NSOrderedDescending;
+        long long size1 = [record1[key] longLongValue], size2 = [record2[key] longLongValue];
+        return size1 > size2 ? NSOrderedAscending : (size1 < size2 ? NSOrderedDescending : NSOrderedSame);
+    }];
+    return UIDs;
+}
+
+// Needs to be called on _quotaQueue.
+- (NSDictionary *)bytesForKey:(NSString *)key UIDs:(NSArray *)UIDs {
+    NSMutableDictionary *bytes = [NSMutableDictionary dictionaryWithCapacity:[UIDs count]];
+    for (NSString *UID in UIDs) bytes[UID] = _records[UID][key];
+    return bytes;
+}
+
+// Called on the main thread, where the store lives.
+- (void)reclaimBytes:(long long)excessBytes pageCacheUIDs:(NSArray *)pageCacheUIDs pageCacheBytes:(NSDictionary *)pageCacheBytes downloadUIDs:(NSArray *)downloadUIDs downloadBytes:(NSDictionary *)downloadBytes {
+    PSCStoreManager *storeManager = [PSCStoreManager sharedStoreManager];
+    long long reclaimedBytes = 0;
+    NSMutableArray *clearedPageCacheUIDs = [NSMutableArray array];
+
+    for (NSString *UID in pageCacheUIDs) {
+        if (reclaimedBytes >= excessBytes) break;
+        PSCMagazine *magazine = [storeManager magazineForUID:UID];
+        if (magazine.isDownloading) continue;
+        if (magazine) {
+            [[PSPDFCache sharedCache] removeCacheForDocument:magazine deleteDocument:NO waitUntilDone:NO];
+        }else {
+            [[NSFileManager new] removeItemAtPath:[[self class] pageCachePathForUID:UID] error:NULL]; // document is gone
+        }
+        reclaimedBytes += [pageCacheBytes[UID] longLongValue];
+        [clearedPageCacheUIDs addObject:UID];
+    }
+
+    if (reclaimedBytes < excessBytes) {
+        NSURLCache *URLCache = [NSURLCache sharedURLCache];
+        reclaimedBytes += [URLCache currentDiskUsage];
+        [URLCache removeAllCachedResponses];
+    }
+
+    for (NSString *UID in downloadUIDs) {
+        if (reclaimedBytes >= excessBytes) break;
+        PSCMagazine *magazine = [storeManager magazineForUID:UID];
+        if (!magazine.URL || !magazine.isAvailable || magazine.isDownloading) continue; // can't be downloaded again
+        reclaimedBytes += [downloadBytes[UID] longLongValue];
+        [storeManager deleteMagazine:magazine]; // calls removeDocument:
+    }
+
+    PSCLog(@"Reclaimed %lldKB of %lldKB.", reclaimedBytes / 1024, excessBytes / 1024);
+    dispatch_async(_quotaQueue, ^{
+        for (NSString *UID in clearedPageCacheUIDs) {
+            [_records[UID] removeObjectForKey:kPSCStorageKeyPageCache];
+        }
+        _dirty = YES;
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFCacheDelegate
+
+- (void)didCachePageForDocument:(PSPDFDocument *)document page:(NSUInteger)page image:(UIImage *)cachedImage size:(PSPDFSize)size {
+    if (size == PSPDFSizeTiny) return; // memory only
+    NSString *UID = document.UID;
+    if (!UID) return;
+    dispatch_async(_quotaQueue, ^{
+        [self schedulePageCacheMeasurementForUID:UID];
+    });
+}
+
+@end
@@ -50,6 +50,9 @@
 - (void)downloadMagazine:(PSCMagazine *)magazine;
 - (PSCDownload *)downloadObjectForMagazine:(PSCMagazine *)magazine;
 
+/// Magazine with UID, nil if it isn't in the store.
+- (PSCMagazine *)magazineForUID:(NSString *)uid;
+
 - (void)addMagazinesToStore:(NSArray *)magazines;
 
 // Delete
@@ -9,14 +9,20 @@
 #import "PSCMagazine.h"
 #import "PSCMagazineFolder.h"
 #import "PSCDownload.h"
+#import "PSCDownloadScheduler.h"
+#import "PSCLibraryCatalog.h"
+#import "PSCLibraryScanner.h"
+#import "PSCStorageQuotaManager.h"
 #import "NSObject+BlockObservation.h"
-#import "AFJSONRequestOperation.h"
+#import "PSCCatalogParser.h"
 #include <sys/xattr.h>
 #include <objc/runtime.h>
 
 @interface PSCStoreManager()
 @property (nonatomic, strong) NSMutableArray *magazineFolders;
 @property (nonatomic, strong) NSMutableArray *downloadQueue;
+@property (nonatomic, strong) PSCLibraryScanner *libraryScanner;
+@property (nonatomic, strong) NSMutableDictionary *catalogMagazines; // URL string -> PSCMagazine of the web catalog
 - (void)updateNewsstandIcon:(PSCMagazine *)magazine;
 @end
 
@@ -32,107 +38,130 @@ static char kvoToken; // we need a static address for the kvo token
     __strong static PSCStoreManager *_sharedStoreManager = nil;
     dispatch_once(&pred, ^{
         _sharedStoreManager = [self new];
-
-        // allow plain text in JSON downloader class, fixes servers that don't know about JSON.
-        [AFJSONRequestOperation addAcceptableContentTypes:[NSSet setWithObject:@"text/plain"]];
     });
     return _sharedStoreManager;
 }
 
-+ (NSOperationQueue *)sharedOperationQueue {
-    static __strong NSOperationQueue *_sharedOperationQueue = nil;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        _sharedOperationQueue = [NSOperationQueue new];
-        [_sharedOperationQueue setMaxConcurrentOperationCount:2];
-    });
-    return _sharedOperationQueue;
-}
-
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - Private 
 
-// helper for folder search
-- (NSMutableArray *)searchFolder:(NSString *)sampleFolder {
-    NSError *error = nil;
-    NSFileManager *fileManager = [[NSFileManager alloc] init];
-    NSArray *documentContents = [fileManager contentsOfDirectoryAtPath:sampleFolder error:&error];
+- (PSCMagazine *)magazineForEntry:(PSCLibraryScanEntry *)entry {
+    PSCMagazine *magazine = [PSCMagazine magazineWithPath:entry.path];
+    magazine.title = entry.title; // from the library catalog, don't open the PDF for the title
+    return magazine;
+}
+
+// groups entries by folder. Everything goes into one folder if kPSPDFStoreManagerPlain is set.
+- (NSMutableArray *)magazineFoldersForEntries:(NSArray *)entries {
     NSMutableArray *folders = [NSMutableArray array];
-    PSCMagazineFolder *rootFolder = [PSCMagazineFolder folderWithTitle:[[NSURL fileURLWithPath:sampleFolder] lastPathComponent]];
-    
-    for (NSString *folder in documentContents) {
-        // check if target path is a directory (all magazines are in directories)
-        NSString *fullPath = [sampleFolder stringByAppendingPathComponent:folder];
-        BOOL isDir;
-        if ([fileManager fileExistsAtPath:fullPath isDirectory:&isDir]) {
-            if (isDir) {
-                PSCMagazineFolder *contentFolder = [PSCMagazineFolder folderWithTitle:[fullPath lastPathComponent]];
-                NSArray *subDocumentContents = [fileManager contentsOfDirectoryAtPath:fullPath error:&error];
-                for (NSString *afolder in subDocumentContents) {
-                    if ([[afolder lowercaseString] hasSuffix:@"pdf"]) {
-                        PSCMagazine *magazine = [PSCMagazine magazineWithPath:[fullPath stringByAppendingPathComponent:afolder]];
-                        [contentFolder addMagazine:magazine];
-                    }
-                }
-                
-                if ([contentFolder.magazines count]) {
-                    [folders addObject:contentFolder];
-                }
-            }else if([[fullPath lowercaseString] hasSuffix:@"pdf"]) {
-                @autoreleasepool {
-                    PSCMagazine *magazine = [PSCMagazine magazineWithPath:fullPath];
-                    [rootFolder addMagazine:magazine];
-                }
-            }
+    NSMutableArray *magazineArrays = [NSMutableArray array];
+    NSMutableDictionary *folderIndexes = [NSMutableDictionary dictionary];
+    for (PSCLibraryScanEntry *entry in entries) {
+        NSString *folderKey = kPSPDFStoreManagerPlain ? @"" : entry.folderTitle;
+        NSNumber *folderIndex = folderIndexes[folderKey];
+        if (!folderIndex) {
+            folderIndex = @([folders count]);
+            folderIndexes[folderKey] = folderIndex;
+            [folders addObject:[PSCMagazineFolder folderWithTitle:entry.folderTitle]];
+            [magazineArrays addObject:[NSMutableArray array]];
         }
+        [magazineArrays[[folderIndex unsignedIntegerValue]] addObject:[self magazineForEntry:entry]];
     }
-    if ([rootFolder.magazines count]) {
-        [folders addObject:rootFolder];
+
+    // set all magazines at once; addMagazine: sorts after every call.
+    [folders enumerateObjectsUsingBlock:^(PSCMagazineFolder *folder, NSUInteger idx, BOOL *stop) {
+        folder.magazines = magazineArrays[idx];
+    }];
+
+    // if we don't have any folders, create one
+    if (kPSPDFStoreManagerPlain && [folders count] == 0) {
+        [folders addObject:[PSCMagazineFolder folderWithTitle:@""]];
     }
-    
     return folders;
 }
 
-// doesn't support deep hierarchies. Just root or a folder
-- (NSMutableArray *)searchForMagazineFolders {
-    NSMutableArray *folders = [NSMutableArray array];
-    
-    NSString *sampleFolder = [[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:@"Samples"];
-    [folders addObjectsFromArray:[self searchFolder:sampleFolder]];
-    
-    NSString *dirPath = [[PSCStoreManager storagePath] stringByAppendingPathComponent:@"downloads"];
-    [folders addObjectsFromArray:[self searchFolder:dirPath]];
-    
-    // flatten hierarchy
-    if (kPSPDFStoreManagerPlain) {
-        // if we don't have any folders, create one
-        if ([folders count] == 0) {
-            PSCMagazineFolder *aFolder = [PSCMagazineFolder folderWithTitle:@""];
-            [folders addObject:aFolder];
+// Samples in the app bundle and downloaded magazines; subfolders become magazine folders.
+- (PSCLibraryScanner *)libraryScanner {
+    pspdf_dispatch_sync_reentrant(_magazineFolderQueue, ^{
+        if (!_libraryScanner) {
+            NSString *sampleFolder = [[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:@"Samples"];
+            NSString *downloadFolder = [[PSCStoreManager storagePath] stringByAppendingPathComponent:@"downloads"];
+            _libraryScanner = [[PSCLibraryScanner alloc] initWithRootPaths:@[sampleFolder, downloadFolder] snapshotName:@"PSCLibrarySnapshot"];
         }
+    });
+    return _libraryScanner;
+}
 
-        NSMutableArray *foldersCopy = [folders mutableCopy];
-        PSCMagazineFolder *firstFolder = foldersCopy[0];
-        [foldersCopy removeObject:firstFolder];
-        NSMutableArray *magazineArray = [firstFolder.magazines mutableCopy];
-        
-        for (PSCMagazineFolder *folder in foldersCopy) {
-            [magazineArray addObjectsFromArray:folder.magazines];
-            [folders removeObject:folder];
-        }
-        
-        firstFolder.magazines = magazineArray;
+- (PSCMagazineFolder *)folderForEntry:(PSCLibraryScanEntry *)entry {
+    if (kPSPDFStoreManagerPlain) return [self.magazineFolders lastObject];
+
+    for (PSCMagazineFolder *folder in self.magazineFolders) {
+        if ([folder.title isEqualToString:entry.folderTitle]) return folder;
     }
-    
-    return folders;
+    PSCMagazineFolder *folder = [PSCMagazineFolder folderWithTitle:entry.folderTitle];
+    dispatch_barrier_sync(_magazineFolderQueue, ^{
+        [_magazineFolders addObject:folder];
+    });
+    return folder;
 }
 
-// add a magazine to folder, then re-sort it
-- (PSCMagazineFolder *)addMagazineToFolder:(PSCMagazine *)magazine {
-    PSCMagazineFolder *folder = [self.magazineFolders lastObject];
-    [folder addMagazine:magazine];
-    NSAssert([folder isKindOfClass:[PSCMagazineFolder class]], @"incorrect type");
-    return folder;
+// applies changes found by the library scanner. Called on the main thread.
+- (void)updateLibraryWithAddedEntries:(NSArray *)addedEntries removedEntries:(NSArray *)removedEntries {
+    [_delegate magazineStoreBeginUpdate];
+
+    for (PSCLibraryScanEntry *entry in removedEntries) {
+        PSCMagazine *magazine = [self magazineForPath:entry.path];
+        if (!magazine) continue; // already deleted
+
+        PSCMagazineFolder *folder = magazine.folder;
+        if (!magazine.URL) {
+            [_delegate magazineStoreMagazineDeleted:magazine];
+            [[PSPDFCache sharedCache] removeCacheForDocument:magazine deleteDocument:NO waitUntilDone:NO];
+            [[PSCStorageQuotaManager sharedStorageQuotaManager] removeDocument:magazine];
+            [folder removeMagazine:magazine];
+
+            if ([folder.magazines count] > 0 || kPSPDFStoreManagerPlain) {
+                [_delegate magazineStoreFolderModified:folder];
+            }else {
+                [_delegate magazineStoreFolderDeleted:folder];
+                dispatch_barrier_sync(_magazineFolderQueue, ^{
+                    [_magazineFolders removeObject:folder];
+                });
+            }
+        }else if (magazine.isAvailable && !magazine.isDownloading) {
+            // file is gone, needs redownloading
+            magazine.available = NO;
+            [_delegate magazineStoreMagazineModified:magazine];
+        }
+    }
+
+    for (PSCLibraryScanEntry *entry in addedEntries) {
+        // already known, e.g. a finished download.
+        PSCMagazine *magazine = [self magazineForPath:entry.path];
+        if (magazine) {
+            [[PSCStorageQuotaManager sharedStorageQuotaManager] noteDocument:magazine fileSize:entry.fileSize];
+            if (!magazine.isAvailable && !magazine.isDownloading) {
+                magazine.available = YES;
+                [_delegate magazineStoreMagazineModified:magazine];
+            }
+            continue;
+        }
+
+        magazine = [self magazineForEntry:entry];
+        [[PSCStorageQuotaManager sharedStorageQuotaManager] noteDocument:magazine fileSize:entry.fileSize];
+        PSCMagazineFolder *folder = [self folderForEntry:entry];
+        [folder addMagazine:magazine];
+
+        // folder fresh or updated?
+        if ([folder.magazines count] == 1) {
+            [_delegate magazineStoreFolderAdded:folder];
+        }else {
+            [_delegate magazineStoreFolderModified:folder];
+        }
+        [_delegate magazineStoreMagazineAdded:magazine];
+    }
+
+    [_delegate magazineStoreEndUpdate];
 }
 
 - (PSCMagazine *)magazineForUID:(NSString *)uid {
@@ -147,6 +176,18 @@ static char kvoToken; // we need a static address for the kvo token
     return nil;
 }
 
+- (PSCMagazine *)magazineForPath:(NSString *)path {
+    for (PSCMagazineFolder *folder in self.magazineFolders) {
+        for (PSCMagazine *magazine in folder.magazines) {
+            if ([magazine.files count] && [[[magazine URLForFileIndex:0] path] isEqualToString:path]) {
+                return magazine;
+            }
+        }
+    }
+
+    return nil;
+}
+
 - (PSCMagazine *)magazineForFileName:(NSString *)fileName {
     for (PSCMagazineFolder *folder in self.magazineFolders) {
         for (PSCMagazine *magazine in folder.magazines) {
@@ -159,74 +200,173 @@ static char kvoToken; // we need a static address for the kvo token
     return nil;
 }
 
+// Last catalog, so a delta catalog can be merged and web magazines show before the request finishes.
+- (NSString *)catalogCachePath {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [cachesPath stringByAppendingPathComponent:@"PSCStoreCatalog.plist"];
+}
+
+// only the keys we use, as strings (JSON can contain null, which plists can't store).
+- (NSDictionary *)catalogEntryForJSON:(NSDictionary *)JSON {
+    NSMutableDictionary *entry = [NSMutableDictionary dictionary];
+    for (NSString *key in @[@"name", @"url", @"image"]) {
+        id value = JSON[key];
+        if ([value isKindOfClass:[NSString class]]) entry[key] = value;
+    }
+    return [entry[@"url"] length] ? entry : nil;
+}
+
+// creates or updates the magazines of catalog entries; one store update per batch. Called on the main thread.
+- (void)mergeCatalogEntries:(NSArray *)entries {
+    NSMutableDictionary *magazinesByFileName = [NSMutableDictionary dictionary];
+    for (PSCMagazineFolder *folder in self.magazineFolders) {
+        for (PSCMagazine *magazine in folder.magazines) {
+            if ([magazine.files count]) magazinesByFileName[magazine.files[0]] = magazine;
+        }
+    }
+
+    NSMutableArray *newMagazines = [NSMutableArray array];
+    NSMutableArray *modifiedMagazines = [NSMutableArray array];
+    for (NSDictionary *entry in entries) {
+        NSString *title = entry[@"name"];
+        NSString *urlString = entry[@"url"];
+        NSString *imageURLString = entry[@"image"];
+        if ([imageURLString length] == 0) {
+            // if no image key is set, try same location as the pdf, but with jpg ending.
+            imageURLString = [urlString stringByReplacingOccurrencesOfString:@".pdf" withString:@".jpg" options:NSCaseInsensitiveSearch | NSBackwardsSearch range:NSMakeRange(0, [urlString length])];
+        }
+        NSString *fileName = [urlString lastPathComponent]; // we use fileName as our way to map files to files on disk - be sure to make it unique!
+
+        PSCMagazine *magazine = _catalogMagazines[urlString] ?: magazinesByFileName[fileName];
+        if (!magazine) {
+            // no magazine found on-disk, create new container
+            magazine = [PSCMagazine magazineWithPath:nil];
+            magazine.available = NO; // not yet available
+            [newMagazines addObject:magazine];
+        }else if (![magazine.title isEqualToString:title] || ![[magazine.URL absoluteString] isEqualToString:urlString] || ![[magazine.imageURL absoluteString] isEqualToString:imageURLString]) {
+            [modifiedMagazines addObject:magazine];
+        }
+        _catalogMagazines[urlString] = magazine;
+
+        // the web title is kept in the cached catalog, which is merged again after a restart.
+        magazine.title = title;
+        magazine.URL = [urlString length] ? [NSURL URLWithString:urlString] : nil;
+        magazine.imageURL = [imageURLString length] ? [NSURL URLWithString:imageURLString] : nil;
+    }
+
+    [self addMagazinesToStore:newMagazines];
+
+    if ([modifiedMagazines count]) {
+        [_delegate magazineStoreBeginUpdate];
+        for (PSCMagazine *magazine in modifiedMagazines) {
+            [_delegate magazineStoreMagazineModified:magazine];
+        }
+        [_delegate magazineStoreEndUpdate];
+    }
+}
+
+// magazines that left the catalog. Downloaded ones stay in the library.
+- (void)removeCatalogEntriesWithURLStrings:(NSArray *)urlStrings {
+    NSMutableArray *removedMagazines = [NSMutableArray array];
+    for (NSString *urlString in urlStrings) {
+        PSCMagazine *magazine = _catalogMagazines[urlString];
+        [_catalogMagazines removeObjectForKey:urlString];
+        if (magazine.folder && !magazine.isAvailable && !magazine.isDownloading) {
+            [removedMagazines addObject:magazine];
+        }
+    }
+    if ([removedMagazines count] == 0) return;
+
+    [_delegate magazineStoreBeginUpdate];
+    for (PSCMagazine *magazine in removedMagazines) {
+        PSCMagazineFolder *folder = magazine.folder;
+        [_delegate magazineStoreMagazineDeleted:magazine];
+        [folder removeMagazine:magazine];
+        [_delegate magazineStoreFolderModified:folder];
+    }
+    [_delegate magazineStoreEndUpdate];
+}
+
+// Shows the magazines of the last catalog, then streams the new catalog (a delta if the server supports it) and merges
+// its entries while they arrive.
 - (void)loadMagazinesAvailableFromWeb {
-    NSURLRequest *loadRequest = [NSURLRequest requestWithURL:[NSURL URLWithString:kPSPDFMagazineJSONURL] cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:30.f];
-    AFJSONRequestOperation *operation = [AFJSONRequestOperation JSONRequestOperationWithRequest:loadRequest success:^(NSURLRequest *request, NSHTTPURLResponse *response, id JSON) {
-        NSArray *dlMagazines = (NSArray *)JSON;
-        NSMutableArray *newMagazines = [NSMutableArray array];
-        for (NSDictionary *dlMagazine in dlMagazines) {
-            if (![dlMagazine isKindOfClass:[NSDictionary class]]) {
-                PSCLog(@"Error while parsing magazine JSON - Dictionary expected. Got this instead: %@", dlMagazine);
-            }else {
-                // create and fill PSPDFMagazine
-                NSString *title = dlMagazine[@"name"];
-                NSString *urlString = dlMagazine[@"url"];
-                NSString *imageURLString = dlMagazine[@"image"];
-                if ([imageURLString length] == 0) {
-                    // if no image key is set, try same location as the pdf, but with jpg ending.
-                    imageURLString = [urlString stringByReplacingOccurrencesOfString:@".pdf" withString:@".jpg" options:NSCaseInsensitiveSearch | NSBackwardsSearch range:NSMakeRange(0, [urlString length])];
-                }
-                NSString *fileName = [urlString lastPathComponent]; // we use fileName as our way to map files to files on disk - be sure to make it unique!
-                
-                PSCMagazine *magazine = [self magazineForFileName:fileName];
-                if (!magazine) {
-                    // no magazine found on-disk, create new container
-                    magazine = [PSCMagazine magazineWithPath:nil];                
-                    magazine.available = NO; // not yet available
-                    [newMagazines addObject:magazine];
-                }
-                
-                // TODO: this is not optimal. The title from used in the web is saved nowhere.
-                // After a restart, the title within the pdf document's metadata is used, or if no title set there, the filename.
-                magazine.title = title;
-                magazine.URL = [urlString length] ? [NSURL URLWithString:urlString] : nil;
-                magazine.imageURL = [imageURLString length] ? [NSURL URLWithString:imageURLString] : nil;
+    NSString *catalogCachePath = [self catalogCachePath];
+    NSDictionary *cachedCatalog = [NSDictionary dictionaryWithContentsOfFile:catalogCachePath];
+    NSMutableDictionary *catalogEntries = [NSMutableDictionary dictionaryWithDictionary:cachedCatalog[@"entries"]];
+    if ([catalogEntries count]) {
+        [self mergeCatalogEntries:[catalogEntries allValues]];
+    }
+
+    NSString *version = [catalogEntries count] ? cachedCatalog[@"version"] : nil;
+    NSString *ETag = [catalogEntries count] ? cachedCatalog[@"ETag"] : nil;
+    NSMutableDictionary *receivedEntries = [NSMutableDictionary dictionary];
+    PSCCatalogRequestOperation *operation = [PSCCatalogRequestOperation catalogRequestOperationWithURL:[NSURL URLWithString:kPSPDFMagazineJSONURL] version:version ETag:ETag entriesHandler:^(NSArray *entries) {
+        NSMutableArray *catalogBatch = [NSMutableArray arrayWithCapacity:[entries count]];
+        for (NSDictionary *JSON in entries) {
+            NSDictionary *entry = [self catalogEntryForJSON:JSON];
+            if (entry) {
+                [catalogBatch addObject:entry];
+                receivedEntries[entry[@"url"]] = entry;
             }
         }
-        [self addMagazinesToStore:newMagazines];
-    } failure:^(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error, id JSON) {
-        PSCLog(@"Failed to download JSON: %@", error);
+        [self mergeCatalogEntries:catalogBatch];
+    } completion:^(PSCCatalogParser *parser, NSHTTPURLResponse *response, NSError *error) {
+        if (error) {
+            PSCLog(@"Failed to download JSON: %@", error);
+            return;
+        }
+        if (!parser) return; // not modified, the cached catalog is current
+
+        NSArray *removedURLStrings;
+        if (parser.isDelta) {
+            [catalogEntries addEntriesFromDictionary:receivedEntries];
+            removedURLStrings = parser.removedURLs ?: @[];
+            [catalogEntries removeObjectsForKeys:removedURLStrings];
+        }else {
+            NSMutableSet *missingURLStrings = [NSMutableSet setWithArray:[catalogEntries allKeys]];
+            [missingURLStrings minusSet:[NSSet setWithArray:[receivedEntries allKeys]]];
+            removedURLStrings = [missingURLStrings allObjects];
+            [catalogEntries setDictionary:receivedEntries];
+        }
+        [self removeCatalogEntriesWithURLStrings:removedURLStrings];
+        PSCLog(@"Loaded catalog: %@", parser);
+
+        NSMutableDictionary *catalog = [NSMutableDictionary dictionaryWithObject:catalogEntries forKey:@"entries"];
+        if (parser.version) catalog[@"version"] = parser.version;
+        if ([response allHeaderFields][@"ETag"]) catalog[@"ETag"] = [response allHeaderFields][@"ETag"];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+            NSData *data = [NSPropertyListSerialization dataWithPropertyList:catalog format:NSPropertyListBinaryFormat_v1_0 options:0 error:NULL];
+            [data writeToFile:catalogCachePath atomically:YES];
+        });
     }];
-    
-    [[[self class] sharedOperationQueue] addOperation:operation];
+
+    [[PSCDownloadScheduler sharedDownloadScheduler] addOperation:operation priority:PSCDownloadPriorityVisible];
 }
 
 - (void)didReceiveMemoryWarning {} // NOP
 
-// load magazines from disk
+// load magazines from disk: show the last scan right away, then scan for changes.
 - (void)loadMagazinesFromDisk {
-    NSMutableArray *magazineFolders = [self searchForMagazineFolders];
+    PSCLibraryScanner *libraryScanner = self.libraryScanner;
+    NSMutableArray *magazineFolders = [self magazineFoldersForEntries:[libraryScanner snapshotEntries]];
     
     dispatch_async(dispatch_get_main_queue(), ^{
         pspdf_dispatch_sync_reentrant(_magazineFolderQueue, ^{
             self.magazineFolders = magazineFolders;
-            [[NSNotificationCenter defaultCenter] postNotificationName:kPSPDFStoreDiskLoadFinishedNotification object:magazineFolders];
+        });
+        [[NSNotificationCenter defaultCenter] postNotificationName:kPSPDFStoreDiskLoadFinishedNotification object:magazineFolders];
+
+        [libraryScanner scanWithChangeHandler:^(NSArray *addedEntries, NSArray *removedEntries) {
+            [self updateLibraryWithAddedEntries:addedEntries removedEntries:removedEntries];
+        } completion:^{
+            // drop metadata of files that are gone.
+            PSCLibraryCatalog *libraryCatalog = [PSCLibraryCatalog sharedLibraryCatalog];
+            [libraryCatalog removeEntriesExceptForPaths:[NSSet setWithArray:[[libraryScanner snapshotEntries] valueForKey:@"path"]]];
+            [libraryCatalog save];
 
-            /*
-            // ensure we have thumbnails for all magazines (else they would be lazy-loaded)
-            // must run on the main thread, as magazines/magazineFolder can be mutated while running
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [magazineFolders enumerateObjectsWithOptions:NSEnumerationReverse usingBlock:^(id folder, NSUInteger idx, BOOL *stop) {
-                    [[folder magazines] enumerateObjectsWithOptions:NSEnumerationReverse usingBlock:^(id magazine, NSUInteger idx2, BOOL *stop2) {
-                        [[PSPDFCache sharedCache] cachedImageForDocument:magazine page:0 size:PSPDFSizeThumbnail];
-                    }];
-                }];
-            });
-             */
-            
             // now start web-request
             [self loadMagazinesAvailableFromWeb];
-        });
+        }];
     });
 }
 
@@ -240,6 +380,11 @@ static char kvoToken; // we need a static address for the kvo token
 }
 
 - (void)finishDownload:(PSCDownload *)storeDownload {
+    if (storeDownload.status == PSPDFStoreDownloadFinished) {
+        NSNumber *fileSize = [[NSFileManager new] attributesOfItemAtPath:[storeDownload.magazine.fileURL path] error:NULL][NSFileSize];
+        [[PSCStorageQuotaManager sharedStorageQuotaManager] setBytes:[fileSize longLongValue] forDownloadOfDocument:storeDownload.magazine];
+    }
+
     AMBlockToken *blockToken = (AMBlockToken *)objc_getAssociatedObject(storeDownload, &kvoToken);
     [storeDownload removeObserverWithBlockToken:blockToken];
     [_downloadQueue removeObject:storeDownload];
@@ -261,6 +406,10 @@ static char kvoToken; // we need a static address for the kvo token
     if ((self = [super init])) {
         _magazineFolderQueue = dispatch_queue_create("com.pspdfkit.store.magazineFolderQueue", NULL);
         _downloadQueue = [[NSMutableArray alloc] init];
+        _catalogMagazines = [[NSMutableDictionary alloc] init];
+
+        // keeps page caches, downloads and the URL cache within the storage budget
+        [PSCStorageQuotaManager sharedStorageQuotaManager];
         
         // register for memory notifications
         NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
@@ -296,6 +445,7 @@ static char kvoToken; // we need a static address for the kvo token
         }
         
         [[PSPDFCache sharedCache] removeCacheForDocument:magazine deleteDocument:YES waitUntilDone:NO];
+        [[PSCStorageQuotaManager sharedStorageQuotaManager] removeDocument:magazine];
     }
     
     [_delegate magazineStoreFolderDeleted:magazineFolder];
@@ -331,6 +481,7 @@ static char kvoToken; // we need a static address for the kvo token
     
     // clear everything
     [[PSPDFCache sharedCache] removeCacheForDocument:magazine deleteDocument:YES waitUntilDone:NO];
+    [[PSCStorageQuotaManager sharedStorageQuotaManager] removeDocument:magazine];
 
     // if magazine has no url - delete
     if (!magazine.URL) {
@@ -450,29 +601,50 @@ static char kvoToken; // we need a static address for the kvo token
 
 - (void)addMagazinesToStore:(NSArray *)magazines {
     
-    // filter out magazines that are already in array
-    NSMutableArray *newMagazines = [NSMutableArray arrayWithArray:magazines];
-    for (PSCMagazine *newMagazine in magazines) {
-        for (PSCMagazineFolder *folder in self.magazineFolders) {
-            NSArray *foundMagazines = [folder.magazines filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"self.UID == %@", newMagazine.UID]];
-            [newMagazines removeObjectsInArray:foundMagazines];
+    // filter out magazines that are already in the store. Catalog magazines without a file share the UID of an
+    // empty document, so they are compared by URL (the key of _catalogMagazines); UIDs only for on-disk magazines.
+    NSMutableSet *knownUIDs = [NSMutableSet set];
+    NSMutableSet *knownURLStrings = [NSMutableSet set];
+    for (PSCMagazineFolder *folder in self.magazineFolders) {
+        for (PSCMagazine *magazine in folder.magazines) {
+            if ([magazine.files count] == 0) {
+                if (magazine.URL) [knownURLStrings addObject:[magazine.URL absoluteString]];
+            }else if (magazine.UID) {
+                [knownUIDs addObject:magazine.UID];
+            }
+        }
+    }
+    NSMutableArray *newMagazines = [NSMutableArray array];
+    for (PSCMagazine *magazine in magazines) {
+        if (magazine.folder) continue;
+        if ([magazine.files count] == 0) {
+            NSString *urlString = [magazine.URL absoluteString];
+            if (urlString && [knownURLStrings containsObject:urlString]) continue;
+            if (urlString) [knownURLStrings addObject:urlString];
+        }else {
+            if (magazine.UID && [knownUIDs containsObject:magazine.UID]) continue;
+            if (magazine.UID) [knownUIDs addObject:magazine.UID];
         }
+        [newMagazines addObject:magazine];
     }
     
     if ([newMagazines count] > 0) {
         [_delegate magazineStoreBeginUpdate];
         
-        for (PSCMagazine *magazine in magazines) {
-            PSCMagazineFolder *folder = [self addMagazineToFolder:magazine];
-            
-
-            // folder fresh or updated?
-            if ([folder.magazines count] == 1) {
-                [_delegate magazineStoreFolderAdded:folder];
-            }else {
-                [_delegate magazineStoreFolderModified:folder]; 
-            }
-            
+        // add all at once, the folder sorts after every change.
+        PSCMagazineFolder *folder = [self.magazineFolders lastObject];
+        NSAssert([folder isKindOfClass:[PSCMagazineFolder class]], @"incorrect type");
+        BOOL folderIsNew = [folder.magazines count] == 0;
+        [folder addMagazines:newMagazines];
+
+        // folder fresh or updated?
+        if (folderIsNew) {
+            [_delegate magazineStoreFolderAdded:folder];
+        }else {
+            [_delegate magazineStoreFolderModified:folder]; 
+        }
+        
+        for (PSCMagazine *magazine in newMagazines) {
             [_delegate magazineStoreMagazineAdded:magazine];    
         }
         
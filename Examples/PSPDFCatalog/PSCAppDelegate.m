@@ -9,8 +9,12 @@
 #import "PSCatalogViewController.h"
 #import "BITHockeyManager.h"
 #import "BITCrashManager.h"
+#import "BITCrashManagerDelegate.h"
 #import "LocalyticsSession.h"
 
+@interface PSCAppDelegate () <BITCrashManagerDelegate>
+@end
+
 @implementation PSCAppDelegate
 
 - (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions {
@@ -55,6 +59,7 @@
         // http://hockeyapp.net
         [[BITHockeyManager sharedHockeyManager] configureWithIdentifier:@"fa73e1f8f3806bcb3466c5ab16d70768" delegate:nil];
         [BITHockeyManager sharedHockeyManager].crashManager.crashManagerStatus = BITCrashManagerStatusAutoSend;
+        [BITHockeyManager sharedHockeyManager].crashManager.delegate = self;
         [[BITHockeyManager sharedHockeyManager] startManager];
 
         // Localytics helps me to track PSPDFKit-DEMO downloads.
@@ -69,4 +74,12 @@
     return YES;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - BITCrashManagerDelegate
+
+// Crash reports are processed in the background, this should stay in the low milliseconds.
+- (void)crashManagerDidFinishStartup:(BITCrashManager *)crashManager {
+    PSCLog(@"Crash manager startup took %.3fs on the main thread.", crashManager.startupTime);
+}
+
 @end
@@ -16,6 +16,7 @@
 #import "PSCSplitDocumentSelectorController.h"
 #import "PSCSplitPDFViewController.h"
 #import "PSCBookmarkParser.h"
+#import "PSCJournaledBookmarkParser.h"
 #import "PSCSettingsBarButtonItem.h"
 #import "PSCKioskPDFViewController.h"
 #import "PSCEmbeddedAnnotationTestViewController.h"
@@ -23,6 +24,15 @@
 #import "PSCExampleAnnotationViewController.h"
 #import "PSCCustomDrawingViewController.h"
 #import "PSCBookViewController.h"
+#import "PSCInkAnnotation.h"
+#import "PSCDrawView.h"
+#import "PSCAnnotationViewCache.h"
+#import "PSCAESCryptoDataProvider.h"
+#import "PSCByteRangeSource.h"
+#import "PSCByteRangeDocument.h"
+#import "PSCMultiFileDocument.h"
+#import "PSCOutlineParser.h"
+#import "PSCLabelParser.h"
 
 // set to auto-choose a section; debugging aid.
 //#define kPSPDFAutoSelectCellNumber [NSIndexPath indexPathForRow:5 inSection:1]
@@ -111,13 +121,47 @@
         [documentTests addContent:[[PSContent alloc] initWithTitle:@"CGDocumentProvider" block:^{
             NSData *data = [NSData dataWithContentsOfURL:hackerMagURL options:NSDataReadingMappedIfSafe error:NULL];
             CGDataProviderRef dataProvider = CGDataProviderCreateWithCFData((__bridge CFDataRef)(data));
-            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithDataProvider:dataProvider];
+            // email exports the mapped data instead of copying the provider.
+            PSPDFDocument *document = [[PSCByteRangeDocument alloc] initWithDataProvider:dataProvider byteRangeSource:[PSCByteRangeSource sourceWithData:data]];
             document.title = @"CGDataProviderRef PDF";
             CGDataProviderRelease(dataProvider);
             PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
             controller.rightBarButtonItems = @[controller.emailButtonItem, controller.searchButtonItem, controller.outlineButtonItem, controller.viewModeButtonItem];
             return controller;
         }]];
+
+        /// AES256 encrypted file, decrypted on demand (iOS5 upwards)
+        [documentTests addContent:[[PSContent alloc] initWithTitle:@"Streaming AES decryption" block:^UIViewController *{
+            if (kCFCoreFoundationVersionNumber < kCFCoreFoundationVersionNumber_iOS_5_0) {
+                [[[UIAlertView alloc] initWithTitle:@"Warning" message:@"AES decryption needs iOS5 or later." delegate:nil cancelButtonTitle:@"Ok" otherButtonTitles:nil] show];
+                return nil;
+            }
+            // measure decryption speed off the main thread, only in debug builds.
+            #ifdef DEBUG
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+                PSCLog(@"AES decryption throughput: %.1f MB/s", [PSCAESCryptoDataProvider decryptionThroughputWithLength:8 * 1024 * 1024]);
+            });
+            #endif
+
+            // encrypt the example once, so we have something to decrypt.
+            NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+            NSURL *encryptedURL = [NSURL fileURLWithPath:[cachesPath stringByAppendingPathComponent:@"hackermonthly12.pdf.aes"]];
+            NSString *passphrase = @"test123", *salt = @"PSPDFCatalog";
+            if (![[NSFileManager defaultManager] fileExistsAtPath:[encryptedURL path]]) {
+                NSError *error = nil;
+                if (![PSCAESCryptoDataProvider encryptFileAtURL:hackerMagURL toURL:encryptedURL passphrase:passphrase salt:salt error:&error]) {
+                    PSCLog(@"Failed to encrypt example: %@", error);
+                    return nil;
+                }
+            }
+
+            PSCAESCryptoDataProvider *cryptoWrapper = [[PSCAESCryptoDataProvider alloc] initWithURL:encryptedURL passphrase:passphrase salt:salt];
+            // the decrypted bytes can't be exported; that fails instead of copying them into memory.
+            PSPDFDocument *document = [[PSCByteRangeDocument alloc] initWithDataProvider:[cryptoWrapper dataProviderRef] byteRangeSource:[cryptoWrapper byteRangeSource]];
+            document.title = @"Encrypted PDF";
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            return controller;
+        }]];
         [content addObject:documentTests];
 
         /// PSPDFDocument works with multiple NSURLs
@@ -129,6 +173,26 @@
             return controller;
         }]];
 
+        /// Page counts of the files are loaded in parallel
+        [documentTests addContent:[[PSContent alloc] initWithTitle:@"Multiple files (concurrent loading)" block:^{
+            NSArray *files = @[@"A.pdf", @"B.pdf", @"C.pdf", @"D.pdf", kHackerMagazineExample, kPaperExampleFileName];
+            PSCMultiFileDocument *document = [[PSCMultiFileDocument alloc] initWithBaseURL:samplesURL files:files];
+            [document loadPageTable];
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            controller.rightBarButtonItems = @[controller.searchButtonItem, controller.outlineButtonItem, controller.viewModeButtonItem];
+
+            // page counts start as estimates; reload as files finish loading.
+            __weak PSPDFViewController *weakController = controller;
+            __block id observer = [[NSNotificationCenter defaultCenter] addObserverForName:kPSCMultiFileDocumentPageCountChangedNotification object:document queue:nil usingBlock:^(NSNotification *notification) {
+                [weakController reloadData];
+                if (!weakController || document.isPageTableLoaded) {
+                    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+                    observer = nil;
+                }
+            }];
+            return controller;
+        }]];
+
         [documentTests addContent:[[PSContent alloc] initWithTitle:@"Multiple NSData objects (memory mapped)" block:^{
 
             static PSPDFDocument *document = nil;
@@ -226,6 +290,29 @@
             return controller;
         }]];
 
+        [annotationSection addContent:[[PSContent alloc] initWithTitle:@"Ink annotations with simplified rendering" block:^{
+            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+            document.overrideClassNames = @{(id)[PSPDFInkAnnotation class] : [PSCInkAnnotation class]};
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            controller.rightBarButtonItems = @[controller.annotationButtonItem, controller.viewModeButtonItem];
+            return controller;
+        }]];
+
+        [annotationSection addContent:[[PSContent alloc] initWithTitle:@"Incremental drawing" block:^{
+            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            controller.overrideClassNames = @{(id)[PSPDFDrawView class] : [PSCDrawView class]};
+            controller.rightBarButtonItems = @[controller.annotationButtonItem, controller.viewModeButtonItem];
+            return controller;
+        }]];
+
+        [annotationSection addContent:[[PSContent alloc] initWithTitle:@"Prewarmed annotation views" block:^{
+            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kPaperExampleFileName]];
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            controller.overrideClassNames = @{(id)[PSPDFAnnotationCache class] : [PSCAnnotationViewCache class]};
+            return controller;
+        }]];
+
         [content addObject:annotationSection];
 
         PSCSectionDescriptor *storyboardSection = [[PSCSectionDescriptor alloc] initWithTitle:@"Storyboards" footer:@""];
@@ -320,6 +407,32 @@
             return controller;
         }]];
 
+        // Outline
+        [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Lazy outline parsing" block:^UIViewController *{
+            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kDevelopersGuideFileName]];
+            document.overrideClassNames = @{(id)[PSPDFOutlineParser class] : [PSCOutlineParser class]};
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            controller.rightBarButtonItems = @[controller.outlineButtonItem, controller.searchButtonItem, controller.viewModeButtonItem];
+            return controller;
+        }]];
+
+        // Page labels
+        [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Page label lookup table" block:^UIViewController *{
+            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kDevelopersGuideFileName]];
+            document.overrideClassNames = @{(id)[PSPDFLabelParser class] : [PSCLabelParser class]};
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            return controller;
+        }]];
+
+        // Bookmarks with a write-behind journal
+        [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Journaled Bookmarks" block:^UIViewController *{
+            PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+            document.overrideClassNames = @{(id)[PSPDFBookmarkParser class] : [PSCJournaledBookmarkParser class]};
+            PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+            controller.rightBarButtonItems = @[controller.bookmarkButtonItem, controller.searchButtonItem, controller.outlineButtonItem, controller.viewModeButtonItem];
+            return controller;
+        }]];
+
         // Vertical always-visible annotation bar
         [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Vertical always-visible annotation bar" block:^UIViewController *{
             PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
@@ -0,0 +1,40 @@
+//
+//  PSCJournaledBookmarkParser.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Bookmark parser that batches writes into an append-only journal.
+
+    PSPDFBookmarkParser rewrites the whole bookmark plist on every add or remove. This subclass collects changes for a
+    moment and appends them as 12 byte records to bookmarks.journal in cachePath. Once the journal grows past
+    compactionThreshold records (or after bulk changes), the current set is written to bookmarks.snapshot with the next
+    generation number and the journal is truncated. Loading reads the snapshot and replays the journal records of that
+    generation; existing bookmark plists are migrated on first load.
+
+    Use PSPDFDocument's overrideClassNames to use this subclass:
+    document.overrideClassNames = @{(id)[PSPDFBookmarkParser class] : [PSCJournaledBookmarkParser class]};
+*/
+@interface PSCJournaledBookmarkParser : PSPDFBookmarkParser
+
+/// Adds bookmarks for all pages at once and writes a single snapshot. Returns the number of added bookmarks.
+- (NSUInteger)addBookmarksForPages:(NSIndexSet *)pages;
+
+/// Removes bookmarks for all pages at once. Returns the number of removed bookmarks.
+- (NSUInteger)removeBookmarksForPages:(NSIndexSet *)pages;
+
+/// Writes pending changes now. Called automatically when the app enters the background.
+- (void)flush;
+
+/// Writes a snapshot and truncates the journal.
+- (void)compact;
+
+/// Journal records before the journal is compacted. Defaults to 256.
+@property(nonatomic, assign) NSUInteger compactionThreshold;
+
+/// Delay used to coalesce changes before they are written. Defaults to 1 second.
+@property(nonatomic, assign) NSTimeInterval flushDelay;
+
+@end
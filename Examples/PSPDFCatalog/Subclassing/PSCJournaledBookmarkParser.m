@@ -0,0 +1,350 @@
+//
+//  PSCJournaledBookmarkParser.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCJournaledBookmarkParser.h"
+
+#define kPSCBookmarkJournalFileName @"bookmarks.journal"
+#define kPSCBookmarkSnapshotFileName @"bookmarks.snapshot"
+#define kPSCBookmarkSnapshotVersion 2
+#define kPSCBookmarkDefaultCompactionThreshold 256
+#define kPSCBookmarkDefaultFlushDelay 1.0
+
+typedef NS_ENUM(uint8_t, PSCBookmarkOperation) {
+    PSCBookmarkOperationAdd = '+',
+    PSCBookmarkOperationRemove = '-'
+};
+
+typedef struct {
+    uint8_t operation;
+    uint8_t reserved[3];
+    uint32_t page;
+    uint32_t generation; // snapshot generation the record applies to, set when it's written
+} PSCBookmarkJournalRecord;
+
+@interface PSCJournaledBookmarkParser () {
+    NSMutableData *_pendingRecords;     // PSCBookmarkJournalRecord, not yet written
+    NSIndexSet *_storedPages;           // pages as stored on disk (snapshot + journal)
+    NSUInteger _journalRecordCount;
+    NSUInteger _loadedJournalRecordCount; // set by loadBookmarks, which might run before init finished
+    uint32_t _generation, _loadedGeneration; // generation of the snapshot on disk
+    BOOL _hasLoadedState, _migrationPending;
+    BOOL _needsSnapshot, _flushScheduled;
+    dispatch_queue_t _journalQueue;
+}
+@end
+
+@implementation PSCJournaledBookmarkParser
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super initWithDocument:document])) {
+        _pendingRecords = [NSMutableData new];
+        _compactionThreshold = kPSCBookmarkDefaultCompactionThreshold;
+        _flushDelay = kPSCBookmarkDefaultFlushDelay;
+        _journalQueue = dispatch_queue_create("com.pspdfkit.catalog.bookmarkJournalQueue", NULL);
+
+        // don't lose the last changes
+        NSNotificationCenter *dnc = [NSNotificationCenter defaultCenter];
+        [dnc addObserver:self selector:@selector(flush) name:UIApplicationDidEnterBackgroundNotification object:nil];
+        [dnc addObserver:self selector:@selector(flush) name:UIApplicationWillTerminateNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    PSPDFDispatchRelease(_journalQueue);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFBookmarkParser
+
+- (BOOL)addBookmarkForPage:(NSUInteger)page {
+    BOOL added = [super addBookmarkForPage:page];
+    if (added) [self recordOperation:PSCBookmarkOperationAdd page:page];
+    return added;
+}
+
+- (BOOL)removeBookmarkForPage:(NSUInteger)page {
+    BOOL removed = [super removeBookmarkForPage:page];
+    if (removed) [self recordOperation:PSCBookmarkOperationRemove page:page];
+    return removed;
+}
+
+// Replacing the whole set is cheaper to store as a snapshot.
+- (void)setBookmarks:(NSArray *)bookmarks {
+    [super setBookmarks:bookmarks];
+    if (!_journalQueue) return; // initial load
+    dispatch_async(_journalQueue, ^{
+        _needsSnapshot = YES;
+        [self scheduleFlush];
+    });
+}
+
+- (NSArray *)loadBookmarks {
+    NSMutableIndexSet *pages = [NSMutableIndexSet indexSet];
+    NSUInteger journalRecordCount = 0;
+    uint32_t generation = 0;
+    BOOL hasSnapshot = [self readSnapshotIntoPages:pages generation:&generation];
+    BOOL hasJournal = NO;
+    if (hasSnapshot || ![[NSFileManager new] fileExistsAtPath:[self snapshotPath]]) {
+        // the journal of an unreadable snapshot can't be applied to anything.
+        hasJournal = [self replayJournalIntoPages:pages generation:generation recordCount:&journalRecordCount];
+    }
+    BOOL migrate = NO;
+    if (!hasSnapshot && !hasJournal) {
+        // nothing stored yet; take over the bookmarks of PSPDFBookmarkParser.
+        for (PSPDFBookmark *bookmark in [super loadBookmarks]) [pages addIndex:bookmark.page];
+        migrate = [pages count] > 0;
+    }
+
+    @synchronized(self) {
+        _storedPages = migrate ? [NSIndexSet indexSet] : [pages copy];
+        _loadedJournalRecordCount = journalRecordCount;
+        _loadedGeneration = generation;
+        _migrationPending = migrate;
+        _hasLoadedState = YES;
+    }
+
+    NSMutableArray *bookmarks = [NSMutableArray arrayWithCapacity:[pages count]];
+    [pages enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        [bookmarks addObject:[[PSPDFBookmark alloc] initWithPage:page]];
+    }];
+    return bookmarks;
+}
+
+// Called by PSPDFBookmarkParser after every change; writing is deferred.
+- (void)saveBookmarks {
+    if (!_journalQueue) return;
+    dispatch_async(_journalQueue, ^{
+        [self scheduleFlush];
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSUInteger)addBookmarksForPages:(NSIndexSet *)pages {
+    return [self updateBookmarksWithPages:pages add:YES];
+}
+
+- (NSUInteger)removeBookmarksForPages:(NSIndexSet *)pages {
+    return [self updateBookmarksWithPages:pages add:NO];
+}
+
+- (void)flush {
+    dispatch_sync(_journalQueue, ^{
+        [self writePendingChanges];
+    });
+}
+
+- (void)compact {
+    dispatch_sync(_journalQueue, ^{
+        _needsSnapshot = YES;
+        [self writePendingChanges];
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSString *)journalPath {
+    return [[self cachePath] stringByAppendingPathComponent:kPSCBookmarkJournalFileName];
+}
+
+- (NSString *)snapshotPath {
+    return [[self cachePath] stringByAppendingPathComponent:kPSCBookmarkSnapshotFileName];
+}
+
+- (NSUInteger)updateBookmarksWithPages:(NSIndexSet *)pages add:(BOOL)add {
+    if ([pages count] == 0) return 0;
+
+    NSMutableIndexSet *bookmarkedPages = [NSMutableIndexSet indexSet];
+    for (PSPDFBookmark *bookmark in self.bookmarks) [bookmarkedPages addIndex:bookmark.page];
+    NSUInteger previousCount = [bookmarkedPages count];
+    if (add) [bookmarkedPages addIndexes:pages];
+    else [bookmarkedPages removeIndexes:pages];
+    NSUInteger changedCount = add ? [bookmarkedPages count] - previousCount : previousCount - [bookmarkedPages count];
+    if (changedCount == 0) return 0;
+
+    NSMutableArray *bookmarks = [NSMutableArray arrayWithCapacity:[bookmarkedPages count]];
+    [bookmarkedPages enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        [bookmarks addObject:[[PSPDFBookmark alloc] initWithPage:page]];
+    }];
+    self.bookmarks = bookmarks; // one snapshot instead of a record per page
+    return changedCount;
+}
+
+- (void)recordOperation:(PSCBookmarkOperation)operation page:(NSUInteger)page {
+    PSCBookmarkJournalRecord record = {operation, {0, 0, 0}, (uint32_t)page, 0};
+    dispatch_async(_journalQueue, ^{
+        [_pendingRecords appendBytes:&record length:sizeof(record)];
+        [self scheduleFlush];
+    });
+}
+
+// Needs to be called on _journalQueue.
+- (void)scheduleFlush {
+    if (_flushScheduled) return;
+    _flushScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.flushDelay * NSEC_PER_SEC)), _journalQueue, ^{
+        [self writePendingChanges];
+    });
+}
+
+// Needs to be called on _journalQueue.
+- (void)writePendingChanges {
+    _flushScheduled = NO;
+
+    // the records have to explain the difference between disk and memory, else (e.g. for unrecorded changes) write a snapshot.
+    NSMutableIndexSet *currentPages = [NSMutableIndexSet indexSet];
+    for (PSPDFBookmark *bookmark in self.bookmarks) [currentPages addIndex:bookmark.page];
+    NSMutableIndexSet *expectedPages;
+    @synchronized(self) {
+        if (_hasLoadedState) {
+            _journalRecordCount = _loadedJournalRecordCount;
+            _generation = _loadedGeneration;
+            if (_migrationPending) _needsSnapshot = YES;
+            _hasLoadedState = _migrationPending = NO;
+        }
+        expectedPages = [_storedPages mutableCopy] ?: [NSMutableIndexSet indexSet];
+        if (!_storedPages) _needsSnapshot = YES;
+    }
+    [self applyRecords:[_pendingRecords bytes] count:[_pendingRecords length] / sizeof(PSCBookmarkJournalRecord) generation:0 toPages:expectedPages];
+    NSUInteger pendingRecordCount = [_pendingRecords length] / sizeof(PSCBookmarkJournalRecord);
+
+    if (!_needsSnapshot && pendingRecordCount == 0 && [expectedPages isEqualToIndexSet:currentPages]) return;
+
+    BOOL success;
+    if (_needsSnapshot || ![expectedPages isEqualToIndexSet:currentPages] || _journalRecordCount + pendingRecordCount > self.compactionThreshold) {
+        success = [self writeSnapshotWithPages:currentPages];
+    }else {
+        success = [self appendRecordsToJournal:_pendingRecords];
+        if (success) _journalRecordCount += pendingRecordCount;
+    }
+
+    if (success) {
+        [_pendingRecords setLength:0];
+        @synchronized(self) {
+            _storedPages = [currentPages copy];
+        }
+    }
+}
+
+- (BOOL)ensureCachePathExists {
+    NSError *error = nil;
+    if (![[NSFileManager new] createDirectoryAtPath:[self cachePath] withIntermediateDirectories:YES attributes:nil error:&error]) {
+        PSPDFLogError(@"Failed to create bookmark directory: %@", error);
+        return NO;
+    }
+    return YES;
+}
+
+// Needs to be called on _journalQueue. Replaying the old journal on top of the new snapshot would not be safe (an old
+// add record brings back a bookmark that was removed since), so the snapshot gets the next generation and loading
+// skips records of older generations. That way a crash between writing the snapshot and truncating the journal is harmless.
+- (BOOL)writeSnapshotWithPages:(NSIndexSet *)pages {
+    if (![self ensureCachePathExists]) return NO;
+
+    NSMutableArray *pageNumbers = [NSMutableArray arrayWithCapacity:[pages count]];
+    [pages enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        [pageNumbers addObject:@(page)];
+    }];
+
+    NSError *error = nil;
+    uint32_t generation = _generation + 1;
+    NSDictionary *snapshot = @{@"version" : @(kPSCBookmarkSnapshotVersion), @"generation" : @(generation), @"pages" : pageNumbers};
+    NSData *snapshotData = [NSPropertyListSerialization dataWithPropertyList:snapshot format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    if (!snapshotData || ![snapshotData writeToFile:[self snapshotPath] options:NSDataWritingAtomic error:&error]) {
+        PSPDFLogError(@"Failed to write bookmark snapshot: %@", error);
+        return NO;
+    }
+
+    _generation = generation;
+    [[NSData data] writeToFile:[self journalPath] options:NSDataWritingAtomic error:NULL];
+    _journalRecordCount = 0;
+    _needsSnapshot = NO;
+    return YES;
+}
+
+// Needs to be called on _journalQueue.
+- (BOOL)appendRecordsToJournal:(NSData *)records {
+    if (![self ensureCachePathExists]) return NO;
+
+    NSString *journalPath = [self journalPath];
+    if (![[NSFileManager new] fileExistsAtPath:journalPath]) {
+        [[NSData data] writeToFile:journalPath options:0 error:NULL];
+    }
+
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForWritingAtPath:journalPath];
+    if (!fileHandle) {
+        PSPDFLogError(@"Failed to open bookmark journal at %@", journalPath);
+        return NO;
+    }
+    // drop a partially written record of an earlier crash, else all following records would be misaligned.
+    unsigned long long journalLength = [fileHandle seekToEndOfFile];
+    if (journalLength % sizeof(PSCBookmarkJournalRecord) != 0) {
+        [fileHandle truncateFileAtOffset:journalLength - journalLength % sizeof(PSCBookmarkJournalRecord)];
+    }
+
+    // stamp the records with the generation of the snapshot they apply to.
+    NSMutableData *stampedRecords = [records mutableCopy];
+    PSCBookmarkJournalRecord *stampedBytes = [stampedRecords mutableBytes];
+    for (NSUInteger idx = 0; idx < [stampedRecords length] / sizeof(PSCBookmarkJournalRecord); idx++) {
+        stampedBytes[idx].generation = _generation;
+    }
+
+    BOOL success = YES;
+    @try {
+        [fileHandle writeData:stampedRecords];
+    }
+    @catch (NSException *exception) {
+        PSPDFLogError(@"Failed to append to bookmark journal: %@", exception);
+        success = NO;
+    }
+    [fileHandle closeFile];
+    return success;
+}
+
+- (BOOL)readSnapshotIntoPages:(NSMutableIndexSet *)pages generation:(uint32_t *)generation {
+    NSData *snapshotData = [NSData dataWithContentsOfFile:[self snapshotPath]];
+    if (!snapshotData) return NO;
+
+    NSDictionary *snapshot = [NSPropertyListSerialization propertyListWithData:snapshotData options:NSPropertyListImmutable format:NULL error:NULL];
+    if (![snapshot isKindOfClass:[NSDictionary class]] || [snapshot[@"version"] integerValue] != kPSCBookmarkSnapshotVersion) {
+        PSPDFLogError(@"Ignoring invalid bookmark snapshot at %@", [self snapshotPath]);
+        return NO;
+    }
+    for (NSNumber *page in snapshot[@"pages"]) {
+        if ([page isKindOfClass:[NSNumber class]]) [pages addIndex:[page unsignedIntegerValue]];
+    }
+    *generation = (uint32_t)[snapshot[@"generation"] unsignedIntValue];
+    return YES;
+}
+
+// Records of generations before the snapshot were written before it and are already part of it.
+- (BOOL)replayJournalIntoPages:(NSMutableIndexSet *)pages generation:(uint32_t)generation recordCount:(NSUInteger *)recordCount {
+    NSData *journalData = [NSData dataWithContentsOfFile:[self journalPath] options:NSDataReadingMappedIfSafe error:NULL];
+    if (!journalData) return NO;
+
+    *recordCount = [journalData length] / sizeof(PSCBookmarkJournalRecord); // ignores a partially written last record
+    [self applyRecords:[journalData bytes] count:*recordCount generation:generation toPages:pages];
+    return YES;
+}
+
+- (void)applyRecords:(const PSCBookmarkJournalRecord *)records count:(NSUInteger)count generation:(uint32_t)generation toPages:(NSMutableIndexSet *)pages {
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        if (records[idx].generation < generation) continue;
+        if (records[idx].operation == PSCBookmarkOperationAdd) [pages addIndex:records[idx].page];
+        else if (records[idx].operation == PSCBookmarkOperationRemove) [pages removeIndex:records[idx].page];
+    }
+}
+
+@end
@@ -0,0 +1,29 @@
+//
+//  PSCLabelParser.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Label parser that answers pageLabelForPage: from a table of page label ranges.
+
+    pageLabelForPage: is called for every scrobble bar move and thumbnail cell. This subclass reads the /PageLabels number
+    tree once into ranges (start page, style, prefix, first number), finds the range of a page with a binary search and
+    formats the label on demand. The table covers all files of the document (pages offset by the preceding files), is
+    stored next to the page geometry table (see PSCPageGeometryCache) and reused while the files don't change.
+    PSPDFKit creates a label parser per document provider; each one looks up its pages with the page offset of its
+    provider, so all parsers of a document share the same table. A reverse index resolves labels like "iv" to a page.
+
+    Use PSPDFDocument's overrideClassNames to use this subclass:
+    document.overrideClassNames = @{(id)[PSPDFLabelParser class] : [PSCLabelParser class]};
+*/
+@interface PSCLabelParser : PSPDFLabelParser
+
+/// Page (starting at 0, within the document provider) for pageLabel, or NSNotFound. Exact matches win over case insensitive ones.
+- (NSUInteger)pageForPageLabel:(NSString *)pageLabel;
+
+/// Number of label ranges. 0 if the document doesn't define page labels.
+@property(nonatomic, assign, readonly) NSUInteger rangeCount;
+
+@end
@@ -0,0 +1,397 @@
+//
+//  PSCLabelParser.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCLabelParser.h"
+#import "PSCPageGeometryCache.h"
+
+#define kPSCLabelTableMagic 0x5053434C // 'PSCL'
+#define kPSCLabelTableVersion 1
+#define kPSCNumberTreeMaxDepth 32
+
+typedef NS_ENUM(uint8_t, PSCPageLabelStyle) {
+    PSCPageLabelStyleNone,          // prefix only
+    PSCPageLabelStyleDecimal,       // D
+    PSCPageLabelStyleUpperRoman,    // R
+    PSCPageLabelStyleLowerRoman,    // r
+    PSCPageLabelStyleUpperLetters,  // A
+    PSCPageLabelStyleLowerLetters,  // a
+    PSCPageLabelStyleUnlabeled      // pages not covered by /PageLabels (e.g. files without labels)
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    double modificationDate; // see PSCPageGeometryCache
+    uint64_t fileSize;
+    uint32_t pageCount;
+    uint32_t rangeCount;
+    uint32_t prefixesLength; // UTF8 prefixes, after the ranges
+} PSCLabelTableHeader;
+
+typedef struct {
+    uint32_t startPage;
+    int32_t firstNumber;
+    uint32_t prefixOffset;
+    uint16_t prefixLength;
+    uint8_t style;
+    uint8_t reserved;
+} PSCLabelRange;
+
+@interface PSCLabelParser () {
+    PSCLabelTableHeader _header;
+    NSMutableData *_ranges;             // PSCLabelRange, sorted by startPage
+    NSMutableData *_prefixes;
+    NSArray *_prefixStrings;            // decoded prefix per range
+    NSDictionary *_pageForLabel;        // label (and lowercased label) -> page, built on first use
+    NSDictionary *_labels;
+    NSUInteger _pageOffset;             // first page of this parser's document provider in the table
+    NSUInteger _pageCount;              // pages of this parser's document provider
+    BOOL _loaded;
+    dispatch_queue_t _labelQueue;
+}
+@property(nonatomic, ps_weak) PSPDFDocument *document;
+@end
+
+static NSString *PSCFormatPageLabelNumber(NSInteger number, PSCPageLabelStyle style) {
+    switch (style) {
+        case PSCPageLabelStyleDecimal:
+            return [NSString stringWithFormat:@"%d", number];
+        case PSCPageLabelStyleUpperRoman:
+        case PSCPageLabelStyleLowerRoman: {
+            if (number <= 0) return [NSString stringWithFormat:@"%d", number];
+            static const NSInteger values[] = {1000, 900, 500, 400, 100, 90, 50, 40, 10, 9, 5, 4, 1};
+            static const char *numerals[] = {"m", "cm", "d", "cd", "c", "xc", "l", "xl", "x", "ix", "v", "iv", "i"};
+            NSMutableString *roman = [NSMutableString string];
+            for (NSUInteger idx = 0; idx < sizeof(values) / sizeof(values[0]); idx++) {
+                while (number >= values[idx]) {
+                    [roman appendFormat:@"%s", numerals[idx]];
+                    number -= values[idx];
+                }
+            }
+            return style == PSCPageLabelStyleUpperRoman ? [roman uppercaseString] : roman;
+        }
+        case PSCPageLabelStyleUpperLetters:
+        case PSCPageLabelStyleLowerLetters: {
+            // A..Z, then AA..ZZ, AAA..ZZZ (PDF Reference, 8.3.1).
+            if (number <= 0) return [NSString stringWithFormat:@"%d", number];
+            unichar letter = (unichar)((style == PSCPageLabelStyleUpperLetters ? 'A' : 'a') + (number - 1) % 26);
+            NSString *letterString = [NSString stringWithCharacters:&letter length:1];
+            return [@"" stringByPaddingToLength:(NSUInteger)((number - 1) / 26 + 1) withString:letterString startingAtIndex:0];
+        }
+        default:
+            return nil;
+    }
+}
+
+@implementation PSCLabelParser
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super initWithDocument:document])) {
+        _document = document;
+        _ranges = [NSMutableData new];
+        _prefixes = [NSMutableData new];
+        _labelQueue = dispatch_queue_create("com.pspdfkit.catalog.labelParserQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    PSPDFDispatchRelease(_labelQueue);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ pageOffset:%d pages:%d ranges:%d>", NSStringFromClass([self class]), _pageOffset, _pageCount, _header.rangeCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFLabelParser
+
+- (NSDictionary *)parseDocument {
+    return self.labels;
+}
+
+- (NSString *)pageLabelForPage:(NSUInteger)page {
+    __block NSString *pageLabel = nil;
+    dispatch_sync(_labelQueue, ^{
+        [self loadTableIfNeeded];
+        if (page < _pageCount) pageLabel = [self labelForPage:_pageOffset + page];
+    });
+    return pageLabel;
+}
+
+// Only built if someone asks for all labels; pageLabelForPage: doesn't need it.
+- (NSDictionary *)labels {
+    __block NSDictionary *labels;
+    dispatch_sync(_labelQueue, ^{
+        [self loadTableIfNeeded];
+        if (!_labels) {
+            NSMutableDictionary *allLabels = [NSMutableDictionary dictionaryWithCapacity:_pageCount];
+            for (NSUInteger page = 0; page < _pageCount; page++) {
+                NSString *pageLabel = [self labelForPage:_pageOffset + page];
+                if (pageLabel) allLabels[@(page)] = pageLabel;
+            }
+            _labels = [allLabels copy];
+        }
+        labels = _labels;
+    });
+    return labels;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSUInteger)pageForPageLabel:(NSString *)pageLabel {
+    if ([pageLabel length] == 0) return NSNotFound;
+
+    __block NSNumber *page = nil;
+    dispatch_sync(_labelQueue, ^{
+        [self loadTableIfNeeded];
+        if (!_pageForLabel) {
+            NSMutableDictionary *pageForLabel = [NSMutableDictionary dictionaryWithCapacity:_pageCount];
+            for (NSUInteger labelPage = 0; labelPage < _pageCount; labelPage++) {
+                NSString *label = [self labelForPage:_pageOffset + labelPage];
+                if (!label || pageForLabel[label]) continue;
+                pageForLabel[label] = @(labelPage);
+                NSString *lowercaseLabel = [label lowercaseString];
+                if (!pageForLabel[lowercaseLabel]) pageForLabel[lowercaseLabel] = @(labelPage);
+            }
+            _pageForLabel = [pageForLabel copy];
+        }
+        page = _pageForLabel[pageLabel] ?: _pageForLabel[[pageLabel lowercaseString]];
+    });
+    return page ? [page unsignedIntegerValue] : NSNotFound;
+}
+
+- (NSUInteger)rangeCount {
+    __block NSUInteger rangeCount = 0;
+    dispatch_sync(_labelQueue, ^{
+        [self loadTableIfNeeded];
+        // ranges that overlap the pages of this provider. (range idx ends where idx + 1 starts)
+        const PSCLabelRange *ranges = [_ranges bytes];
+        for (NSUInteger idx = 0; idx < _header.rangeCount; idx++) {
+            NSUInteger rangeEnd = idx + 1 < _header.rangeCount ? ranges[idx + 1].startPage : _header.pageCount;
+            if (ranges[idx].style != PSCPageLabelStyleUnlabeled && ranges[idx].startPage < _pageOffset + _pageCount && rangeEnd > _pageOffset) rangeCount++;
+        }
+    });
+    return rangeCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Needs to be called on _labelQueue. page is a document page. Last range starting at or before page.
+- (NSString *)labelForPage:(NSUInteger)page {
+    NSUInteger count = _header.rangeCount;
+    if (page >= _header.pageCount || count == 0) return nil;
+
+    const PSCLabelRange *ranges = [_ranges bytes];
+    NSUInteger low = 0, high = count;
+    while (low < high) {
+        NSUInteger mid = (low + high) / 2;
+        if (ranges[mid].startPage <= page) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0) return nil;
+
+    const PSCLabelRange *range = &ranges[low - 1];
+    if (range->style == PSCPageLabelStyleUnlabeled) return nil;
+    NSString *prefix = _prefixStrings[low - 1];
+    NSInteger number = range->firstNumber + (NSInteger)(page - range->startPage);
+    NSString *numberString = PSCFormatPageLabelNumber(number, range->style);
+    return numberString ? [prefix stringByAppendingString:numberString] : prefix;
+}
+
+// Needs to be called on _labelQueue.
+- (void)loadTableIfNeeded {
+    if (_loaded) return;
+    _loaded = YES;
+
+    PSPDFDocument *document = self.document;
+    _header = (PSCLabelTableHeader){kPSCLabelTableMagic, kPSCLabelTableVersion, 0, 0, 0, 0, 0};
+    NSString *tablePath = [PSCPageGeometryCache tablePathForDocument:document pathExtension:@"labels"];
+    if (tablePath && ![PSCPageGeometryCache getModificationDate:&_header.modificationDate fileSize:&_header.fileSize forDocument:document]) {
+        tablePath = nil;
+    }
+
+    if (![self readTableAtPath:tablePath]) {
+        [self parseRangesOfDocument:document];
+        if (tablePath) [self writeTableToPath:tablePath];
+    }
+
+    NSMutableArray *prefixStrings = [NSMutableArray arrayWithCapacity:_header.rangeCount];
+    const PSCLabelRange *ranges = [_ranges bytes];
+    for (NSUInteger idx = 0; idx < _header.rangeCount; idx++) {
+        NSString *prefix = [[NSString alloc] initWithBytes:(const uint8_t *)[_prefixes bytes] + ranges[idx].prefixOffset length:ranges[idx].prefixLength encoding:NSUTF8StringEncoding];
+        [prefixStrings addObject:prefix ?: @""];
+    }
+    _prefixStrings = prefixStrings;
+    [self loadPageRangeOfDocument:document];
+}
+
+// The table covers all files of the document, but PSPDFKit creates a parser per document provider and asks it for
+// pages of that provider (starting at 0). Finds the provider of this parser and its first page in the table.
+- (void)loadPageRangeOfDocument:(PSPDFDocument *)document {
+    NSUInteger pageOffset = 0;
+    for (PSPDFDocumentProvider *documentProvider in document.documentProviders) {
+        if (documentProvider.labelParser == self) {
+            _pageOffset = pageOffset;
+            _pageCount = MIN(documentProvider.pageCount, _header.pageCount > pageOffset ? _header.pageCount - pageOffset : 0);
+            return;
+        }
+        pageOffset += documentProvider.pageCount;
+    }
+
+    // not owned by a provider (created for the document directly): answer for the whole document.
+    _pageOffset = 0;
+    _pageCount = _header.pageCount;
+}
+
+- (BOOL)readTableAtPath:(NSString *)tablePath {
+    if (!tablePath) return NO;
+    NSData *tableData = [NSData dataWithContentsOfFile:tablePath options:NSDataReadingUncached error:NULL];
+    if ([tableData length] < sizeof(PSCLabelTableHeader)) return NO;
+
+    PSCLabelTableHeader header;
+    [tableData getBytes:&header length:sizeof(header)];
+    NSUInteger rangesLength = header.rangeCount * sizeof(PSCLabelRange);
+    BOOL valid = header.magic == kPSCLabelTableMagic && header.version == kPSCLabelTableVersion &&
+                 header.modificationDate == _header.modificationDate && header.fileSize == _header.fileSize &&
+                 [tableData length] == sizeof(header) + rangesLength + header.prefixesLength;
+    if (!valid) {
+        PSCLog(@"Discarding outdated page label table for %@.", self.document.UID);
+        return NO;
+    }
+
+    // prefixes have to be within the prefix data.
+    const PSCLabelRange *ranges = (const PSCLabelRange *)((const uint8_t *)[tableData bytes] + sizeof(header));
+    for (NSUInteger idx = 0; idx < header.rangeCount; idx++) {
+        if ((uint64_t)ranges[idx].prefixOffset + ranges[idx].prefixLength > header.prefixesLength) return NO;
+    }
+
+    _header = header;
+    [_ranges setData:[tableData subdataWithRange:NSMakeRange(sizeof(header), rangesLength)]];
+    [_prefixes setData:[tableData subdataWithRange:NSMakeRange(sizeof(header) + rangesLength, header.prefixesLength)]];
+    return YES;
+}
+
+- (void)writeTableToPath:(NSString *)tablePath {
+    NSMutableData *tableData = [NSMutableData dataWithCapacity:sizeof(_header) + [_ranges length] + [_prefixes length]];
+    [tableData appendBytes:&_header length:sizeof(_header)];
+    [tableData appendData:_ranges];
+    [tableData appendData:_prefixes];
+
+    NSError *error = nil;
+    [[NSFileManager new] createDirectoryAtPath:[tablePath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (![tableData writeToFile:tablePath options:NSDataWritingAtomic error:&error]) {
+        PSCLog(@"Failed to write page label table: %@", error);
+    }
+}
+
+// Reads the /PageLabels number trees of all files. Pages are offset by the page count of the preceding files.
+- (void)parseRangesOfDocument:(PSPDFDocument *)document {
+    [_ranges setLength:0];
+    [_prefixes setLength:0];
+    __block uint32_t pageOffset = 0;
+    __block BOOL hasLabels = NO;
+
+    for (PSPDFDocumentProvider *documentProvider in document.documentProviders) {
+        [documentProvider performBlock:^(PSPDFDocumentProvider *docProvider, CGPDFDocumentRef documentRef) {
+            if (!documentRef) return;
+            NSUInteger firstRange = [_ranges length] / sizeof(PSCLabelRange);
+            CGPDFDictionaryRef catalog = CGPDFDocumentGetCatalog(documentRef), pageLabels;
+            if (catalog && CGPDFDictionaryGetDictionary(catalog, "PageLabels", &pageLabels)) {
+                [self addRangesOfNumberTree:pageLabels pageOffset:pageOffset depth:0];
+            }
+
+            // pages before the first key (or files without labels) don't have labels.
+            const PSCLabelRange *ranges = [_ranges bytes];
+            NSUInteger rangeCount = [_ranges length] / sizeof(PSCLabelRange);
+            if (rangeCount > firstRange) hasLabels = YES;
+            if (rangeCount == firstRange || ranges[firstRange].startPage != pageOffset) {
+                PSCLabelRange unlabeled = {pageOffset, 0, 0, 0, PSCPageLabelStyleUnlabeled, 0};
+                [_ranges replaceBytesInRange:NSMakeRange(firstRange * sizeof(PSCLabelRange), 0) withBytes:&unlabeled length:sizeof(unlabeled)];
+            }
+            pageOffset += (uint32_t)CGPDFDocumentGetNumberOfPages(documentRef);
+        }];
+    }
+
+    if (!hasLabels) {
+        [_ranges setLength:0];
+        [_prefixes setLength:0];
+    }
+    _header.pageCount = pageOffset;
+    _header.rangeCount = (uint32_t)([_ranges length] / sizeof(PSCLabelRange));
+    _header.prefixesLength = (uint32_t)[_prefixes length];
+}
+
+// /Nums holds [key value key value ...] in ascending order; /Kids hold further nodes in ascending order.
+- (void)addRangesOfNumberTree:(CGPDFDictionaryRef)node pageOffset:(uint32_t)pageOffset depth:(NSUInteger)depth {
+    if (depth > kPSCNumberTreeMaxDepth) return;
+
+    CGPDFArrayRef nums;
+    if (CGPDFDictionaryGetArray(node, "Nums", &nums)) {
+        for (size_t idx = 0; idx + 1 < CGPDFArrayGetCount(nums); idx += 2) {
+            CGPDFInteger startPage;
+            CGPDFDictionaryRef labelDictionary;
+            if (!CGPDFArrayGetInteger(nums, idx, &startPage) || startPage < 0 || !CGPDFArrayGetDictionary(nums, idx + 1, &labelDictionary)) continue;
+            [self addRangeWithLabelDictionary:labelDictionary startPage:pageOffset + (uint32_t)startPage];
+        }
+    }
+
+    CGPDFArrayRef kids;
+    if (CGPDFDictionaryGetArray(node, "Kids", &kids)) {
+        for (size_t idx = 0; idx < CGPDFArrayGetCount(kids); idx++) {
+            CGPDFDictionaryRef kid;
+            if (CGPDFArrayGetDictionary(kids, idx, &kid)) [self addRangesOfNumberTree:kid pageOffset:pageOffset depth:depth + 1];
+        }
+    }
+}
+
+- (void)addRangeWithLabelDictionary:(CGPDFDictionaryRef)labelDictionary startPage:(uint32_t)startPage {
+    PSCLabelRange range = {startPage, 1, (uint32_t)[_prefixes length], 0, PSCPageLabelStyleNone, 0};
+
+    const char *style;
+    if (CGPDFDictionaryGetName(labelDictionary, "S", &style)) {
+        switch (style[0]) {
+            case 'D': range.style = PSCPageLabelStyleDecimal; break;
+            case 'R': range.style = PSCPageLabelStyleUpperRoman; break;
+            case 'r': range.style = PSCPageLabelStyleLowerRoman; break;
+            case 'A': range.style = PSCPageLabelStyleUpperLetters; break;
+            case 'a': range.style = PSCPageLabelStyleLowerLetters; break;
+        }
+    }
+
+    CGPDFInteger firstNumber;
+    if (CGPDFDictionaryGetInteger(labelDictionary, "St", &firstNumber)) range.firstNumber = (int32_t)firstNumber;
+
+    CGPDFStringRef prefixString;
+    if (CGPDFDictionaryGetString(labelDictionary, "P", &prefixString)) {
+        NSString *prefix = CFBridgingRelease(CGPDFStringCopyTextString(prefixString));
+        NSData *prefixData = [prefix dataUsingEncoding:NSUTF8StringEncoding];
+        NSUInteger prefixLength = MIN([prefixData length], UINT16_MAX);
+        // don't cut a UTF8 sequence in half: back up while the first dropped byte is a continuation byte (10xxxxxx).
+        const uint8_t *prefixBytes = [prefixData bytes];
+        while (prefixLength > 0 && prefixLength < [prefixData length] && (prefixBytes[prefixLength] & 0xC0) == 0x80) prefixLength--;
+        range.prefixLength = (uint16_t)prefixLength;
+        [_prefixes appendBytes:[prefixData bytes] length:range.prefixLength];
+    }
+
+    // keys are sorted, but don't rely on it; keep the ranges ordered and unique by start page.
+    PSCLabelRange *ranges = [_ranges mutableBytes];
+    NSUInteger count = [_ranges length] / sizeof(PSCLabelRange), idx = count;
+    while (idx > 0 && ranges[idx - 1].startPage > startPage) idx--;
+    if (idx > 0 && ranges[idx - 1].startPage == startPage) {
+        ranges[idx - 1] = range;
+    }else {
+        [_ranges replaceBytesInRange:NSMakeRange(idx * sizeof(PSCLabelRange), 0) withBytes:&range length:sizeof(range)];
+    }
+}
+
+@end
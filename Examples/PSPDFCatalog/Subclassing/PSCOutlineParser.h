@@ -0,0 +1,32 @@
+//
+//  PSCOutlineParser.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+/**
+    Outline parser that builds the outline tree on demand.
+
+    PSPDFOutlineParser parses the whole outline and resolves all named destinations up front, which takes seconds for
+    manuals with thousands of entries. This subclass returns a root element immediately; the children of an element are
+    only read from the PDF when they are first accessed (e.g. when the node is expanded). Named destinations are looked
+    up one by one in the /Dests name tree (binary search over the /Limits of its kids) and cached.
+    The document ref is only held while the outline is read, and released a few seconds after the last access.
+
+    outlineElementForPage:exactPageOnly: is answered from a page interval index. The index only stores the page and
+    position of every entry; the returned element (and its ancestors) is created on lookup.
+
+    Use PSPDFDocument's overrideClassNames to use this subclass:
+    document.overrideClassNames = @{(id)[PSPDFOutlineParser class] : [PSCOutlineParser class]};
+*/
+@interface PSCOutlineParser : PSPDFOutlineParser
+
+/// Builds the page interval index in the background, so the first outlineElementForPage:exactPageOnly: call doesn't have to.
+/// Otherwise the first lookup builds it synchronously (and waits for a build that's already running).
+- (void)buildPageIndex;
+
+/// YES once the page interval index is available.
+@property(nonatomic, assign, readonly, getter=isPageIndexBuilt) BOOL pageIndexBuilt;
+
+@end
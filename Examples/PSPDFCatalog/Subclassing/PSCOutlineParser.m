@@ -0,0 +1,553 @@
+//
+//  PSCOutlineParser.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2012 PSPDFKit. All rights reserved.
+//
+
+#import "PSCOutlineParser.h"
+
+#define kPSCOutlineMaxSiblings 100000 // guards against /Next cycles in broken files
+#define kPSCOutlineMaxDepth 64
+#define kPSCNameTreeMaxDepth 32
+#define kPSCOutlineDocumentIdleTime 5.0 // seconds the document ref stays open after the last access
+
+// Opens the document ref while the outline is read and releases it when idle.
+// CGPDFDictionaryRefs are only valid while it's open, so outline items are addressed by index path instead.
+@interface PSCOutlineContext : NSObject {
+    CGPDFDocumentRef _documentRef;
+    CFMutableDictionaryRef _pageNumbers; // page dictionary -> page number, built on first use per open document ref
+    NSMutableDictionary *_namedDestinations; // NSData name -> NSNumber page
+    NSUInteger _useCount;
+    NSUInteger _closeGeneration;
+    dispatch_queue_t _contextQueue;
+}
+- (id)initWithDocumentProvider:(PSPDFDocumentProvider *)documentProvider;
+@property(nonatomic, ps_weak, readonly) PSPDFDocumentProvider *documentProvider;
+- (NSArray *)childrenOfOutlineItemAtIndexPath:(NSIndexPath *)indexPath level:(NSUInteger)level;
+- (void)enumerateOutlineItemPagesUsingBlock:(void (^)(NSIndexPath *indexPath, NSUInteger page))block;
+- (void)performBlock:(dispatch_block_t)block;
+@end
+
+// Outline element that reads its children when they are first accessed.
+@interface PSCLazyOutlineElement : PSPDFOutlineElement {
+    PSCOutlineContext *_context;
+    NSIndexPath *_indexPath; // sibling indexes from the outline root, nil for the root itself
+    NSArray *_lazyChildren;
+    BOOL _childrenLoaded;
+}
+- (id)initWithTitle:(NSString *)title page:(NSUInteger)page relativePath:(NSString *)relativePath level:(NSUInteger)level indexPath:(NSIndexPath *)indexPath context:(PSCOutlineContext *)context;
+@end
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSCLazyOutlineElement
+
+@implementation PSCLazyOutlineElement
+
+- (id)initWithTitle:(NSString *)title page:(NSUInteger)page relativePath:(NSString *)relativePath level:(NSUInteger)level indexPath:(NSIndexPath *)indexPath context:(PSCOutlineContext *)context {
+    if ((self = [super initWithTitle:title page:page relativePath:relativePath children:nil level:level])) {
+        _indexPath = indexPath;
+        _context = context;
+    }
+    return self;
+}
+
+- (NSArray *)children {
+    if (!_childrenLoaded) {
+        [_context performBlock:^{
+            if (!_childrenLoaded) {
+                // the root element has no title; its children are the top level.
+                NSUInteger childLevel = self.title ? self.level + 1 : self.level;
+                _lazyChildren = childLevel < kPSCOutlineMaxDepth ? [_context childrenOfOutlineItemAtIndexPath:_indexPath level:childLevel] : @[];
+                _childrenLoaded = YES;
+            }
+        }];
+    }
+    return _lazyChildren;
+}
+
+- (NSArray *)flattenedChildren {
+    NSMutableArray *flattenedChildren = [NSMutableArray array];
+    for (PSPDFOutlineElement *child in self.children) {
+        [flattenedChildren addObject:child];
+        [flattenedChildren addObjectsFromArray:[child flattenedChildren]];
+    }
+    return flattenedChildren;
+}
+
+@end
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSCOutlineContext
+
+static NSData *PSCDataFromPDFString(CGPDFStringRef string) {
+    return string ? [NSData dataWithBytes:CGPDFStringGetBytePtr(string) length:CGPDFStringGetLength(string)] : nil;
+}
+
+static NSComparisonResult PSCCompareNameTreeKey(NSData *key, CGPDFStringRef string) {
+    size_t length = CGPDFStringGetLength(string);
+    int result = memcmp([key bytes], CGPDFStringGetBytePtr(string), MIN([key length], length));
+    if (result != 0) return result < 0 ? NSOrderedAscending : NSOrderedDescending;
+    if ([key length] == length) return NSOrderedSame;
+    return [key length] < length ? NSOrderedAscending : NSOrderedDescending;
+}
+
+// Binary search in a name tree node; kids are selected by their /Limits.
+static CGPDFObjectRef PSCNameTreeLookup(CGPDFDictionaryRef node, NSData *key, NSUInteger depth) {
+    if (!node || depth > kPSCNameTreeMaxDepth) return NULL;
+
+    CGPDFArrayRef names;
+    if (CGPDFDictionaryGetArray(node, "Names", &names)) {
+        NSInteger low = 0, high = (NSInteger)(CGPDFArrayGetCount(names) / 2) - 1;
+        while (low <= high) {
+            NSInteger mid = (low + high) / 2;
+            CGPDFStringRef name;
+            if (!CGPDFArrayGetString(names, mid * 2, &name)) break;
+            NSComparisonResult result = PSCCompareNameTreeKey(key, name);
+            if (result == NSOrderedSame) {
+                CGPDFObjectRef value = NULL;
+                CGPDFArrayGetObject(names, mid * 2 + 1, &value);
+                return value;
+            }
+            if (result == NSOrderedAscending) high = mid - 1;
+            else low = mid + 1;
+        }
+        return NULL;
+    }
+
+    CGPDFArrayRef kids;
+    if (CGPDFDictionaryGetArray(node, "Kids", &kids)) {
+        NSInteger low = 0, high = (NSInteger)CGPDFArrayGetCount(kids) - 1;
+        while (low <= high) {
+            NSInteger mid = (low + high) / 2;
+            CGPDFDictionaryRef kid;
+            CGPDFArrayRef limits;
+            CGPDFStringRef lowerLimit, upperLimit;
+            if (!CGPDFArrayGetDictionary(kids, mid, &kid)) break;
+            if (!CGPDFDictionaryGetArray(kid, "Limits", &limits) || !CGPDFArrayGetString(limits, 0, &lowerLimit) || !CGPDFArrayGetString(limits, 1, &upperLimit)) {
+                // no limits; fall back to searching all kids.
+                for (size_t i = 0; i < CGPDFArrayGetCount(kids); i++) {
+                    if (CGPDFArrayGetDictionary(kids, i, &kid)) {
+                        CGPDFObjectRef value = PSCNameTreeLookup(kid, key, depth + 1);
+                        if (value) return value;
+                    }
+                }
+                return NULL;
+            }
+            if (PSCCompareNameTreeKey(key, lowerLimit) == NSOrderedAscending) high = mid - 1;
+            else if (PSCCompareNameTreeKey(key, upperLimit) == NSOrderedDescending) low = mid + 1;
+            else return PSCNameTreeLookup(kid, key, depth + 1);
+        }
+    }
+    return NULL;
+}
+
+@implementation PSCOutlineContext
+
+- (id)initWithDocumentProvider:(PSPDFDocumentProvider *)documentProvider {
+    if ((self = [super init])) {
+        _documentProvider = documentProvider;
+        _namedDestinations = [NSMutableDictionary new];
+        _contextQueue = dispatch_queue_create("com.pspdfkit.catalog.outlineContextQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeDocumentRef];
+    PSPDFDispatchRelease(_contextQueue);
+}
+
+// The document ref is open for the duration of block (and kPSCOutlineDocumentIdleTime after).
+- (void)performBlock:(dispatch_block_t)block {
+    pspdf_dispatch_sync_reentrant(_contextQueue, ^{
+        if (_useCount++ == 0 && !_documentRef) {
+            PSPDFDocumentProvider *documentProvider = self.documentProvider;
+            CGPDFDocumentRef documentRef = [documentProvider requestDocumentRef];
+            _documentRef = CGPDFDocumentRetain(documentRef);
+            [documentProvider releaseDocumentRef:documentRef];
+        }
+        block();
+        if (--_useCount == 0) {
+            NSUInteger closeGeneration = ++_closeGeneration;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kPSCOutlineDocumentIdleTime * NSEC_PER_SEC)), _contextQueue, ^{
+                if (_useCount == 0 && _closeGeneration == closeGeneration) [self closeDocumentRef];
+            });
+        }
+    });
+}
+
+- (void)closeDocumentRef {
+    if (_pageNumbers) CFRelease(_pageNumbers);
+    _pageNumbers = NULL;
+    CGPDFDocumentRelease(_documentRef);
+    _documentRef = NULL;
+}
+
+- (CGPDFDictionaryRef)outlineRoot {
+    CGPDFDictionaryRef catalog = _documentRef ? CGPDFDocumentGetCatalog(_documentRef) : NULL, outlines = NULL;
+    if (catalog) CGPDFDictionaryGetDictionary(catalog, "Outlines", &outlines);
+    return outlines;
+}
+
+// Follows /First and /Next from the root. Needs to be called within performBlock:.
+- (CGPDFDictionaryRef)outlineItemAtIndexPath:(NSIndexPath *)indexPath {
+    CGPDFDictionaryRef item = [self outlineRoot];
+    for (NSUInteger position = 0; item && position < [indexPath length]; position++) {
+        NSUInteger siblingIndex = [indexPath indexAtPosition:position];
+        CGPDFDictionaryRef child = NULL;
+        CGPDFDictionaryGetDictionary(item, "First", &child);
+        for (NSUInteger i = 0; child && i < siblingIndex; i++) {
+            CGPDFDictionaryRef next = NULL;
+            if (!CGPDFDictionaryGetDictionary(child, "Next", &next) || next == child) next = NULL;
+            child = next;
+        }
+        item = child;
+    }
+    return item;
+}
+
+// Calls block(child, siblingIndex) for the children of item, in document order.
+static void PSCOutlineEnumerateChildren(CGPDFDictionaryRef item, void (^block)(CGPDFDictionaryRef child, NSUInteger siblingIndex)) {
+    CGPDFDictionaryRef child = NULL;
+    if (item) CGPDFDictionaryGetDictionary(item, "First", &child);
+
+    for (NSUInteger siblingIndex = 0; child && siblingIndex < kPSCOutlineMaxSiblings; siblingIndex++) {
+        block(child, siblingIndex);
+        CGPDFDictionaryRef next = NULL;
+        if (!CGPDFDictionaryGetDictionary(child, "Next", &next) || next == child) break;
+        child = next;
+    }
+}
+
+- (NSArray *)childrenOfOutlineItemAtIndexPath:(NSIndexPath *)indexPath level:(NSUInteger)level {
+    NSMutableArray *children = [NSMutableArray array];
+    [self performBlock:^{
+        PSCOutlineEnumerateChildren([self outlineItemAtIndexPath:indexPath], ^(CGPDFDictionaryRef child, NSUInteger siblingIndex) {
+            NSString *title = nil;
+            CGPDFStringRef titleString;
+            if (CGPDFDictionaryGetString(child, "Title", &titleString)) {
+                title = CFBridgingRelease(CGPDFStringCopyTextString(titleString));
+            }
+
+            NSString *relativePath = nil;
+            NSUInteger page = [self pageForOutlineItem:child relativePath:&relativePath];
+            NSIndexPath *childIndexPath = indexPath ? [indexPath indexPathByAddingIndex:siblingIndex] : [NSIndexPath indexPathWithIndex:siblingIndex];
+            [children addObject:[[PSCLazyOutlineElement alloc] initWithTitle:title ?: @"" page:page relativePath:relativePath level:level indexPath:childIndexPath context:self]];
+        });
+    }];
+    return children;
+}
+
+// Walks the whole outline in document order without creating elements (no titles, no element objects).
+- (void)enumerateOutlineItemPagesUsingBlock:(void (^)(NSIndexPath *indexPath, NSUInteger page))block {
+    [self performBlock:^{
+        [self enumerateChildrenOfOutlineItem:[self outlineRoot] indexPath:nil usingBlock:block];
+    }];
+}
+
+- (void)enumerateChildrenOfOutlineItem:(CGPDFDictionaryRef)item indexPath:(NSIndexPath *)indexPath usingBlock:(void (^)(NSIndexPath *indexPath, NSUInteger page))block {
+    if ([indexPath length] >= kPSCOutlineMaxDepth) return;
+    PSCOutlineEnumerateChildren(item, ^(CGPDFDictionaryRef child, NSUInteger siblingIndex) {
+        NSIndexPath *childIndexPath = indexPath ? [indexPath indexPathByAddingIndex:siblingIndex] : [NSIndexPath indexPathWithIndex:siblingIndex];
+        block(childIndexPath, [self pageForOutlineItem:child relativePath:NULL]);
+        [self enumerateChildrenOfOutlineItem:child indexPath:childIndexPath usingBlock:block];
+    });
+}
+
+// Page of the item's /Dest or /A (GoTo, GoToR) entry. Pages start at 0.
+- (NSUInteger)pageForOutlineItem:(CGPDFDictionaryRef)item relativePath:(NSString **)relativePath {
+    CGPDFObjectRef destination = NULL;
+    if (!CGPDFDictionaryGetObject(item, "Dest", &destination)) {
+        CGPDFDictionaryRef action;
+        const char *actionType;
+        if (CGPDFDictionaryGetDictionary(item, "A", &action) && CGPDFDictionaryGetName(action, "S", &actionType)) {
+            if (strcmp(actionType, "GoTo") == 0 || strcmp(actionType, "GoToR") == 0) {
+                CGPDFDictionaryGetObject(action, "D", &destination);
+            }
+            if (strcmp(actionType, "GoToR") == 0) {
+                CGPDFStringRef fileString = NULL;
+                CGPDFDictionaryRef fileSpecification;
+                if (CGPDFDictionaryGetDictionary(action, "F", &fileSpecification)) {
+                    if (!CGPDFDictionaryGetString(fileSpecification, "UF", &fileString)) CGPDFDictionaryGetString(fileSpecification, "F", &fileString);
+                }else {
+                    CGPDFDictionaryGetString(action, "F", &fileString);
+                }
+                if (fileString && relativePath) *relativePath = CFBridgingRelease(CGPDFStringCopyTextString(fileString));
+                // remote destinations use page indexes.
+                CGPDFArrayRef destinationArray;
+                CGPDFInteger pageIndex;
+                if (destination && CGPDFObjectGetValue(destination, kCGPDFObjectTypeArray, &destinationArray) && CGPDFArrayGetInteger(destinationArray, 0, &pageIndex)) {
+                    return (NSUInteger)MAX(pageIndex, 0);
+                }
+                return 0;
+            }
+        }
+    }
+    return [self pageForDestination:destination depth:0];
+}
+
+- (NSUInteger)pageForDestination:(CGPDFObjectRef)destination depth:(NSUInteger)depth {
+    if (!destination || depth > 2) return 0;
+
+    switch (CGPDFObjectGetType(destination)) {
+        case kCGPDFObjectTypeArray: {
+            CGPDFArrayRef destinationArray;
+            CGPDFDictionaryRef pageDictionary;
+            CGPDFObjectGetValue(destination, kCGPDFObjectTypeArray, &destinationArray);
+            if (CGPDFArrayGetDictionary(destinationArray, 0, &pageDictionary)) {
+                return [self pageForPageDictionary:pageDictionary];
+            }
+            return 0;
+        }
+        case kCGPDFObjectTypeDictionary: {
+            // named destinations may be wrapped in a dictionary with /D.
+            CGPDFDictionaryRef destinationDictionary;
+            CGPDFObjectRef innerDestination;
+            CGPDFObjectGetValue(destination, kCGPDFObjectTypeDictionary, &destinationDictionary);
+            return CGPDFDictionaryGetObject(destinationDictionary, "D", &innerDestination) ? [self pageForDestination:innerDestination depth:depth + 1] : 0;
+        }
+        case kCGPDFObjectTypeName: {
+            const char *name;
+            CGPDFObjectGetValue(destination, kCGPDFObjectTypeName, &name);
+            return [self pageForNamedDestination:[NSData dataWithBytes:name length:strlen(name)] isName:YES depth:depth];
+        }
+        case kCGPDFObjectTypeString: {
+            CGPDFStringRef string;
+            CGPDFObjectGetValue(destination, kCGPDFObjectTypeString, &string);
+            return [self pageForNamedDestination:PSCDataFromPDFString(string) isName:NO depth:depth];
+        }
+        default:
+            return 0;
+    }
+}
+
+// Names are looked up in /Dests (PDF 1.1), strings in the /Names /Dests name tree.
+- (NSUInteger)pageForNamedDestination:(NSData *)name isName:(BOOL)isName depth:(NSUInteger)depth {
+    if (!name) return 0;
+    NSNumber *cachedPage = _namedDestinations[name];
+    if (cachedPage) return [cachedPage unsignedIntegerValue];
+
+    CGPDFDictionaryRef catalog = CGPDFDocumentGetCatalog(_documentRef);
+    CGPDFObjectRef destination = NULL;
+    if (isName) {
+        CGPDFDictionaryRef dests;
+        NSString *nameString = [[NSString alloc] initWithData:name encoding:NSUTF8StringEncoding];
+        if (nameString && CGPDFDictionaryGetDictionary(catalog, "Dests", &dests)) {
+            CGPDFDictionaryGetObject(dests, [nameString UTF8String], &destination);
+        }
+    }
+    if (!destination) {
+        CGPDFDictionaryRef names, destsTree;
+        if (CGPDFDictionaryGetDictionary(catalog, "Names", &names) && CGPDFDictionaryGetDictionary(names, "Dests", &destsTree)) {
+            destination = PSCNameTreeLookup(destsTree, name, 0);
+        }
+    }
+
+    NSUInteger page = [self pageForDestination:destination depth:depth + 1];
+    _namedDestinations[name] = @(page);
+    return page;
+}
+
+- (NSUInteger)pageForPageDictionary:(CGPDFDictionaryRef)pageDictionary {
+    if (!_pageNumbers) {
+        // one pass over the page tree; much cheaper than comparing against every page for every item.
+        size_t pageCount = CGPDFDocumentGetNumberOfPages(_documentRef);
+        _pageNumbers = CFDictionaryCreateMutable(NULL, (CFIndex)pageCount, NULL, NULL);
+        for (size_t pageNumber = 1; pageNumber <= pageCount; pageNumber++) {
+            CGPDFPageRef pageRef = CGPDFDocumentGetPage(_documentRef, pageNumber);
+            if (pageRef) CFDictionarySetValue(_pageNumbers, CGPDFPageGetDictionary(pageRef), (const void *)pageNumber);
+        }
+    }
+    size_t pageNumber = (size_t)CFDictionaryGetValue(_pageNumbers, pageDictionary);
+    return pageNumber > 0 ? pageNumber - 1 : 0;
+}
+
+@end
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSCOutlineParser
+
+// Page index entry; order is the position in document order, so sorting by (page, order) is stable.
+typedef struct {
+    NSUInteger page;
+    NSUInteger order;
+} PSCOutlineIndexEntry;
+
+static int PSCCompareOutlineIndexEntries(const void *entry1, const void *entry2) {
+    const PSCOutlineIndexEntry *e1 = entry1, *e2 = entry2;
+    if (e1->page != e2->page) return e1->page < e2->page ? -1 : 1;
+    if (e1->order != e2->order) return e1->order < e2->order ? -1 : 1;
+    return 0;
+}
+
+@interface PSCOutlineParser () {
+    PSCOutlineContext *_context;
+    PSPDFOutlineElement *_lazyOutline;
+    NSArray *_indexedPaths;  // NSIndexPath of the elements, sorted by page, stable (document order within a page)
+    NSUInteger *_indexedPages;
+    dispatch_queue_t _parserQueue;
+    dispatch_queue_t _indexQueue; // serializes index builds, so a lookup waits for a running build instead of starting another
+}
+@property(nonatomic, ps_weak) PSPDFDocumentProvider *documentProvider;
+@end
+
+@implementation PSCOutlineParser
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocumentProvider:(PSPDFDocumentProvider *)documentProvider {
+    if ((self = [super initWithDocumentProvider:documentProvider])) {
+        _documentProvider = documentProvider;
+        _parserQueue = dispatch_queue_create("com.pspdfkit.catalog.outlineParserQueue", NULL);
+        _indexQueue = dispatch_queue_create("com.pspdfkit.catalog.outlineIndexQueue", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_indexedPages);
+    PSPDFDispatchRelease(_parserQueue);
+    PSPDFDispatchRelease(_indexQueue);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFOutlineParser
+
+- (PSPDFOutlineElement *)outline {
+    __block PSPDFOutlineElement *outline;
+    dispatch_sync(_parserQueue, ^{
+        if (!_lazyOutline) {
+            // nothing is read yet; the context opens the document ref when children are accessed.
+            if (!_context) _context = [[PSCOutlineContext alloc] initWithDocumentProvider:self.documentProvider];
+            _lazyOutline = [[PSCLazyOutlineElement alloc] initWithTitle:nil page:0 relativePath:nil level:0 indexPath:nil context:_context];
+        }
+        outline = _lazyOutline;
+    });
+    return outline;
+}
+
+- (void)setOutline:(PSPDFOutlineElement *)outline {
+    dispatch_sync(_parserQueue, ^{
+        _lazyOutline = outline;
+        _indexedPaths = nil;
+        free(_indexedPages);
+        _indexedPages = NULL;
+    });
+}
+
+- (BOOL)isOutlineParsed {
+    __block BOOL outlineParsed;
+    dispatch_sync(_parserQueue, ^{ outlineParsed = _lazyOutline != nil; });
+    return outlineParsed;
+}
+
+- (BOOL)isOutlineAvailable {
+    return self.isOutlineParsed && [self.outline.children count] > 0;
+}
+
+- (PSPDFOutlineElement *)outlineElementForPage:(NSUInteger)page exactPageOnly:(BOOL)exactPageOnly {
+    [self buildPageIndexIfNeeded];
+
+    __block PSPDFOutlineElement *outline = nil;
+    __block NSIndexPath *indexPath = nil;
+    dispatch_sync(_parserQueue, ^{
+        NSUInteger count = [_indexedPaths count];
+        if (count == 0) return;
+
+        // last element starting at or before page.
+        NSUInteger low = 0, high = count;
+        while (low < high) {
+            NSUInteger mid = (low + high) / 2;
+            if (_indexedPages[mid] <= page) low = mid + 1;
+            else high = mid;
+        }
+        if (low > 0 && (!exactPageOnly || _indexedPages[low - 1] == page)) {
+            indexPath = _indexedPaths[low - 1];
+            outline = _lazyOutline;
+        }
+    });
+    return [self outlineElementAtIndexPath:indexPath inOutline:outline];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)buildPageIndex {
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        [self buildPageIndexIfNeeded];
+    });
+}
+
+- (BOOL)isPageIndexBuilt {
+    __block BOOL pageIndexBuilt;
+    dispatch_sync(_parserQueue, ^{ pageIndexBuilt = _indexedPaths != nil; });
+    return pageIndexBuilt;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)buildPageIndexIfNeeded {
+    dispatch_sync(_indexQueue, ^{
+        if (self.isPageIndexBuilt) return;
+
+        // only index paths and pages are collected; elements are created when a lookup returns them.
+        PSPDFOutlineElement *outline = self.outline;
+        NSMutableArray *paths = [NSMutableArray array];
+        NSMutableData *entries = [NSMutableData data];
+        void (^addEntry)(NSIndexPath *, NSUInteger) = ^(NSIndexPath *indexPath, NSUInteger page) {
+            PSCOutlineIndexEntry entry = {page, [paths count]};
+            [entries appendBytes:&entry length:sizeof(entry)];
+            [paths addObject:indexPath];
+        };
+        if ([outline isKindOfClass:[PSCLazyOutlineElement class]]) {
+            [_context enumerateOutlineItemPagesUsingBlock:addEntry];
+        }else {
+            // an outline that was set manually is already in memory.
+            [self enumerateOutlineElement:outline indexPath:nil usingBlock:addEntry];
+        }
+
+        NSUInteger count = [paths count];
+        PSCOutlineIndexEntry *sortedEntries = [entries mutableBytes];
+        qsort(sortedEntries, count, sizeof(PSCOutlineIndexEntry), PSCCompareOutlineIndexEntries);
+        NSUInteger *pages = malloc(MAX(count, 1) * sizeof(NSUInteger));
+        NSMutableArray *sortedPaths = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            pages[i] = sortedEntries[i].page;
+            [sortedPaths addObject:paths[sortedEntries[i].order]];
+        }
+
+        dispatch_sync(_parserQueue, ^{
+            if (_lazyOutline == outline) {
+                free(_indexedPages);
+                _indexedPages = pages;
+                _indexedPaths = sortedPaths;
+            }else {
+                free(pages);
+            }
+        });
+    });
+}
+
+- (void)enumerateOutlineElement:(PSPDFOutlineElement *)element indexPath:(NSIndexPath *)indexPath usingBlock:(void (^)(NSIndexPath *indexPath, NSUInteger page))block {
+    [element.children enumerateObjectsUsingBlock:^(PSPDFOutlineElement *child, NSUInteger idx, BOOL *stop) {
+        NSIndexPath *childIndexPath = indexPath ? [indexPath indexPathByAddingIndex:idx] : [NSIndexPath indexPathWithIndex:idx];
+        block(childIndexPath, child.page);
+        [self enumerateOutlineElement:child indexPath:childIndexPath usingBlock:block];
+    }];
+}
+
+// Loads the children along indexPath only.
+- (PSPDFOutlineElement *)outlineElementAtIndexPath:(NSIndexPath *)indexPath inOutline:(PSPDFOutlineElement *)outline {
+    PSPDFOutlineElement *element = indexPath ? outline : nil;
+    for (NSUInteger position = 0; element && position < [indexPath length]; position++) {
+        NSArray *children = element.children;
+        NSUInteger index = [indexPath indexAtPosition:position];
+        element = index < [children count] ? children[index] : nil;
+    }
+    return element;
+}
+
+@end
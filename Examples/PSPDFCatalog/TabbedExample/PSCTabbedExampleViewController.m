@@ -7,6 +7,7 @@
 
 #import "PSCTabbedExampleViewController.h"
 #import "PSCAddDocumentsBarButtonItem.h"
+#import "PSCPooledDocumentProvider.h"
 #import <objc/runtime.h>
 
 @implementation PSCTabbedExampleViewController
@@ -40,6 +41,7 @@ const char *clearAllActionSheetToken;
                 return arc4random_uniform(2) > 0; // returns 0 or 1 randomly.
             }]];
         }
+        [self usePooledDocumentProvidersForDocuments:self.documents];
     }
     return self;
 }
@@ -47,6 +49,17 @@ const char *clearAllActionSheetToken;
 ///////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - Private
 
+// With many tabs, open document references are shared through PSCDocumentRefPool.
+- (void)usePooledDocumentProvidersForDocuments:(NSArray *)documents {
+    for (PSPDFDocument *document in documents) {
+        if (!document.overrideClassNames[[PSPDFDocumentProvider class]]) {
+            NSMutableDictionary *overrideClassNames = [NSMutableDictionary dictionaryWithDictionary:document.overrideClassNames ?: @{}];
+            overrideClassNames[(id)[PSPDFDocumentProvider class]] = [PSCPooledDocumentProvider class];
+            document.overrideClassNames = overrideClassNames;
+        }
+    }
+}
+
 - (void)clearAll:(id)sender {
     // ensure we correctly shwow/hide the sheet
     PSPDFActionSheet *actionSheet = objc_getAssociatedObject(sender, clearAllActionSheetToken);
@@ -75,6 +88,7 @@ const char *clearAllActionSheetToken;
 
 - (BOOL)tabbedPDFController:(PSPDFTabbedViewController *)tabbedPDFController shouldChangeDocuments:(NSArray *)newDocuments {
     NSLog(@"shouldChangeDocuments: %@", newDocuments);
+    [self usePooledDocumentProvidersForDocuments:newDocuments];
 
     // return YES to allow the change
     return YES;
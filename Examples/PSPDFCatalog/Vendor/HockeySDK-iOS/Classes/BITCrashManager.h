@@ -68,6 +68,9 @@ static NSString *kBITCrashManagerStatus = @"BITCrashManagerStatus";
  and the app could not react to any user input when network conditions are bad or connectivity might be
  very slow.
  
+ Parsing and formatting pending crash reports is done on a low priority background queue, with a limited
+ amount of CPU time per app launch. Reports that don't fit are processed on the next launch.
+ 
  More background information on this topic can be found in the following blog post by Landon Fuller, the
  developer of [PLCrashReporter](https://code.google.com/p/plcrashreporter/), about writing reliable and
  safe crash reporting: [Reliable Crash Reporting](http://goo.gl/WvTBR)
@@ -82,6 +85,7 @@ static NSString *kBITCrashManagerStatus = @"BITCrashManagerStatus";
   NSMutableDictionary *_approvedCrashReports;
 
   NSMutableArray *_crashFiles;
+  NSMutableSet   *_deferredCrashFiles; // over this launch's processing budget, ignored until the next launch
   NSString       *_crashesDir;
   NSString       *_settingsFile;
   NSString       *_analyzerInProgressFile;
@@ -95,6 +99,13 @@ static NSString *kBITCrashManagerStatus = @"BITCrashManagerStatus";
   NSURLConnection *_urlConnection;
   
   BOOL _sendingInProgress;
+  
+  dispatch_queue_t _processingQueue;
+  NSString *_lastSessionCrashReportFile;
+  
+  NSTimeInterval _startupTime;
+  NSTimeInterval _crashReportProcessingTime;
+  BOOL _didFinishStartup;
 }
 
 
@@ -186,4 +197,28 @@ static NSString *kBITCrashManagerStatus = @"BITCrashManagerStatus";
  */
 @property (nonatomic, readonly) NSTimeInterval timeintervalCrashInLastSessionOccured;
 
+
+///-----------------------------------------------------------------------------
+/// @name Startup Timing
+///-----------------------------------------------------------------------------
+
+/**
+ Time in seconds the crash manager spent on the main thread while starting up
+ 
+ This covers the setup when the HockeySDK is configured and `startManager`, but not
+ the crash report processing, which runs in the background.
+ 
+ @see crashReportProcessingTime
+ @see [BITCrashManagerDelegate crashManagerDidFinishStartup:]
+ */
+@property (nonatomic, readonly) NSTimeInterval startupTime;
+
+
+/**
+ CPU time in seconds spent parsing and formatting crash reports in the background during this launch
+ 
+ @see startupTime
+ */
+@property (nonatomic, readonly) NSTimeInterval crashReportProcessingTime;
+
 @end
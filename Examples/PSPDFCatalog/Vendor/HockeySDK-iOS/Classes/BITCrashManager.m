@@ -38,6 +38,7 @@
 #import "BITCrashReportTextFormatter.h"
 
 #include <sys/sysctl.h>
+#include <mach/mach.h>
 
 // flags if the crashreporter should automatically send crashes without asking the user again
 #define kBITCrashAutomaticallySendReports @"BITCrashAutomaticallySendReports"
@@ -50,6 +51,26 @@
 #define kBITCrashMetaUserEmail @"BITCrashMetaUserEmail"
 #define kBITCrashMetaApplicationLog @"BITCrashMetaApplicationLog"
 
+// suffix of the file caching the XML of a processed crash report, so it isn't parsed again if sending fails
+#define kBITCrashXMLSuffix @".xml"
+
+// CPU time in seconds crash report processing may use per app launch
+#define BITCrashProcessingTimeBudget 0.5
+
+// CPU time used by the calling thread, in seconds
+static NSTimeInterval BITCurrentThreadCPUTime(void) {
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  mach_port_t thread = mach_thread_self();
+  kern_return_t result = thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  
+  if (result != KERN_SUCCESS) return 0;
+  
+  return info.user_time.seconds + info.user_time.microseconds / 1000000.0 +
+         info.system_time.seconds + info.system_time.microseconds / 1000000.0;
+}
+
 
 @interface BITCrashManager ()
 
@@ -64,12 +85,15 @@
 @synthesize showAlwaysButton = _showAlwaysButton;
 @synthesize didCrashInLastSession = _didCrashInLastSession;
 @synthesize timeintervalCrashInLastSessionOccured = _timeintervalCrashInLastSessionOccured;
+@synthesize startupTime = _startupTime;
+@synthesize crashReportProcessingTime = _crashReportProcessingTime;
 
 @synthesize fileManager = _fileManager;
 
 
 - (id)initWithAppIdentifier:(NSString *)appIdentifier {
   if ((self = [super init])) {
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
     BITHockeyLog(@"Initializing CrashReporter");
     
     _appIdentifier = appIdentifier;
@@ -84,11 +108,21 @@
     
     _didCrashInLastSession = NO;
     _timeintervalCrashInLastSessionOccured = -1;
+    _lastSessionCrashReportFile = nil;
+    
+    _startupTime = 0;
+    _crashReportProcessingTime = 0;
+    _didFinishStartup = NO;
+    
+    // crash reports are parsed and formatted on this queue, away from the launch path
+    _processingQueue = dispatch_queue_create("net.hockeyapp.sdk.crashReportProcessing", NULL);
+    dispatch_set_target_queue(_processingQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
     
     _approvedCrashReports = [[NSMutableDictionary alloc] init];
 
     _fileManager = [[NSFileManager alloc] init];
     _crashFiles = [[NSMutableArray alloc] init];
+    _deferredCrashFiles = [[NSMutableSet alloc] init];
     
     _crashManagerStatus = BITCrashManagerStatusAlwaysAsk;
     
@@ -140,6 +174,8 @@
     if (!BITHockeyBundle()) {
       NSLog(@"WARNING: %@ is missing, will send reports automatically!", BITHOCKEYSDK_BUNDLE);
     }
+    
+    _startupTime += CFAbsoluteTimeGetCurrent() - startTime;
   }
   return self;
 }
@@ -158,6 +194,7 @@
   
   [_crashesDir release];
   [_crashFiles release];
+  [_deferredCrashFiles release];
   
   [_fileManager release];
   _fileManager = nil;
@@ -168,6 +205,11 @@
   [_analyzerInProgressFile release];
   _analyzerInProgressFile = nil;
   
+  [_lastSessionCrashReportFile release];
+  _lastSessionCrashReportFile = nil;
+  
+  dispatch_release(_processingQueue);
+  
   [super dealloc];
 }
 
@@ -178,6 +220,22 @@
   [[NSUserDefaults standardUserDefaults] setInteger:crashManagerStatus forKey:kBITCrashManagerStatus];
 }
 
+- (NSTimeInterval)timeintervalCrashInLastSessionOccured {
+  // the report is only parsed here if it wasn't processed yet, which keeps parsing out of the app launch
+  if (_lastSessionCrashReportFile) {
+    NSData *crashData = [NSData dataWithContentsOfFile:_lastSessionCrashReportFile];
+    if ([crashData length] > 0) {
+      PLCrashReport *report = [[[PLCrashReport alloc] initWithData:crashData error:NULL] autorelease];
+      _timeintervalCrashInLastSessionOccured = [self timeintervalCrashOccuredForCrashReport:report];
+    }
+    
+    [_lastSessionCrashReportFile release];
+    _lastSessionCrashReportFile = nil;
+  }
+  
+  return _timeintervalCrashInLastSessionOccured;
+}
+
 
 #pragma mark - Private
 
@@ -226,6 +284,7 @@
   for (NSUInteger i=0; i < [_crashFiles count]; i++) {
     [_fileManager removeItemAtPath:[_crashFiles objectAtIndex:i] error:&error];
     [_fileManager removeItemAtPath:[[_crashFiles objectAtIndex:i] stringByAppendingString:@".meta"] error:&error];
+    [_fileManager removeItemAtPath:[[_crashFiles objectAtIndex:i] stringByAppendingString:kBITCrashXMLSuffix] error:&error];
   }
   [_crashFiles removeAllObjects];
   [_approvedCrashReports removeAllObjects];
@@ -260,6 +319,14 @@
   return platform;
 }
 
+// time between startup and crash, or -1 if unknown
+- (NSTimeInterval)timeintervalCrashOccuredForCrashReport:(PLCrashReport *)report {
+  if (report.systemInfo.timestamp && report.applicationInfo.applicationStartupTimestamp) {
+    return [report.systemInfo.timestamp timeIntervalSinceDate:report.applicationInfo.applicationStartupTimestamp];
+  }
+  return -1;
+}
+
 
 #pragma mark - PLCrashReporter
 
@@ -287,6 +354,10 @@
     } else {
       [crashData writeToFile:[_crashesDir stringByAppendingPathComponent: cacheFilename] atomically:YES];
       
+      // parsed later, see timeintervalCrashInLastSessionOccured
+      [_lastSessionCrashReportFile release];
+      _lastSessionCrashReportFile = [[_crashesDir stringByAppendingPathComponent: cacheFilename] retain];
+      
       // write the meta file
       NSMutableDictionary *metaDict = [NSMutableDictionary dictionaryWithCapacity:4];
       NSString *username = @"";
@@ -317,13 +388,6 @@
       } else {
         BITHockeyLog(@"ERROR: Writing crash meta data failed. %@", error);
       }
-
-      // get the startup timestamp from the crash report, and the file timestamp to calculate the timeinterval when the crash happened after startup
-      PLCrashReport *report = [[[PLCrashReport alloc] initWithData:crashData error:&error] autorelease];
-      
-      if (report.systemInfo.timestamp && report.applicationInfo.applicationStartupTimestamp) {
-        _timeintervalCrashInLastSessionOccured = [report.systemInfo.timestamp timeIntervalSinceDate:report.applicationInfo.applicationStartupTimestamp];
-      }
     }
   }
 	
@@ -352,7 +416,9 @@
 
 - (BOOL)hasPendingCrashReport {
   if (_crashManagerStatus == BITCrashManagerStatusDisabled) return NO;
-    
+  
+  [_crashFiles removeAllObjects];
+  
   if ([self.fileManager fileExistsAtPath:_crashesDir]) {
     NSString *file = nil;
     NSError *error = NULL;
@@ -364,8 +430,13 @@
       if ([[fileAttributes objectForKey:NSFileSize] intValue] > 0 &&
           ![file hasSuffix:@".analyzer"] &&
           ![file hasSuffix:@".plist"] &&
-          ![file hasSuffix:@".meta"]) {
-        [_crashFiles addObject:[_crashesDir stringByAppendingPathComponent: file]];
+          ![file hasSuffix:@".meta"] &&
+          ![file hasSuffix:kBITCrashXMLSuffix]) {
+        NSString *filename = [_crashesDir stringByAppendingPathComponent:file];
+        // deferred reports would show the alert again on every startManager call (e.g. on reachability changes)
+        if (![_deferredCrashFiles containsObject:filename]) {
+          [_crashFiles addObject:filename];
+        }
       }
     }
   }
@@ -384,6 +455,8 @@
 - (void)startManager {
   if (_crashManagerStatus == BITCrashManagerStatusDisabled) return;
   
+  CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+  
   if (!_sendingInProgress && [self hasPendingCrashReport]) {
     _sendingInProgress = YES;
     if (!BITHockeyBundle()) {
@@ -429,6 +502,17 @@
       [self sendCrashReports];
     }
   }
+  
+  // only the first call is part of the startup, later ones come from reachability changes
+  if (!_didFinishStartup) {
+    _didFinishStartup = YES;
+    _startupTime += CFAbsoluteTimeGetCurrent() - startTime;
+    BITHockeyLog(@"Startup took %.3fs on the main thread.", _startupTime);
+    
+    if (self.delegate != nil && [self.delegate respondsToSelector:@selector(crashManagerDidFinishStartup:)]) {
+      [self.delegate crashManagerDidFinishStartup:self];
+    }
+  }
 }
 
 - (void)sendCrashReports {
@@ -437,96 +521,154 @@
 }
 
 - (void)performSendingCrashReports {
-  NSError *error = NULL;
-	  
-  NSMutableString *crashes = nil;
-  _crashIdenticalCurrentVersion = NO;
+  NSArray *crashFiles = [[_crashFiles copy] autorelease];
+  NSString *lastSessionCrashReportFile = [[_lastSessionCrashReportFile copy] autorelease];
+  NSTimeInterval processingTimeBudget = BITCrashProcessingTimeBudget - _crashReportProcessingTime;
   
-  for (NSUInteger i=0; i < [_crashFiles count]; i++) {
-    NSString *filename = [_crashFiles objectAtIndex:i];
-    NSData *crashData = [NSData dataWithContentsOfFile:filename];
-		
-    if ([crashData length] > 0) {
-      PLCrashReport *report = [[[PLCrashReport alloc] initWithData:crashData error:&error] autorelease];
-			
-      if (report == nil) {
-        BITHockeyLog(@"Could not parse crash report");
-        // we cannot do anything with this report, so delete it
-        [_fileManager removeItemAtPath:filename error:&error];
-        [_fileManager removeItemAtPath:[NSString stringWithFormat:@"%@.meta", filename] error:&error];
-        continue;
-      }
+  // parsing and formatting big crash reports is expensive, do it in the background with a limited CPU time
+  dispatch_async(_processingQueue, ^{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSFileManager *fileManager = [[[NSFileManager alloc] init] autorelease];
+    NSError *error = NULL;
+    
+    NSMutableString *crashes = nil;
+    NSMutableArray *processedCrashFiles = [NSMutableArray arrayWithCapacity:[crashFiles count]];
+    BOOL crashIdenticalCurrentVersion = NO;
+    NSTimeInterval timeintervalCrashInLastSessionOccured = -1;
+    NSTimeInterval startTime = BITCurrentThreadCPUTime();
+    NSTimeInterval processingTime = 0;
+    
+    for (NSString *filename in crashFiles) {
+      NSString *xmlFilename = [filename stringByAppendingString:kBITCrashXMLSuffix];
+      NSString *crashXML = [NSString stringWithContentsOfFile:xmlFilename encoding:NSUTF8StringEncoding error:NULL];
       
-      NSString *crashUUID = report.reportInfo.reportGUID ?: @"";
-      NSString *crashLogString = [BITCrashReportTextFormatter stringValueForCrashReport:report];
+      if (crashXML == nil) {
+        if (processingTime >= processingTimeBudget) {
+          BITHockeyLog(@"Crash report processing time used up, %@ will be processed on the next launch.", [filename lastPathComponent]);
+          continue;
+        }
+        
+        NSAutoreleasePool *reportPool = [[NSAutoreleasePool alloc] init];
+        NSData *crashData = [NSData dataWithContentsOfFile:filename];
+        PLCrashReport *report = nil;
+        if ([crashData length] > 0) {
+          report = [[[PLCrashReport alloc] initWithData:crashData error:&error] autorelease];
+        }
+        
+        if (report == nil) {
+          BITHockeyLog(@"Could not parse crash report");
+          // we cannot do anything with this report, so delete it
+          [fileManager removeItemAtPath:filename error:&error];
+          [fileManager removeItemAtPath:[NSString stringWithFormat:@"%@.meta", filename] error:&error];
+        } else {
+          if ([report.applicationInfo.applicationVersion compare:[[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"]] == NSOrderedSame) {
+            crashIdenticalCurrentVersion = YES;
+          }
+          if ([filename isEqualToString:lastSessionCrashReportFile]) {
+            timeintervalCrashInLastSessionOccured = [self timeintervalCrashOccuredForCrashReport:report];
+          }
+          
+          crashXML = [[self crashXMLForCrashReport:report filename:filename] retain];
+          [crashXML writeToFile:xmlFilename atomically:YES encoding:NSUTF8StringEncoding error:&error];
+        }
+        [reportPool drain];
+        [crashXML autorelease];
+        
+        processingTime = BITCurrentThreadCPUTime() - startTime;
+      }
       
-      if ([report.applicationInfo.applicationVersion compare:[[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"]] == NSOrderedSame) {
-        _crashIdenticalCurrentVersion = YES;
+      if (crashXML != nil) {
+        if (crashes == nil) {
+          crashes = [NSMutableString string];
+        }
+        [crashes appendString:crashXML];
+        [processedCrashFiles addObject:filename];
       }
-			
-      if (crashes == nil) {
-        crashes = [NSMutableString string];
+    }
+    
+    BITHockeyLog(@"Processed %i of %i crash reports in %.3fs CPU time.", [processedCrashFiles count], [crashFiles count], processingTime);
+    
+    dispatch_async(dispatch_get_main_queue(), ^{
+      _crashReportProcessingTime += processingTime;
+      _crashIdenticalCurrentVersion = crashIdenticalCurrentVersion;
+      if ([lastSessionCrashReportFile isEqualToString:_lastSessionCrashReportFile] && timeintervalCrashInLastSessionOccured >= 0) {
+        _timeintervalCrashInLastSessionOccured = timeintervalCrashInLastSessionOccured;
+        [_lastSessionCrashReportFile release];
+        _lastSessionCrashReportFile = nil;
       }
       
-      NSString *username = @"";
-      NSString *useremail = @"";
-      NSString *applicationLog = @"";
-      NSString *description = @"";
-      
-      NSString *errorString = nil;
-      NSPropertyListFormat format;
-      
-      NSData *plist = [NSData dataWithContentsOfFile:[filename stringByAppendingString:@".meta"]];
-      if (plist) {
-        NSDictionary *metaDict = (NSDictionary *)[NSPropertyListSerialization
-                                                  propertyListFromData:plist
-                                                  mutabilityOption:NSPropertyListMutableContainersAndLeaves
-                                                  format:&format
-                                                  errorDescription:&errorString];
-        
-        username = [metaDict objectForKey:kBITCrashMetaUserName] ?: @"";
-        useremail = [metaDict objectForKey:kBITCrashMetaUserEmail] ?: @"";
-        applicationLog = [metaDict objectForKey:kBITCrashMetaApplicationLog] ?: @"";
-      } else {
-        BITHockeyLog(@"ERROR: Reading crash meta data. %@", error);
+      // deferred reports are left alone (and on disk) until they are sent with a later launch
+      for (NSString *filename in crashFiles) {
+        if (![processedCrashFiles containsObject:filename]) {
+          [_deferredCrashFiles addObject:filename];
+        }
       }
-      
-      if ([applicationLog length] > 0) {
-        description = [NSString stringWithFormat:@"Log:\n%@", applicationLog];
+      [_crashFiles setArray:processedCrashFiles];
+      for (NSString *filename in processedCrashFiles) {
+        // store this crash report as user approved, so if it fails it will retry automatically
+        [_approvedCrashReports setObject:[NSNumber numberWithBool:YES] forKey:filename];
       }
       
-      [crashes appendFormat:@"<crash><applicationname>%s</applicationname><uuids>%@</uuids><bundleidentifier>%@</bundleidentifier><systemversion>%@</systemversion><platform>%@</platform><senderversion>%@</senderversion><version>%@</version><uuid>%@</uuid><log><![CDATA[%@]]></log><userid>%@</userid><contact>%@</contact><description><![CDATA[%@]]></description></crash>",
-       [[[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleExecutable"] UTF8String],
-       [self extractAppUUIDs:report],
-       report.applicationInfo.applicationIdentifier,
-       report.systemInfo.operatingSystemVersion,
-       [self getDevicePlatform],
-       [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"],
-       report.applicationInfo.applicationVersion,
-       crashUUID,
-       [crashLogString stringByReplacingOccurrencesOfString:@"]]>" withString:@"]]" @"]]><![CDATA[" @">" options:NSLiteralSearch range:NSMakeRange(0,crashLogString.length)],
-       username,
-       useremail,
-       [description stringByReplacingOccurrencesOfString:@"]]>" withString:@"]]" @"]]><![CDATA[" @">" options:NSLiteralSearch range:NSMakeRange(0,description.length)]];
-      
+      [self saveSettings];
       
-      // store this crash report as user approved, so if it fails it will retry automatically
-      [_approvedCrashReports setObject:[NSNumber numberWithBool:YES] forKey:filename];
-    } else {
-      // we cannot do anything with this report, so delete it
-      [_fileManager removeItemAtPath:filename error:&error];
-      [_fileManager removeItemAtPath:[NSString stringWithFormat:@"%@.meta", filename] error:&error];
-    }
-  }
-	
-  [self saveSettings];
+      if (crashes != nil) {
+        BITHockeyLog(@"Sending crash reports:\n%@", crashes);
+        [self postXML:[NSString stringWithFormat:@"<crashes>%@</crashes>", crashes]
+                toURL:[NSURL URLWithString:BITHOCKEYSDK_URL]];
+      } else {
+        _sendingInProgress = NO;
+      }
+    });
+    
+    [pool drain];
+  });
+}
+
+// called on the processing queue
+- (NSString *)crashXMLForCrashReport:(PLCrashReport *)report filename:(NSString *)filename {
+  NSString *crashUUID = report.reportInfo.reportGUID ?: @"";
+  NSString *crashLogString = [BITCrashReportTextFormatter stringValueForCrashReport:report];
   
-  if (crashes != nil) {
-    BITHockeyLog(@"Sending crash reports:\n%@", crashes);
-    [self postXML:[NSString stringWithFormat:@"<crashes>%@</crashes>", crashes]
-            toURL:[NSURL URLWithString:BITHOCKEYSDK_URL]];
+  NSString *username = @"";
+  NSString *useremail = @"";
+  NSString *applicationLog = @"";
+  NSString *description = @"";
+  
+  NSString *errorString = nil;
+  NSPropertyListFormat format;
+  
+  NSData *plist = [NSData dataWithContentsOfFile:[filename stringByAppendingString:@".meta"]];
+  if (plist) {
+    NSDictionary *metaDict = (NSDictionary *)[NSPropertyListSerialization
+                                              propertyListFromData:plist
+                                              mutabilityOption:NSPropertyListMutableContainersAndLeaves
+                                              format:&format
+                                              errorDescription:&errorString];
     
+    username = [metaDict objectForKey:kBITCrashMetaUserName] ?: @"";
+    useremail = [metaDict objectForKey:kBITCrashMetaUserEmail] ?: @"";
+    applicationLog = [metaDict objectForKey:kBITCrashMetaApplicationLog] ?: @"";
+  } else {
+    BITHockeyLog(@"ERROR: Reading crash meta data. %@", errorString);
+  }
+  
+  if ([applicationLog length] > 0) {
+    description = [NSString stringWithFormat:@"Log:\n%@", applicationLog];
   }
+  
+  return [NSString stringWithFormat:@"<crash><applicationname>%s</applicationname><uuids>%@</uuids><bundleidentifier>%@</bundleidentifier><systemversion>%@</systemversion><platform>%@</platform><senderversion>%@</senderversion><version>%@</version><uuid>%@</uuid><log><![CDATA[%@]]></log><userid>%@</userid><contact>%@</contact><description><![CDATA[%@]]></description></crash>",
+          [[[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleExecutable"] UTF8String],
+          [self extractAppUUIDs:report],
+          report.applicationInfo.applicationIdentifier,
+          report.systemInfo.operatingSystemVersion,
+          [self getDevicePlatform],
+          [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"],
+          report.applicationInfo.applicationVersion,
+          crashUUID,
+          [crashLogString stringByReplacingOccurrencesOfString:@"]]>" withString:@"]]" @"]]><![CDATA[" @">" options:NSLiteralSearch range:NSMakeRange(0,crashLogString.length)],
+          username,
+          useremail,
+          [description stringByReplacingOccurrencesOfString:@"]]>" withString:@"]]" @"]]><![CDATA[" @">" options:NSLiteralSearch range:NSMakeRange(0,description.length)]];
 }
 
 
@@ -75,6 +75,20 @@
 -(NSString *)userEmailForCrashManager:(BITCrashManager *)crashManager;
 
 
+///-----------------------------------------------------------------------------
+/// @name Startup
+///-----------------------------------------------------------------------------
+
+/** Invoked once the crash manager has finished its startup work on the main thread
+ 
+ Crash reports are processed in the background afterwards. Use this to check
+ `[BITCrashManager startupTime]`, e.g. to verify the crash manager isn't slowing down the app launch.
+ 
+ @param crashManager The `BITCrashManager` instance invoking this delegate
+ */
+-(void)crashManagerDidFinishStartup:(BITCrashManager *)crashManager;
+
+
 ///-----------------------------------------------------------------------------
 /// @name Alert
 ///-----------------------------------------------------------------------------
@@ -37,9 +37,11 @@
 
 @interface BITCrashReportTextFormatter (PrivateAPI)
 NSInteger binaryImageSort(id binary1, id binary2, void *context);
+PLCrashReportBinaryImageInfo *imageForAddressInSortedImages(uint64_t address, NSArray *sortedImages);
 + (NSString *)formatStackFrame:(PLCrashReportStackFrameInfo *)frameInfo 
                     frameIndex:(NSUInteger)frameIndex
-                        report:(PLCrashReport *)report;
+                        report:(PLCrashReport *)report
+                  sortedImages:(NSArray *)sortedImages;
 @end
 
 
@@ -61,6 +63,9 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context);
 	NSMutableString* text = [NSMutableString string];
 	boolean_t lp64 = true; // quiesce GCC uninitialized value warning
     
+    /* Sorted by base address, for the binary images list and looking up the image of each stack frame */
+    NSArray *sortedImages = [report.images sortedArrayUsingFunction: binaryImageSort context: nil];
+    
 	/* Header */
 	
     /* Map to apple style OS nane */
@@ -257,7 +262,7 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context);
         
         for (NSUInteger frame_idx = 0; frame_idx < [exception.stackFrames count]; frame_idx++) {
             PLCrashReportStackFrameInfo *frameInfo = [exception.stackFrames objectAtIndex: frame_idx];
-            NSString *formattedStackFrame = [self formatStackFrame: frameInfo frameIndex: frame_idx - numberBlankStackFrames report: report];
+            NSString *formattedStackFrame = [self formatStackFrame: frameInfo frameIndex: frame_idx - numberBlankStackFrames report: report sortedImages: sortedImages];
             if (formattedStackFrame) {
                 if (frame_idx - numberBlankStackFrames == 0) {
                     /* Create the pseudo-thread header. We use the named thread format to mark this thread */
@@ -282,7 +287,7 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context);
         
         for (NSUInteger frame_idx = 0; frame_idx < [thread.stackFrames count]; frame_idx++) {
             PLCrashReportStackFrameInfo *frameInfo = [thread.stackFrames objectAtIndex: frame_idx];
-            NSString *formattedStackFrame = [self formatStackFrame: frameInfo frameIndex: frame_idx report: report];
+            NSString *formattedStackFrame = [self formatStackFrame: frameInfo frameIndex: frame_idx report: report sortedImages: sortedImages];
             if (formattedStackFrame) {
                 if (frame_idx - numberBlankStackFrames == 0) {
                     /* Create the thread header. */
@@ -347,7 +352,7 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context);
     
     /* Images. The iPhone crash report format sorts these in ascending order, by the base address */
     [text appendString: @"Binary Images:\n"];
-    for (PLCrashReportBinaryImageInfo *imageInfo in [report.images sortedArrayUsingFunction: binaryImageSort context: nil]) {
+    for (PLCrashReportBinaryImageInfo *imageInfo in sortedImages) {
         NSString *uuid;
         /* Fetch the UUID if it exists */
         if (imageInfo.hasImageUUID)
@@ -517,12 +522,14 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context);
  * @param frameInfo The stack frame to format
  * @param frameIndex The frame's index
  * @param report The report from which this frame was acquired.
+ * @param sortedImages The report's images, sorted with binaryImageSort.
  *
  * @return Returns a formatted frame line.
  */
 + (NSString *)formatStackFrame: (PLCrashReportStackFrameInfo *) frameInfo 
                     frameIndex: (NSUInteger) frameIndex
                         report: (PLCrashReport *) report
+                  sortedImages: (NSArray *) sortedImages
 {
     /* Base image address containing instrumention pointer, offset of the IP from that base
      * address, and the associated image name */
@@ -531,7 +538,7 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context);
     NSString *imageName = @"\?\?\?";
     NSString *symbol = nil;
     
-    PLCrashReportBinaryImageInfo *imageInfo = [report imageForAddress: frameInfo.instructionPointer];
+    PLCrashReportBinaryImageInfo *imageInfo = imageForAddressInSortedImages(frameInfo.instructionPointer, sortedImages);
     if (imageInfo != nil) {
         imageName = [imageInfo.imageName lastPathComponent];
         baseAddress = imageInfo.imageBaseAddress;
@@ -602,4 +609,30 @@ NSInteger binaryImageSort(id binary1, id binary2, void *context) {
         return NSOrderedSame;
 }
 
+/**
+ * Returns the image containing address, or nil. A binary search, unlike -[PLCrashReport imageForAddress:]
+ * which walks all images for every stack frame.
+ */
+PLCrashReportBinaryImageInfo *imageForAddressInSortedImages(uint64_t address, NSArray *sortedImages) {
+    NSUInteger low = 0;
+    NSUInteger high = [sortedImages count];
+    
+    /* Find the last image starting at or before address */
+    while (low < high) {
+        NSUInteger mid = low + (high - low) / 2;
+        if ([[sortedImages objectAtIndex: mid] imageBaseAddress] <= address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == 0)
+        return nil;
+    
+    PLCrashReportBinaryImageInfo *imageInfo = [sortedImages objectAtIndex: low - 1];
+    if (address - imageInfo.imageBaseAddress < imageInfo.imageSize)
+        return imageInfo;
+    
+    return nil;
+}
+
 @end
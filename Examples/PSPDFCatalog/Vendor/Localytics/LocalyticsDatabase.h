@@ -11,13 +11,25 @@
 
 #define MAX_DATABASE_SIZE   500000  // The maximum allowed disk size of the primary database file at open, in bytes
 #define VACUUM_THRESHOLD    0.8     // The database is vacuumed after its size exceeds this proportion of the maximum.
+#define EVENT_BATCH_SIZE    50      // Events outside of transactions are buffered and written as one row, in one transaction.
+#define EVENT_BATCH_AGE     10.0    // A batch is also written when an event is added and the oldest is older than this (seconds).
 
 @interface LocalyticsDatabase : NSObject {
     sqlite3 *_databaseConnection;
+    sqlite3_stmt *_insertEventStatement;    // Prepared once, reused for every insert.
+    NSMutableArray *_pendingEvents;         // Blob strings not yet written.
+    NSTimeInterval _pendingEventsTimestamp; // When the first pending event was added.
+    int _transactionDepth;                  // Open savepoints.
+    dispatch_queue_t _flushQueue;           // Queue the database is used on, not retained.
+    dispatch_source_t _flushTimer;          // Writes pending events EVENT_BATCH_AGE after the first was added.
 }
 
 + (LocalyticsDatabase *)sharedLocalyticsDatabase;
 
+// The serial queue all database calls are made on. Pending events are flushed on it by a timer; without it they are
+// only written by the next add, transaction, read or explicit flushPendingEvents.
+- (void)setFlushQueue:(dispatch_queue_t)queue;
+
 - (NSUInteger)databaseSize;
 - (int)eventCount;
 - (NSTimeInterval)createdTimestamp;
@@ -29,7 +41,11 @@
 - (BOOL)incrementLastUploadNumber:(int *)uploadNumber;
 - (BOOL)incrementLastSessionNumber:(int *)sessionNumber;
 
+// Outside of a transaction, events are buffered; the batch is written on the next transaction, read, when full or
+// EVENT_BATCH_AGE after the first buffered event. YES then means the event was buffered, not that it's stored: it is
+// lost if the process dies before the flush, and a failed write is only reported by the call that flushes.
 - (BOOL)addEventWithBlobString:(NSString *)blob;
+- (BOOL)flushPendingEvents;
 - (BOOL)addCloseEventWithBlobString:(NSString *)blob;
 - (BOOL)addFlowEventWithBlobString:(NSString *)blob;
 - (BOOL)removeLastCloseAndFlowEvents;
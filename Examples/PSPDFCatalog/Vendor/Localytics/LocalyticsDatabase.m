@@ -7,6 +7,7 @@
 //
 
 #import "LocalyticsDatabase.h"
+#import <zlib.h>
 
 #define LOCALYTICS_DIR              @".localytics"	// Name for the directory in which Localytics database is stored
 #define LOCALYTICS_DB               @"localytics"	// File name for the database (without extension)
@@ -19,6 +20,8 @@
     - (void)upgradeToSchemaV3;
     - (void)moveDbToCaches;
     - (NSString *)randomUUID;
+    - (BOOL)insertEventWithBlob:(const void *)bytes length:(int)length compressed:(BOOL)compressed;
+    - (void)scheduleFlush;
 @end
 
 @implementation LocalyticsDatabase
@@ -49,6 +52,8 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 - (LocalyticsDatabase *)init {
 	if((self = [super init])) {
         
+        _pendingEvents = [[NSMutableArray alloc] initWithCapacity:EVENT_BATCH_SIZE];
+
         // Mover any data that a previous library may have left in the documents directory
         [self moveDbToCaches];
         
@@ -91,20 +96,37 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 #pragma mark - Database 
 
 - (BOOL)beginTransaction:(NSString *)name {
+    // Buffered events were added before the transaction, they must not be rolled back with it.
+    [self flushPendingEvents];
+
     const char *sql = [[NSString stringWithFormat:@"SAVEPOINT %@", name] cStringUsingEncoding:NSUTF8StringEncoding];
     int code = sqlite3_exec(_databaseConnection, sql, NULL, NULL, NULL);
+    if (code == SQLITE_OK) {
+        _transactionDepth++;
+    }
     return code == SQLITE_OK;
 }
 
 - (BOOL)releaseTransaction:(NSString *)name {
     const char *sql = [[NSString stringWithFormat:@"RELEASE SAVEPOINT %@", name] cStringUsingEncoding:NSUTF8StringEncoding];
     int code = sqlite3_exec(_databaseConnection, sql, NULL, NULL, NULL);
+    if (code == SQLITE_OK) {
+        _transactionDepth--;
+    }
     return code == SQLITE_OK;
 }
 
 - (BOOL)rollbackTransaction:(NSString *)name {
-    const char *sql = [[NSString stringWithFormat:@"ROLLBACK SAVEPOINT %@", name] cStringUsingEncoding:NSUTF8StringEncoding];
+    // ROLLBACK TO leaves the savepoint open, it has to be released as well.
+    const char *sql = [[NSString stringWithFormat:@"ROLLBACK TO SAVEPOINT %@", name] cStringUsingEncoding:NSUTF8StringEncoding];
     int code = sqlite3_exec(_databaseConnection, sql, NULL, NULL, NULL);
+    if (code == SQLITE_OK) {
+        sql = [[NSString stringWithFormat:@"RELEASE SAVEPOINT %@", name] cStringUsingEncoding:NSUTF8StringEncoding];
+        code = sqlite3_exec(_databaseConnection, sql, NULL, NULL, NULL);
+    }
+    if (code == SQLITE_OK) {
+        _transactionDepth--;
+    }
     return code == SQLITE_OK;
 }
 
@@ -301,6 +323,8 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 }
 
 - (int) eventCount {
+    [self flushPendingEvents];
+
     int count = 0;
     const char *sql = "SELECT count(*) FROM events";
     sqlite3_stmt *selectEventCount;
@@ -478,13 +502,114 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 }
 
 - (BOOL)addEventWithBlobString:(NSString *)blob {
+    if (blob == nil) {
+        return NO;
+    }
 
-    int code = SQLITE_OK;
-    sqlite3_stmt *insertEvent;
-    sqlite3_prepare_v2(_databaseConnection, "INSERT INTO events (blob_string) VALUES (?)", -1, &insertEvent, NULL);
-    sqlite3_bind_text(insertEvent, 1, [blob UTF8String], -1, SQLITE_TRANSIENT); 
-    code = sqlite3_step(insertEvent);
-    sqlite3_finalize(insertEvent);
+    // Inside a transaction the event is written right away, so it's committed or rolled back with the transaction
+    // and callers can use sqlite3_last_insert_rowid.
+    if (_transactionDepth > 0) {
+        const char *bytes = [blob UTF8String];
+        return [self insertEventWithBlob:bytes length:(int)strlen(bytes) compressed:NO];
+    }
+
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    if ([_pendingEvents count] == 0) {
+        _pendingEventsTimestamp = now;
+        [self scheduleFlush];
+    }
+    [_pendingEvents addObject:blob];
+
+    if ([_pendingEvents count] >= EVENT_BATCH_SIZE || now - _pendingEventsTimestamp >= EVENT_BATCH_AGE) {
+        return [self flushPendingEvents];
+    }
+    return YES;
+}
+
+- (void)setFlushQueue:(dispatch_queue_t)queue {
+    _flushQueue = queue;
+}
+
+// Arms the one-shot flush timer, so a batch that never fills up is still written after EVENT_BATCH_AGE.
+- (void)scheduleFlush {
+    if (_flushQueue == NULL) {
+        return;
+    }
+    if (_flushTimer == NULL) {
+        _flushTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _flushQueue);
+        dispatch_source_set_event_handler(_flushTimer, ^{
+            // beginTransaction already flushed, and events added inside a transaction aren't buffered.
+            if (_transactionDepth == 0) {
+                [self flushPendingEvents];
+            }
+        });
+        dispatch_resume(_flushTimer);
+    }
+    dispatch_source_set_timer(_flushTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(EVENT_BATCH_AGE * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, NSEC_PER_SEC);
+}
+
+// Writes all buffered events as one row in one transaction. The row holds the concatenated blob strings (which is
+// exactly what uploadBlobString sends for them), deflated: a 4 byte big endian length of the text, then a zlib stream.
+- (BOOL)flushPendingEvents {
+    if ([_pendingEvents count] == 0) {
+        return YES;
+    }
+
+    NSMutableData *text = [NSMutableData dataWithCapacity:[_pendingEvents count] * 256];
+    for (NSString *blob in _pendingEvents) {
+        const char *bytes = [blob UTF8String];
+        [text appendBytes:bytes length:strlen(bytes)];
+    }
+    // The events are dropped even if they can't be written, memory must not grow with a broken database.
+    [_pendingEvents removeAllObjects];
+
+    uLong textLength = [text length];
+    uLongf compressedLength = compressBound(textLength);
+    NSMutableData *row = [NSMutableData dataWithLength:4 + compressedLength];
+    uint8_t *rowBytes = [row mutableBytes];
+    rowBytes[0] = (textLength >> 24) & 0xFF;
+    rowBytes[1] = (textLength >> 16) & 0xFF;
+    rowBytes[2] = (textLength >> 8) & 0xFF;
+    rowBytes[3] = textLength & 0xFF;
+    BOOL compressed = compress2(rowBytes + 4, &compressedLength, [text bytes], textLength, Z_BEST_SPEED) == Z_OK;
+
+    // A savepoint works both as outermost transaction and nested in one.
+    if (sqlite3_exec(_databaseConnection, "SAVEPOINT flush_events", NULL, NULL, NULL) != SQLITE_OK) {
+        return NO;
+    }
+
+    BOOL success;
+    if (compressed) {
+        success = [self insertEventWithBlob:rowBytes length:(int)(4 + compressedLength) compressed:YES];
+    } else {
+        success = [self insertEventWithBlob:[text bytes] length:(int)textLength compressed:NO];
+    }
+
+    if (!success) {
+        sqlite3_exec(_databaseConnection, "ROLLBACK TO SAVEPOINT flush_events", NULL, NULL, NULL);
+    }
+    sqlite3_exec(_databaseConnection, "RELEASE SAVEPOINT flush_events", NULL, NULL, NULL);
+
+    return success;
+}
+
+- (BOOL)insertEventWithBlob:(const void *)bytes length:(int)length compressed:(BOOL)compressed {
+    if (_insertEventStatement == NULL &&
+        sqlite3_prepare_v2(_databaseConnection, "INSERT INTO events (blob_string) VALUES (?)", -1, &_insertEventStatement, NULL) != SQLITE_OK) {
+        sqlite3_finalize(_insertEventStatement);
+        _insertEventStatement = NULL;
+        return NO;
+    }
+
+    // Plain events stay TEXT, batches are BLOBs; uploadBlobString tells them apart by the column type.
+    if (compressed) {
+        sqlite3_bind_blob(_insertEventStatement, 1, bytes, length, SQLITE_TRANSIENT);
+    } else {
+        sqlite3_bind_text(_insertEventStatement, 1, bytes, length, SQLITE_TRANSIENT);
+    }
+    int code = sqlite3_step(_insertEventStatement);
+    sqlite3_reset(_insertEventStatement);
+    sqlite3_clear_bindings(_insertEventStatement);
 
     return code == SQLITE_DONE;
 }
@@ -569,6 +694,8 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 }
 
 - (int)unstagedEventCount {
+    [self flushPendingEvents];
+
     int rowCount = 0;
     sqlite3_stmt *selectEventCount;
     sqlite3_prepare_v2(_databaseConnection, "SELECT COUNT(*) FROM events WHERE UPLOAD_HEADER IS NULL", -1, &selectEventCount, NULL);
@@ -582,7 +709,8 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 }
 
 - (BOOL)stageEventsForUpload:(sqlite3_int64)headerId {
-    
+    [self flushPendingEvents];
+
     // Associate all outstanding events with the given upload header ID.
     NSString *stageEvents = [NSString stringWithFormat:@"UPDATE events SET upload_header = ? WHERE upload_header IS NULL"];
     sqlite3_stmt *updateEvents;
@@ -607,6 +735,7 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 }
 
 - (NSString *)uploadBlobString {
+    [self flushPendingEvents];
 
     // Retrieve the blob strings of each upload header and its child events, in order.
     const char *sql = "SELECT * FROM ( "
@@ -619,6 +748,25 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
     sqlite3_prepare_v2(_databaseConnection, sql, -1, &selectBlobs, NULL);
     NSMutableString *uploadBlobString = [NSMutableString string];
     while (sqlite3_step(selectBlobs) == SQLITE_ROW) {
+        // Batched events (see flushPendingEvents).
+        if (sqlite3_column_type(selectBlobs, 0) == SQLITE_BLOB) {
+            const uint8_t *bytes = sqlite3_column_blob(selectBlobs, 0);
+            int length = sqlite3_column_bytes(selectBlobs, 0);
+            if (bytes != NULL && length > 4) {
+                uLongf textLength = ((uLong)bytes[0] << 24) | ((uLong)bytes[1] << 16) | ((uLong)bytes[2] << 8) | bytes[3];
+                NSMutableData *text = [NSMutableData dataWithLength:textLength];
+                if (uncompress([text mutableBytes], &textLength, bytes + 4, length - 4) == Z_OK) {
+                    [text setLength:textLength];
+                    NSString *blobString = [[NSString alloc] initWithData:text encoding:NSUTF8StringEncoding];
+                    if (blobString != nil) {
+                        [uploadBlobString appendString:blobString];
+                    }
+                    [blobString release];
+                }
+            }
+            continue;
+        }
+
         const char *blob = (const char *)sqlite3_column_text(selectBlobs, 0);
         if (blob != NULL) {
             NSString *blobString = [[NSString alloc] initWithCString:blob encoding:NSUTF8StringEncoding];
@@ -736,6 +884,12 @@ static LocalyticsDatabase *_sharedLocalyticsDatabase = nil;
 }
 
 - (void)dealloc {
+    if (_flushTimer) {
+        dispatch_source_cancel(_flushTimer);
+        dispatch_release(_flushTimer);
+    }
+    [_pendingEvents release];
+    sqlite3_finalize(_insertEventStatement);
     sqlite3_close(_databaseConnection);
 	[super dealloc];
 }
@@ -114,8 +114,9 @@ static LocalyticsSession *_sharedLocalyticsSession = nil;
         _criticalGroup = dispatch_group_create();
         
         [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationWillTerminate:) name:UIApplicationWillTerminateNotification object:nil];
         
-        [LocalyticsDatabase sharedLocalyticsDatabase];
+        [[LocalyticsDatabase sharedLocalyticsDatabase] setFlushQueue:_queue];
     }
     
     return self;
@@ -835,6 +836,11 @@ static LocalyticsSession *_sharedLocalyticsSession = nil;
         });
     }];
 
+    // Write buffered events, the app may be terminated without the session being closed.
+    dispatch_group_async(_criticalGroup, _queue, ^{
+        [[LocalyticsDatabase sharedLocalyticsDatabase] flushPendingEvents];
+    });
+
     // Critical tasks have finished. Expire the background task.
     dispatch_group_notify(_criticalGroup, dispatch_get_main_queue(), ^{
         [self logMessage:@"Finished executing critical tasks."];
@@ -845,6 +851,14 @@ static LocalyticsSession *_sharedLocalyticsSession = nil;
     });
 }
 
+- (void)applicationWillTerminate:(NSNotification *)notification
+{
+    // Write buffered events before the process exits; this has to block.
+    dispatch_sync(_queue, ^{
+        [[LocalyticsDatabase sharedLocalyticsDatabase] flushPendingEvents];
+    });
+}
+
 /*!
  @method logMessage
  @abstract Logs a message with (localytics) prepended to it.
@@ -1131,6 +1145,7 @@ static LocalyticsSession *_sharedLocalyticsSession = nil;
 
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidEnterBackgroundNotification object:nil];
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationWillTerminateNotification object:nil];
 
     dispatch_release(_criticalGroup);
     dispatch_release(_queue);
@@ -15,7 +15,9 @@
     BOOL _diskCacheInfoDirty;
     BOOL _ignoreMemoryOnlyStoragePolicy;
     BOOL _timerPaused;
+    BOOL _flushScheduled;
     NSUInteger _diskCacheUsage;
+    NSUInteger _pendingWriteBytes;
     NSTimeInterval _minCacheInterval;
     dispatch_source_t _maintenanceTimer;
 }
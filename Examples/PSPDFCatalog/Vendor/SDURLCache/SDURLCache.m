@@ -22,7 +22,7 @@
 // THE SOFTWARE.
 
 #import "SDURLCache.h"
-#import <CommonCrypto/CommonDigest.h>
+#import "SDURLCacheIndex.h"
 
 #define kAFURLCachePath @"SDNetworkingURLCache"
 #define kAFURLCacheMaintenanceTime 5ull
@@ -32,11 +32,13 @@
 #endif
 
 static NSTimeInterval const kAFURLCacheInfoDefaultMinCacheInterval = 5.0 * 60.0; // 5 minute
-static NSString *const kAFURLCacheInfoFileName = @"cacheInfo.plist";
-static NSString *const kAFURLCacheInfoAccessesKey = @"accesses";
-static NSString *const kAFURLCacheInfoSizesKey = @"sizes";
+static NSString *const kAFURLCacheLegacyInfoFileName = @"cacheInfo.plist"; // cache info of format version 2
+static NSString *const kAFURLCacheIndexFileName = @"cacheIndex.bin";
 static float const kAFURLCacheLastModFraction = 0.1f; // 10% since Last-Modified suggested by RFC2616 section 13.2.4
 static float const kAFURLCacheDefault = 3600.0f; // Default cache expiration delay if none defined (1 hour)
+static NSTimeInterval const kAFURLCacheWriteDelay = 1.0; // Stored responses are written to disk in batches at most this late...
+static NSUInteger const kAFURLCacheWriteBatchBytes = 512 * 1024; // ...or as soon as this many bytes are pending.
+static float const kAFURLCacheEvictionTarget = 0.9f; // Evict down to 90% of the disk capacity, so not every store evicts again
 
 /**
  Below is ragel source used to compile those tables. The output was polished / pretty-printed and tweaked from ragel.
@@ -310,7 +312,9 @@ inline void dispatch_async_afreentrant(dispatch_queue_t queue, dispatch_block_t
 
 @interface SDURLCache ()
 @property (nonatomic, retain) NSString *diskCachePath;
-@property (nonatomic, retain) NSMutableDictionary *diskCacheInfo;
+@property (nonatomic, retain) SDURLCacheIndex *diskCacheIndex;
+@property (nonatomic, retain) NSMutableDictionary *pendingWrites;          // hash -> NSCachedURLResponse, not yet in the index
+@property (nonatomic, retain) NSMutableDictionary *pendingExpirationDates; // hash -> NSDate
 - (void)periodicMaintenance;
 @end
 
@@ -329,13 +333,9 @@ inline void dispatch_async_afreentrant(dispatch_queue_t queue, dispatch_block_t
     return copy;
 }
 
-+ (NSString *)cacheKeyForURL:(NSURL *)url {
-    const char *str = [url.absoluteString UTF8String];
-    unsigned char r[CC_MD5_DIGEST_LENGTH];
-    CC_MD5(str, strlen(str), r);
-    static NSString *cacheFormatVersion = @"2";
-    return [NSString stringWithFormat:@"%@_%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
-            cacheFormatVersion, r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9], r[10], r[11], r[12], r[13], r[14], r[15]];
++ (NSString *)cacheFileNameForHash:(uint64_t)hash {
+    static NSString *cacheFormatVersion = @"3";
+    return [NSString stringWithFormat:@"%@_%016llx", cacheFormatVersion, hash];
 }
 
 #pragma mark SDURLCache (private)
@@ -482,76 +482,77 @@ static dispatch_queue_t get_disk_io_queue() {
     return [[NSDate alloc] initWithTimeInterval:kAFURLCacheDefault sinceDate:now];
 }
 
-- (NSMutableDictionary *)diskCacheInfo {
-    if (!_diskCacheInfo) {
+- (SDURLCacheIndex *)diskCacheIndex {
+    if (!_diskCacheIndex) {
         dispatch_sync_afreentrant(get_disk_cache_queue(), ^{
-            if (!_diskCacheInfo) { // Check again, maybe another thread created it while waiting for the mutex
-                _diskCacheInfo = [[NSMutableDictionary alloc] initWithContentsOfFile:[_diskCachePath stringByAppendingPathComponent:kAFURLCacheInfoFileName]];
-                if (!_diskCacheInfo) {
-                    _diskCacheInfo = [[NSMutableDictionary alloc] initWithObjectsAndKeys:
-                                      [NSMutableDictionary dictionary], kAFURLCacheInfoAccessesKey,
-                                      [NSMutableDictionary dictionary], kAFURLCacheInfoSizesKey,
-                                      nil];
+            if (!_diskCacheIndex) { // Check again, maybe another thread created it while waiting for the mutex
+                NSFileManager *fileManager = [[NSFileManager alloc] init];
+                if ([fileManager fileExistsAtPath:[_diskCachePath stringByAppendingPathComponent:kAFURLCacheLegacyInfoFileName]]) {
+                    // Files of the plist based format aren't in the index, start over
+                    [fileManager removeItemAtPath:_diskCachePath error:NULL];
+                }
+                [self createDiskCachePath];
+
+                _diskCacheIndex = [[SDURLCacheIndex alloc] initWithPath:[_diskCachePath stringByAppendingPathComponent:kAFURLCacheIndexFileName]];
+                if (!_diskCacheIndex) {
+                    NSLog(@"Could not open the cache index at %@, disk cache disabled.", _diskCachePath);
                 }
                 _diskCacheInfoDirty = NO;
-                NSArray *sizes = [[_diskCacheInfo objectForKey:kAFURLCacheInfoSizesKey] allValues];
-                _diskCacheUsage = [[sizes valueForKeyPath:@"@sum.self"] unsignedIntegerValue];
-                
+                _diskCacheUsage = (NSUInteger)_diskCacheIndex.totalSize;
+
                 // create maintenance timer
                 [self maintenanceTimer];
             }
         });
     }
-    
-    return _diskCacheInfo;
+
+    return _diskCacheIndex;
 }
 
 - (void)createDiskCachePath {
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        NSFileManager *fileManager = [[NSFileManager alloc] init];
-        if (![fileManager fileExistsAtPath:_diskCachePath]) {
-            [fileManager createDirectoryAtPath:_diskCachePath
-                   withIntermediateDirectories:YES
-                                    attributes:nil
-                                         error:NULL];
-        }
-    });
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+    if (![fileManager fileExistsAtPath:_diskCachePath]) {
+        [fileManager createDirectoryAtPath:_diskCachePath
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:NULL];
+    }
 }
 
 - (void)saveCacheInfo {
-    [self createDiskCachePath];
     dispatch_async_afreentrant(get_disk_cache_queue(), ^{
-        // Previous versions of SDURLCache stored a diskUsage key that could go wrong, just get rid of it.
-        [self.diskCacheInfo removeObjectForKey:@"diskUsage"];
-        NSData *data = [NSPropertyListSerialization dataFromPropertyList:self.diskCacheInfo format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
-        if (data) {
-            [data writeToFile:[_diskCachePath stringByAppendingPathComponent:kAFURLCacheInfoFileName] atomically:YES];
-        }
-        
+        // The index lives in a mapped file, this only asks the kernel to write the changed pages back.
+        [self.diskCacheIndex synchronize];
         _diskCacheInfoDirty = NO;
     });
 }
 
-- (void)removeCachedResponseForCachedKeys:(NSArray *)cacheKeys {
+- (void)removeCachedResponsesForHashes:(NSArray *)hashes {
     dispatch_async_afreentrant(get_disk_cache_queue(), ^{
-        @autoreleasepool {
-            NSEnumerator *enumerator = [cacheKeys objectEnumerator];
-            NSString *cacheKey;
-            
-            NSMutableDictionary *accesses = [self.diskCacheInfo objectForKey:kAFURLCacheInfoAccessesKey];
-            NSMutableDictionary *sizes = [self.diskCacheInfo objectForKey:kAFURLCacheInfoSizesKey];
-            NSFileManager *fileManager = [[NSFileManager alloc] init];
-            
-            while ((cacheKey = [enumerator nextObject])) {
-                NSUInteger cacheItemSize = [[sizes objectForKey:cacheKey] unsignedIntegerValue];
-                [accesses removeObjectForKey:cacheKey];
-                [sizes removeObjectForKey:cacheKey];
-                [fileManager removeItemAtPath:[_diskCachePath stringByAppendingPathComponent:cacheKey] error:NULL];
-                
-                _diskCacheUsage -= cacheItemSize;
+        SDURLCacheIndex *index = self.diskCacheIndex;
+        NSMutableArray *fileNames = [NSMutableArray arrayWithCapacity:hashes.count];
+        for (NSNumber *hashNumber in hashes) {
+            [_pendingWrites removeObjectForKey:hashNumber];
+            [_pendingExpirationDates removeObjectForKey:hashNumber];
+            if ([index containsHash:[hashNumber unsignedLongLongValue]]) {
+                [index removeHash:[hashNumber unsignedLongLongValue]];
+                [fileNames addObject:[SDURLCache cacheFileNameForHash:[hashNumber unsignedLongLongValue]]];
             }
         }
+        _diskCacheUsage = (NSUInteger)index.totalSize;
+        _diskCacheInfoDirty = YES;
+
+        if (fileNames.count) {
+            NSString *diskCachePath = _diskCachePath;
+            dispatch_async(get_disk_io_queue(), ^{
+                @autoreleasepool {
+                    NSFileManager *fileManager = [[NSFileManager alloc] init];
+                    for (NSString *fileName in fileNames) {
+                        [fileManager removeItemAtPath:[diskCachePath stringByAppendingPathComponent:fileName] error:NULL];
+                    }
+                }
+            });
+        }
     });
 }
 
@@ -559,56 +560,97 @@ static dispatch_queue_t get_disk_io_queue() {
     if (_diskCacheUsage < self.diskCapacity) {
         return; // Already done
     }
-    
+
     dispatch_async_afreentrant(get_disk_cache_queue(), ^{
-        NSMutableArray *keysToRemove = [NSMutableArray array];
-        
-        // Apply LRU cache eviction algorithm while disk usage outreach capacity
-        NSDictionary *sizes = [self.diskCacheInfo objectForKey:kAFURLCacheInfoSizesKey];
-        
-        NSInteger capacityToSave = _diskCacheUsage - self.diskCapacity;
-        NSArray *sortedKeys = [[self.diskCacheInfo objectForKey:kAFURLCacheInfoAccessesKey] keysSortedByValueUsingSelector:@selector(compare:)];
-        NSEnumerator *enumerator = [sortedKeys objectEnumerator];
-        NSString *cacheKey;
-        
-        while (capacityToSave > 0 && (cacheKey = [enumerator nextObject])) {
-            [keysToRemove addObject:cacheKey];
-            capacityToSave -= [(NSNumber *)[sizes objectForKey:cacheKey] unsignedIntegerValue];
+        // Apply LRU cache eviction algorithm while disk usage outreach capacity.
+        // The index knows sizes and access times, so this doesn't need to look at the files.
+        uint64_t totalSize = self.diskCacheIndex.totalSize;
+        uint64_t targetSize = (uint64_t)(self.diskCapacity * kAFURLCacheEvictionTarget);
+        if (totalSize <= targetSize) {
+            return;
         }
-        
-        [self removeCachedResponseForCachedKeys:keysToRemove];
+
+        [self removeCachedResponsesForHashes:[self.diskCacheIndex leastRecentlyUsedHashesForBytes:totalSize - targetSize]];
         [self saveCacheInfo];
     });
 }
 
+- (void)enqueueWriteOfResponse:(NSCachedURLResponse *)cachedResponse forHash:(uint64_t)hash expirationDate:(NSDate *)expirationDate {
+    dispatch_async(get_disk_cache_queue(), ^{
+        NSNumber *hashNumber = [NSNumber numberWithUnsignedLongLong:hash];
+        [_pendingWrites setObject:cachedResponse forKey:hashNumber];
+        if (expirationDate) {
+            [_pendingExpirationDates setObject:expirationDate forKey:hashNumber];
+        }else {
+            [_pendingExpirationDates removeObjectForKey:hashNumber];
+        }
+        _pendingWriteBytes += cachedResponse.data.length;
 
-- (void)storeRequestToDisk:(NSURLRequest *)request response:(NSCachedURLResponse *)cachedResponse {
-    NSString *cacheKey = [SDURLCache cacheKeyForURL:request.URL];
-    NSString *cacheFilePath = [_diskCachePath stringByAppendingPathComponent:cacheKey];
-    
-    [self createDiskCachePath];
-    
-    // Archive the cached response on disk
-    if (![NSKeyedArchiver archiveRootObject:cachedResponse toFile:cacheFilePath]) {
-        // Caching failed for some reason
+        // Batch writes: a burst of responses (e.g. a web view loading a page) causes one flush and one index update.
+        if (_pendingWriteBytes >= kAFURLCacheWriteBatchBytes) {
+            _pendingWriteBytes = 0;
+            dispatch_async(get_disk_io_queue(), ^{
+                [self flushPendingWrites];
+            });
+        }else if (!_flushScheduled) {
+            _flushScheduled = YES;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kAFURLCacheWriteDelay * NSEC_PER_SEC)), get_disk_io_queue(), ^{
+                [self flushPendingWrites];
+            });
+        }
+    });
+}
+
+// Needs to be called on the disk io queue.
+- (void)flushPendingWrites {
+    __block NSDictionary *writes = nil;
+    __block NSDictionary *expirationDates = nil;
+    dispatch_sync(get_disk_cache_queue(), ^{
+        // Responses stay pending until they are in the index, so cachedResponseForRequest: finds them meanwhile.
+        [self diskCacheIndex]; // (re)creates the cache directory if needed
+        writes = [_pendingWrites copy];
+        expirationDates = [_pendingExpirationDates copy];
+        _pendingWriteBytes = 0;
+        _flushScheduled = NO;
+    });
+    if (!writes.count) {
         return;
     }
-    
-    // Update disk usage info
-    NSFileManager *fileManager = [[NSFileManager alloc] init];
-    NSNumber *cacheItemSize = [[fileManager attributesOfItemAtPath:cacheFilePath error:NULL] objectForKey:NSFileSize];
-    
-    dispatch_async_afreentrant(get_disk_cache_queue(), ^{
-        NSNumber *previousCacheItemSize = [[self.diskCacheInfo objectForKey:kAFURLCacheInfoSizesKey] objectForKey:cacheKey];
-        _diskCacheUsage -= [previousCacheItemSize unsignedIntegerValue];
-        _diskCacheUsage += [cacheItemSize unsignedIntegerValue];
-        
-        // Update cache info for the stored item
-        [(NSMutableDictionary *)[self.diskCacheInfo objectForKey:kAFURLCacheInfoAccessesKey] setObject:[NSDate date] forKey:cacheKey];
-        [(NSMutableDictionary *)[self.diskCacheInfo objectForKey:kAFURLCacheInfoSizesKey] setObject:cacheItemSize forKey:cacheKey];
-        
-        [self saveCacheInfo];
-        
+
+    NSMutableDictionary *sizes = [NSMutableDictionary dictionaryWithCapacity:writes.count];
+    [writes enumerateKeysAndObjectsUsingBlock:^(NSNumber *hashNumber, NSCachedURLResponse *cachedResponse, BOOL *stop) {
+        @autoreleasepool {
+            // Archive the cached response on disk; the archive length is the size, no need to stat the file.
+            NSData *data = [NSKeyedArchiver archivedDataWithRootObject:cachedResponse];
+            NSString *cacheFilePath = [_diskCachePath stringByAppendingPathComponent:[SDURLCache cacheFileNameForHash:[hashNumber unsignedLongLongValue]]];
+            if ([data writeToFile:cacheFilePath atomically:NO]) {
+                [sizes setObject:[NSNumber numberWithUnsignedInteger:data.length] forKey:hashNumber];
+            }
+        }
+    }];
+
+    dispatch_sync(get_disk_cache_queue(), ^{
+        SDURLCacheIndex *index = self.diskCacheIndex;
+        NSFileManager *fileManager = nil;
+        for (NSNumber *hashNumber in writes) {
+            NSCachedURLResponse *pendingResponse = [_pendingWrites objectForKey:hashNumber];
+            NSNumber *size = [sizes objectForKey:hashNumber];
+            if (pendingResponse == [writes objectForKey:hashNumber]) {
+                if (size) {
+                    [index setSize:(uint32_t)[size unsignedIntegerValue] expirationDate:[expirationDates objectForKey:hashNumber] forHash:[hashNumber unsignedLongLongValue]];
+                }
+                [_pendingWrites removeObjectForKey:hashNumber];
+                [_pendingExpirationDates removeObjectForKey:hashNumber];
+            }else if (!pendingResponse && size && ![index containsHash:[hashNumber unsignedLongLongValue]]) {
+                // Removed while it was written, don't leave an orphaned file around.
+                // (A replaced response is written again by the next flush.)
+                if (!fileManager) fileManager = [[NSFileManager alloc] init];
+                [fileManager removeItemAtPath:[_diskCachePath stringByAppendingPathComponent:[SDURLCache cacheFileNameForHash:[hashNumber unsignedLongLongValue]]] error:NULL];
+            }
+        }
+        _diskCacheUsage = (NSUInteger)index.totalSize;
+        _diskCacheInfoDirty = YES;
+
         // start timer for cleanup (rely on fact that dispatch_suspend syncs with disk cache queue)
         if (_timerPaused) {
             _timerPaused = NO;
@@ -644,6 +686,8 @@ static dispatch_queue_t get_disk_io_queue() {
     if ((self = [super initWithMemoryCapacity:memoryCapacity diskCapacity:diskCapacity diskPath:path])) {
         self.minCacheInterval = kAFURLCacheInfoDefaultMinCacheInterval;
         self.diskCachePath = path;
+        self.pendingWrites = [NSMutableDictionary dictionary];
+        self.pendingExpirationDates = [NSMutableDictionary dictionary];
         self.ignoreMemoryOnlyStoragePolicy = NO;
 	}
     
@@ -670,19 +714,17 @@ static dispatch_queue_t get_disk_io_queue() {
         && [cachedResponse.response isKindOfClass:[NSHTTPURLResponse self]]
         && cachedResponse.data.length < self.diskCapacity) {
         NSDictionary *headers = [(NSHTTPURLResponse *)cachedResponse.response allHeaderFields];
+        NSDate *expirationDate = [SDURLCache expirationDateFromHeaders:headers
+                                                        withStatusCode:((NSHTTPURLResponse *)cachedResponse.response).statusCode];
         // RFC 2616 section 13.3.4 says clients MUST use Etag in any cache-conditional request if provided by server
         if (![headers objectForKey:@"Etag"]) {
-            NSDate *expirationDate = [SDURLCache expirationDateFromHeaders:headers
-                                                            withStatusCode:((NSHTTPURLResponse *)cachedResponse.response).statusCode];
             if (!expirationDate || [expirationDate timeIntervalSinceNow] - _minCacheInterval <= 0) {
                 // This response is not cacheable, headers said
                 return;
             }
         }
         
-        dispatch_async(get_disk_io_queue(), ^{
-            [self storeRequestToDisk:request response:cachedResponse];
-        });
+        [self enqueueWriteOfResponse:cachedResponse forHash:[SDURLCacheIndex hashForURL:request.URL] expirationDate:expirationDate];
     }
 }
 
@@ -694,27 +736,31 @@ static dispatch_queue_t get_disk_io_queue() {
         return memoryResponse;
     }
     
-    NSString *cacheKey = [SDURLCache cacheKeyForURL:request.URL];
+    uint64_t hash = [SDURLCacheIndex hashForURL:request.URL];
     
     // NOTE: We don't handle expiration here as even staled cache data is necessary for NSURLConnection to handle cache revalidation.
     //       Staled cache data is also needed for cachePolicies which force the use of the cache.
     __block NSCachedURLResponse *response = nil;
     dispatch_sync(get_disk_cache_queue(), ^{
-        NSMutableDictionary *accesses = [self.diskCacheInfo objectForKey:kAFURLCacheInfoAccessesKey];
-        if ([accesses objectForKey:cacheKey]) { // OPTI: Check for cache-hit in a in-memory dictionnary before to hit the FS
+        response = [_pendingWrites objectForKey:[NSNumber numberWithUnsignedLongLong:hash]];
+        if (!response && [self.diskCacheIndex containsHash:hash]) { // OPTI: Check for cache-hit in the mapped index before to hit the FS
+            NSString *cacheFilePath = [_diskCachePath stringByAppendingPathComponent:[SDURLCache cacheFileNameForHash:hash]];
             @try {
-                response = [NSKeyedUnarchiver unarchiveObjectWithFile:[_diskCachePath stringByAppendingPathComponent:cacheKey]];
+                response = [NSKeyedUnarchiver unarchiveObjectWithFile:cacheFilePath];
                 if (response) {
-                    // OPTI: Log the entry last access time for LRU cache eviction algorithm but don't save the dictionary
-                    //       on disk now in order to save IO and time
-                    [accesses setObject:[NSDate date] forKey:cacheKey];
+                    // OPTI: Log the entry last access time for LRU cache eviction algorithm, the mapped index
+                    //       is written back by the kernel (or on the next maintenance)
+                    [self.diskCacheIndex touchHash:hash];
                     _diskCacheInfoDirty = YES;
+                }else {
+                    // The file is gone, drop the stale entry
+                    [self removeCachedResponsesForHashes:[NSArray arrayWithObject:[NSNumber numberWithUnsignedLongLong:hash]]];
                 }
             }
             @catch (NSException *exception) {
                 if ([exception.name isEqualToString:NSInvalidArgumentException]) {
-                    NSLog(@"Could not unarchive object at %@, Invalid archive!", [_diskCachePath stringByAppendingPathComponent:cacheKey]);
-                    [self removeCachedResponseForRequest:request];
+                    NSLog(@"Could not unarchive object at %@, Invalid archive!", cacheFilePath);
+                    [self removeCachedResponsesForHashes:[NSArray arrayWithObject:[NSNumber numberWithUnsignedLongLong:hash]]];
                 }
             }
             @finally {
@@ -732,8 +778,8 @@ static dispatch_queue_t get_disk_io_queue() {
 }
 
 - (NSUInteger)currentDiskUsage {
-    if (!_diskCacheInfo) {
-        [self diskCacheInfo];
+    if (!_diskCacheIndex) {
+        [self diskCacheIndex];
     }
     return _diskCacheUsage;
 }
@@ -742,16 +788,19 @@ static dispatch_queue_t get_disk_io_queue() {
     request = [SDURLCache canonicalRequestForRequest:request];
     
     [super removeCachedResponseForRequest:request];
-    [self removeCachedResponseForCachedKeys:[NSArray arrayWithObject:[SDURLCache cacheKeyForURL:request.URL]]];
+    [self removeCachedResponsesForHashes:[NSArray arrayWithObject:[NSNumber numberWithUnsignedLongLong:[SDURLCacheIndex hashForURL:request.URL]]]];
     [self saveCacheInfo];
 }
 
 - (void)removeAllCachedResponses {
     [super removeAllCachedResponses];
-    NSFileManager *fileManager = [[NSFileManager alloc] init];
-    [fileManager removeItemAtPath:_diskCachePath error:NULL];
     dispatch_async_afreentrant(get_disk_cache_queue(), ^{
-        self.diskCacheInfo = nil;
+        [_pendingWrites removeAllObjects];
+        [_pendingExpirationDates removeAllObjects];
+        self.diskCacheIndex = nil; // unmaps the index; it's reopened (empty) on next use
+        NSFileManager *fileManager = [[NSFileManager alloc] init];
+        [fileManager removeItemAtPath:_diskCachePath error:NULL];
+        _diskCacheUsage = 0;
     });
 }
 
@@ -766,10 +815,13 @@ static dispatch_queue_t get_disk_io_queue() {
     if ([super cachedResponseForRequest:request]) {
         return YES;
     }
-    NSString *cacheKey = [SDURLCache cacheKeyForURL:url];
-    NSString *cacheFile = [_diskCachePath stringByAppendingPathComponent:cacheKey];
+    uint64_t hash = [SDURLCacheIndex hashForURL:request.URL];
     
-    BOOL isCached = [[[NSFileManager alloc] init] fileExistsAtPath:cacheFile];
+    // Answered by the index, without touching the file system
+    __block BOOL isCached = NO;
+    dispatch_sync_afreentrant(get_disk_cache_queue(), ^{
+        isCached = [_pendingWrites objectForKey:[NSNumber numberWithUnsignedLongLong:hash]] || [self.diskCacheIndex containsHash:hash];
+    });
     return isCached;
 }
 
@@ -781,13 +833,15 @@ static dispatch_queue_t get_disk_io_queue() {
         dispatch_release(_maintenanceTimer);
     }
     _diskCachePath = nil;
-    _diskCacheInfo = nil;
+    _diskCacheIndex = nil;
 }
 
 @synthesize minCacheInterval = _minCacheInterval;
 @synthesize ignoreMemoryOnlyStoragePolicy = _ignoreMemoryOnlyStoragePolicy;
 @synthesize allowCachingResponsesToNonCachedRequests = _allowCachingResponsesToNonCachedRequests;
 @synthesize diskCachePath = _diskCachePath;
-@synthesize diskCacheInfo = _diskCacheInfo;
+@synthesize diskCacheIndex = _diskCacheIndex;
+@synthesize pendingWrites = _pendingWrites;
+@synthesize pendingExpirationDates = _pendingExpirationDates;
 
 @end
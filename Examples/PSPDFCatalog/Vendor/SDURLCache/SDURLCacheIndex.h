@@ -0,0 +1,76 @@
+//
+//  SDURLCacheIndex.h
+//  SDURLCache
+//
+//  Distributed under the same license as SDURLCache (see LICENCE).
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Persistent index of the SDURLCache disk cache.
+ *
+ * The index is an open addressing hash table (64 bit URL hash -> size, last access, expiration) that lives in a
+ * memory mapped file. Opening it maps the file, nothing is parsed or enumerated; lookups are a few memory accesses.
+ * Changes are written to the mapping and flushed asynchronously by the kernel (see -synchronize).
+ * The table grows (doubles) at 50% load.
+ *
+ * Not thread safe; SDURLCache uses it from its disk cache queue only.
+ */
+@interface SDURLCacheIndex : NSObject
+
+/*
+ * Opens or creates the index file at path. Returns nil if the file can't be created or mapped.
+ * A file with an unknown format is replaced with an empty index.
+ */
+- (id)initWithPath:(NSString *)path;
+
+/*
+ * 64 bit hash of an URL as used as key of the index (never 0).
+ */
++ (uint64_t)hashForURL:(NSURL *)url;
+
+- (BOOL)containsHash:(uint64_t)hash;
+
+/*
+ * Returns NO if hash is not in the index. expirationDate is nil if unknown.
+ */
+- (BOOL)getSize:(uint32_t *)size expirationDate:(NSDate **)expirationDate forHash:(uint64_t)hash;
+
+/*
+ * Adds or updates an entry and marks it as just accessed.
+ */
+- (void)setSize:(uint32_t)size expirationDate:(NSDate *)expirationDate forHash:(uint64_t)hash;
+
+/*
+ * Marks the entry as just accessed (for LRU eviction).
+ */
+- (void)touchHash:(uint64_t)hash;
+
+- (void)removeHash:(uint64_t)hash;
+
+- (void)removeAllEntries;
+
+/*
+ * Hashes of the least recently used entries whose sizes add up to at least bytes, oldest first.
+ * Walks the table in memory, doesn't touch the file system.
+ */
+- (NSArray *)leastRecentlyUsedHashesForBytes:(uint64_t)bytes;
+
+/*
+ * Schedules writing changed pages of the mapping to disk (MS_ASYNC).
+ */
+- (void)synchronize;
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) uint64_t totalSize;
+
+#ifdef DEBUG
+/*
+ * Microbenchmark: fills a temporary index with entryCount entries and measures lookups of existing and missing hashes.
+ * Returns the average latency of one lookup in nanoseconds and logs the details.
+ */
++ (double)benchmarkLookupLatencyWithEntryCount:(NSUInteger)entryCount;
+#endif
+
+@end
@@ -0,0 +1,352 @@
+//
+//  SDURLCacheIndex.m
+//  SDURLCache
+//
+//  Distributed under the same license as SDURLCache (see LICENCE).
+//
+
+#import "SDURLCacheIndex.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mach/mach_time.h>
+
+#if !__has_feature(objc_arc)
+#error "SDURLCacheIndex needs to be compiled with ARC enabled."
+#endif
+
+#define kSDURLCacheIndexMagic 0x49434453u // "SDCI"
+#define kSDURLCacheIndexVersion 1u
+#define kSDURLCacheIndexMinimumCapacity 1024u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;  // number of slots, power of two
+    uint32_t count;
+    uint64_t totalSize;
+} SDURLCacheIndexHeader;
+
+typedef struct {
+    uint64_t hash;      // 0 marks a free slot
+    uint32_t size;
+    uint32_t accessed;  // seconds since the reference date
+    uint32_t expires;   // seconds since the reference date, 0 if unknown
+    uint32_t reserved;
+} SDURLCacheIndexEntry;
+
+typedef struct {
+    int fd;
+    void *map;
+    size_t length;
+    SDURLCacheIndexHeader *header;
+    SDURLCacheIndexEntry *entries;
+} SDURLCacheIndexTable;
+
+static size_t SDURLCacheIndexLengthForCapacity(uint32_t capacity) {
+    return sizeof(SDURLCacheIndexHeader) + (size_t)capacity * sizeof(SDURLCacheIndexEntry);
+}
+
+// Maps the index file at path; a missing or invalid file is replaced by an empty table with capacity slots.
+static BOOL SDURLCacheIndexTableOpen(SDURLCacheIndexTable *table, const char *path, uint32_t capacity) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return NO;
+
+    struct stat fileStat;
+    SDURLCacheIndexHeader header;
+    BOOL valid = fstat(fd, &fileStat) == 0
+        && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+        && header.magic == kSDURLCacheIndexMagic
+        && header.version == kSDURLCacheIndexVersion
+        && header.capacity >= kSDURLCacheIndexMinimumCapacity
+        && (header.capacity & (header.capacity - 1)) == 0
+        && header.count <= header.capacity / 2
+        && (size_t)fileStat.st_size == SDURLCacheIndexLengthForCapacity(header.capacity);
+
+    if (!valid) {
+        // truncating to 0 first makes sure all slots read as zero (free)
+        header = (SDURLCacheIndexHeader){.magic = kSDURLCacheIndexMagic, .version = kSDURLCacheIndexVersion, .capacity = capacity};
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)SDURLCacheIndexLengthForCapacity(capacity)) != 0
+            || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            close(fd);
+            return NO;
+        }
+    }
+
+    size_t length = SDURLCacheIndexLengthForCapacity(header.capacity);
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NO;
+    }
+
+    table->fd = fd;
+    table->map = map;
+    table->length = length;
+    table->header = (SDURLCacheIndexHeader *)map;
+    table->entries = (SDURLCacheIndexEntry *)((char *)map + sizeof(SDURLCacheIndexHeader));
+    return YES;
+}
+
+static void SDURLCacheIndexTableClose(SDURLCacheIndexTable *table) {
+    if (table->map) {
+        munmap(table->map, table->length);
+        close(table->fd);
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+// Linear probing; the table is never more than half full, so there always is a free slot to stop at.
+static int64_t SDURLCacheIndexTableFind(const SDURLCacheIndexTable *table, uint64_t hash) {
+    uint32_t mask = table->header->capacity - 1;
+    for (uint32_t slot = (uint32_t)hash & mask;; slot = (slot + 1) & mask) {
+        uint64_t slotHash = table->entries[slot].hash;
+        if (slotHash == hash) return slot;
+        if (slotHash == 0) return -1;
+    }
+}
+
+// Returns the entry for hash, a new zeroed one if needed. The caller has to make sure there is room.
+static SDURLCacheIndexEntry *SDURLCacheIndexTableInsert(SDURLCacheIndexTable *table, uint64_t hash) {
+    uint32_t mask = table->header->capacity - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    while (table->entries[slot].hash != 0 && table->entries[slot].hash != hash) {
+        slot = (slot + 1) & mask;
+    }
+    SDURLCacheIndexEntry *entry = &table->entries[slot];
+    if (entry->hash == 0) {
+        memset(entry, 0, sizeof(*entry));
+        entry->hash = hash;
+        table->header->count++;
+    }
+    return entry;
+}
+
+// Backward shift deletion: entries after the hole that may live there move up, so lookups never need tombstones.
+static void SDURLCacheIndexTableRemoveSlot(SDURLCacheIndexTable *table, uint32_t slot) {
+    uint32_t mask = table->header->capacity - 1;
+    table->header->totalSize -= table->entries[slot].size;
+    table->header->count--;
+
+    uint32_t hole = slot;
+    for (uint32_t next = (slot + 1) & mask; table->entries[next].hash != 0; next = (next + 1) & mask) {
+        uint32_t home = (uint32_t)table->entries[next].hash & mask;
+        BOOL homeBetweenHoleAndNext = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!homeBetweenHoleAndNext) {
+            table->entries[hole] = table->entries[next];
+            hole = next;
+        }
+    }
+    memset(&table->entries[hole], 0, sizeof(SDURLCacheIndexEntry));
+}
+
+// Rehashes into a new file with twice the capacity, which then replaces the old one.
+static BOOL SDURLCacheIndexTableGrow(SDURLCacheIndexTable *table, const char *path) {
+    char temporaryPath[PATH_MAX];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.new", path);
+    unlink(temporaryPath);
+
+    SDURLCacheIndexTable newTable;
+    if (!SDURLCacheIndexTableOpen(&newTable, temporaryPath, table->header->capacity * 2)) return NO;
+
+    for (uint32_t slot = 0; slot < table->header->capacity; slot++) {
+        if (table->entries[slot].hash == 0) continue;
+        *SDURLCacheIndexTableInsert(&newTable, table->entries[slot].hash) = table->entries[slot];
+    }
+    newTable.header->totalSize = table->header->totalSize;
+
+    if (rename(temporaryPath, path) != 0) {
+        SDURLCacheIndexTableClose(&newTable);
+        unlink(temporaryPath);
+        return NO;
+    }
+    SDURLCacheIndexTableClose(table);
+    *table = newTable;
+    return YES;
+}
+
+static uint32_t SDURLCacheIndexTimeFromDate(NSDate *date) {
+    NSTimeInterval interval = date ? [date timeIntervalSinceReferenceDate] : 0;
+    return interval > 0 ? (uint32_t)MIN(interval, (NSTimeInterval)UINT32_MAX) : 0;
+}
+
+static uint32_t SDURLCacheIndexNow(void) {
+    return (uint32_t)MAX(CFAbsoluteTimeGetCurrent(), 0);
+}
+
+typedef struct {
+    uint64_t hash;
+    uint32_t size;
+    uint32_t accessed;
+} SDURLCacheIndexUsage;
+
+static int SDURLCacheIndexCompareUsage(const void *usage1, const void *usage2) {
+    uint32_t accessed1 = ((const SDURLCacheIndexUsage *)usage1)->accessed, accessed2 = ((const SDURLCacheIndexUsage *)usage2)->accessed;
+    return accessed1 < accessed2 ? -1 : (accessed1 > accessed2 ? 1 : 0);
+}
+
+@interface SDURLCacheIndex () {
+    SDURLCacheIndexTable _table;
+    NSString *_path;
+}
+@end
+
+@implementation SDURLCacheIndex
+
++ (uint64_t)hashForURL:(NSURL *)url {
+    const char *str = [url.absoluteString UTF8String];
+    unsigned char digest[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(str, (CC_LONG)strlen(str), digest);
+    uint64_t hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return hash ? hash : 1;
+}
+
+- (id)initWithPath:(NSString *)path {
+    if ((self = [super init])) {
+        _path = [path copy];
+        if (!SDURLCacheIndexTableOpen(&_table, [_path fileSystemRepresentation], kSDURLCacheIndexMinimumCapacity)) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    SDURLCacheIndexTableClose(&_table);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ count:%u capacity:%u size:%llu>", NSStringFromClass([self class]), _table.header->count, _table.header->capacity, _table.header->totalSize];
+}
+
+- (NSUInteger)count {
+    return _table.header->count;
+}
+
+- (uint64_t)totalSize {
+    return _table.header->totalSize;
+}
+
+- (BOOL)containsHash:(uint64_t)hash {
+    return SDURLCacheIndexTableFind(&_table, hash) >= 0;
+}
+
+- (BOOL)getSize:(uint32_t *)size expirationDate:(NSDate **)expirationDate forHash:(uint64_t)hash {
+    int64_t slot = SDURLCacheIndexTableFind(&_table, hash);
+    if (slot < 0) return NO;
+
+    SDURLCacheIndexEntry *entry = &_table.entries[slot];
+    if (size) *size = entry->size;
+    if (expirationDate) *expirationDate = entry->expires ? [NSDate dateWithTimeIntervalSinceReferenceDate:entry->expires] : nil;
+    return YES;
+}
+
+- (void)setSize:(uint32_t)size expirationDate:(NSDate *)expirationDate forHash:(uint64_t)hash {
+    if (_table.header->count + 1 > _table.header->capacity / 2 && ![self containsHash:hash]) {
+        if (!SDURLCacheIndexTableGrow(&_table, [_path fileSystemRepresentation])) {
+            NSLog(@"Could not grow URL cache index at %@", _path);
+            return;
+        }
+    }
+
+    SDURLCacheIndexEntry *entry = SDURLCacheIndexTableInsert(&_table, hash);
+    _table.header->totalSize = _table.header->totalSize - entry->size + size;
+    entry->size = size;
+    entry->expires = SDURLCacheIndexTimeFromDate(expirationDate);
+    entry->accessed = SDURLCacheIndexNow();
+}
+
+- (void)touchHash:(uint64_t)hash {
+    int64_t slot = SDURLCacheIndexTableFind(&_table, hash);
+    if (slot >= 0) {
+        _table.entries[slot].accessed = SDURLCacheIndexNow();
+    }
+}
+
+- (void)removeHash:(uint64_t)hash {
+    int64_t slot = SDURLCacheIndexTableFind(&_table, hash);
+    if (slot >= 0) {
+        SDURLCacheIndexTableRemoveSlot(&_table, (uint32_t)slot);
+    }
+}
+
+- (void)removeAllEntries {
+    memset(_table.entries, 0, (size_t)_table.header->capacity * sizeof(SDURLCacheIndexEntry));
+    _table.header->count = 0;
+    _table.header->totalSize = 0;
+}
+
+- (NSArray *)leastRecentlyUsedHashesForBytes:(uint64_t)bytes {
+    uint32_t count = _table.header->count;
+    if (bytes == 0 || count == 0) return [NSArray array];
+
+    SDURLCacheIndexUsage *usages = malloc(count * sizeof(SDURLCacheIndexUsage));
+    uint32_t usageCount = 0;
+    for (uint32_t slot = 0; slot < _table.header->capacity && usageCount < count; slot++) {
+        SDURLCacheIndexEntry *entry = &_table.entries[slot];
+        if (entry->hash) {
+            usages[usageCount++] = (SDURLCacheIndexUsage){.hash = entry->hash, .size = entry->size, .accessed = entry->accessed};
+        }
+    }
+    qsort(usages, usageCount, sizeof(SDURLCacheIndexUsage), SDURLCacheIndexCompareUsage);
+
+    NSMutableArray *hashes = [NSMutableArray array];
+    uint64_t freedBytes = 0;
+    for (uint32_t i = 0; i < usageCount && freedBytes < bytes; i++) {
+        [hashes addObject:[NSNumber numberWithUnsignedLongLong:usages[i].hash]];
+        freedBytes += usages[i].size;
+    }
+    free(usages);
+    return hashes;
+}
+
+- (void)synchronize {
+    msync(_table.map, _table.length, MS_ASYNC);
+}
+
+#ifdef DEBUG
+
++ (double)benchmarkLookupLatencyWithEntryCount:(NSUInteger)entryCount {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"SDURLCacheIndexBenchmark-%u", arc4random()]];
+    SDURLCacheIndex *index = [[SDURLCacheIndex alloc] initWithPath:path];
+    if (!index) return -1;
+
+    uint64_t *hashes = malloc(entryCount * sizeof(uint64_t));
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        hashes[i] = ((uint64_t)arc4random() << 32 | arc4random()) | 1;
+        [index setSize:(uint32_t)(arc4random() % 65536) expirationDate:nil forHash:hashes[i]];
+    }
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    NSUInteger found = 0, iterations = 10;
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger iteration = 0; iteration < iterations; iteration++) {
+        for (NSUInteger i = 0; i < entryCount; i++) found += [index containsHash:hashes[(i * 7919) % entryCount]];
+    }
+    uint64_t hitTime = mach_absolute_time() - start;
+
+    start = mach_absolute_time();
+    for (NSUInteger iteration = 0; iteration < iterations; iteration++) {
+        for (NSUInteger i = 0; i < entryCount; i++) found += [index containsHash:hashes[i] ^ 0x5555555555555554ull];
+    }
+    uint64_t missTime = mach_absolute_time() - start;
+
+    double lookups = (double)entryCount * iterations;
+    double hitLatency = hitTime * timebase.numer / (double)timebase.denom / lookups;
+    double missLatency = missTime * timebase.numer / (double)timebase.denom / lookups;
+    NSLog(@"SDURLCacheIndex with %u entries (%@): hit %.0fns, miss %.0fns per lookup (found %u).", entryCount, index, hitLatency, missLatency, found);
+
+    free(hashes);
+    index = nil;
+    unlink([path fileSystemRepresentation]);
+    return (hitLatency + missLatency) / 2;
+}
+
+#endif
+
+@end